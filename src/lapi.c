@@ -21,8 +21,10 @@
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lmem.h"
 #include "lobject.h"
+#include "lopcodes.h"
 #include "lstate.h"
 #include "lstring.h"
 #include "ltable.h"
@@ -309,7 +311,7 @@ SOL_API int sol_isinteger (sol_State *L, int idx) {
 SOL_API int sol_isnumber (sol_State *L, int idx) {
   sol_Number n;
   const TValue *o = index2value(L, idx);
-  return tonumber(o, &n);
+  return tonumber(L, o, &n);
 }
 
 
@@ -376,10 +378,25 @@ SOL_API size_t sol_stringtonumber (sol_State *L, const char *s) {
 }
 
 
+/*
+** Write 'n' into 'buff' as 'sprintf' with format "%.<prec><conv>" (for
+** 'conv' one of 'e', 'f', and 'g'), or as 'tostring' (without a '.0'
+** suffix) if 'conv' is 0. 'buff' must have room for the result.
+*/
+SOL_API int sol_formatnumber (sol_State *L, char *buff, size_t sz,
+                                            sol_Number n, int conv,
+                                            int prec) {
+  UNUSED(L);
+  api_check(L, conv == 0 || (strchr("efg", conv) != NULL && prec >= 0),
+               "invalid conversion");
+  return solO_fmtfloat(buff, sz, n, conv, prec);
+}
+
+
 SOL_API sol_Number sol_tonumberx (sol_State *L, int idx, int *pisnum) {
   sol_Number n = 0;
   const TValue *o = index2value(L, idx);
-  int isnum = tonumber(o, &n);
+  int isnum = tonumber(L, o, &n);
   if (pisnum)
     *pisnum = isnum;
   return n;
@@ -389,7 +406,7 @@ SOL_API sol_Number sol_tonumberx (sol_State *L, int idx, int *pisnum) {
 SOL_API sol_Integer sol_tointegerx (sol_State *L, int idx, int *pisnum) {
   sol_Integer res = 0;
   const TValue *o = index2value(L, idx);
-  int isnum = tointeger(o, &res);
+  int isnum = tointeger(L, o, &res);
   if (pisnum)
     *pisnum = isnum;
   return res;
@@ -419,7 +436,23 @@ SOL_API const char *sol_tolstring (sol_State *L, int idx, size_t *len) {
   if (len != NULL)
     *len = tsslen(tsvalue(o));
   sol_unlock(L);
-  return getstr(tsvalue(o));
+  return solS_getstr(L, tsvalue(o));
+}
+
+
+/*
+** Like 'sol_tolstring', but the bytes of a slice (see 'solS_sub') are
+** given where they are, in the string it was cut from; so, they may
+** not be followed by a '\0'.
+*/
+SOL_API const char *sol_tostringview (sol_State *L, int idx, size_t *len) {
+  const TValue *o = index2value(L, idx);
+  if (ttisstring(o) && isslice(tsvalue(o))) {
+    if (len != NULL)
+      *len = tsvalue(o)->u.lnglen;
+    return slicestr(tsvalue(o));
+  }
+  return sol_tolstring(L, idx, len);
 }
 
 
@@ -459,6 +492,32 @@ SOL_API void *sol_touserdata (sol_State *L, int idx) {
 }
 
 
+/*
+** If the value at 'idx' is a table with a typed array part (see
+** ltable.h), return the address of its elements t[1..n], which are all
+** integers ('*isint') or all floats, stored as a C array. Otherwise
+** (or if 'Value' has not the size of the elements) return NULL. The
+** address is valid only while the table is not changed; any call that
+** may run the collector may also run a finalizer that changes it.
+*/
+SOL_API void *sol_tonumarray (sol_State *L, int idx, sol_Unsigned *n,
+                                                     int *isint) {
+  const TValue *o = index2value(L, idx);
+  if (ttistable(o) && isnumarray(hvalue(o))) {
+    Table *t = hvalue(o);
+    const NumHeader *nh = numheader(t);
+    int ii = (nh->tt == SOL_VNUMINT);
+    if (nh->n > 0 &&
+        sizeof(Value) == (ii ? sizeof(sol_Integer) : sizeof(sol_Number))) {
+      *n = nh->n;
+      *isint = ii;
+      return numvalues(t);
+    }
+  }
+  return NULL;
+}
+
+
 SOL_API sol_State *sol_tothread (sol_State *L, int idx) {
   const TValue *o = index2value(L, idx);
   return (!ttisthread(o)) ? NULL : thvalue(o);
@@ -535,6 +594,55 @@ SOL_API const char *sol_pushlstring (sol_State *L, const char *s, size_t len) {
 }
 
 
+/*
+** Push the 'len' bytes from position 'i' (counting from 0) of the
+** string at index 'idx'. The result may share the bytes of that string.
+*/
+SOL_API void sol_pushsubstring (sol_State *L, int idx, size_t i,
+                                                   size_t len) {
+  TString *ts;
+  const TValue *o;
+  sol_lock(L);
+  o = index2value(L, idx);
+  api_check(L, ttisstring(o), "string expected");
+  api_check(L, i <= tsslen(tsvalue(o)) && len <= tsslen(tsvalue(o)) - i,
+                "invalid substring");
+  ts = solS_sub(L, tsvalue(o), i, len);
+  setsvalue2s(L, L->top.p, ts);
+  api_incr_top(L);
+  solC_checkGC(L);
+  sol_unlock(L);
+}
+
+
+/*
+** Push a string with the 'len' bytes at 's' (which must be followed by
+** a '\0') without copying them. The caller gives up their ownership:
+** they are released with 'falloc(ud, s, len + 1, 0)' (unless 'falloc'
+** is NULL) when the string is collected, or right away when it is
+** short (as short strings are internalized). A release function is
+** called by the collector, so it must not call the API.
+*/
+SOL_API const char *sol_pushexternalstring (sol_State *L, const char *s,
+                                  size_t len, sol_Alloc falloc, void *ud) {
+  TString *ts;
+  sol_lock(L);
+  api_check(L, s[len] == '\0', "string not ending with zero");
+  if (len <= SOLI_MAXSHORTLEN) {  /* short string? */
+    ts = solS_newlstr(L, s, len);
+    if (falloc != NULL)
+      (*falloc)(ud, cast_voidp(s), len + 1, 0);  /* release buffer */
+  }
+  else
+    ts = solS_newextlngstr(L, s, len, falloc, ud);
+  setsvalue2s(L, L->top.p, ts);
+  api_incr_top(L);
+  solC_checkGC(L);
+  sol_unlock(L);
+  return getstr(ts);
+}
+
+
 SOL_API const char *sol_pushstring (sol_State *L, const char *s) {
   sol_lock(L);
   if (s == NULL)
@@ -637,16 +745,16 @@ SOL_API int sol_pushthread (sol_State *L) {
 
 
 l_sinline int auxgetstr (sol_State *L, const TValue *t, const char *k) {
-  const TValue *slot;
+  lu_byte tag;
   TString *str = solS_new(L, k);
-  if (solV_fastget(L, t, str, slot, solH_getstr)) {
-    setobj2s(L, L->top.p, slot);
+  solV_fastget(L, t, str, s2v(L->top.p), solH_getstr, tag);
+  if (!tagisempty(tag)) {
     api_incr_top(L);
   }
   else {
     setsvalue2s(L, L->top.p, str);
     api_incr_top(L);
-    solV_finishget(L, t, s2v(L->top.p - 1), L->top.p - 1, slot);
+    solV_finishget(L, t, s2v(L->top.p - 1), L->top.p - 1, tag);
   }
   sol_unlock(L);
   return ttype(s2v(L->top.p - 1));
@@ -659,28 +767,30 @@ l_sinline int auxgetstr (sol_State *L, const TValue *t, const char *k) {
 ** was created and never removed, they must always be in the array
 ** part of the registry.
 */
-#define getGtable(L)  \
-	(&hvalue(&G(L)->l_registry)->array[SOL_RIDX_GLOBALS - 1])
+static void getGtable (sol_State *L, TValue *gt) {
+  Table *registry = hvalue(&G(L)->l_registry);
+  lu_byte tag = solH_getint(registry, SOL_RIDX_GLOBALS, gt);
+  (void)tag;  /* avoid not-used warnings when checks are off */
+  api_check(L, novariant(tag) == SOL_TTABLE, "global table must exist");
+}
 
 
 SOL_API int sol_getglobal (sol_State *L, const char *name) {
-  const TValue *G;
+  TValue gt;
   sol_lock(L);
-  G = getGtable(L);
-  return auxgetstr(L, G, name);
+  getGtable(L, &gt);
+  return auxgetstr(L, &gt, name);
 }
 
 
 SOL_API int sol_gettable (sol_State *L, int idx) {
-  const TValue *slot;
+  lu_byte tag;
   TValue *t;
   sol_lock(L);
   t = index2value(L, idx);
-  if (solV_fastget(L, t, s2v(L->top.p - 1), slot, solH_get)) {
-    setobj2s(L, L->top.p - 1, slot);
-  }
-  else
-    solV_finishget(L, t, s2v(L->top.p - 1), L->top.p - 1, slot);
+  solV_fastget(L, t, s2v(L->top.p - 1), s2v(L->top.p - 1), solH_get, tag);
+  if (tagisempty(tag))
+    solV_finishget(L, t, s2v(L->top.p - 1), L->top.p - 1, tag);
   sol_unlock(L);
   return ttype(s2v(L->top.p - 1));
 }
@@ -694,16 +804,14 @@ SOL_API int sol_getfield (sol_State *L, int idx, const char *k) {
 
 SOL_API int sol_geti (sol_State *L, int idx, sol_Integer n) {
   TValue *t;
-  const TValue *slot;
+  lu_byte tag;
   sol_lock(L);
   t = index2value(L, idx);
-  if (solV_fastgeti(L, t, n, slot)) {
-    setobj2s(L, L->top.p, slot);
-  }
-  else {
+  solV_fastgeti(L, t, n, s2v(L->top.p), tag);
+  if (tagisempty(tag)) {
     TValue aux;
     setivalue(&aux, n);
-    solV_finishget(L, t, &aux, L->top.p, slot);
+    solV_finishget(L, t, &aux, L->top.p, tag);
   }
   api_incr_top(L);
   sol_unlock(L);
@@ -711,11 +819,9 @@ SOL_API int sol_geti (sol_State *L, int idx, sol_Integer n) {
 }
 
 
-l_sinline int finishrawget (sol_State *L, const TValue *val) {
-  if (isempty(val))  /* avoid copying empty items to the stack */
+l_sinline int finishrawget (sol_State *L, lu_byte tag) {
+  if (tagisempty(tag))  /* avoid copying empty items to the stack */
     setnilvalue(s2v(L->top.p));
-  else
-    setobj2s(L, L->top.p, val);
   api_incr_top(L);
   sol_unlock(L);
   return ttype(s2v(L->top.p - 1));
@@ -731,13 +837,13 @@ static Table *gettable (sol_State *L, int idx) {
 
 SOL_API int sol_rawget (sol_State *L, int idx) {
   Table *t;
-  const TValue *val;
+  lu_byte tag;
   sol_lock(L);
   api_checknelems(L, 1);
   t = gettable(L, idx);
-  val = solH_get(t, s2v(L->top.p - 1));
+  tag = solH_get(t, s2v(L->top.p - 1), s2v(L->top.p - 1));
   L->top.p--;  /* remove key */
-  return finishrawget(L, val);
+  return finishrawget(L, tag);
 }
 
 
@@ -745,7 +851,7 @@ SOL_API int sol_rawgeti (sol_State *L, int idx, sol_Integer n) {
   Table *t;
   sol_lock(L);
   t = gettable(L, idx);
-  return finishrawget(L, solH_getint(t, n));
+  return finishrawget(L, solH_getint(t, n, s2v(L->top.p)));
 }
 
 
@@ -755,7 +861,7 @@ SOL_API int sol_rawgetp (sol_State *L, int idx, const void *p) {
   sol_lock(L);
   t = gettable(L, idx);
   setpvalue(&k, cast_voidp(p));
-  return finishrawget(L, solH_get(t, &k));
+  return finishrawget(L, solH_get(t, &k, s2v(L->top.p)));
 }
 
 
@@ -766,7 +872,7 @@ SOL_API void sol_createtable (sol_State *L, int narray, int nrec) {
   sethvalue2s(L, L->top.p, t);
   api_incr_top(L);
   if (narray > 0 || nrec > 0)
-    solH_resize(L, t, narray, nrec);
+    solH_presize(L, t, narray, nrec);
   solC_checkGC(L);
   sol_unlock(L);
 }
@@ -827,17 +933,18 @@ SOL_API int sol_getiuservalue (sol_State *L, int idx, int n) {
 ** t[k] = value at the top of the stack (where 'k' is a string)
 */
 static void auxsetstr (sol_State *L, const TValue *t, const char *k) {
-  const TValue *slot;
+  int hres;
   TString *str = solS_new(L, k);
   api_checknelems(L, 1);
-  if (solV_fastget(L, t, str, slot, solH_getstr)) {
-    solV_finishfastset(L, t, slot, s2v(L->top.p - 1));
+  solV_fastset(L, t, str, s2v(L->top.p - 1), hres, solH_psetstr);
+  if (hres == HOK) {
+    solV_finishfastset(L, t, s2v(L->top.p - 1));
     L->top.p--;  /* pop value */
   }
   else {
     setsvalue2s(L, L->top.p, str);  /* push 'str' (to make it a TValue) */
     api_incr_top(L);
-    solV_finishset(L, t, s2v(L->top.p - 1), s2v(L->top.p - 2), slot);
+    solV_finishset(L, t, s2v(L->top.p - 1), s2v(L->top.p - 2), hres);
     L->top.p -= 2;  /* pop value and key */
   }
   sol_unlock(L);  /* lock done by caller */
@@ -845,24 +952,24 @@ static void auxsetstr (sol_State *L, const TValue *t, const char *k) {
 
 
 SOL_API void sol_setglobal (sol_State *L, const char *name) {
-  const TValue *G;
+  TValue gt;
   sol_lock(L);  /* unlock done in 'auxsetstr' */
-  G = getGtable(L);
-  auxsetstr(L, G, name);
+  getGtable(L, &gt);
+  auxsetstr(L, &gt, name);
 }
 
 
 SOL_API void sol_settable (sol_State *L, int idx) {
   TValue *t;
-  const TValue *slot;
+  int hres;
   sol_lock(L);
   api_checknelems(L, 2);
   t = index2value(L, idx);
-  if (solV_fastget(L, t, s2v(L->top.p - 2), slot, solH_get)) {
-    solV_finishfastset(L, t, slot, s2v(L->top.p - 1));
-  }
+  solV_fastset(L, t, s2v(L->top.p - 2), s2v(L->top.p - 1), hres, solH_pset);
+  if (hres == HOK)
+    solV_finishfastset(L, t, s2v(L->top.p - 1));
   else
-    solV_finishset(L, t, s2v(L->top.p - 2), s2v(L->top.p - 1), slot);
+    solV_finishset(L, t, s2v(L->top.p - 2), s2v(L->top.p - 1), hres);
   L->top.p -= 2;  /* pop index and value */
   sol_unlock(L);
 }
@@ -876,17 +983,17 @@ SOL_API void sol_setfield (sol_State *L, int idx, const char *k) {
 
 SOL_API void sol_seti (sol_State *L, int idx, sol_Integer n) {
   TValue *t;
-  const TValue *slot;
+  int hres;
   sol_lock(L);
   api_checknelems(L, 1);
   t = index2value(L, idx);
-  if (solV_fastgeti(L, t, n, slot)) {
-    solV_finishfastset(L, t, slot, s2v(L->top.p - 1));
-  }
+  solV_fastseti(L, t, n, s2v(L->top.p - 1), hres);
+  if (hres == HOK)
+    solV_finishfastset(L, t, s2v(L->top.p - 1));
   else {
     TValue aux;
     setivalue(&aux, n);
-    solV_finishset(L, t, &aux, s2v(L->top.p - 1), slot);
+    solV_finishset(L, t, &aux, s2v(L->top.p - 1), hres);
   }
   L->top.p--;  /* pop value */
   sol_unlock(L);
@@ -930,6 +1037,15 @@ SOL_API void sol_rawseti (sol_State *L, int idx, sol_Integer n) {
 }
 
 
+SOL_API void sol_cleartable (sol_State *L, int idx) {
+  Table *t;
+  sol_lock(L);
+  t = gettable(L, idx);
+  solH_clear(L, t);
+  sol_unlock(L);
+}
+
+
 SOL_API int sol_setmetatable (sol_State *L, int objindex) {
   TValue *obj;
   Table *mt;
@@ -1096,10 +1212,11 @@ SOL_API int sol_load (sol_State *L, sol_Reader reader, void *data,
     LClosure *f = clLvalue(s2v(L->top.p - 1));  /* get new function */
     if (f->nupvalues >= 1) {  /* does it have an upvalue? */
       /* get global table from registry */
-      const TValue *gt = getGtable(L);
+      TValue gt;
+      getGtable(L, &gt);
       /* set global table as 1st upvalue of 'f' (may be SOL_ENV) */
-      setobj(L, f->upvals[0]->v.p, gt);
-      solC_barrier(L, f->upvals[0], gt);
+      setobj(L, f->upvals[0]->v.p, &gt);
+      solC_barrier(L, f->upvals[0], &gt);
     }
   }
   sol_unlock(L);
@@ -1221,11 +1338,94 @@ SOL_API int sol_gc (sol_State *L, int what, ...) {
       solC_changemode(L, KGC_INC);
       break;
     }
+    case SOL_GCPARALLEL: {
+      int n = va_arg(argp, int);
+      res = solC_setmarkers(L, n);
+      break;
+    }
+    case SOL_GCSWEEPER: {
+      int on = va_arg(argp, int);
+      res = solC_setsweeper(L, on);
+      break;
+    }
+    case SOL_GCFREEZE: {
+      solC_freeze(L);
+      break;
+    }
+    case SOL_GCSTEPTIME: {
+      int usec = va_arg(argp, int);
+      res = cast_int(g->gcsteptime);
+      if (usec >= 0)
+        g->gcsteptime = usec;
+      break;
+    }
+    case SOL_GCIDLE: {
+      int usec = va_arg(argp, int);
+      lu_byte oldstp = g->gcstp;
+      g->gcstp = 0;  /* allow GC to run (GCSTPGC must be zero here) */
+      res = solC_idlestep(L, usec);
+      g->gcstp = oldstp;  /* restore previous state */
+      break;
+    }
+    case SOL_GCSTEPSTATS: {
+      sol_GCStepStats *s = va_arg(argp, sol_GCStepStats *);
+      solC_stepstats(g, s);
+      break;
+    }
+    default: res = -1;  /* invalid option */
+  }
+  va_end(argp);
+  sol_unlock(L);
+  return res;
+}
+
+
+/*
+** Baseline-compiler function; all options are invalid (-1) when the
+** compiler is not available
+*/
+SOL_API int sol_jit (sol_State *L, int what, ...) {
+#if SOL_USE_JIT
+  va_list argp;
+  int res = 0;
+  JitState *js;
+  sol_lock(L);
+  js = solJ_state(L);
+  va_start(argp, what);
+  switch (what) {
+    case SOL_JITOFF: case SOL_JITON: {
+      res = js->on;
+      js->on = (what == SOL_JITON);
+      break;
+    }
+    case SOL_JITFLUSH: {
+      solJ_flush(L);
+      break;
+    }
+    case SOL_JITISON: {
+      res = js->on;
+      break;
+    }
+    case SOL_JITSETHOT: {
+      int data = va_arg(argp, int);
+      res = js->hotcount;
+      if (data > 0)
+        js->hotcount = data;
+      break;
+    }
+    case SOL_JITCOUNT: {
+      res = js->ncode;
+      break;
+    }
     default: res = -1;  /* invalid option */
   }
   va_end(argp);
   sol_unlock(L);
   return res;
+#else
+  UNUSED(L); UNUSED(what);
+  return -1;
+#endif
 }
 
 
@@ -1318,8 +1518,23 @@ SOL_API sol_Alloc sol_getallocf (sol_State *L, void **ud) {
 
 SOL_API void sol_setallocf (sol_State *L, sol_Alloc f, void *ud) {
   sol_lock(L);
+  solC_freesweeper(L);  /* new function may not be thread safe */
   G(L)->ud = ud;
   G(L)->frealloc = f;
+  G(L)->allocsafe = 0;
+  sol_unlock(L);
+}
+
+
+/*
+** Declare whether the allocation function can be called from several
+** threads at the same time, as background sweeping needs.
+*/
+SOL_API void sol_setallocsafe (sol_State *L, int safe) {
+  sol_lock(L);
+  if (!safe)
+    solC_freesweeper(L);
+  G(L)->allocsafe = (safe != 0);
   sol_unlock(L);
 }
 
@@ -1450,6 +1665,35 @@ SOL_API void *sol_upvalueid (sol_State *L, int fidx, int n) {
 }
 
 
+/*
+** Get statistics for the 'n'-th inline cache (counting from 1) of the
+** Sol function at index 'fidx'. Returns 0 if there is no such cache.
+*/
+SOL_API int sol_getcachestat (sol_State *L, int fidx, int n,
+                              sol_CacheStat *cs) {
+  Proto *p;
+  int pc;
+  int ic = 0;  /* index of the cache of the current instruction */
+  TValue *fi = index2value(L, fidx);
+  api_check(L, ttisLclosure(fi), "Sol function expected");
+  p = clLvalue(fi)->p;
+  for (pc = 0; pc < p->sizecode; pc++) {
+    if (!solF_hascache(p, pc))
+      continue;
+    if (isIC(p->code[pc]) && --n == 0) {
+      const ICache *c = &p->icache[ic];
+      cs->pc = pc + 1;
+      cs->currentline = solG_getfuncline(p, pc);
+      cs->hits = c->hits;
+      cs->misses = c->misses;
+      return 1;
+    }
+    ic++;
+  }
+  return 0;
+}
+
+
 SOL_API void sol_upvaluejoin (sol_State *L, int fidx1, int n1,
                                             int fidx2, int n2) {
   LClosure *f1;
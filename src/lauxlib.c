@@ -7,6 +7,10 @@
 #define lauxlib_c
 #define SOL_LIB
 
+#if !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE		/* for 'MAP_ANONYMOUS' */
+#endif
+
 #include "lprefix.h"
 
 
@@ -1034,6 +1038,303 @@ static void *l_alloc (void *ud, void *ptr, size_t osize, size_t nsize) {
 }
 
 
+/*
+** {======================================================
+** Arena allocator
+** =======================================================
+*/
+
+/*
+** Small blocks are grouped by size class into slabs: aligned chunks
+** of SLABSIZE bytes, each one with a header followed by blocks of a
+** single class. Sol always tells the original size of a block when
+** resizing or freeing it, so blocks need no headers: the size gives
+** the class and the address gives the slab. Each class keeps a list
+** of its slabs with free blocks. A slab that becomes empty goes back
+** to the system, except for a few kept for reuse. Blocks larger than
+** the largest class go to 'realloc'. An arena created by
+** 'solL_newstatex' is freed together with the last block of its state.
+** The arena has no locks, so it is not declared thread safe (see
+** 'sol_setallocsafe'), which keeps the sweeper thread away from it.
+*/
+
+/* log2 of the size of a slab */
+#if !defined(SOLL_SLABBITS)
+#define SOLL_SLABBITS	16
+#endif
+
+/* number of empty slabs kept for reuse */
+#if !defined(SOLL_SLABCACHE)
+#define SOLL_SLABCACHE	4
+#endif
+
+#define SLABSIZE	((size_t)1 << SOLL_SLABBITS)
+
+
+/*
+** Size classes: multiples of 16 up to 256 (classes 0-15), then
+** multiples of 64 up to ARENAMAX (classes 16-27)
+*/
+#define ARENAMAX	1024
+#define NCLASSES	28
+
+#define sizeclass(n)  \
+	((n) <= 256 ? (int)(((n) - 1) >> 4) : 16 + (int)(((n) - 257) >> 6))
+#define classsize(c)  \
+	((c) < 16 ? ((size_t)(c) + 1) << 4 : ((size_t)(c) - 11) << 6)
+
+
+typedef struct Slab {
+  struct Slab *next, *prev;  /* list of slabs with free blocks */
+  void *freeb;  /* list of freed blocks */
+  char *unused;  /* start of blocks never used */
+  void *mem;  /* memory block with the slab (for 'l_freeslab') */
+  unsigned int nused;  /* number of blocks in use */
+  unsigned int nblocks;  /* total number of blocks */
+  int cls;  /* size class */
+  int inlist;  /* true iff slab is in the list of its class */
+} Slab;
+
+/* size of a slab header, keeping blocks aligned to 16 bytes */
+#define SLABHEAD	((sizeof(Slab) + 15) & ~(size_t)15)
+
+#define slabof(b)	((Slab *)((size_t)(b) & ~(SLABSIZE - 1)))
+
+
+typedef struct Arena {
+  Slab *partial[NCLASSES];  /* slabs with free blocks, per class */
+  Slab *empty;  /* empty slabs kept for reuse */
+  int nempty;  /* number of slabs in 'empty' */
+  int owned;  /* true iff arena goes away with its last block */
+  size_t nblocks;  /* number of blocks in use */
+  solL_ArenaStats st;
+} Arena;
+
+
+#if defined(SOL_USE_POSIX)	/* { */
+
+#include <sys/mman.h>
+
+#if !defined(MAP_ANONYMOUS)
+#define MAP_ANONYMOUS	MAP_ANON
+#endif
+
+/*
+** Map a slab straight from the system (so that it really goes back
+** when unmapped): map twice its size and unmap the unaligned ends.
+*/
+static void *l_getslab (void **mem) {
+  char *p = (char *)mmap(NULL, 2 * SLABSIZE, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  char *s;
+  if (p == (char *)MAP_FAILED)
+    return NULL;
+  s = (char *)(((size_t)p + SLABSIZE - 1) & ~(SLABSIZE - 1));
+  if (s > p)
+    munmap(p, s - p);
+  if (s < p + SLABSIZE)
+    munmap(s + SLABSIZE, p + SLABSIZE - s);
+  *mem = s;
+  return s;
+}
+
+#define l_freeslab(mem)		munmap(mem, SLABSIZE)
+
+#else				/* }{ */
+
+/* ISO C has no aligned allocation; use a block with room to align */
+static void *l_getslab (void **mem) {
+  char *p = (char *)malloc(2 * SLABSIZE);
+  if (p == NULL)
+    return NULL;
+  *mem = p;
+  return (void *)(((size_t)p + SLABSIZE - 1) & ~(SLABSIZE - 1));
+}
+
+#define l_freeslab(mem)		free(mem)
+
+#endif				/* } */
+
+
+static void linkslab (Arena *a, Slab *s) {
+  Slab **list = &a->partial[s->cls];
+  s->prev = NULL;
+  s->next = *list;
+  if (*list != NULL)
+    (*list)->prev = s;
+  *list = s;
+  s->inlist = 1;
+}
+
+
+static void unlinkslab (Arena *a, Slab *s) {
+  if (s->prev != NULL)
+    s->prev->next = s->next;
+  else
+    a->partial[s->cls] = s->next;
+  if (s->next != NULL)
+    s->next->prev = s->prev;
+  s->inlist = 0;
+}
+
+
+static Slab *newslab (Arena *a, int c) {
+  Slab *s;
+  if (a->empty != NULL) {  /* reuse an empty slab? */
+    s = a->empty;
+    a->empty = s->next;
+    a->nempty--;
+  }
+  else {
+    void *mem;
+    s = (Slab *)l_getslab(&mem);
+    if (s == NULL)
+      return NULL;
+    s->mem = mem;
+    a->st.slabs++;
+  }
+  s->freeb = NULL;
+  s->unused = (char *)s + SLABHEAD;
+  s->nused = 0;
+  s->nblocks = (unsigned int)((SLABSIZE - SLABHEAD) / classsize(c));
+  s->cls = c;
+  linkslab(a, s);
+  return s;
+}
+
+
+/* slab 's' became empty: keep it for reuse or give it back */
+static void freeslab (Arena *a, Slab *s) {
+  unlinkslab(a, s);
+  if (a->nempty < SOLL_SLABCACHE) {
+    s->next = a->empty;
+    a->empty = s;
+    a->nempty++;
+  }
+  else {
+    l_freeslab(s->mem);
+    a->st.slabs--;
+    a->st.released++;
+  }
+}
+
+
+static void *smallalloc (Arena *a, size_t n) {
+  int c = sizeclass(n);
+  Slab *s = a->partial[c];
+  void *b;
+  if (s == NULL && (s = newslab(a, c)) == NULL)
+    return NULL;
+  if (s->freeb != NULL) {  /* reuse a freed block? */
+    b = s->freeb;
+    s->freeb = *(void **)b;
+  }
+  else {
+    b = s->unused;
+    s->unused += classsize(c);
+  }
+  if (++s->nused == s->nblocks)  /* slab is full? */
+    unlinkslab(a, s);
+  a->st.blockbytes += classsize(c);
+  a->st.reqbytes += n;
+  return b;
+}
+
+
+static void smallfree (Arena *a, void *b, size_t n) {
+  Slab *s = slabof(b);
+  *(void **)b = s->freeb;
+  s->freeb = b;
+  if (!s->inlist)  /* slab was full? */
+    linkslab(a, s);
+  a->st.blockbytes -= classsize(s->cls);
+  a->st.reqbytes -= n;
+  if (--s->nused == 0)
+    freeslab(a, s);
+}
+
+
+static Arena *newarena (void) {
+  Arena *a = (Arena *)malloc(sizeof(Arena));
+  if (a != NULL) {
+    int i;
+    for (i = 0; i < NCLASSES; i++)
+      a->partial[i] = NULL;
+    a->empty = NULL;
+    a->nempty = 0;
+    a->owned = 0;
+    a->nblocks = 0;
+    memset(&a->st, 0, sizeof(a->st));
+    a->st.slabsize = SLABSIZE;
+  }
+  return a;
+}
+
+
+/* free an arena with no blocks in use (so all its slabs are empty) */
+static void freearena (Arena *a) {
+  while (a->empty != NULL) {
+    Slab *s = a->empty;
+    a->empty = s->next;
+    l_freeslab(s->mem);
+  }
+  free(a);
+}
+
+
+static void *l_arenaalloc (void *ud, void *ptr, size_t osize,
+                                                size_t nsize) {
+  Arena *a = (Arena *)ud;
+  void *nptr = NULL;
+  if (ptr == NULL)
+    osize = 0;  /* 'osize' is the kind of object */
+  else if (nsize > ARENAMAX && osize > ARENAMAX) {  /* large block? */
+    nptr = realloc(ptr, nsize);
+    if (nptr != NULL)
+      a->st.largebytes += nsize - osize;
+    return nptr;
+  }
+  else if (nsize != 0 && nsize <= ARENAMAX && osize <= ARENAMAX &&
+           sizeclass(nsize) == sizeclass(osize)) {  /* same class? */
+    a->st.reqbytes += nsize - osize;
+    return ptr;
+  }
+  if (nsize != 0) {  /* need a new block? */
+    if (nsize <= ARENAMAX)
+      nptr = smallalloc(a, nsize);
+    else if ((nptr = malloc(nsize)) != NULL)
+      a->st.largebytes += nsize;
+    if (nptr == NULL)
+      return NULL;  /* old block is untouched */
+    a->nblocks++;
+  }
+  if (ptr != NULL) {  /* free old block */
+    if (nptr != NULL)
+      memcpy(nptr, ptr, (osize < nsize) ? osize : nsize);
+    if (osize <= ARENAMAX)
+      smallfree(a, ptr, osize);
+    else {
+      free(ptr);
+      a->st.largebytes -= osize;
+    }
+    if (--a->nblocks == 0 && a->owned)  /* last block of its state? */
+      freearena(a);
+  }
+  return nptr;
+}
+
+
+SOLLIB_API int solL_arenastats (sol_State *L, solL_ArenaStats *st) {
+  void *ud;
+  if (sol_getallocf(L, &ud) != l_arenaalloc)
+    return 0;  /* state does not use an arena */
+  *st = ((Arena *)ud)->st;
+  return 1;
+}
+
+/* }====================================================== */
+
+
 /*
 ** Standard panic funcion just prints an error message. The test
 ** with 'sol_type' avoids possible memory errors in 'sol_tostring'.
@@ -1105,16 +1406,35 @@ static void warnfon (void *ud, const char *message, int tocont) {
 }
 
 
-SOLLIB_API sol_State *solL_newstate (void) {
-  sol_State *L = sol_newstate(l_alloc, NULL);
+SOLLIB_API sol_State *solL_newstatex (int flags) {
+  sol_State *L;
+  Arena *a = NULL;
+  if (flags & SOLL_ARENA) {
+    if ((a = newarena()) == NULL)
+      return NULL;
+    L = sol_newstate(l_arenaalloc, a);
+  }
+  else
+    L = sol_newstate(l_alloc, NULL);
   if (l_likely(L)) {
+    if (a != NULL)
+      a->owned = 1;  /* from now on, state owns the arena */
+    else
+      sol_setallocsafe(L, 1);  /* 'realloc' and 'free' are thread safe */
     sol_atpanic(L, &panic);
     sol_setwarnf(L, warnfoff, L);  /* default is warnings off */
   }
+  else if (a != NULL)  /* all blocks (if any) are already free */
+    freearena(a);
   return L;
 }
 
 
+SOLLIB_API sol_State *solL_newstate (void) {
+  return solL_newstatex(0);
+}
+
+
 SOLLIB_API void solL_checkversion_ (sol_State *L, sol_Number ver, size_t sz) {
   sol_Number v = sol_version(L);
   if (sz != SOLL_NUMSIZES)  /* check numeric types */
@@ -100,6 +100,22 @@ SOLLIB_API int (solL_loadstring) (sol_State *L, const char *s);
 
 SOLLIB_API sol_State *(solL_newstate) (void);
 
+/* flags for 'solL_newstatex' */
+#define SOLL_ARENA	1	/* use a size-class arena allocator */
+
+/* statistics of an arena allocator */
+typedef struct solL_ArenaStats {
+  size_t slabsize;  /* size of each slab */
+  size_t slabs;  /* number of slabs held (including empty ones) */
+  size_t blockbytes;  /* bytes in small blocks in use (whole classes) */
+  size_t reqbytes;  /* bytes asked for those blocks */
+  size_t largebytes;  /* bytes in large blocks (outside slabs) */
+  size_t released;  /* number of slabs given back to the system */
+} solL_ArenaStats;
+
+SOLLIB_API sol_State *(solL_newstatex) (int flags);
+SOLLIB_API int (solL_arenastats) (sol_State *L, solL_ArenaStats *st);
+
 SOLLIB_API sol_Integer (solL_len) (sol_State *L, int idx);
 
 SOLLIB_API void (solL_addgsub) (solL_Buffer *b, const char *s,
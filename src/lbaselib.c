@@ -11,6 +11,7 @@
 
 
 #include <ctype.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -196,13 +197,44 @@ static int pushmode (sol_State *L, int oldmode) {
 */
 #define checkvalres(res) { if (res == -1) break; }
 
+/*
+** push a table with the durations of the collector steps (see
+** 'sol_GCStepStats')
+*/
+static void pushstepstats (sol_State *L, const sol_GCStepStats *s) {
+  int i;
+  sol_createtable(L, 0, 7);
+  sol_pushinteger(L, s->steps);
+  sol_setfield(L, -2, "steps");
+  sol_pushinteger(L, s->over);
+  sol_setfield(L, -2, "over");
+  sol_pushinteger(L, s->total);
+  sol_setfield(L, -2, "total");
+  sol_pushinteger(L, s->max);
+  sol_setfield(L, -2, "max");
+  sol_pushinteger(L, s->last);
+  sol_setfield(L, -2, "last");
+  sol_pushinteger(L, sol_gc(L, SOL_GCSTEPTIME, -1));
+  sol_setfield(L, -2, "target");
+  sol_createtable(L, SOL_GCSTEPHIST, 0);
+  for (i = 0; i < SOL_GCSTEPHIST; i++) {
+    sol_pushinteger(L, s->hist[i]);
+    sol_rawseti(L, -2, i + 1);
+  }
+  sol_setfield(L, -2, "hist");
+}
+
+
 static int solB_collectgarbage (sol_State *L) {
   static const char *const opts[] = {"stop", "restart", "collect",
     "count", "step", "setpause", "setstepmul",
-    "isrunning", "generational", "incremental", NULL};
+    "isrunning", "generational", "incremental", "parallel", "sweeper",
+    "freeze", "steptime", "idle", "stepstats", NULL};
   static const int optsnum[] = {SOL_GCSTOP, SOL_GCRESTART, SOL_GCCOLLECT,
     SOL_GCCOUNT, SOL_GCSTEP, SOL_GCSETPAUSE, SOL_GCSETSTEPMUL,
-    SOL_GCISRUNNING, SOL_GCGEN, SOL_GCINC};
+    SOL_GCISRUNNING, SOL_GCGEN, SOL_GCINC, SOL_GCPARALLEL,
+    SOL_GCSWEEPER, SOL_GCFREEZE, SOL_GCSTEPTIME, SOL_GCIDLE,
+    SOL_GCSTEPSTATS};
   int o = optsnum[solL_checkoption(L, 1, "collect", opts)];
   switch (o) {
     case SOL_GCCOUNT: {
@@ -220,13 +252,52 @@ static int solB_collectgarbage (sol_State *L) {
       return 1;
     }
     case SOL_GCSETPAUSE:
-    case SOL_GCSETSTEPMUL: {
+    case SOL_GCSETSTEPMUL:
+    case SOL_GCPARALLEL: {
       int p = (int)solL_optinteger(L, 2, 0);
       int previous = sol_gc(L, o, p);
       checkvalres(previous);
       sol_pushinteger(L, previous);
       return 1;
     }
+    case SOL_GCSWEEPER: {
+      int on = sol_isnoneornil(L, 2) ? -1 : sol_toboolean(L, 2);
+      int previous = sol_gc(L, o, on);
+      if (previous == -1) {  /* not available? */
+        solL_pushfail(L);
+        sol_pushliteral(L, "background sweeping not available");
+        return 2;
+      }
+      sol_pushboolean(L, previous);
+      return 1;
+    }
+    case SOL_GCSTEPTIME: {
+      sol_Integer usec = solL_optinteger(L, 2, -1);
+      int previous;
+      solL_argcheck(L, usec <= INT_MAX, 2, "value out of range");
+      previous = sol_gc(L, o, (usec < 0) ? -1 : (int)usec);
+      checkvalres(previous);
+      sol_pushinteger(L, previous);
+      return 1;
+    }
+    case SOL_GCIDLE: {
+      sol_Integer usec = solL_checkinteger(L, 2);
+      int res;
+      solL_argcheck(L, usec <= INT_MAX, 2, "value out of range");
+      res = sol_gc(L, o, (int)usec);
+      checkvalres(res);
+      sol_pushboolean(L, res);
+      return 1;
+    }
+    case SOL_GCSTEPSTATS: {
+      sol_GCStepStats s;
+      int reset = sol_toboolean(L, 2);
+      checkvalres(sol_gc(L, o, &s));
+      pushstepstats(L, &s);
+      if (reset)
+        sol_gc(L, o, (sol_GCStepStats *)NULL);
+      return 1;
+    }
     case SOL_GCISRUNNING: {
       int res = sol_gc(L, o);
       checkvalres(res);
@@ -545,10 +545,11 @@ static int addk (FuncState *fs, TValue *key, TValue *v) {
   TValue val;
   sol_State *L = fs->ls->L;
   Proto *f = fs->f;
-  const TValue *idx = solH_get(fs->ls->h, key);  /* query scanner table */
+  TValue idx;
   int k, oldsize;
-  if (ttisinteger(idx)) {  /* is there an index there? */
-    k = cast_int(ivalue(idx));
+  /* query scanner table: is there an index there? */
+  if (solH_get(fs->ls->h, key, &idx) == SOL_VNUMINT) {
+    k = cast_int(ivalue(&idx));
     /* correct value? (warning: must distinguish floats from integers!) */
     if (k < fs->nk && ttypetag(&f->k[k]) == ttypetag(v) &&
                       solV_rawequalobj(&f->k[k], v))
@@ -560,7 +561,7 @@ static int addk (FuncState *fs, TValue *key, TValue *v) {
   /* numerical value does not need GC barrier;
      table has no metatable, so it does not need to invalidate cache */
   setivalue(&val, k);
-  solH_finishset(L, fs->ls->h, key, idx, &val);
+  solH_set(L, fs->ls->h, key, &val);
   solM_growvector(L, f->k, k, f->sizek, TValue, MAXARG_Ax, "constants");
   while (oldsize < f->sizek) setnilvalue(&f->k[oldsize++]);
   setobj(L, &f->k[k], v);
@@ -1873,3 +1874,438 @@ void solK_finish (FuncState *fs) {
     }
   }
 }
+
+
+/*
+** {======================================================================
+** Inlining
+** =======================================================================
+*/
+
+/*
+** Maximum size (in instructions) of a function to be inlined. (Zero
+** disables inlining.)
+*/
+#if !defined(SOLI_MAXINLINE)
+#define SOLI_MAXINLINE		40
+#endif
+
+
+/* kinds of operands of an instruction, for 'relocate' */
+#define OA_RA		1	/* A is a register */
+#define OA_RB		2	/* B is a register */
+#define OA_RC		4	/* C is a register */
+#define OA_KB		8	/* B is a constant */
+#define OA_KC		16	/* C is a constant */
+#define OA_RKC		32	/* C is a register or a constant (by 'k') */
+#define OA_KBX		64	/* Bx is a constant */
+
+
+/*
+** Operands of instructions that can be inlined; -1 for the others
+** (upvalues, calls, closures, varargs, and to-be-closed variables).
+** Return instructions are handled apart.
+*/
+static int operands (OpCode op) {
+  switch (op) {
+    case OP_JMP: case OP_EXTRAARG:
+      return 0;
+    case OP_LOADI: case OP_LOADF: case OP_LOADKX: case OP_LOADFALSE:
+    case OP_LFALSESKIP: case OP_LOADTRUE: case OP_LOADNIL:
+    case OP_NEWTABLE: case OP_CONCAT: case OP_EQI: case OP_LTI:
+    case OP_LEI: case OP_GTI: case OP_GEI: case OP_TEST:
+    case OP_FORLOOP: case OP_FORPREP: case OP_SETLIST: case OP_MMBINI:
+      return OA_RA;
+    case OP_LOADK:
+      return OA_RA | OA_KBX;
+    case OP_MOVE: case OP_GETI: case OP_ADDI: case OP_SHRI: case OP_SHLI:
+    case OP_UNM: case OP_BNOT: case OP_NOT: case OP_LEN: case OP_EQ:
+    case OP_LT: case OP_LE: case OP_TESTSET: case OP_MMBIN:
+      return OA_RA | OA_RB;
+    case OP_GETFIELD: case OP_ADDK: case OP_SUBK: case OP_MULK:
+    case OP_MODK: case OP_POWK: case OP_DIVK: case OP_IDIVK:
+    case OP_BANDK: case OP_BORK: case OP_BXORK:
+      return OA_RA | OA_RB | OA_KC;
+    case OP_GETTABLE: case OP_ADD: case OP_SUB: case OP_MUL: case OP_MOD:
+    case OP_POW: case OP_DIV: case OP_IDIV: case OP_BAND: case OP_BOR:
+    case OP_BXOR: case OP_SHL: case OP_SHR:
+      return OA_RA | OA_RB | OA_RC;
+    case OP_EQK: case OP_MMBINK:
+      return OA_RA | OA_KB;
+    case OP_SETTABLE:
+      return OA_RA | OA_RB | OA_RKC;
+    case OP_SETI:
+      return OA_RA | OA_RKC;
+    case OP_SETFIELD:
+      return OA_RA | OA_KB | OA_RKC;
+    default:
+      return -1;
+  }
+}
+
+
+/*
+** Add constant 'v' (from another function) to the current function.
+*/
+static int copyk (FuncState *fs, const TValue *v) {
+  switch (ttypetag(v)) {
+    case SOL_VSHRSTR: case SOL_VLNGSTR: return stringK(fs, tsvalue(v));
+    case SOL_VNUMINT: return solK_intK(fs, ivalue(v));
+    case SOL_VNUMFLT: return solK_numberK(fs, fltvalue(v));
+    case SOL_VFALSE: return boolF(fs);
+    case SOL_VTRUE: return boolT(fs);
+    default: sol_assert(ttisnil(v)); return nilK(fs);
+  }
+}
+
+
+/*
+** Adjust instruction '*pi' from function 'p' to run inlined in the
+** current function: move its registers up by 'base' and copy its
+** constants. ('prev' is the previous instruction, which tells what an
+** OP_EXTRAARG holds.) Return false if a constant index does not fit
+** in its operand.
+*/
+static int relocate (FuncState *fs, const Proto *p, Instruction *pi,
+                     Instruction prev, int base) {
+  Instruction i = *pi;
+  int m = operands(GET_OPCODE(i));
+  int k;
+  sol_assert(m >= 0);
+  if (m & OA_RA)
+    SETARG_A(i, GETARG_A(i) + base);
+  if (m & OA_RB)
+    SETARG_B(i, GETARG_B(i) + base);
+  if ((m & OA_RC) || ((m & OA_RKC) && !GETARG_k(i)))
+    SETARG_C(i, GETARG_C(i) + base);
+  if (m & OA_KB) {
+    k = copyk(fs, &p->k[GETARG_B(i)]);
+    if (k > MAXARG_B) return 0;
+    SETARG_B(i, k);
+  }
+  if ((m & OA_KC) || ((m & OA_RKC) && GETARG_k(i))) {
+    k = copyk(fs, &p->k[GETARG_C(i)]);
+    if (k > MAXARG_C) return 0;
+    SETARG_C(i, k);
+  }
+  if (m & OA_KBX) {
+    k = copyk(fs, &p->k[GETARG_Bx(i)]);
+    if (k > MAXARG_Bx) return 0;
+    SETARG_Bx(i, k);
+  }
+  if (GET_OPCODE(i) == OP_EXTRAARG && GET_OPCODE(prev) == OP_LOADKX)
+    SETARG_Ax(i, copyk(fs, &p->k[GETARG_Ax(i)]));
+  *pi = i;
+  return 1;
+}
+
+
+static int isreturn (Instruction i) {
+  OpCode op = GET_OPCODE(i);
+  return (op == OP_RETURN || op == OP_RETURN0 || op == OP_RETURN1);
+}
+
+
+/* number of values returned by return instruction 'i' */
+static int nreturns (Instruction i) {
+  switch (GET_OPCODE(i)) {
+    case OP_RETURN0: return 0;
+    case OP_RETURN1: return 1;
+    default: return GETARG_B(i) - 1;
+  }
+}
+
+
+/*
+** Size of the inlined code for instruction 'pc' of function 'p', when
+** the call wants 'nres' results and the inlined code has 'n'
+** instructions. A return becomes moves to the result registers,
+** filled with nils if needed, and a jump to the end.
+*/
+static int inlinedsize (const Proto *p, int pc, int n, int nres) {
+  Instruction i = p->code[pc];
+  if (!isreturn(i))
+    return 1;
+  else {
+    int nr = nreturns(i);
+    return ((nr < nres) ? nr + 1 : nres) + (pc < n - 1);
+  }
+}
+
+
+/* target of jump instruction 'i' at 'pc', or -1 if it is not a jump */
+static int jumptarget (Instruction i, int pc) {
+  switch (GET_OPCODE(i)) {
+    case OP_JMP: return pc + 1 + GETARG_sJ(i);
+    case OP_FORPREP: return pc + 2 + GETARG_Bx(i);
+    case OP_TFORPREP: return pc + 1 + GETARG_Bx(i);
+    case OP_FORLOOP: case OP_TFORLOOP: return pc + 1 - GETARG_Bx(i);
+    default: return -1;
+  }
+}
+
+
+static void setjumptarget (Instruction *i, int pc, int target) {
+  switch (GET_OPCODE(*i)) {
+    case OP_JMP: SETARG_sJ(*i, target - (pc + 1)); break;
+    case OP_FORPREP: SETARG_Bx(*i, target - (pc + 2)); break;
+    case OP_TFORPREP: SETARG_Bx(*i, target - (pc + 1)); break;
+    default: SETARG_Bx(*i, (pc + 1) - target); break;  /* loop back */
+  }
+}
+
+
+/*
+** Number of instructions of 'p' to be inlined: the final return added
+** by the parser is left out when it cannot be reached.
+*/
+static int codesize (const Proto *p) {
+  int n = p->sizecode;
+  int pc;
+  if (n < 2 || !isreturn(p->code[n - 2]))
+    return n;
+  for (pc = 0; pc < n; pc++) {
+    if (jumptarget(p->code[pc], pc) == n - 1)
+      return n;  /* final return is reachable */
+  }
+  return n - 1;
+}
+
+
+/*
+** Line of instruction 'pc', given the line of the previous one; 'abs'
+** is the next entry in 'abslineinfo', for a sequential traversal.
+*/
+static int decodeline (const Proto *p, int line, int pc, int *abs) {
+  if (p->lineinfo[pc] != ABSLINEINFO)
+    return line + p->lineinfo[pc];
+  else {
+    sol_assert(p->abslineinfo[*abs].pc == pc);
+    return p->abslineinfo[(*abs)++].line;
+  }
+}
+
+
+/*
+** Check whether the call 'c' can be inlined and compute the size of
+** its new code. The called function must be small, have no upvalues,
+** varargs, inner functions or calls, and return a fixed number of
+** values; the call must have a fixed number of arguments and results.
+*/
+static int caninline (FuncState *fs, InlineCall *c) {
+  Proto *f = fs->f;
+  Instruction call = f->code[c->pc];
+  Proto *p;
+  int base, nres, n, pc;
+  if (GET_OPCODE(call) != OP_CALL || GETARG_B(call) == 0 ||
+      GETARG_C(call) == 0)
+    return 0;
+  p = f->p[c->fidx];
+  base = GETARG_A(call) + 1;
+  nres = GETARG_C(call) - 1;
+  if (p->is_vararg || p->sizeupvalues > 0 || p->sizep > 0 ||
+      p->sizeinlined > 0 || p->sizecode > SOLI_MAXINLINE ||
+      base + p->maxstacksize > MAXREGS)
+    return 0;
+  n = codesize(p);
+  c->size = (GETARG_B(call) - 1 < p->numparams);  /* nil arguments */
+  for (pc = 0; pc < n; pc++) {
+    Instruction i = p->code[pc];
+    if (isreturn(i)) {
+      if (GETARG_B(i) == 0 || GETARG_k(i))  /* multiple results? */
+        return 0;
+    }
+    else if (operands(GET_OPCODE(i)) < 0)
+      return 0;
+    c->size += inlinedsize(p, pc, n, nres);
+  }
+  for (pc = 0; pc < n; pc++) {  /* now check the constants */
+    Instruction i = p->code[pc];
+    if (!isreturn(i) &&
+        !relocate(fs, p, &i, (pc > 0) ? p->code[pc - 1] : 0, base))
+      return 0;
+  }
+  return 1;
+}
+
+
+/* code instruction 'i' at line 'line' */
+static int recode (FuncState *fs, Instruction i, int line) {
+  Proto *f = fs->f;
+  solM_growvector(fs->ls->L, f->code, fs->pc, f->sizecode, Instruction,
+                  MAX_INT, "opcodes");
+  f->code[fs->pc++] = i;
+  savelineinfo(fs, f, line);
+  return fs->pc - 1;
+}
+
+
+/*
+** Code call 'c' (originally instruction 'call', at line 'line') as the
+** code of its function, with jumps and registers adjusted and returns
+** moving their values to the call's result registers.
+*/
+static void expandcall (FuncState *fs, const InlineCall *c,
+                        Instruction call, int line, int *ninlined) {
+  Proto *f = fs->f;
+  Proto *p = f->p[c->fidx];
+  int ra = GETARG_A(call);
+  int base = ra + 1;
+  int nargs = GETARG_B(call) - 1;
+  int nres = GETARG_C(call) - 1;
+  int n = codesize(p);
+  int newpc[SOLI_MAXINLINE + 1];  /* new position of each instruction */
+  int exits[SOLI_MAXINLINE + 1];  /* jumps to the end */
+  int nexits = 0;
+  int start = fs->pc;
+  int pline = p->linedefined;
+  int pabs = 0;
+  int pc;
+  InlineInfo *ii;
+  if (nargs < p->numparams)  /* missing arguments? */
+    recode(fs, CREATE_ABCk(OP_LOADNIL, base + nargs,
+                           p->numparams - nargs - 1, 0, 0), line);
+  for (pc = 0; pc < n; pc++) {
+    Instruction i = p->code[pc];
+    pline = decodeline(p, pline, pc, &pabs);
+    newpc[pc] = fs->pc;
+    if (isreturn(i)) {
+      int nr = nreturns(i);
+      int j;
+      for (j = 0; j < nr && j < nres; j++)
+        recode(fs, CREATE_ABCk(OP_MOVE, ra + j, GETARG_A(i) + base + j,
+                               0, 0), pline);
+      if (nr < nres)
+        recode(fs, CREATE_ABCk(OP_LOADNIL, ra + nr, nres - nr - 1, 0, 0),
+                   pline);
+      if (pc < n - 1)
+        exits[nexits++] = recode(fs, CREATE_sJ(OP_JMP, OFFSET_sJ, 0),
+                                     pline);
+    }
+    else {
+      relocate(fs, p, &i, (pc > 0) ? p->code[pc - 1] : 0, base);
+      recode(fs, i, pline);
+    }
+  }
+  newpc[pc] = fs->pc;
+  sol_assert(fs->pc - start == c->size);
+  for (pc = 0; pc < n; pc++) {  /* fix jumps */
+    int target = jumptarget(p->code[pc], pc);
+    if (target >= 0)
+      setjumptarget(&f->code[newpc[pc]], newpc[pc], newpc[target]);
+  }
+  while (nexits > 0) {
+    int j = exits[--nexits];
+    setjumptarget(&f->code[j], j, fs->pc);
+  }
+  if (base + p->maxstacksize > f->maxstacksize)
+    f->maxstacksize = cast_byte(base + p->maxstacksize);
+  solM_growvector(fs->ls->L, f->inlined, *ninlined, f->sizeinlined,
+                  InlineInfo, MAX_INT, "inlined calls");
+  ii = &f->inlined[(*ninlined)++];
+  ii->startpc = start;
+  ii->endpc = fs->pc;
+  ii->line = line;
+  ii->fidx = c->fidx;
+  ii->reg = c->reg;
+  ii->base = cast_byte(base);
+  ii->nres = cast_byte(nres);
+  ii->nilargs = (nargs < p->numparams);
+}
+
+
+/*
+** Position in the code of function 'p' of instruction 'pc' of an
+** inlined call 'ii' of 'p', or -1 if that instruction does not come
+** from 'p' (the LOADNIL for missing arguments and the code replacing
+** returns). This follows the layout made by 'expandcall'.
+*/
+int solK_inlinedpc (const Proto *p, const InlineInfo *ii, int pc) {
+  int n = codesize(p);
+  int off = pc - ii->startpc - ii->nilargs;  /* offset in expanded code */
+  int ppc;
+  for (ppc = 0; ppc < n && off >= 0; ppc++) {
+    int size = inlinedsize(p, ppc, n, ii->nres);
+    if (off < size)
+      return isreturn(p->code[ppc]) ? -1 : ppc;
+    off -= size;
+  }
+  return -1;
+}
+
+
+/* new position of the original instruction 'pc' */
+static int newposition (FuncState *fs, const CodeLine *old, int n, int pc) {
+  return (pc < n) ? old[pc].newpc : fs->pc;
+}
+
+
+/*
+** Inline the calls registered by the parser for the current function
+** (whose code is otherwise complete). The function is coded again
+** from a copy of its instructions, expanding the calls being inlined;
+** jumps and debug information are then moved to the new positions.
+** Tracebacks still show inlined calls (see 'sol_getstack'), but their
+** call and return hooks do not run.
+*/
+void solK_inline (FuncState *fs) {
+  Dyndata *dyd = fs->ls->dyd;
+  InlineCall *calls = &dyd->inl.arr[fs->firstinline];
+  int ncalls = dyd->inl.n - fs->firstinline;
+  Proto *f = fs->f;
+  int n = fs->pc;
+  int ninlined = 0;
+  int abs = 0;
+  int pc, line, i;
+  CodeLine *old;
+  dyd->inl.n = fs->firstinline;  /* remove calls from the list */
+  for (i = 0; i < ncalls; i++) {
+    if (calls[i].fidx >= 0 && caninline(fs, &calls[i]))
+      ninlined++;
+    else
+      calls[i].fidx = -1;
+  }
+  if (ninlined == 0)
+    return;
+  if (dyd->copy.size < n) {
+    dyd->copy.arr = solM_reallocvector(fs->ls->L, dyd->copy.arr,
+                                       dyd->copy.size, n, CodeLine);
+    dyd->copy.size = n;
+  }
+  old = dyd->copy.arr;
+  line = f->linedefined;
+  for (pc = 0; pc < n; pc++) {  /* copy code with its lines */
+    line = decodeline(f, line, pc, &abs);
+    old[pc].i = f->code[pc];
+    old[pc].line = line;
+  }
+  /* code the function again */
+  fs->pc = 0;
+  fs->previousline = f->linedefined;
+  fs->iwthabs = 0;
+  fs->nabslineinfo = 0;
+  ninlined = 0;
+  for (pc = 0, i = 0; pc < n; pc++) {
+    old[pc].newpc = fs->pc;
+    if (i < ncalls && calls[i].pc == pc && calls[i++].fidx >= 0)
+      expandcall(fs, &calls[i - 1], old[pc].i, old[pc].line, &ninlined);
+    else
+      recode(fs, old[pc].i, old[pc].line);
+  }
+  for (pc = 0; pc < n; pc++) {  /* fix jumps */
+    int target = jumptarget(old[pc].i, pc);
+    if (target >= 0) {
+      int npc = old[pc].newpc;
+      setjumptarget(&f->code[npc], npc, newposition(fs, old, n, target));
+    }
+  }
+  for (i = 0; i < fs->ndebugvars; i++) {  /* fix scopes of variables */
+    LocVar *var = &f->locvars[i];
+    var->startpc = newposition(fs, old, n, var->startpc);
+    var->endpc = newposition(fs, old, n, var->endpc);
+  }
+  solM_shrinkvector(fs->ls->L, f->inlined, f->sizeinlined, ninlined,
+                    InlineInfo);
+}
+
+/* }====================================================================== */
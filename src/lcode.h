@@ -95,6 +95,8 @@ SOLI_FUNC void solK_settablesize (FuncState *fs, int pc,
                                   int ra, int asize, int hsize);
 SOLI_FUNC void solK_setlist (FuncState *fs, int base, int nelems, int tostore);
 SOLI_FUNC void solK_finish (FuncState *fs);
+SOLI_FUNC void solK_inline (FuncState *fs);
+SOLI_FUNC int solK_inlinedpc (const Proto *p, const InlineInfo *ii, int pc);
 SOLI_FUNC l_noret solK_semerror (LexState *ls, const char *msg);
 
 
@@ -316,6 +316,33 @@ static int db_upvaluejoin (sol_State *L) {
 }
 
 
+/*
+** Return a list with the statistics of all inline caches of a Sol
+** function, each one as a table with fields 'pc', 'currentline',
+** 'hits', and 'misses'.
+*/
+static int db_getcachestats (sol_State *L) {
+  sol_CacheStat cs;
+  int n;
+  solL_checktype(L, 1, SOL_TFUNCTION);
+  solL_argcheck(L, !sol_iscfunction(L, 1), 1, "Sol function expected");
+  sol_newtable(L);
+  for (n = 1; sol_getcachestat(L, 1, n, &cs); n++) {
+    sol_createtable(L, 0, 4);
+    sol_pushinteger(L, cs.pc);
+    sol_setfield(L, -2, "pc");
+    sol_pushinteger(L, cs.currentline);
+    sol_setfield(L, -2, "currentline");
+    sol_pushinteger(L, (sol_Integer)cs.hits);
+    sol_setfield(L, -2, "hits");
+    sol_pushinteger(L, (sol_Integer)cs.misses);
+    sol_setfield(L, -2, "misses");
+    sol_rawseti(L, -2, n);
+  }
+  return 1;
+}
+
+
 /*
 ** Call hook function registered at hook table for the current
 ** thread (if there is one)
@@ -458,6 +485,7 @@ static const solL_Reg dblib[] = {
   {"debug", db_debug},
   {"getuservalue", db_getuservalue},
   {"gethook", db_gethook},
+  {"getcachestats", db_getcachestats},
   {"getinfo", db_getinfo},
   {"getlocal", db_getlocal},
   {"getregistry", db_getregistry},
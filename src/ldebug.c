@@ -103,6 +103,34 @@ static int getcurrentline (CallInfo *ci) {
 }
 
 
+/*
+** If Sol function 'ci' is running code of an inlined call, return the
+** index (plus one) of that call in 'inlined'; otherwise return 0.
+** The call is ignored if its variable does not hold the inlined
+** function anymore (it can be changed by 'debug.setlocal').
+*/
+int solG_inlinedcall (CallInfo *ci) {
+  const Proto *p = ci_func(ci)->p;
+  if (p->sizeinlined > 0) {
+    int pc = currentpc(ci);
+    int i;
+    for (i = 0; i < p->sizeinlined; i++) {
+      const InlineInfo *ii = &p->inlined[i];
+      if (ii->startpc <= pc && pc < ii->endpc) {
+        const TValue *fv = s2v(ci->func.p + 1 + ii->reg);
+        if (ttisLclosure(fv) && clLvalue(fv)->p == p->p[ii->fidx])
+          return i + 1;
+        break;
+      }
+    }
+  }
+  return 0;
+}
+
+
+#define getinlined(ci,inl)	(&ci_func(ci)->p->inlined[(inl) - 1])
+
+
 /*
 ** Set 'trap' for all active Sol frames.
 ** This function can be called during a signal, under "reasonable"
@@ -160,18 +188,30 @@ SOL_API int sol_gethookcount (sol_State *L) {
 }
 
 
+/*
+** A Sol function running an inlined call counts as two levels: the
+** inlined function and the function itself.
+*/
 SOL_API int sol_getstack (sol_State *L, int level, sol_Debug *ar) {
-  int status;
+  int status = 0;  /* no such level */
   CallInfo *ci;
   if (level < 0) return 0;  /* invalid (negative) level */
   sol_lock(L);
-  for (ci = L->ci; level > 0 && ci != &L->base_ci; ci = ci->previous)
-    level--;
-  if (level == 0 && ci != &L->base_ci) {  /* level found? */
-    status = 1;
-    ar->i_ci = ci;
+  for (ci = L->ci; ci != &L->base_ci; ci = ci->previous) {
+    int inl = isSol(ci) ? solG_inlinedcall(ci) : 0;
+    if (inl && level-- == 0) {  /* inlined call at this level? */
+      status = 1;
+      ar->i_ci = ci;
+      ar->i_inl = inl;
+      break;
+    }
+    if (level-- == 0) {  /* level found? */
+      status = 1;
+      ar->i_ci = ci;
+      ar->i_inl = 0;
+      break;
+    }
   }
-  else status = 0;  /* no such level */
   sol_unlock(L);
   return status;
 }
@@ -220,6 +260,26 @@ const char *solG_findlocal (sol_State *L, CallInfo *ci, int n, StkId *pos) {
 }
 
 
+/*
+** Only the parameters of an inlined call are visible; its other
+** locals live in temporaries of the calling function.
+*/
+static const char *inlinedlocal (const sol_Debug *ar, int n, StkId *pos) {
+  CallInfo *ci = ar->i_ci;
+  const InlineInfo *ii = getinlined(ci, ar->i_inl);
+  const Proto *p = ci_func(ci)->p->p[ii->fidx];
+  const char *name = (n > 0) ? solF_getlocalname(p, n, 0) : NULL;
+  if (name)
+    *pos = ci->func.p + 1 + ii->base + (n - 1);
+  return name;
+}
+
+
+#define findlocal(L,ar,n,pos)  \
+	((ar)->i_inl ? inlinedlocal(ar, n, pos) \
+	             : solG_findlocal(L, (ar)->i_ci, n, pos))
+
+
 SOL_API const char *sol_getlocal (sol_State *L, const sol_Debug *ar, int n) {
   const char *name;
   sol_lock(L);
@@ -231,7 +291,7 @@ SOL_API const char *sol_getlocal (sol_State *L, const sol_Debug *ar, int n) {
   }
   else {  /* active function; get information through 'ar' */
     StkId pos = NULL;  /* to avoid warnings */
-    name = solG_findlocal(L, ar->i_ci, n, &pos);
+    name = findlocal(L, ar, n, &pos);
     if (name) {
       setobjs2s(L, L->top.p, pos);
       api_incr_top(L);
@@ -246,7 +306,7 @@ SOL_API const char *sol_setlocal (sol_State *L, const sol_Debug *ar, int n) {
   StkId pos = NULL;  /* to avoid warnings */
   const char *name;
   sol_lock(L);
-  name = solG_findlocal(L, ar->i_ci, n, &pos);
+  name = findlocal(L, ar, n, &pos);
   if (name) {
     setobjs2s(L, pos, L->top.p - 1);
     L->top.p--;  /* pop value */
@@ -329,8 +389,12 @@ static const char *getfuncname (sol_State *L, CallInfo *ci, const char **name) {
 }
 
 
+/*
+** 'inl' is the inlined call when 'ar' is for the inlined function, or
+** 0; the function itself reports the line of that call.
+*/
 static int auxgetinfo (sol_State *L, const char *what, sol_Debug *ar,
-                       Closure *f, CallInfo *ci) {
+                       Closure *f, CallInfo *ci, int inl) {
   int status = 1;
   for (; *what; what++) {
     switch (*what) {
@@ -339,7 +403,13 @@ static int auxgetinfo (sol_State *L, const char *what, sol_Debug *ar,
         break;
       }
       case 'l': {
-        ar->currentline = (ci && isSol(ci)) ? getcurrentline(ci) : -1;
+        int call;
+        if (ci == NULL || !isSol(ci))
+          ar->currentline = -1;
+        else if (!inl && (call = solG_inlinedcall(ci)) != 0)
+          ar->currentline = getinlined(ci, call)->line;  /* line of call */
+        else
+          ar->currentline = getcurrentline(ci);
         break;
       }
       case 'u': {
@@ -355,11 +425,18 @@ static int auxgetinfo (sol_State *L, const char *what, sol_Debug *ar,
         break;
       }
       case 't': {
-        ar->istailcall = (ci) ? ci->callstatus & CIST_TAIL : 0;
+        ar->istailcall = (ci && !inl) ? ci->callstatus & CIST_TAIL : 0;
         break;
       }
       case 'n': {
-        ar->namewhat = getfuncname(L, ci, &ar->name);
+        if (inl) {  /* inlined call? */
+          const InlineInfo *ii = getinlined(ci, inl);
+          ar->name = solF_getlocalname(ci_func(ci)->p, ii->reg + 1,
+                                       ii->startpc);
+          ar->namewhat = (ar->name) ? strlocal : NULL;
+        }
+        else
+          ar->namewhat = getfuncname(L, ci, &ar->name);
         if (ar->namewhat == NULL) {
           ar->namewhat = "";  /* not found */
           ar->name = NULL;
@@ -367,7 +444,7 @@ static int auxgetinfo (sol_State *L, const char *what, sol_Debug *ar,
         break;
       }
       case 'r': {
-        if (ci == NULL || !(ci->callstatus & CIST_TRAN))
+        if (ci == NULL || inl || !(ci->callstatus & CIST_TRAN))
           ar->ftransfer = ar->ntransfer = 0;
         else {
           ar->ftransfer = ci->u2.transferinfo.ftransfer;
@@ -390,6 +467,7 @@ SOL_API int sol_getinfo (sol_State *L, const char *what, sol_Debug *ar) {
   Closure *cl;
   CallInfo *ci;
   TValue *func;
+  int inl = 0;
   sol_lock(L);
   if (*what == '>') {
     ci = NULL;
@@ -400,11 +478,15 @@ SOL_API int sol_getinfo (sol_State *L, const char *what, sol_Debug *ar) {
   }
   else {
     ci = ar->i_ci;
-    func = s2v(ci->func.p);
+    inl = ar->i_inl;
+    if (inl)  /* inlined function? */
+      func = s2v(ci->func.p + 1 + getinlined(ci, inl)->reg);
+    else
+      func = s2v(ci->func.p);
     sol_assert(ttisfunction(func));
   }
   cl = ttisclosure(func) ? clvalue(func) : NULL;
-  status = auxgetinfo(L, what, ar, cl, ci);
+  status = auxgetinfo(L, what, ar, cl, ci, inl);
   if (strchr(what, 'f')) {
     setobj2s(L, L->top.p, func);
     api_incr_top(L);
@@ -725,6 +807,30 @@ static const char *formatvarinfo (sol_State *L, const char *kind,
     return solO_pushfstring(L, " (%s '%s')", kind, name);
 }
 
+/*
+** Find a "name" for register 'reg' at instruction 'pc' of function
+** 'p'. Registers of an inlined call belong to the inlined function, so
+** they are named by its own code, at the corresponding instruction.
+*/
+static const char *regname (const Proto *p, int pc, int reg,
+                            const char **name) {
+  int i;
+  for (i = 0; i < p->sizeinlined; i++) {
+    const InlineInfo *ii = &p->inlined[i];
+    if (ii->startpc <= pc && pc < ii->endpc) {
+      if (reg >= ii->base) {  /* register of the inlined call? */
+        const Proto *ip = p->p[ii->fidx];
+        int ipc = solK_inlinedpc(ip, ii, pc);
+        if (ipc >= 0)
+          return getobjname(ip, ipc, reg - ii->base, name);
+      }
+      break;
+    }
+  }
+  return getobjname(p, pc, reg, name);
+}
+
+
 /*
 ** Build a string with a "description" for the value 'o', such as
 ** "variable 'x'" or "upvalue 'y'".
@@ -738,7 +844,7 @@ static const char *varinfo (sol_State *L, const TValue *o) {
     if (!kind) {  /* not an upvalue? */
       int reg = instack(ci, o);  /* try a register */
       if (reg >= 0)  /* is 'o' a register? */
-        kind = getobjname(ci_func(ci)->p, currentpc(ci), reg, &name);
+        kind = regname(ci_func(ci)->p, currentpc(ci), reg, &name);
     }
   }
   return formatvarinfo(L, kind, name);
@@ -37,6 +37,7 @@
 
 
 SOLI_FUNC int solG_getfuncline (const Proto *f, int pc);
+SOLI_FUNC int solG_inlinedcall (CallInfo *ci);
 SOLI_FUNC const char *solG_findlocal (sol_State *L, CallInfo *ci, int n,
                                                     StkId *pos);
 SOLI_FUNC l_noret solG_typeerror (sol_State *L, const TValue *o,
@@ -344,6 +344,7 @@ void solD_hook (sol_State *L, int event, int line,
     ar.event = event;
     ar.currentline = line;
     ar.i_ci = ci;
+    ar.i_inl = isSol(ci) ? solG_inlinedcall(ci) : 0;
     if (ntransfer != 0) {
       mask |= CIST_TRAN;  /* 'ci' has transfer information */
       ci->u2.transferinfo.ftransfer = ftransfer;
@@ -1022,12 +1023,16 @@ int solD_protectedparser (sol_State *L, ZIO *z, const char *name,
   p.dyd.actvar.arr = NULL; p.dyd.actvar.size = 0;
   p.dyd.gt.arr = NULL; p.dyd.gt.size = 0;
   p.dyd.label.arr = NULL; p.dyd.label.size = 0;
+  p.dyd.inl.arr = NULL; p.dyd.inl.size = 0;
+  p.dyd.copy.arr = NULL; p.dyd.copy.size = 0;
   solZ_initbuffer(L, &p.buff);
   status = solD_pcall(L, f_parser, &p, savestack(L, L->top.p), L->errfunc);
   solZ_freebuffer(L, &p.buff);
   solM_freearray(L, p.dyd.actvar.arr, p.dyd.actvar.size);
   solM_freearray(L, p.dyd.gt.arr, p.dyd.gt.size);
   solM_freearray(L, p.dyd.label.arr, p.dyd.label.size);
+  solM_freearray(L, p.dyd.inl.arr, p.dyd.inl.size);
+  solM_freearray(L, p.dyd.copy.arr, p.dyd.copy.size);
   decnny(L);
   return status;
 }
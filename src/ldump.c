@@ -16,6 +16,7 @@
 #include "sol.h"
 
 #include "lobject.h"
+#include "lopcodes.h"
 #include "lstate.h"
 #include "lundump.h"
 
@@ -101,9 +102,25 @@ static void dumpString (DumpState *D, const TString *s) {
 }
 
 
+/*
+** Quickened instructions are dumped in their generic forms, as they
+** depend on the values seen by the running code.
+*/
 static void dumpCode (DumpState *D, const Proto *f) {
-  dumpInt(D, f->sizecode);
-  dumpVector(D, f->code, f->sizecode);
+  int n = f->sizecode;
+  int start = 0;  /* first instruction not dumped yet */
+  int i;
+  dumpInt(D, n);
+  for (i = 0; i < n; i++) {
+    Instruction inst = f->code[i];
+    if (isquickened(GET_OPCODE(inst))) {
+      dumpVector(D, f->code + start, i - start);
+      SET_OPCODE(inst, solP_generic(GET_OPCODE(inst)));
+      dumpVar(D, inst);
+      start = i + 1;
+    }
+  }
+  dumpVector(D, f->code + start, n - start);
 }
 
 
@@ -177,6 +194,18 @@ static void dumpDebug (DumpState *D, const Proto *f) {
   dumpInt(D, n);
   for (i = 0; i < n; i++)
     dumpString(D, f->upvalues[i].name);
+  n = (D->strip) ? 0 : f->sizeinlined;
+  dumpInt(D, n);
+  for (i = 0; i < n; i++) {
+    dumpInt(D, f->inlined[i].startpc);
+    dumpInt(D, f->inlined[i].endpc);
+    dumpInt(D, f->inlined[i].line);
+    dumpInt(D, f->inlined[i].fidx);
+    dumpByte(D, f->inlined[i].reg);
+    dumpByte(D, f->inlined[i].base);
+    dumpByte(D, f->inlined[i].nres);
+    dumpByte(D, f->inlined[i].nilargs);
+  }
 }
 
 
@@ -18,8 +18,10 @@
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lmem.h"
 #include "lobject.h"
+#include "lopcodes.h"
 #include "lstate.h"
 
 
@@ -257,6 +259,14 @@ Proto *solF_newproto (sol_State *L) {
   f->maxstacksize = 0;
   f->locvars = NULL;
   f->sizelocvars = 0;
+  f->icache = NULL;
+  f->sizeicache = 0;
+  f->icmap = NULL;
+  f->sizeicmap = 0;
+  f->inlined = NULL;
+  f->sizeinlined = 0;
+  f->jitcount = 0;
+  f->jitcode = NULL;
   f->linedefined = 0;
   f->lastlinedefined = 0;
   f->source = NULL;
@@ -272,10 +282,47 @@ void solF_freeproto (sol_State *L, Proto *f) {
   solM_freearray(L, f->abslineinfo, f->sizeabslineinfo);
   solM_freearray(L, f->locvars, f->sizelocvars);
   solM_freearray(L, f->upvalues, f->sizeupvalues);
+  solM_freearray(L, f->icache, f->sizeicache);
+  solM_freearray(L, f->icmap, f->sizeicmap);
+  solM_freearray(L, f->inlined, f->sizeinlined);
+  solJ_freeproto(L, f);
   solM_free(L, f);
 }
 
 
+/*
+** Create the inline caches for prototype 'f', once its code is
+** complete: one for each instruction that uses it, in the order of the
+** code, and the map that gives the interpreter the cache of an
+** instruction from its 'pc' (see 'ICMap').
+*/
+void solF_initcache (sol_State *L, Proto *f) {
+  int pc, i;
+  int n = 0;  /* number of caches */
+  int nmap = (f->sizecode + ICMAPBITS - 1) / ICMAPBITS;
+  f->icmap = solM_newvectorchecked(L, nmap, ICMap);
+  f->sizeicmap = nmap;
+  for (pc = 0; pc < f->sizecode; pc++) {
+    ICMap *m = &f->icmap[pc / ICMAPBITS];
+    if (pc % ICMAPBITS == 0) {  /* first instruction of the entry? */
+      m->mask = 0;
+      m->base = n;
+    }
+    if (hascache(f->code[pc])) {
+      m->mask |= 1u << (pc % ICMAPBITS);
+      n++;
+    }
+  }
+  f->icache = solM_newvectorchecked(L, n, ICache);
+  f->sizeicache = n;
+  for (i = 0; i < n; i++) {
+    ICache *ic = &f->icache[i];
+    ic->slot = ic->islot = 0;
+    ic->hits = ic->misses = 0;
+  }
+}
+
+
 /*
 ** Look for n-th local variable at line 'line' in function 'func'.
 ** Returns NULL if not found.
@@ -43,6 +43,14 @@
 
 
 
+/* number of instructions covered by each entry of a cache map */
+#define ICMAPBITS	32
+
+/* true if instruction 'pc' of prototype 'p' has an inline cache */
+#define solF_hascache(p,pc)  \
+	((p)->icmap[(pc) / ICMAPBITS].mask & (1u << ((pc) % ICMAPBITS)))
+
+
 /* special status to close upvalues preserving the top of the stack */
 #define CLOSEKTOP	(-1)
 
@@ -57,6 +65,7 @@ SOLI_FUNC void solF_closeupval (sol_State *L, StkId level);
 SOLI_FUNC StkId solF_close (sol_State *L, StkId level, int status, int yy);
 SOLI_FUNC void solF_unlinkupval (UpVal *uv);
 SOLI_FUNC void solF_freeproto (sol_State *L, Proto *f);
+SOLI_FUNC void solF_initcache (sol_State *L, Proto *f);
 SOLI_FUNC const char *solF_getlocalname (const Proto *func, int local_number,
                                          int pc);
 
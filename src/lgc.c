@@ -11,6 +11,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
 
 #include "sol.h"
@@ -21,6 +22,7 @@
 #include "lgc.h"
 #include "lmem.h"
 #include "lobject.h"
+#include "lshape.h"
 #include "lstate.h"
 #include "lstring.h"
 #include "ltable.h"
@@ -107,6 +109,14 @@
 static void reallymarkobject (global_State *g, GCObject *o);
 static lu_mem atomic (sol_State *L);
 static void entersweep (sol_State *L);
+#if SOL_USE_PARMARK
+static lu_mem parpropagate (global_State *g);
+#endif
+#if SOL_USE_BGSWEEP
+static int sweeperrunning (global_State *g);
+#else
+#define sweeperrunning(g)	0
+#endif
 
 
 /*
@@ -122,6 +132,20 @@ static void entersweep (sol_State *L);
 #define gnodelast(h)	gnode(h, cast_sizet(sizenode(h)))
 
 
+/*
+** number of elements to traverse in the array part of a table: typed
+** arrays have nothing to mark
+*/
+#define gcasize(h)	(isnumarray(h) ? 0u : solH_realasize(h))
+
+/*
+** collectable object in element 'i' of the (generic) array part of a
+** table, or NULL (see ltable.h)
+*/
+#define arraygcvalueN(h,i)  \
+	((*arraytag(h,i) & BIT_ISCOLLECTABLE) ? (h)->array[i].gc : NULL)
+
+
 static GCObject **getgclist (GCObject *o) {
   switch (o->tt) {
     case SOL_VTABLE: return &gco2t(o)->gclist;
@@ -192,6 +216,26 @@ static int iscleared (global_State *g, const GCObject *o) {
 }
 
 
+/* maximum size of list 'frozendirty' */
+#define MAXFROZENDIRTY	cast_int(solM_limitN(MAX_INT, GCObject*))
+
+
+/*
+** Barrier for a frozen object 'o', which the collector does not
+** traverse: paint it gray, so that it gets no more barriers, and
+** record it in 'frozendirty', to be traversed at every cycle from now
+** on (see 'markfrozen'). The list has room for every frozen object
+** that can point to others (see 'solC_freeze'), as a barrier cannot
+** allocate memory.
+*/
+static void frozenbarrier (sol_State *L, GCObject *o) {
+  global_State *g = G(L);
+  set2gray(o);
+  sol_assert(g->nfrozendirty < g->sizefrozendirty);
+  g->frozendirty[g->nfrozendirty++] = o;
+}
+
+
 /*
 ** Barrier that moves collector forward, that is, marks the white object
 ** 'v' being pointed by the black object 'o'.  In the generational
@@ -207,6 +251,12 @@ static int iscleared (global_State *g, const GCObject *o) {
 */
 void solC_barrier_ (sol_State *L, GCObject *o, GCObject *v) {
   global_State *g = G(L);
+  if (isfrozen(o)) {  /* 'v' is not frozen */
+    frozenbarrier(L, o);
+    return;
+  }
+  if (sweeperrunning(g))  /* 'o' is being swept? */
+    return;  /* nothing to be done */
   sol_assert(isblack(o) && iswhite(v) && !isdead(g, v) && !isdead(g, o));
   if (keepinvariant(g)) {  /* must keep invariant? */
     reallymarkobject(g, v);  /* restore invariant */
@@ -229,6 +279,12 @@ void solC_barrier_ (sol_State *L, GCObject *o, GCObject *v) {
 */
 void solC_barrierback_ (sol_State *L, GCObject *o) {
   global_State *g = G(L);
+  if (isfrozen(o)) {
+    frozenbarrier(L, o);
+    return;
+  }
+  if (sweeperrunning(g))  /* 'o' is being swept? */
+    return;  /* nothing to be done */
   sol_assert(isblack(o) && !isdead(g, o));
   sol_assert((g->gckind == KGC_GEN) == (isold(o) && getage(o) != G_TOUCHED1));
   if (getage(o) == G_TOUCHED2)  /* already in gray list? */
@@ -293,14 +349,44 @@ GCObject *solC_newobj (sol_State *L, int tt, size_t sz) {
 ** upvalues can call this function recursively, but this recursion goes
 ** for at most two levels: An upvalue cannot refer to another upvalue
 ** (only closures can), and a userdata's metatable must be a table.
+** Shapes refer only to strings and to their parents, so they are
+** marked here too, walking up the parent chain until a shape that is
+** already marked. Ropes are marked in the same way, walking down their
+** left pieces (their right pieces are never lazy), and a slice marks
+** its parent (which is never a rope). (In generational mode, 'markold'
+** calls this function for black shapes and lazy strings too.)
 */
 static void reallymarkobject (global_State *g, GCObject *o) {
   switch (o->tt) {
-    case SOL_VSHRSTR:
-    case SOL_VLNGSTR: {
+    case SOL_VSHRSTR: {
       set2black(o);  /* nothing to visit */
       break;
     }
+    case SOL_VLNGSTR: {
+      TString *ts = gco2ts(o);
+      set2black(ts);
+      while (isrope(ts) || isslice(ts)) {
+        if (isrope(ts))
+          markobject(g, ts->right);
+        ts = ts->left;
+        if (!iswhite(ts))  /* piece already marked? */
+          break;
+        set2black(ts);
+      }
+      break;
+    }
+    case SOL_VSHAPE: {
+      Shape *s = gco2shape(o);
+      set2black(s);
+      while (s->parent != NULL) {  /* not the root shape? */
+        markobject(g, s->keys[s->nfields - 1]);  /* mark its last key */
+        s = s->parent;
+        if (!iswhite(s))  /* parent already marked? */
+          break;
+        set2black(s);
+      }
+      break;
+    }
     case SOL_VUPVAL: {
       UpVal *uv = gco2upv(o);
       if (upisopen(uv))
@@ -445,9 +531,9 @@ static void genlink (global_State *g, GCObject *o) {
 */
 static void traverseweakvalue (global_State *g, Table *h) {
   Node *n, *limit = gnodelast(h);
-  /* if there is array part, assume it may have white values (it is not
-     worth traversing it now just to check) */
-  int hasclears = (h->alimit > 0);
+  /* if there is array part or there are slots, assume they may have
+     white values (it is not worth traversing them now just to check) */
+  int hasclears = (h->alimit > 0 && !isnumarray(h)) || nslots(h) > 0;
   for (n = gnode(h, 0); n < limit; n++) {  /* traverse hash part */
     if (isempty(gval(n)))  /* entry is empty? */
       clearkey(n);  /* clear its key */
@@ -482,13 +568,22 @@ static int traverseephemeron (global_State *g, Table *h, int inv) {
   int hasclears = 0;  /* true if table has white keys */
   int hasww = 0;  /* true if table has entry "white-key -> white-value" */
   unsigned int i;
-  unsigned int asize = solH_realasize(h);
+  unsigned int asize = gcasize(h);
   unsigned int nsize = sizenode(h);
+  unsigned int ns = nslots(h);
   /* traverse array part */
   for (i = 0; i < asize; i++) {
-    if (valiswhite(&h->array[i])) {
+    GCObject *o = arraygcvalueN(h, i);
+    if (o != NULL && iswhite(o)) {
+      marked = 1;
+      reallymarkobject(g, o);
+    }
+  }
+  /* traverse slots (their keys are strings, which are never cleared) */
+  for (i = 0; i < ns; i++) {
+    if (valiswhite(&h->slots[i])) {
       marked = 1;
-      reallymarkobject(g, gcvalue(&h->array[i]));
+      reallymarkobject(g, gcvalue(&h->slots[i]));
     }
   }
   /* traverse hash part; if 'inv', traverse descending
@@ -523,9 +618,14 @@ static int traverseephemeron (global_State *g, Table *h, int inv) {
 static void traversestrongtable (global_State *g, Table *h) {
   Node *n, *limit = gnodelast(h);
   unsigned int i;
-  unsigned int asize = solH_realasize(h);
-  for (i = 0; i < asize; i++)  /* traverse array part */
-    markvalue(g, &h->array[i]);
+  unsigned int asize = gcasize(h);
+  unsigned int ns = nslots(h);
+  for (i = 0; i < asize; i++) {  /* traverse array part */
+    GCObject *o = arraygcvalueN(h, i);
+    markobjectN(g, o);
+  }
+  for (i = 0; i < ns; i++)  /* traverse slots */
+    markvalue(g, &h->slots[i]);
   for (n = gnode(h, 0); n < limit; n++) {  /* traverse hash part */
     if (isempty(gval(n)))  /* entry is empty? */
       clearkey(n);  /* clear its key */
@@ -544,6 +644,8 @@ static lu_mem traversetable (global_State *g, Table *h) {
   const TValue *mode = gfasttm(g, h->metatable, TM_MODE);
   TString *smode;
   markobjectN(g, h->metatable);
+  if (isshaped(h))
+    markobject(g, tshape(h));
   if (mode && ttisshrstring(mode) &&  /* is there a weak mode? */
       (cast_void(smode = tsvalue(mode)),
        cast_void(weakkey = strchr(getshrstr(smode), 'k')),
@@ -558,7 +660,7 @@ static lu_mem traversetable (global_State *g, Table *h) {
   }
   else  /* not weak */
     traversestrongtable(g, h);
-  return 1 + h->alimit + 2 * allocsizenode(h);
+  return 1 + h->alimit + nslots(h) + 2 * allocsizenode(h);
 }
 
 
@@ -673,8 +775,17 @@ static lu_mem propagatemark (global_State *g) {
 }
 
 
+/*
+** Traverse all gray objects. In the atomic phase of the incremental
+** collector, this can be done by several threads (see 'parpropagate').
+*/
 static lu_mem propagateall (global_State *g) {
   lu_mem tot = 0;
+#if SOL_USE_PARMARK
+  if (g->markpool != NULL && g->gcstate == GCSatomic &&
+      g->gckind == KGC_INC)
+    return parpropagate(g);
+#endif
   while (g->gray)
     tot += propagatemark(g);
   return tot;
@@ -712,6 +823,558 @@ static void convergeephemerons (global_State *g) {
 /* }====================================================== */
 
 
+/*
+** {======================================================
+** Parallel marking
+** =======================================================
+*/
+
+#if SOL_USE_PARMARK
+
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stddef.h>
+
+
+/*
+** Size of the work queue of each marker (must be a power of 2). Gray
+** objects that do not fit in the queue go to a private overflow list.
+*/
+#if !defined(MARKQSIZE)
+#define MARKQSIZE	4096
+#endif
+
+
+/*
+** Work-stealing queue (Chase-Lev deque with a fixed buffer). Only its
+** owner pushes and pops at 'bottom'; other markers steal at 'top'.
+*/
+typedef struct MarkQueue {
+  GCObject **buff;
+  long top;
+  long bottom;
+} MarkQueue;
+
+
+typedef struct Marker {
+  MarkQueue q;
+  GCObject *overflow;  /* gray objects that did not fit in 'q' */
+  GCObject *deferred;  /* gray objects left to the main thread */
+  lu_mem work;  /* work done in the current phase */
+  struct MarkPool *pool;
+  int id;
+  pthread_t thread;
+  char pad[64];  /* keep markers in different cache lines */
+} Marker;
+
+
+/*
+** The main thread is marker 0; the other markers are helper threads,
+** which sleep on 'start' between phases.
+*/
+typedef struct MarkPool {
+  pthread_mutex_t lock;
+  pthread_cond_t start;  /* signals a new phase to helpers */
+  pthread_cond_t done;  /* signals the end of all helpers */
+  unsigned int phase;  /* number of the current phase */
+  int running;  /* number of helpers still marking in this phase */
+  int quit;  /* true when helpers must exit */
+  int idle;  /* number of markers out of work (atomic) */
+  int n;  /* number of markers */
+  size_t size;  /* size of this block */
+  Marker m[1];  /* markers (variable size) */
+} MarkPool;
+
+
+#define qload(x)	__atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define qstore(x,v)	__atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+#define qfence()	__atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define qcas(x,e,v)  \
+	__atomic_compare_exchange_n(&(x), &(e), (v), 0, \
+	                            __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)
+
+#define qslot(q,i)	((q)->buff[(i) & (MARKQSIZE - 1)])
+
+#define qsize(q)	(qload((q)->bottom) - qload((q)->top))
+
+
+static int qpush (MarkQueue *q, GCObject *o) {
+  long b = __atomic_load_n(&q->bottom, __ATOMIC_RELAXED);
+  if (b - qload(q->top) >= MARKQSIZE)
+    return 0;  /* queue is full */
+  __atomic_store_n(&qslot(q, b), o, __ATOMIC_RELAXED);
+  qstore(q->bottom, b + 1);
+  return 1;
+}
+
+
+static GCObject *qpop (MarkQueue *q) {
+  long b = __atomic_load_n(&q->bottom, __ATOMIC_RELAXED) - 1;
+  long t;
+  GCObject *o;
+  __atomic_store_n(&q->bottom, b, __ATOMIC_RELAXED);
+  qfence();
+  t = __atomic_load_n(&q->top, __ATOMIC_RELAXED);
+  if (t > b) {  /* queue is empty? */
+    __atomic_store_n(&q->bottom, b + 1, __ATOMIC_RELAXED);
+    return NULL;
+  }
+  o = __atomic_load_n(&qslot(q, b), __ATOMIC_RELAXED);
+  if (t == b) {  /* last element? race with thieves for it */
+    if (!qcas(q->top, t, t + 1))
+      o = NULL;  /* a thief got it */
+    __atomic_store_n(&q->bottom, b + 1, __ATOMIC_RELAXED);
+  }
+  return o;
+}
+
+
+static GCObject *qsteal (MarkQueue *q) {
+  long t = qload(q->top);
+  long b;
+  qfence();
+  b = qload(q->bottom);
+  if (t < b) {  /* not empty? */
+    GCObject *o = __atomic_load_n(&qslot(q, t), __ATOMIC_RELAXED);
+    if (qcas(q->top, t, t + 1))
+      return o;
+  }
+  return NULL;  /* empty, or lost the race */
+}
+
+
+static void pushwork (Marker *mk, GCObject *o) {
+  if (!qpush(&mk->q, o)) {  /* queue is full? */
+    *getgclist(o) = mk->overflow;
+    mk->overflow = o;
+  }
+}
+
+
+static GCObject *popwork (Marker *mk) {
+  GCObject *o = qpop(&mk->q);
+  if (o == NULL && (o = mk->overflow) != NULL) {
+    GCObject *next;
+    mk->overflow = *getgclist(o);
+    /* refill the queue, where other markers can steal from; an object
+       can be stolen (and relinked) as soon as it is pushed, so it must
+       leave the overflow list before that */
+    while ((next = mk->overflow) != NULL) {
+      GCObject *rest = *getgclist(next);
+      if (!qpush(&mk->q, next))
+        break;
+      mk->overflow = rest;
+    }
+  }
+  return o;
+}
+
+
+/*
+** Mark bits may be changed by several markers at the same time, so
+** they are accessed atomically (see 'getmarked'). Any other field of
+** an object is either only read during the atomic phase or written
+** only by the marker that owns the object (the one that turned it
+** gray).
+*/
+#define pnw2black(o)  \
+  __atomic_or_fetch(&(o)->marked, cast_byte(bitmask(BLACKBIT)), \
+                    __ATOMIC_RELAXED)
+
+#define pmarkobject(mk,t)  \
+  { if (getmarked(t) & WHITEBITS) pmark(mk, obj2gco(t)); }
+
+#define pmarkobjectN(mk,t)	{ if (t) pmarkobject(mk,t); }
+
+#define pmarkvalue(mk,o)  \
+  { if (iscollectable(o)) pmarkobject(mk, gcvalue(o)); }
+
+#define pmarkkey(mk,n)  \
+  { if (keyiscollectable(n)) pmarkobject(mk, gckey(n)); }
+
+
+/*
+** Turn a white object gray (or black, if 'black'). Returns false if
+** the object was not white, that is, another marker got it first.
+*/
+static int claim (GCObject *o, int black) {
+  lu_byte m = getmarked(o);
+  while (m & WHITEBITS) {
+    lu_byte nm = cast_byte((m & ~maskcolors) |
+                           (black ? bitmask(BLACKBIT) : 0));
+    if (__atomic_compare_exchange_n(&o->marked, &m, nm, 1,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      return 1;
+  }
+  return 0;
+}
+
+
+/*
+** Same as 'reallymarkobject', but objects to be visited go to the
+** marker's queue instead of the gray list.
+*/
+static void pmark (Marker *mk, GCObject *o) {
+  switch (o->tt) {
+    case SOL_VSHRSTR: {
+      claim(o, 1);
+      break;
+    }
+    case SOL_VLNGSTR: {
+      TString *ts = gco2ts(o);
+      if (!claim(o, 1))
+        break;
+      while (isrope(ts) || isslice(ts)) {
+        if (isrope(ts))
+          pmarkobject(mk, ts->right);
+        ts = ts->left;
+        if (!claim(obj2gco(ts), 1))  /* piece already marked? */
+          break;
+      }
+      break;
+    }
+    case SOL_VSHAPE: {
+      Shape *s = gco2shape(o);
+      if (!claim(o, 1))
+        break;
+      while (s->parent != NULL) {  /* not the root shape? */
+        pmarkobject(mk, s->keys[s->nfields - 1]);
+        s = s->parent;
+        if (!claim(obj2gco(s), 1))  /* parent already marked? */
+          break;
+      }
+      break;
+    }
+    case SOL_VUPVAL: {
+      UpVal *uv = gco2upv(o);
+      if (claim(o, !upisopen(uv)))  /* open upvalues are kept gray */
+        pmarkvalue(mk, uv->v.p);
+      break;
+    }
+    case SOL_VUSERDATA: {
+      Udata *u = gco2u(o);
+      if (u->nuvalue == 0) {  /* no user values? */
+        if (claim(o, 1))
+          pmarkobjectN(mk, u->metatable);
+        break;
+      }
+      /* else... */
+    }  /* FALLTHROUGH */
+    case SOL_VLCL: case SOL_VCCL: case SOL_VTABLE:
+    case SOL_VTHREAD: case SOL_VPROTO: {
+      if (claim(o, 0))
+        pushwork(mk, o);  /* to be visited later */
+      break;
+    }
+    default: sol_assert(0); break;
+  }
+}
+
+
+/*
+** Traverse a table that is not weak. (In incremental mode there are
+** no touched objects, so there is nothing to do for 'genlink'.)
+*/
+static lu_mem ptraversetable (Marker *mk, Table *h) {
+  Node *n, *limit = gnodelast(h);
+  unsigned int i;
+  unsigned int asize = gcasize(h);
+  unsigned int ns = nslots(h);
+  pmarkobjectN(mk, h->metatable);
+  if (isshaped(h))
+    pmarkobject(mk, tshape(h));
+  for (i = 0; i < asize; i++) {  /* traverse array part */
+    GCObject *o = arraygcvalueN(h, i);
+    pmarkobjectN(mk, o);
+  }
+  for (i = 0; i < ns; i++)  /* traverse slots */
+    pmarkvalue(mk, &h->slots[i]);
+  for (n = gnode(h, 0); n < limit; n++) {  /* traverse hash part */
+    if (isempty(gval(n)))  /* entry is empty? */
+      clearkey(n);  /* clear its key */
+    else {
+      sol_assert(!keyisnil(n));
+      pmarkkey(mk, n);
+      pmarkvalue(mk, gval(n));
+    }
+  }
+  return 1 + h->alimit + ns + 2 * allocsizenode(h);
+}
+
+
+static lu_mem ptraverseudata (Marker *mk, Udata *u) {
+  int i;
+  pmarkobjectN(mk, u->metatable);
+  for (i = 0; i < u->nuvalue; i++)
+    pmarkvalue(mk, &u->uv[i].uv);
+  return 1 + u->nuvalue;
+}
+
+
+static lu_mem ptraverseproto (Marker *mk, Proto *f) {
+  int i;
+  pmarkobjectN(mk, f->source);
+  for (i = 0; i < f->sizek; i++)
+    pmarkvalue(mk, &f->k[i]);
+  for (i = 0; i < f->sizeupvalues; i++)
+    pmarkobjectN(mk, f->upvalues[i].name);
+  for (i = 0; i < f->sizep; i++)
+    pmarkobjectN(mk, f->p[i]);
+  for (i = 0; i < f->sizelocvars; i++)
+    pmarkobjectN(mk, f->locvars[i].varname);
+  return 1 + f->sizek + f->sizeupvalues + f->sizep + f->sizelocvars;
+}
+
+
+static lu_mem ptraverseCclosure (Marker *mk, CClosure *cl) {
+  int i;
+  for (i = 0; i < cl->nupvalues; i++)
+    pmarkvalue(mk, &cl->upvalue[i]);
+  return 1 + cl->nupvalues;
+}
+
+
+static lu_mem ptraverseLclosure (Marker *mk, LClosure *cl) {
+  int i;
+  pmarkobjectN(mk, cl->p);
+  for (i = 0; i < cl->nupvalues; i++)
+    pmarkobjectN(mk, cl->upvals[i]);
+  return 1 + cl->nupvalues;
+}
+
+
+/*
+** Traverse a gray object owned by marker 'mk'. Threads, and tables
+** whose metatable has not cached the absence of '__mode' (which may
+** be weak), have traversals with side effects on the global state;
+** they are deferred to the main thread.
+*/
+static lu_mem ptraverse (Marker *mk, GCObject *o) {
+  switch (o->tt) {
+    case SOL_VTABLE: {
+      Table *h = gco2t(o);
+      Table *mt = h->metatable;
+      if (mt == NULL || (mt->flags & bitmask(TM_MODE))) {  /* not weak? */
+        pnw2black(o);
+        return ptraversetable(mk, h);
+      }
+      break;
+    }
+    case SOL_VUSERDATA:
+      pnw2black(o); return ptraverseudata(mk, gco2u(o));
+    case SOL_VLCL:
+      pnw2black(o); return ptraverseLclosure(mk, gco2lcl(o));
+    case SOL_VCCL:
+      pnw2black(o); return ptraverseCclosure(mk, gco2ccl(o));
+    case SOL_VPROTO:
+      pnw2black(o); return ptraverseproto(mk, gco2p(o));
+    default: break;
+  }
+  *getgclist(o) = mk->deferred;  /* leave it to the main thread */
+  mk->deferred = o;
+  return 0;
+}
+
+
+/*
+** Steal an object from some other marker. Markers without work count
+** themselves in 'idle'; as only markers with work can create more
+** work, marking is over when all markers are idle.
+*/
+static int stealwork (MarkPool *p, Marker *mk) {
+  __atomic_add_fetch(&p->idle, 1, __ATOMIC_SEQ_CST);
+  for (;;) {
+    int i;
+    for (i = 1; i < p->n; i++) {
+      MarkQueue *q = &p->m[(mk->id + i) % p->n].q;
+      if (qsize(q) > 0) {  /* victim seems to have some work? */
+        GCObject *o;
+        __atomic_sub_fetch(&p->idle, 1, __ATOMIC_SEQ_CST);
+        if ((o = qsteal(q)) != NULL) {
+          qpush(&mk->q, o);  /* (own queue is empty) */
+          return 1;
+        }
+        __atomic_add_fetch(&p->idle, 1, __ATOMIC_SEQ_CST);
+      }
+    }
+    if (__atomic_load_n(&p->idle, __ATOMIC_SEQ_CST) == p->n)
+      return 0;  /* nobody has work */
+    sched_yield();
+  }
+}
+
+
+static void markloop (MarkPool *p, Marker *mk) {
+  GCObject *o;
+  do {
+    while ((o = popwork(mk)) != NULL)
+      mk->work += ptraverse(mk, o);
+  } while (stealwork(p, mk));
+}
+
+
+static void *helpermain (void *ud) {
+  Marker *mk = cast(Marker *, ud);
+  MarkPool *p = mk->pool;
+  unsigned int phase = 0;
+  pthread_mutex_lock(&p->lock);
+  for (;;) {
+    while (p->phase == phase && !p->quit)
+      pthread_cond_wait(&p->start, &p->lock);
+    if (p->quit)
+      break;
+    phase = p->phase;
+    pthread_mutex_unlock(&p->lock);
+    markloop(p, mk);
+    pthread_mutex_lock(&p->lock);
+    if (--p->running == 0)
+      pthread_cond_signal(&p->done);
+  }
+  pthread_mutex_unlock(&p->lock);
+  return NULL;
+}
+
+
+/*
+** Run one parallel phase: the main thread marks as marker 0 and then
+** waits for all helpers to run out of work.
+*/
+static void runphase (MarkPool *p) {
+  int i;
+  for (i = 0; i < p->n; i++)
+    p->m[i].work = 0;
+  p->idle = 0;
+  pthread_mutex_lock(&p->lock);
+  p->phase++;
+  p->running = p->n - 1;
+  pthread_cond_broadcast(&p->start);
+  pthread_mutex_unlock(&p->lock);
+  markloop(p, &p->m[0]);
+  pthread_mutex_lock(&p->lock);
+  while (p->running > 0)
+    pthread_cond_wait(&p->done, &p->lock);
+  pthread_mutex_unlock(&p->lock);
+}
+
+
+/*
+** Propagate marks with all markers, spreading the gray list over
+** their queues. Deferred objects are then traversed by the main
+** thread; whatever they mark goes to another parallel phase.
+*/
+static lu_mem parpropagate (global_State *g) {
+  MarkPool *p = g->markpool;
+  lu_mem work = 0;
+  while (g->gray != NULL) {
+    GCObject *o;
+    int i = 0;
+    while ((o = g->gray) != NULL) {  /* distribute gray objects */
+      g->gray = *getgclist(o);
+      pushwork(&p->m[i], o);
+      i = (i + 1) % p->n;
+    }
+    runphase(p);
+    for (i = 0; i < p->n; i++) {
+      Marker *mk = &p->m[i];
+      work += mk->work;
+      while ((o = mk->deferred) != NULL) {
+        mk->deferred = *getgclist(o);
+        *getgclist(o) = g->gray;  /* 'propagatemark' takes it from there */
+        g->gray = o;
+        work += propagatemark(g);
+      }
+    }
+  }
+  return work;
+}
+
+
+void solC_freemarkers (sol_State *L) {
+  global_State *g = G(L);
+  MarkPool *p = g->markpool;
+  if (p != NULL) {
+    int i;
+    pthread_mutex_lock(&p->lock);
+    p->quit = 1;
+    pthread_cond_broadcast(&p->start);
+    pthread_mutex_unlock(&p->lock);
+    for (i = 1; i < p->n; i++)
+      pthread_join(p->m[i].thread, NULL);
+    pthread_cond_destroy(&p->done);
+    pthread_cond_destroy(&p->start);
+    pthread_mutex_destroy(&p->lock);
+    g->markpool = NULL;
+    solM_freemem(L, p, p->size);
+  }
+}
+
+
+/*
+** Create a pool with 'n' markers. Helpers run with all signals
+** blocked, so that signals go to the application threads. If some
+** helper cannot be created, the pool works with fewer markers.
+*/
+static void newpool (sol_State *L, int n) {
+  size_t msize = offsetof(MarkPool, m) + cast_sizet(n) * sizeof(Marker);
+  size_t size = msize + cast_sizet(n) * MARKQSIZE * sizeof(GCObject *);
+  MarkPool *p = cast(MarkPool *, solM_malloc_(L, size, 0));
+  GCObject **buff = cast(GCObject **, cast_charp(p) + msize);
+  sigset_t all, old;
+  int i;
+  p->size = size;
+  p->phase = 0;
+  p->running = p->quit = p->idle = 0;
+  p->n = 1;  /* main thread */
+  pthread_mutex_init(&p->lock, NULL);
+  pthread_cond_init(&p->start, NULL);
+  pthread_cond_init(&p->done, NULL);
+  for (i = 0; i < n; i++) {
+    Marker *mk = &p->m[i];
+    mk->q.buff = buff + i * MARKQSIZE;
+    mk->q.top = mk->q.bottom = 0;
+    mk->overflow = mk->deferred = NULL;
+    mk->work = 0;
+    mk->pool = p;
+    mk->id = i;
+  }
+  G(L)->markpool = p;
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  for (i = 1; i < n; i++) {
+    if (pthread_create(&p->m[i].thread, NULL, helpermain, &p->m[i]) != 0)
+      break;
+    p->n++;
+  }
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  if (p->n == 1)  /* no helpers? */
+    solC_freemarkers(L);
+}
+
+
+/*
+** Set the number of threads that mark in the atomic phase of the
+** incremental collector (1 means no parallel marking). Returns the
+** previous number; 'n' < 1 only queries it.
+*/
+int solC_setmarkers (sol_State *L, int n) {
+  global_State *g = G(L);
+  int old = (g->markpool != NULL) ? g->markpool->n : 1;
+  if (n > SOLI_MAXMARKERS)
+    n = SOLI_MAXMARKERS;
+  if (n >= 1 && n != old) {
+    solC_freemarkers(L);
+    if (n > 1)
+      newpool(L, n);
+  }
+  return old;
+}
+
+#endif
+
+/* }====================================================== */
+
+
 /*
 ** {======================================================
 ** Sweep Functions
@@ -746,11 +1409,15 @@ static void clearbyvalues (global_State *g, GCObject *l, GCObject *f) {
     Table *h = gco2t(l);
     Node *n, *limit = gnodelast(h);
     unsigned int i;
-    unsigned int asize = solH_realasize(h);
+    unsigned int asize = gcasize(h);
+    unsigned int ns = nslots(h);
     for (i = 0; i < asize; i++) {
-      TValue *o = &h->array[i];
-      if (iscleared(g, gcvalueN(o)))  /* value was collected? */
-        setempty(o);  /* remove entry */
+      if (iscleared(g, arraygcvalueN(h, i)))  /* value was collected? */
+        *arraytag(h, i) = SOL_VEMPTY;  /* remove entry */
+    }
+    for (i = 0; i < ns; i++) {
+      if (iscleared(g, gcvalueN(&h->slots[i])))  /* value was collected? */
+        setempty(&h->slots[i]);  /* remove entry (but keep its slot) */
     }
     for (n = gnode(h, 0); n < limit; n++) {
       if (iscleared(g, gcvalueN(gval(n))))  /* unmarked value? */
@@ -790,6 +1457,9 @@ static void freeobj (sol_State *L, GCObject *o) {
     case SOL_VTABLE:
       solH_free(L, gco2t(o));
       break;
+    case SOL_VSHAPE:
+      solR_free(L, gco2shape(o));
+      break;
     case SOL_VTHREAD:
       solE_freethread(L, gco2th(o));
       break;
@@ -805,8 +1475,7 @@ static void freeobj (sol_State *L, GCObject *o) {
       break;
     }
     case SOL_VLNGSTR: {
-      TString *ts = gco2ts(o);
-      solM_freemem(L, ts, sizelstring(ts->u.lnglen));
+      solS_freelngstr(L, gco2ts(o));
       break;
     }
     default: sol_assert(0);
@@ -859,6 +1528,320 @@ static GCObject **sweeptolive (sol_State *L, GCObject **p) {
 /* }====================================================== */
 
 
+/*
+** {======================================================
+** Background sweeping
+** =======================================================
+*/
+
+#if SOL_USE_BGSWEEP
+
+#include <pthread.h>
+#include <signal.h>
+
+
+/*
+** When enabled, the incremental collector hands its 'allgc' list to a
+** background thread at the end of the atomic phase. The sweeper makes
+** live objects white and frees dead objects that nobody else can
+** reach: tables, closures, userdata (objects with finalizers are in
+** other lists), and long strings. It uses a private state to free
+** them, so that the allocation function is the only thing shared
+** with the mutator (which therefore must be thread safe). Everything
+** else goes to a 'left' list for the mutator: upvalues (whose marks
+** the mutator changes when closing them) and dead strings, shapes,
+** threads, prototypes, and external strings, which are in global
+** structures or whose release has side effects. Meanwhile, the
+** mutator allocates into a new 'allgc' list and barriers do nothing,
+** as they only try to avoid further barriers in the sweep phase.
+*/
+
+
+/* states of the sweeper thread */
+#define SWIDLE		0	/* waiting for work */
+#define SWBUSY		1	/* sweeping */
+#define SWDONE		2	/* results not collected yet */
+#define SWQUIT		3	/* thread must exit */
+
+
+typedef struct Sweeper {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  pthread_t thread;
+  int state;  /* state of the thread (see above) */
+  int running;  /* true while the sweeper owns old objects */
+  lu_byte white;  /* current white */
+  lu_byte ow;  /* white of dead objects */
+  GCObject *list;  /* objects to be swept */
+  GCObject *kept;  /* live objects, already white */
+  GCObject **keptend;  /* end of 'kept' list */
+  GCObject *left;  /* objects to be swept by the mutator */
+  sol_State L;  /* private state used to free objects */
+  global_State g;  /* its allocator and freed bytes (as 'GCdebt') */
+} Sweeper;
+
+
+static int sweeperrunning (global_State *g) {
+  return (g->sweeper != NULL && g->sweeper->running);
+}
+
+
+/* true while 'allgc' is being swept with the sweeper */
+#define bgsweeping(g)  \
+	((g)->sweeper != NULL && \
+	 ((g)->sweeper->running || (g)->sweeper->left != NULL))
+
+
+static int bgfreeable (GCObject *o) {
+  switch (o->tt) {
+    case SOL_VTABLE: case SOL_VLCL: case SOL_VCCL: case SOL_VUSERDATA:
+      return 1;
+    case SOL_VLNGSTR:
+      return (gco2ts(o)->shrlen != LSTREXT);
+    default:
+      return 0;
+  }
+}
+
+
+static void bgsweep (Sweeper *sw) {
+  GCObject *curr, *next;
+  GCObject **kept = &sw->kept;
+  GCObject **left = &sw->left;
+  for (curr = sw->list; curr != NULL; curr = next) {
+    next = curr->next;
+    if (curr->tt == SOL_VUPVAL) {  /* leave it to the mutator */
+      *left = curr;
+      left = &curr->next;
+    }
+    else {
+      lu_byte marked = getmarked(curr);
+      if (!isdeadm(sw->ow, marked)) {  /* change mark to 'white' */
+        __atomic_store_n(&curr->marked,
+                         cast_byte((marked & ~maskgcbits) | sw->white),
+                         __ATOMIC_RELAXED);
+        *kept = curr;
+        kept = &curr->next;
+      }
+      else if (bgfreeable(curr))
+        freeobj(&sw->L, curr);
+      else {
+        *left = curr;
+        left = &curr->next;
+      }
+    }
+  }
+  *kept = *left = NULL;
+  sw->keptend = kept;
+}
+
+
+static void *sweepermain (void *ud) {
+  Sweeper *sw = cast(Sweeper *, ud);
+  pthread_mutex_lock(&sw->lock);
+  for (;;) {
+    while (sw->state == SWIDLE || sw->state == SWDONE)
+      pthread_cond_wait(&sw->cond, &sw->lock);
+    if (sw->state == SWQUIT)
+      break;
+    pthread_mutex_unlock(&sw->lock);
+    bgsweep(sw);
+    pthread_mutex_lock(&sw->lock);
+    __atomic_store_n(&sw->state, SWDONE, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&sw->cond);
+  }
+  pthread_mutex_unlock(&sw->lock);
+  return NULL;
+}
+
+
+/*
+** Hand the 'allgc' list to the sweeper.
+*/
+static void startsweeper (global_State *g) {
+  Sweeper *sw = g->sweeper;
+  sol_assert(!sw->running && sw->left == NULL);
+  sw->list = g->allgc;
+  g->allgc = NULL;
+  sw->white = solC_white(g);
+  sw->ow = cast_byte(otherwhite(g));
+  sw->g.frealloc = g->frealloc;
+  sw->g.ud = g->ud;
+  sw->g.GCdebt = 0;
+  sw->running = 1;
+  pthread_mutex_lock(&sw->lock);
+  sw->state = SWBUSY;
+  pthread_cond_broadcast(&sw->cond);
+  pthread_mutex_unlock(&sw->lock);
+}
+
+
+/*
+** Collect the results of the sweeper: live objects go back to the end
+** of 'allgc', after the objects created meanwhile (so that the main
+** thread is still its last element), and freed memory is discounted.
+*/
+static void joinsweeper (global_State *g) {
+  Sweeper *sw = g->sweeper;
+  GCObject **p = &g->allgc;
+  while (*p != NULL)  /* find the end of 'allgc' */
+    p = &(*p)->next;
+  *p = sw->kept;
+  g->GCdebt += sw->g.GCdebt;
+  g->GCestimate += sw->g.GCdebt;
+  sw->running = 0;  /* (thread stays in SWDONE until next start) */
+}
+
+
+/*
+** Wait for the sweeper to finish, if it is running.
+*/
+void solC_waitsweeper (sol_State *L) {
+  global_State *g = G(L);
+  Sweeper *sw = g->sweeper;
+  if (sw != NULL && sw->running) {
+    pthread_mutex_lock(&sw->lock);
+    while (sw->state != SWDONE)
+      pthread_cond_wait(&sw->cond, &sw->lock);
+    pthread_mutex_unlock(&sw->lock);
+    joinsweeper(g);
+  }
+}
+
+
+/*
+** Sweep objects left by the sweeper, moving live ones back to 'allgc'.
+** Returns the number of objects swept.
+*/
+static int sweepleft (sol_State *L, Sweeper *sw, int countin) {
+  global_State *g = G(L);
+  int ow = otherwhite(g);
+  int white = solC_white(g);
+  int i;
+  for (i = 0; sw->left != NULL && i < countin; i++) {
+    GCObject *curr = sw->left;
+    int marked = curr->marked;
+    sw->left = curr->next;
+    if (isdeadm(ow, marked))
+      freeobj(L, curr);
+    else {
+      curr->marked = cast_byte((marked & ~maskgcbits) | white);
+      curr->next = g->allgc;
+      g->allgc = curr;
+    }
+  }
+  return i;
+}
+
+
+/*
+** Sweep step for 'allgc' while the sweeper has work: check whether it
+** has finished and then sweep what it left. While it runs, the step
+** counts as the work the sweeper is doing.
+*/
+static int bgsweepstep (sol_State *L, global_State *g) {
+  Sweeper *sw = g->sweeper;
+  if (sw->running) {
+    if (__atomic_load_n(&sw->state, __ATOMIC_ACQUIRE) != SWDONE)
+      return GCSWEEPMAX;
+    joinsweeper(g);
+  }
+  if (sw->left != NULL) {
+    l_mem olddebt = g->GCdebt;
+    int count = sweepleft(L, sw, GCSWEEPMAX);
+    g->GCestimate += g->GCdebt - olddebt;  /* update estimate */
+    return count;
+  }
+  else {  /* enter next state */
+    g->gcstate = GCSswpfinobj;
+    g->sweepgc = &g->finobj;
+    return 0;
+  }
+}
+
+
+/*
+** Finish everything pending from the sweeper.
+*/
+static void finishsweeper (sol_State *L) {
+  Sweeper *sw = G(L)->sweeper;
+  if (sw != NULL) {
+    solC_waitsweeper(L);
+    while (sw->left != NULL)
+      sweepleft(L, sw, MAX_INT);
+  }
+}
+
+
+void solC_freesweeper (sol_State *L) {
+  global_State *g = G(L);
+  Sweeper *sw = g->sweeper;
+  if (sw != NULL) {
+    finishsweeper(L);
+    pthread_mutex_lock(&sw->lock);
+    sw->state = SWQUIT;
+    pthread_cond_broadcast(&sw->cond);
+    pthread_mutex_unlock(&sw->lock);
+    pthread_join(sw->thread, NULL);
+    pthread_cond_destroy(&sw->cond);
+    pthread_mutex_destroy(&sw->lock);
+    g->sweeper = NULL;
+    solM_free(L, sw);
+  }
+}
+
+
+/*
+** Turn background sweeping on (if 'on' > 0) or off (if 'on' == 0).
+** Returns whether it was on, or -1 if it cannot be turned on because
+** the allocation function is not declared thread safe (see
+** 'sol_setallocsafe').
+*/
+int solC_setsweeper (sol_State *L, int on) {
+  global_State *g = G(L);
+  int old = (g->sweeper != NULL);
+  if (on == 0)
+    solC_freesweeper(L);
+  else if (on > 0 && !old) {
+    if (!g->allocsafe)  /* sweeper would call 'frealloc' concurrently? */
+      return -1;
+    Sweeper *sw = solM_new(L, Sweeper);
+    sigset_t all, oldmask;
+    int res;
+    sw->state = SWIDLE;
+    sw->running = 0;
+    sw->list = sw->kept = sw->left = NULL;
+    sw->keptend = &sw->kept;
+    sw->L.l_G = &sw->g;
+    pthread_mutex_init(&sw->lock, NULL);
+    pthread_cond_init(&sw->cond, NULL);
+    sigfillset(&all);  /* sweeper runs with all signals blocked */
+    pthread_sigmask(SIG_SETMASK, &all, &oldmask);
+    res = pthread_create(&sw->thread, NULL, sweepermain, sw);
+    pthread_sigmask(SIG_SETMASK, &oldmask, NULL);
+    if (res == 0)
+      g->sweeper = sw;
+    else {  /* cannot create thread; keep sweeping in the mutator */
+      pthread_cond_destroy(&sw->cond);
+      pthread_mutex_destroy(&sw->lock);
+      solM_free(L, sw);
+    }
+  }
+  return old;
+}
+
+#else
+
+#define startsweeper(g)		((void)0)
+#define bgsweeping(g)		0
+#define bgsweepstep(L,g)	0
+#define finishsweeper(L)	((void)0)
+
+#endif
+
+/* }====================================================== */
+
+
 /*
 ** {======================================================
 ** Finalization
@@ -1018,10 +2001,14 @@ static void correctpointers (global_State *g, GCObject *o) {
 */
 void solC_checkfinalizer (sol_State *L, GCObject *o, Table *mt) {
   global_State *g = G(L);
-  if (tofinalize(o) ||                 /* obj. is already marked... */
-      gfasttm(g, mt, TM_GC) == NULL ||    /* or has no finalizer... */
+  if (gfasttm(g, mt, TM_GC) == NULL ||    /* obj. has no finalizer... */
       (g->gcstp & GCSTPCLS))                   /* or closing state? */
     return;  /* nothing to be done */
+  solC_waitsweeper(L);  /* 'o' may be with the sweeper */
+  if (tofinalize(o))  /* obj. is already marked? */
+    return;  /* nothing to be done */
+  else if (isfrozen(o))  /* frozen objects stay in their list */
+    l_setbit(o->marked, FINALIZEDBIT);  /* (see 'thawall') */
   else {  /* move 'o' to 'finobj' list */
     GCObject **p;
     if (issweepphase(g)) {
@@ -1181,6 +2168,8 @@ static GCObject **correctgraylist (GCObject **p) {
       changeage(curr, G_TOUCHED1, G_TOUCHED2);
       goto remain;  /* keep it in the list and go to next element */
     }
+    else if (getage(curr) == G_FROZEN)
+      goto remove;  /* keep its color (see 'markfrozen') */
     else if (curr->tt == SOL_VTHREAD) {
       sol_assert(isgray(curr));
       goto remain;  /* keep non-white threads on the list */
@@ -1469,6 +2458,168 @@ static void genstep (sol_State *L, global_State *g) {
 /* }====================================================== */
 
 
+/*
+** {======================================================
+** Frozen generation
+** =======================================================
+*/
+
+
+/*
+** Objects in the frozen generation are neither marked nor swept, so
+** the collector neither spends time with them nor writes into them
+** (which keeps their memory pages shared with forked processes).
+** Clean frozen objects are black and point only to frozen objects;
+** the barriers catch any other object stored into them (see
+** 'needbarrier'), which makes the frozen object dirty: it goes to
+** list 'frozendirty' and is traversed at every atomic phase from then
+** on. Threads, which have no barriers, are always dirty. Between
+** traversals, dirty objects are kept gray, out of the gray lists, to
+** avoid more barriers.
+** This spares only frozen objects. All other objects still keep their
+** marks in their headers, which the collector writes at every cycle:
+** there are no side mark bitmaps, not even for states that use the
+** arena of 'solL_newstatex', whose slabs could hold them.
+** List 'frozendirty' comes from the allocation function and is
+** allocated and freed only by the mutator ('solC_freeze' and
+** 'close_state'). The sweeper never sees frozen objects: it gets only
+** 'allgc', and it is done before freezing (at 'GCSpause') and before
+** thawing (in 'solC_freeallobjects').
+** (at 'GCSpause') and before thawing (in 'solC_freeallobjects').
+*/
+
+
+/*
+** Mark again the dirty frozen objects: they become white and are
+** marked as any other object. Clean frozen objects are not touched.
+*/
+static lu_mem markfrozen (global_State *g) {
+  int i;
+  for (i = 0; i < g->nfrozendirty; i++) {
+    GCObject *o = g->frozendirty[i];
+    makewhite(g, o);
+    reallymarkobject(g, o);
+  }
+  return cast(lu_mem, g->nfrozendirty);
+}
+
+
+/*
+** Paint dirty frozen objects gray again after their traversal. (Those
+** left in gray lists are removed from them by 'correctgraylist' in
+** generational mode and are dropped with the lists in incremental
+** mode.)
+*/
+static void regrayfrozen (global_State *g) {
+  int i;
+  for (i = 0; i < g->nfrozendirty; i++)
+    set2gray(g->frozendirty[i]);
+}
+
+
+/*
+** Move objects in list 'p' (up to 'limit') to the frozen generation,
+** returning the pointer to the end of the moved sublist.
+*/
+static GCObject **freezelist (global_State *g, GCObject **p,
+                                               GCObject *limit) {
+  GCObject *curr;
+  for (; (curr = *p) != limit; p = &curr->next) {
+    setage(curr, G_FROZEN);
+    if (curr->tt == SOL_VTHREAD) {  /* threads are always dirty */
+      set2gray(curr);
+      g->frozendirty[g->nfrozendirty++] = curr;
+    }
+    else if (curr->tt == SOL_VUPVAL && upisopen(gco2upv(curr)))
+      set2gray(curr);  /* open upvalues are always gray */
+    else
+      set2black(curr);
+  }
+  return p;
+}
+
+
+/*
+** Collect all garbage and then move all objects, except the main
+** thread, to the frozen generation. This is done in incremental mode,
+** where objects have no ages and there are no pending gray lists.
+** (The second collection frees the objects finalized by the first
+** one.) Finalizers of frozen objects run only when the state is
+** closed. Each frozen object goes to 'frozendirty' at most once, so
+** the list gets a slot for each one that is not a string. (Unused
+** slots are never written.)
+*/
+void solC_freeze (sol_State *L) {
+  global_State *g = G(L);
+  int gen = isdecGCmodegen(g);
+  GCObject *mainth = obj2gco(g->mainthread);
+  GCObject *o;
+  GCObject **p;
+  int n = 0;
+  solC_changemode(L, KGC_INC);
+  solC_fullgc(L, 0);
+  solC_fullgc(L, 0);
+  sol_assert(g->gcstate == GCSpause && g->tobefnz == NULL);
+  for (o = g->allgc; o != mainth; o = o->next)  /* count what can */
+    n += (novariant(o->tt) != SOL_TSTRING);      /* become dirty */
+  for (o = g->finobj; o != NULL; o = o->next)
+    n += (novariant(o->tt) != SOL_TSTRING);
+  if (n > 0) {  /* make room for all of them in 'frozendirty' */
+    int nsize;
+    if (n > MAXFROZENDIRTY - g->sizefrozendirty)
+      solM_toobig(L);
+    nsize = g->sizefrozendirty + n;
+    g->frozendirty = cast(GCObject **,
+        solM_saferealloc_(L, g->frozendirty,
+                          cast_sizet(g->sizefrozendirty) * sizeof(GCObject *),
+                          cast_sizet(nsize) * sizeof(GCObject *)));
+    g->sizefrozendirty = nsize;
+  }
+  /* move 'allgc' but its last element (the main thread) */
+  p = freezelist(g, &g->allgc, mainth);
+  *p = g->frozen;
+  g->frozen = g->allgc;
+  g->allgc = mainth;
+  /* move 'finobj' (which has no threads) */
+  p = freezelist(g, &g->finobj, NULL);
+  *p = g->frozen;
+  g->frozen = g->finobj;
+  g->finobj = NULL;
+  if (gen)
+    solC_changemode(L, KGC_GEN);
+}
+
+
+/*
+** Give all frozen objects back to the regular lists, so that the state
+** can be closed. Objects with finalizers go to the end of 'finobj', as
+** they were marked for finalization before the others.
+*/
+static void thawall (global_State *g) {
+  int white = solC_white(g);
+  GCObject *curr = g->frozen;
+  GCObject **lastnext = findlast(&g->finobj);
+  while (curr != NULL) {
+    GCObject *next = curr->next;
+    curr->marked = cast_byte((curr->marked & ~maskgcbits) | white);
+    if (tofinalize(curr)) {
+      *lastnext = curr;
+      lastnext = &curr->next;
+      curr->next = NULL;
+    }
+    else {
+      curr->next = g->allgc;
+      g->allgc = curr;
+    }
+    curr = next;
+  }
+  g->frozen = NULL;
+  g->nfrozendirty = 0;
+}
+
+/* }====================================================== */
+
+
 /*
 ** {======================================================
 ** GC control
@@ -1487,7 +2638,10 @@ static void entersweep (sol_State *L) {
   global_State *g = G(L);
   g->gcstate = GCSswpallgc;
   sol_assert(g->sweepgc == NULL);
-  g->sweepgc = sweeptolive(L, &g->allgc);
+  if (g->sweeper != NULL && g->gckind == KGC_INC)
+    startsweeper(g);
+  else
+    g->sweepgc = sweeptolive(L, &g->allgc);
 }
 
 
@@ -1511,7 +2665,9 @@ static void deletelist (sol_State *L, GCObject *p, GCObject *limit) {
 void solC_freeallobjects (sol_State *L) {
   global_State *g = G(L);
   g->gcstp = GCSTPCLS;  /* no extra finalizers after here */
+  finishsweeper(L);
   solC_changemode(L, KGC_INC);
+  thawall(g);
   separatetobefnz(g, 1);  /* separate all objects with finalizers */
   sol_assert(g->finobj == NULL);
   callallpendingfinalizers(L);
@@ -1535,6 +2691,7 @@ static lu_mem atomic (sol_State *L) {
   /* registry and global metatables may be changed by API */
   markvalue(g, &g->l_registry);
   markmt(g);  /* mark global metatables */
+  work += markfrozen(g);  /* frozen objects that may point to others */
   work += propagateall(g);  /* empties 'gray' list */
   /* remark occasional upvalues of (maybe) dead threads */
   work += remarkupvals(g);
@@ -1559,6 +2716,7 @@ static lu_mem atomic (sol_State *L) {
   clearbyvalues(g, g->weak, origweak);
   clearbyvalues(g, g->allweak, origall);
   solS_clearcache(g);
+  regrayfrozen(g);
   g->currentwhite = cast_byte(otherwhite(g));  /* flip current white */
   sol_assert(g->gray == NULL);
   return work;  /* estimate of slots marked by 'atomic' */
@@ -1610,7 +2768,10 @@ static lu_mem singlestep (sol_State *L) {
       break;
     }
     case GCSswpallgc: {  /* sweep "regular" objects */
-      work = sweepstep(L, g, GCSswpfinobj, &g->finobj);
+      if (bgsweeping(g))
+        work = bgsweepstep(L, g);
+      else
+        work = sweepstep(L, g, GCSswpfinobj, &g->finobj);
       break;
     }
     case GCSswpfinobj: {  /* sweep objects with finalizers */
@@ -1651,18 +2812,186 @@ static lu_mem singlestep (sol_State *L) {
 */
 void solC_runtilstate (sol_State *L, int statesmask) {
   global_State *g = G(L);
-  while (!testbit(statesmask, g->gcstate))
+  while (!testbit(statesmask, g->gcstate)) {
+    solC_waitsweeper(L);  /* do not poll it */
     singlestep(L);
+  }
 }
 
 
 
+/*
+** {======================================================
+** Time-budgeted steps
+** =======================================================
+*/
+
+
+/*
+** Current time in microseconds. Only differences between readings
+** are used, so wrapping around is harmless. Without a monotonic clock,
+** it uses the processor time, which is what a step takes anyway.
+*/
+#if defined(CLOCK_MONOTONIC)
+
+static lu_mem gcclock (void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return cast(lu_mem, ts.tv_sec) * 1000000 + cast(lu_mem, ts.tv_nsec) / 1000;
+}
+
+#else
+
+static lu_mem gcclock (void) {
+  /* in floating point, as CLOCKS_PER_SEC may be less than 1000 */
+  double c = cast(double, cast(lu_mem, clock()));
+  return cast(lu_mem, c * (1e6 / cast(double, CLOCKS_PER_SEC)));
+}
+
+#endif
+
+
+/*
+** Kind of work the collector is doing, as an index into 'gcrate':
+** marking, sweeping, or calling finalizers. Work units mean different
+** things in each one (bytes traversed, objects swept, finalizers
+** called), so each has its own rate.
+*/
+#define gcphase(g)  \
+	((g)->gcstate <= GCSatomic || (g)->gcstate == GCSpause ? 0 :  \
+	 (g)->gcstate < GCScallfin ? 1 : 2)
+
+
+/*
+** Runs single steps for about 'usec' microseconds, until doing 'goal'
+** units of work, or until the end of the cycle. To read the clock
+** only a few times, it runs the single steps in batches, each one
+** sized to take half the time left at the measured rate of the
+** current phase; a batch also stops when the phase changes, and each
+** batch updates the rate of its phase. A single step cannot be cut,
+** so a step can still take longer than 'usec' (the atomic phase, in
+** particular, is a single step). It also stops when the sweeper
+** thread is working, as polling it would only waste the time. Returns
+** the work done.
+*/
+static l_mem timedsteps (sol_State *L, global_State *g, l_mem usec,
+                                                        l_mem goal) {
+  lu_mem start = gcclock();
+  lu_mem now = start;
+  l_mem work = 0;
+  do {
+    int phase = gcphase(g);
+    l_mem rate = g->gcrate[phase];
+    l_mem left = usec - cast(l_mem, now - start);
+    l_mem batch = (left < MAX_LMEM / rate) ? left * rate / 2000 : MAX_LMEM;
+    l_mem done = 0;
+    lu_mem elapsed;
+    if (batch > goal - work)
+      batch = goal - work;
+    do {
+      done += singlestep(L);
+    } while (done < batch && g->gcstate != GCSpause &&
+             gcphase(g) == phase && !sweeperrunning(g));
+    work += done;
+    elapsed = gcclock() - now;
+    now += elapsed;
+    if (done > 0) {  /* update rate of 'phase' */
+      if (elapsed == 0)  /* too fast to measure? */
+        rate = (rate < MAX_LMEM / 2) ? rate * 2 : MAX_LMEM;
+      else {
+        l_mem actual = (done < MAX_LMEM / 1000)
+                     ? done * 1000 / cast(l_mem, elapsed)
+                     : done / cast(l_mem, elapsed) * 1000;
+        rate = rate / 2 + actual / 2;
+      }
+      g->gcrate[phase] = (rate > 0) ? rate : 1;
+    }
+  } while (work < goal && g->gcstate != GCSpause && !sweeperrunning(g) &&
+           cast(l_mem, now - start) < usec - usec / 8);
+  return work;
+}
+
+
+/*
+** Add a step that took 'usec' microseconds, with a time target
+** 'target' (0 if none), to the statistics.
+*/
+static void addstepstat (global_State *g, lu_mem usec, l_mem target) {
+  sol_GCStepStats *s = &g->gcstats;
+  sol_Integer t = (usec < cast(lu_mem, MAX_INT)) ? cast(sol_Integer, usec)
+                                                 : MAX_INT;
+  int i = solO_ceillog2(cast_uint(t) + 1);
+  s->steps++;
+  if (target > 0 && t > target)
+    s->over++;
+  s->total += t;
+  if (t > s->max)
+    s->max = t;
+  s->last = t;
+  s->hist[(i < SOL_GCSTEPHIST) ? i : SOL_GCSTEPHIST - 1]++;
+}
+
+
+/*
+** Copy the step statistics into 's' or, if 's' is NULL, reset them.
+*/
+void solC_stepstats (global_State *g, sol_GCStepStats *s) {
+  if (s != NULL)
+    *s = g->gcstats;
+  else
+    memset(&g->gcstats, 0, sizeof(g->gcstats));
+}
+
+
+/*
+** Does incremental work for about 'usec' microseconds, for embedders
+** that have idle time between requests (see option SOL_GCIDLE). The
+** work done counts as credit against future allocation, so that the
+** collector needs fewer steps while the program is busy. In the pause
+** between cycles, it starts the next cycle early only if the program
+** has allocated at least half of what the pause allows, so that calls
+** on an idle program do not run cycles that find no garbage. In
+** generational mode, whose collections cannot be split, it does
+** nothing. Returns 1 if it finished a cycle.
+*/
+int solC_idlestep (sol_State *L, int usec) {
+  global_State *g = G(L);
+  int stepmul = (getgcparam(g->gcstepmul) | 1);  /* avoid division by 0 */
+  lu_mem start;
+  l_mem work;
+  if (isdecGCmodegen(g) || usec <= 0)
+    return 0;
+  if (g->gcstate == GCSpause) {
+    l_mem threshold = gettotalbytes(g) - g->GCdebt;
+    l_mem allowance = threshold - cast(l_mem, g->GCestimate);
+    if (-g->GCdebt > allowance / 2)  /* too early for a new cycle? */
+      return 0;
+  }
+  start = gcclock();
+  work = timedsteps(L, g, usec, MAX_LMEM);
+  addstepstat(g, gcclock() - start, usec);
+  if (g->gcstate == GCSpause) {
+    setpause(g);  /* pause until next cycle */
+    return 1;
+  }
+  else {
+    l_mem credit = (work / stepmul) * WORK2MEM;  /* work in bytes */
+    solE_setdebt(g, (g->GCdebt > credit - MAX_LMEM) ? g->GCdebt - credit
+                                                    : -MAX_LMEM);
+    return 0;
+  }
+}
+
+/* }====================================================== */
+
+
 /*
 ** Performs a basic incremental step. The debt and step size are
 ** converted from bytes to "units of work"; then the function loops
 ** running single steps until adding that many units of work or
-** finishing a cycle (pause state). Finally, it sets the debt that
-** controls when next step will be performed.
+** finishing a cycle (pause state). With a time target for steps
+** ('gcsteptime'), the step also stops after that time. Finally, it
+** sets the debt that controls when next step will be performed.
 */
 static void incstep (sol_State *L, global_State *g) {
   int stepmul = (getgcparam(g->gcstepmul) | 1);  /* avoid division by 0 */
@@ -1670,10 +2999,18 @@ static void incstep (sol_State *L, global_State *g) {
   l_mem stepsize = (g->gcstepsize <= log2maxs(l_mem))
                  ? ((cast(l_mem, 1) << g->gcstepsize) / WORK2MEM) * stepmul
                  : MAX_LMEM;  /* overflow; keep maximum value */
-  do {  /* repeat until pause or enough "credit" (negative debt) */
-    lu_mem work = singlestep(L);  /* perform one single step */
-    debt -= work;
-  } while (debt > -stepsize && g->gcstate != GCSpause);
+  if (g->gcsteptime > 0) {  /* time-budgeted step? */
+    l_mem goal = (debt < MAX_LMEM - stepsize) ? debt + stepsize : MAX_LMEM;
+    debt -= timedsteps(L, g, g->gcsteptime, goal);
+    if (sweeperrunning(g) && debt > -stepsize)
+      debt = -stepsize;  /* what polling the sweeper would pay */
+  }
+  else {
+    do {  /* repeat until pause or enough "credit" (negative debt) */
+      lu_mem work = singlestep(L);  /* perform one single step */
+      debt -= work;
+    } while (debt > -stepsize && g->gcstate != GCSpause);
+  }
   if (g->gcstate == GCSpause)
     setpause(g);  /* pause until next cycle */
   else {
@@ -1692,10 +3029,12 @@ void solC_step (sol_State *L) {
   if (!gcrunning(g))  /* not running? */
     solE_setdebt(g, -2000);
   else {
+    lu_mem start = gcclock();
     if(isdecGCmodegen(g))
       genstep(L, g);
     else
       incstep(L, g);
+    addstepstat(g, gcclock() - start, g->gcsteptime);
   }
 }
 
@@ -54,6 +54,29 @@
 #define keepinvariant(g)	((g)->gcstate <= GCSatomic)
 
 
+/*
+** The atomic phase of the incremental collector can mark with a pool
+** of helper threads (see 'sol_gc' option SOL_GCPARALLEL). This needs
+** POSIX threads and the GCC atomic builtins.
+*/
+#if !defined(SOL_USE_PARMARK)
+#if defined(SOL_USE_POSIX) && defined(__GNUC__) && \
+    (defined(__linux__) || defined(__APPLE__)) && !defined(SOL_NOPARMARK)
+#define SOL_USE_PARMARK	1
+#else
+#define SOL_USE_PARMARK	0
+#endif
+#endif
+
+/*
+** The incremental collector can also sweep in a background thread (see
+** 'sol_gc' option SOL_GCSWEEPER), which needs the same support.
+*/
+#if !defined(SOL_USE_BGSWEEP)
+#define SOL_USE_BGSWEEP		SOL_USE_PARMARK
+#endif
+
+
 /*
 ** some useful bit tricks
 */
@@ -84,18 +107,31 @@
 #define WHITEBITS	bit2mask(WHITE0BIT, WHITE1BIT)
 
 
-#define iswhite(x)      testbits((x)->marked, WHITEBITS)
-#define isblack(x)      testbit((x)->marked, BLACKBIT)
+/*
+** Collector threads may change the mark bits of an object while other
+** threads read them (see lgc.c), so colors are read atomically.
+*/
+#if SOL_USE_PARMARK || SOL_USE_BGSWEEP
+#define getmarked(x)	__atomic_load_n(&(x)->marked, __ATOMIC_RELAXED)
+#define changewhite(x)  \
+	__atomic_xor_fetch(&(x)->marked, cast_byte(WHITEBITS), __ATOMIC_RELAXED)
+#else
+#define getmarked(x)	((x)->marked)
+#define changewhite(x)	((x)->marked ^= WHITEBITS)
+#endif
+
+
+#define iswhite(x)      testbits(getmarked(x), WHITEBITS)
+#define isblack(x)      testbit(getmarked(x), BLACKBIT)
 #define isgray(x)  /* neither white nor black */  \
-	(!testbits((x)->marked, WHITEBITS | bitmask(BLACKBIT)))
+	(!testbits(getmarked(x), WHITEBITS | bitmask(BLACKBIT)))
 
 #define tofinalize(x)	testbit((x)->marked, FINALIZEDBIT)
 
 #define otherwhite(g)	((g)->currentwhite ^ WHITEBITS)
 #define isdeadm(ow,m)	((m) & (ow))
-#define isdead(g,v)	isdeadm(otherwhite(g), (v)->marked)
+#define isdead(g,v)	isdeadm(otherwhite(g), getmarked(v))
 
-#define changewhite(x)	((x)->marked ^= WHITEBITS)
 #define nw2black(x)  \
 	check_exp(!iswhite(x), l_setbit((x)->marked, BLACKBIT))
 
@@ -110,12 +146,14 @@
 #define G_OLD		4	/* really old object (not to be visited) */
 #define G_TOUCHED1	5	/* old object touched this cycle */
 #define G_TOUCHED2	6	/* old object touched in previous cycle */
+#define G_FROZEN	7	/* frozen object (see 'solC_freeze') */
 
 #define AGEBITS		7  /* all age bits (111) */
 
 #define getage(o)	((o)->marked & AGEBITS)
 #define setage(o,a)  ((o)->marked = cast_byte(((o)->marked & (~AGEBITS)) | a))
 #define isold(o)	(getage(o) > G_SURVIVAL)
+#define isfrozen(o)	((getmarked(o) & AGEBITS) == G_FROZEN)
 
 #define changeage(o,f,t)  \
 	check_exp(getage(o) == (f), (o)->marked ^= ((f)^(t)))
@@ -140,6 +178,15 @@
 /* how much to allocate before next GC step (log2) */
 #define SOLI_GCSTEPSIZE 13      /* 8 KB */
 
+/* first guess of work units per millisecond for timed steps */
+#define SOLI_GCRATE	100000
+
+
+/* maximum number of threads marking in parallel */
+#if !defined(SOLI_MAXMARKERS)
+#define SOLI_MAXMARKERS	64
+#endif
+
 
 /*
 ** Check whether the declared GC mode is generational. While in
@@ -172,15 +219,23 @@
 #define solC_checkGC(L)		solC_condGC(L,(void)0,(void)0)
 
 
+/*
+** The collector does not traverse a frozen object again unless a
+** barrier records it, so storing into it anything that is not frozen
+** needs a barrier.
+*/
+#define needbarrier(p,o)  \
+	(isblack(p) && (iswhite(o) || (isfrozen(p) && !isfrozen(o))))
+
 #define solC_objbarrier(L,p,o) (  \
-	(isblack(p) && iswhite(o)) ? \
+	needbarrier(p,o) ? \
 	solC_barrier_(L,obj2gco(p),obj2gco(o)) : cast_void(0))
 
 #define solC_barrier(L,p,v) (  \
 	iscollectable(v) ? solC_objbarrier(L,p,gcvalue(v)) : cast_void(0))
 
 #define solC_objbarrierback(L,p,o) (  \
-	(isblack(p) && iswhite(o)) ? solC_barrierback_(L,p) : cast_void(0))
+	needbarrier(p,o) ? solC_barrierback_(L,p) : cast_void(0))
 
 #define solC_barrierback(L,p,v) (  \
 	iscollectable(v) ? solC_objbarrierback(L, p, gcvalue(v)) : cast_void(0))
@@ -197,6 +252,27 @@ SOLI_FUNC void solC_barrier_ (sol_State *L, GCObject *o, GCObject *v);
 SOLI_FUNC void solC_barrierback_ (sol_State *L, GCObject *o);
 SOLI_FUNC void solC_checkfinalizer (sol_State *L, GCObject *o, Table *mt);
 SOLI_FUNC void solC_changemode (sol_State *L, int newmode);
+SOLI_FUNC void solC_freeze (sol_State *L);
+SOLI_FUNC int solC_idlestep (sol_State *L, int usec);
+SOLI_FUNC void solC_stepstats (global_State *g, sol_GCStepStats *s);
+
+#if SOL_USE_PARMARK
+SOLI_FUNC int solC_setmarkers (sol_State *L, int n);
+SOLI_FUNC void solC_freemarkers (sol_State *L);
+#else
+#define solC_setmarkers(L,n)	((void)(n), -1)
+#define solC_freemarkers(L)	((void)0)
+#endif
+
+#if SOL_USE_BGSWEEP
+SOLI_FUNC int solC_setsweeper (sol_State *L, int on);
+SOLI_FUNC void solC_waitsweeper (sol_State *L);
+SOLI_FUNC void solC_freesweeper (sol_State *L);
+#else
+#define solC_setsweeper(L,on)	((void)(on), -1)
+#define solC_waitsweeper(L)	((void)0)
+#define solC_freesweeper(L)	((void)0)
+#endif
 
 
 #endif
@@ -50,6 +50,7 @@ static const solL_Reg loadedlibs[] = {
   {SOL_MATHLIBNAME, solopen_math},
   {SOL_UTF8LIBNAME, solopen_utf8},
   {SOL_DBLIBNAME, solopen_debug},
+  {SOL_JITLIBNAME, solopen_jit},
   {NULL, NULL}
 };
 
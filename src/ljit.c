@@ -0,0 +1,1616 @@
+/*
+** $Id: ljit.c $
+** Baseline (template) compiler to native code
+** See Copyright Notice in sol.h
+*/
+
+#define ljit_c
+#define SOL_CORE
+
+#if !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE		/* for 'MAP_ANONYMOUS' */
+#endif
+
+#include "lprefix.h"
+
+
+#include <stddef.h>
+#include <string.h>
+
+#include "sol.h"
+
+#include "ldebug.h"
+#include "ldo.h"
+#include "lfunc.h"
+#include "lgc.h"
+#include "ljit.h"
+#include "lmem.h"
+#include "lobject.h"
+#include "lopcodes.h"
+#include "lstate.h"
+#include "ltable.h"
+#include "ltm.h"
+#include "lvm.h"
+
+
+#if SOL_USE_JIT
+
+#include <sys/mman.h>
+
+
+/*
+** The compiler translates a whole prototype, one instruction at a
+** time, stitching together fixed machine-code templates. Simple
+** instructions (moves, loads, jumps, tests, numeric for loops, and the
+** integer/float cases of common arithmetic and comparisons) are written
+** inline; everything else calls a helper below, which does exactly what
+** the interpreter does for that instruction. Native code runs with the
+** same stack layout and 'CallInfo' as the interpreter, so it can leave
+** a function at any instruction boundary ("exit"), setting 'savedpc'
+** and letting 'solV_execute' go on from there. It does that whenever
+** hooks become active and for the few instructions it does not handle.
+**
+** Compiled code is a C function 'int f (sol_State *L, CallInfo *ci)'
+** returning SOLJ_RETURN or SOLJ_EXIT. It keeps 'L' in RBX, 'ci' in R12,
+** 'base' in R13, and 'k' in R14; 'base' is reloaded after every helper
+** call, as the stack may have been reallocated.
+*/
+
+
+/*
+** Calls nested deeper than this in the C stack let the interpreter do
+** the call (native code uses the C stack for Sol calls), so that deep
+** recursion does not raise a "C stack overflow".
+*/
+#define JITMAXCCALLS	(SOLI_MAXCCALLS - 40)
+
+
+typedef int (*NativeCode) (sol_State *L, CallInfo *ci);
+
+
+/*
+** {==================================================================
+** Helpers called from native code
+** ===================================================================
+*/
+
+/*
+** A helper gets the running 'ci' and the 'pc' that follows the
+** instruction being executed, the same value the interpreter would
+** save, so that errors and debug information see the right position.
+*/
+typedef int (*Helper) (sol_State *L, CallInfo *ci, const Instruction *pc);
+
+
+#define hRA(i)	(base + GETARG_A(i))
+#define hvRB(i)	s2v(base + GETARG_B(i))
+#define hvRC(i)	s2v(base + GETARG_C(i))
+#define hK(i)	(ci_func(ci)->p->k + (i))
+#define hRKC(i)	((TESTARG_k(i)) ? hK(GETARG_C(i)) : hvRC(i))
+
+#define hsavestate(L,ci,pc)	((ci)->u.l.savedpc = (pc), \
+                                 L->top.p = (ci)->top.p)
+
+#define hcheckGC(L,c)  \
+	{ solC_condGC(L, L->top.p = (c), (void)0); soli_threadyield(L); }
+
+
+/*
+** Called when 'ci->u.l.trap' is set: return true if the function must
+** continue in the interpreter (to run hooks); otherwise the trap came
+** from a stack reallocation, which native code already handles.
+*/
+static int jh_trap (sol_State *L, CallInfo *ci) {
+  if (L->hookmask)
+    return 1;
+  ci->u.l.trap = 0;
+  return 0;
+}
+
+
+/* OP_GETTABUP, OP_GETTABLE, OP_GETI, OP_GETFIELD, and OP_SELF */
+static int jh_get (sol_State *L, CallInfo *ci, const Instruction *pc) {
+  Instruction i = pc[-1];
+  StkId base = ci->func.p + 1;
+  StkId ra = hRA(i);
+  lu_byte tag;
+  TValue *t;
+  TValue *key;
+  TValue aux;
+  switch (GET_OPCODE(i)) {
+    case OP_GETTABUP:
+      t = ci_func(ci)->upvals[GETARG_B(i)]->v.p;
+      key = hK(GETARG_C(i));
+      break;
+    case OP_GETTABLE:
+      t = hvRB(i); key = hvRC(i);
+      break;
+    case OP_GETI:
+      t = hvRB(i); setivalue(&aux, GETARG_C(i)); key = &aux;
+      break;
+    case OP_GETFIELD:
+      t = hvRB(i); key = hK(GETARG_C(i));
+      break;
+    default:  /* OP_SELF */
+      t = hvRB(i); key = hRKC(i);
+      setobj2s(L, ra + 1, t);
+      break;
+  }
+  if (ttisinteger(key)) {
+    solV_fastgeti(L, t, ivalue(key), s2v(ra), tag);
+  }
+  else
+    solV_fastget(L, t, key, s2v(ra), solH_get, tag);
+  if (tagisempty(tag)) {
+    hsavestate(L, ci, pc);
+    solV_finishget(L, t, key, ra, tag);
+  }
+  return 0;
+}
+
+
+/* OP_SETTABUP, OP_SETTABLE, OP_SETI, and OP_SETFIELD */
+static int jh_set (sol_State *L, CallInfo *ci, const Instruction *pc) {
+  Instruction i = pc[-1];
+  StkId base = ci->func.p + 1;
+  int hres;
+  TValue *t;
+  TValue *key;
+  TValue *val = hRKC(i);
+  TValue aux;
+  switch (GET_OPCODE(i)) {
+    case OP_SETTABUP:
+      t = ci_func(ci)->upvals[GETARG_A(i)]->v.p;
+      key = hK(GETARG_B(i));
+      break;
+    case OP_SETTABLE:
+      t = s2v(hRA(i)); key = hvRB(i);
+      break;
+    case OP_SETI:
+      t = s2v(hRA(i)); setivalue(&aux, GETARG_B(i)); key = &aux;
+      break;
+    default:  /* OP_SETFIELD */
+      t = s2v(hRA(i)); key = hK(GETARG_B(i));
+      break;
+  }
+  if (ttisinteger(key)) {
+    solV_fastseti(L, t, ivalue(key), val, hres);
+  }
+  else
+    solV_fastset(L, t, key, val, hres, solH_pset);
+  if (hres == HOK)
+    solV_finishfastset(L, t, val);
+  else {
+    hsavestate(L, ci, pc);
+    solV_finishset(L, t, key, val, hres);
+  }
+  return 0;
+}
+
+
+static int jh_setupval (sol_State *L, CallInfo *ci, const Instruction *pc) {
+  Instruction i = pc[-1];
+  StkId base = ci->func.p + 1;
+  UpVal *uv = ci_func(ci)->upvals[GETARG_B(i)];
+  setobj(L, uv->v.p, s2v(hRA(i)));
+  solC_barrier(L, uv, s2v(hRA(i)));
+  return 0;
+}
+
+
+static int jh_newtable (sol_State *L, CallInfo *ci, const Instruction *pc) {
+  Instruction i = pc[-1];
+  StkId base = ci->func.p + 1;
+  StkId ra = hRA(i);
+  int b = GETARG_B(i);  /* log2(hash size) + 1 */
+  int c = GETARG_C(i);  /* array size */
+  Table *t;
+  if (b > 0)
+    b = 1 << (b - 1);  /* size is 2^(b - 1) */
+  if (TESTARG_k(i))  /* non-zero extra argument? */
+    c += GETARG_Ax(*pc) * (MAXARG_C + 1);  /* add it to size */
+  ci->u.l.savedpc = pc + 1;  /* skip extra argument */
+  L->top.p = ra + 1;  /* correct top in case of emergency GC */
+  t = solH_new(L);
+  sethvalue2s(L, ra, t);
+  if (b != 0 || c != 0)
+    solH_presize(L, t, c, b);
+  hcheckGC(L, ra + 1);
+  return 0;
+}
+
+
+/*
+** Generic arithmetic (without metamethods) for all arithmetic and
+** bitwise opcodes. Returns true if it could do the operation; otherwise
+** native code goes on to the OP_MMBIN* instruction that follows.
+*/
+static int jh_arith (sol_State *L, CallInfo *ci, const Instruction *pc) {
+  Instruction i = pc[-1];
+  OpCode op = GET_OPCODE(i);
+  StkId base = ci->func.p + 1;
+  TValue *v1 = hvRB(i);
+  TValue *v2;
+  TValue aux;
+  int aop;
+  if (isquickened(op))
+    op = solP_generic(op);
+  switch (op) {
+    case OP_ADDI:
+      setivalue(&aux, GETARG_sC(i)); v2 = &aux; aop = SOL_OPADD;
+      break;
+    case OP_SHRI:
+      setivalue(&aux, GETARG_sC(i)); v2 = &aux; aop = SOL_OPSHR;
+      break;
+    case OP_SHLI:  /* immediate is the first operand */
+      setivalue(&aux, GETARG_sC(i)); v2 = v1; v1 = &aux; aop = SOL_OPSHL;
+      break;
+    default:
+      if (OP_ADDK <= op && op <= OP_BXORK) {
+        v2 = hK(GETARG_C(i)); aop = op - OP_ADDK + SOL_OPADD;
+      }
+      else {
+        v2 = hvRC(i); aop = op - OP_ADD + SOL_OPADD;
+      }
+      break;
+  }
+  hsavestate(L, ci, pc);  /* in case of division by 0 */
+  return solO_rawarith(L, aop, v1, v2, s2v(hRA(i)));
+}
+
+
+/* OP_MMBIN, OP_MMBINI, and OP_MMBINK */
+static int jh_mmbin (sol_State *L, CallInfo *ci, const Instruction *pc) {
+  Instruction i = pc[-1];
+  StkId base = ci->func.p + 1;
+  StkId ra = hRA(i);
+  StkId result = hRA(pc[-2]);  /* from the original arith. expression */
+  TMS tm = (TMS)GETARG_C(i);
+  hsavestate(L, ci, pc);
+  switch (GET_OPCODE(i)) {
+    case OP_MMBIN:
+      solT_trybinTM(L, s2v(ra), hvRB(i), result, tm);
+      break;
+    case OP_MMBINI:
+      solT_trybiniTM(L, s2v(ra), GETARG_sB(i), GETARG_k(i), result, tm);
+      break;
+    default:  /* OP_MMBINK */
+      solT_trybinassocTM(L, s2v(ra), hK(GETARG_B(i)), GETARG_k(i),
+                         result, tm);
+      break;
+  }
+  return 0;
+}
+
+
+/* OP_UNM, OP_BNOT, and OP_LEN */
+static int jh_unary (sol_State *L, CallInfo *ci, const Instruction *pc) {
+  Instruction i = pc[-1];
+  StkId base = ci->func.p + 1;
+  StkId ra = hRA(i);
+  TValue *rb = hvRB(i);
+  hsavestate(L, ci, pc);
+  switch (GET_OPCODE(i)) {
+    case OP_UNM: {
+      sol_Number nb;
+      if (ttisinteger(rb)) {
+        sol_Integer ib = ivalue(rb);
+        setivalue(s2v(ra), intop(-, 0, ib));
+      }
+      else if (tonumberns(rb, nb)) {
+        setfltvalue(s2v(ra), soli_numunm(L, nb));
+      }
+      else
+        solT_trybinTM(L, rb, rb, ra, TM_UNM);
+      break;
+    }
+    case OP_BNOT: {
+      sol_Integer ib;
+      if (tointegerns(rb, &ib)) {
+        setivalue(s2v(ra), intop(^, ~l_castS2U(0), ib));
+      }
+      else
+        solT_trybinTM(L, rb, rb, ra, TM_BNOT);
+      break;
+    }
+    default:  /* OP_LEN */
+      solV_objlen(L, ra, rb);
+      break;
+  }
+  return 0;
+}
+
+
+static int jh_concat (sol_State *L, CallInfo *ci, const Instruction *pc) {
+  Instruction i = pc[-1];
+  StkId base = ci->func.p + 1;
+  int n = GETARG_B(i);  /* number of elements to concatenate */
+  L->top.p = hRA(i) + n;  /* mark the end of concat operands */
+  ci->u.l.savedpc = pc;
+  solV_concat(L, n);
+  hcheckGC(L, L->top.p);  /* 'solV_concat' ensures correct top */
+  return 0;
+}
+
+
+static int jh_close (sol_State *L, CallInfo *ci, const Instruction *pc) {
+  StkId base = ci->func.p + 1;
+  hsavestate(L, ci, pc);
+  solF_close(L, hRA(pc[-1]), SOL_OK, 1);
+  return 0;
+}
+
+
+/* OP_TBC and OP_TFORPREP (which creates a tbc variable at 'ra + 3') */
+static int jh_tbc (sol_State *L, CallInfo *ci, const Instruction *pc) {
+  Instruction i = pc[-1];
+  StkId base = ci->func.p + 1;
+  StkId ra = hRA(i);
+  hsavestate(L, ci, pc);
+  solF_newtbcupval(L, (GET_OPCODE(i) == OP_TBC) ? ra : ra + 3);
+  return 0;
+}
+
+
+/*
+** Comparisons, for the cases not handled inline; returns the result
+** of the comparison ('cond' in the interpreter).
+*/
+static int jh_compare (sol_State *L, CallInfo *ci, const Instruction *pc) {
+  Instruction i = pc[-1];
+  OpCode op = GET_OPCODE(i);
+  StkId base = ci->func.p + 1;
+  TValue *ra = s2v(hRA(i));
+  int cond;
+  if (isquickened(op))
+    op = solP_generic(op);
+  hsavestate(L, ci, pc);
+  switch (op) {
+    case OP_EQ: cond = solV_equalobj(L, ra, hvRB(i)); break;
+    case OP_LT: cond = solV_lessthan(L, ra, hvRB(i)); break;
+    case OP_LE: cond = solV_lessequal(L, ra, hvRB(i)); break;
+    case OP_EQK: cond = solV_rawequalobj(ra, hK(GETARG_B(i))); break;
+    default: {  /* OP_LTI, OP_LEI, OP_GTI, OP_GEI */
+      int im = GETARG_sB(i);
+      if (ttisnumber(ra)) {
+        TValue imm;
+        setivalue(&imm, im);
+        switch (op) {
+          case OP_LTI: cond = solV_lessthan(L, ra, &imm); break;
+          case OP_LEI: cond = solV_lessequal(L, ra, &imm); break;
+          case OP_GTI: cond = solV_lessthan(L, &imm, ra); break;
+          default: cond = solV_lessequal(L, &imm, ra); break;
+        }
+      }
+      else {
+        int inv = (op == OP_GTI || op == OP_GEI);
+        TMS tm = (op == OP_LTI || op == OP_GTI) ? TM_LT : TM_LE;
+        cond = solT_callorderiTM(L, ra, im, inv, GETARG_C(i), tm);
+      }
+      break;
+    }
+  }
+  return (cond != 0);
+}
+
+
+/*
+** Returns true when the interpreter must do the call (see
+** JITMAXCCALLS); the native code then exits before the instruction.
+*/
+static int jh_call (sol_State *L, CallInfo *ci, const Instruction *pc) {
+  Instruction i = pc[-1];
+  StkId base = ci->func.p + 1;
+  StkId ra = hRA(i);
+  int b = GETARG_B(i);
+  if (getCcalls(L) >= JITMAXCCALLS)
+    return 1;
+  if (b != 0)  /* fixed number of arguments? */
+    L->top.p = ra + b;  /* top signals number of arguments */
+  /* else previous instruction set top */
+  ci->u.l.savedpc = pc;
+  solD_call(L, ra, GETARG_C(i) - 1);
+  return 0;
+}
+
+
+/* OP_RETURN, OP_RETURN0, and OP_RETURN1 (in non-vararg functions) */
+static int jh_return (sol_State *L, CallInfo *ci, const Instruction *pc) {
+  Instruction i = pc[-1];
+  StkId base = ci->func.p + 1;
+  StkId ra = hRA(i);
+  int n;
+  ci->u.l.savedpc = pc;
+  switch (GET_OPCODE(i)) {
+    case OP_RETURN0: n = 0; break;
+    case OP_RETURN1: n = 1; break;
+    default: {
+      n = GETARG_B(i) - 1;  /* number of results */
+      if (n < 0)  /* not fixed? */
+        n = cast_int(L->top.p - ra);  /* get what is available */
+      if (TESTARG_k(i)) {  /* may there be open upvalues? */
+        ci->u2.nres = n;  /* save number of returns */
+        if (L->top.p < ci->top.p)
+          L->top.p = ci->top.p;
+        solF_close(L, base, CLOSEKTOP, 1);
+        base = ci->func.p + 1;  /* stack may have been reallocated */
+        ra = hRA(i);
+      }
+      break;
+    }
+  }
+  L->top.p = ra + n;  /* set call for 'solD_poscall' */
+  solD_poscall(L, ci, n);
+  return 0;
+}
+
+
+/* OP_FORPREP: returns true to skip the loop */
+static int jh_forprep (sol_State *L, CallInfo *ci, const Instruction *pc) {
+  StkId base = ci->func.p + 1;
+  hsavestate(L, ci, pc);  /* in case of errors */
+  return solV_forprep(L, hRA(pc[-1]));
+}
+
+
+/* OP_FORLOOP for float loops: returns true to jump back */
+static int jh_forloop (sol_State *L, CallInfo *ci, const Instruction *pc) {
+  StkId base = ci->func.p + 1;
+  UNUSED(L);
+  return solV_floatforloop(hRA(pc[-1]));
+}
+
+
+static int jh_tforcall (sol_State *L, CallInfo *ci, const Instruction *pc) {
+  Instruction i = pc[-1];
+  StkId base = ci->func.p + 1;
+  StkId ra = hRA(i);
+  /* push function, state, and control variable */
+  memcpy(ra + 4, ra, 3 * sizeof(*ra));
+  L->top.p = ra + 4 + 3;
+  ci->u.l.savedpc = pc;
+  solD_call(L, ra + 4, GETARG_C(i));  /* do the call */
+  return 0;
+}
+
+
+static int jh_setlist (sol_State *L, CallInfo *ci, const Instruction *pc) {
+  Instruction i = pc[-1];
+  StkId base = ci->func.p + 1;
+  StkId ra = hRA(i);
+  int n = GETARG_B(i);
+  unsigned int last = GETARG_C(i);
+  Table *h = hvalue(s2v(ra));
+  ci->u.l.savedpc = pc;
+  if (n == 0)
+    n = cast_int(L->top.p - ra) - 1;  /* get up to the top */
+  else
+    L->top.p = ci->top.p;  /* correct top in case of emergency GC */
+  last += n;
+  if (TESTARG_k(i))
+    last += GETARG_Ax(*pc) * (MAXARG_C + 1);
+  if (last > solH_realasize(h))  /* needs more space? */
+    solH_resizearray(L, h, last);  /* preallocate it at once */
+  solH_setlist(L, h, last - n, ra, n);
+  for (; n > 0; n--)
+    solC_barrierback(L, obj2gco(h), s2v(ra + n));
+  return 0;
+}
+
+
+static int jh_closure (sol_State *L, CallInfo *ci, const Instruction *pc) {
+  Instruction i = pc[-1];
+  StkId base = ci->func.p + 1;
+  StkId ra = hRA(i);
+  LClosure *cl = ci_func(ci);
+  hsavestate(L, ci, pc);
+  solV_pushclosure(L, cl->p->p[GETARG_Bx(i)], cl->upvals, base, ra);
+  hcheckGC(L, ra + 1);
+  return 0;
+}
+
+/* }================================================================== */
+
+
+/*
+** {==================================================================
+** Code emission
+** ===================================================================
+*/
+
+/* x86-64 registers */
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+       R8, R9, R10, R11, R12, R13, R14, R15 };
+
+#define RL	RBX	/* 'L' */
+#define RCI	R12	/* 'ci' */
+#define RBASE	R13	/* 'base' */
+#define RK	R14	/* 'k' */
+
+#define XMM0	0
+#define XMM1	1
+
+/* condition codes */
+#define CC_P	0xA
+#define CC_B	0x2
+#define CC_AE	0x3
+#define CC_E	0x4
+#define CC_NE	0x5
+#define CC_A	0x7
+#define CC_L	0xC
+#define CC_GE	0xD
+#define CC_LE	0xE
+#define CC_G	0xF
+#define CC_ALWAYS	(-1)
+
+/* opcodes (with a 0x0F prefix when above 0xFF) */
+#define X_ADD	0x03
+#define X_OR	0x0B
+#define X_AND	0x23
+#define X_SUB	0x2B
+#define X_XOR	0x33
+#define X_CMP	0x3B
+#define X_MOVST	0x89
+#define X_MOVLD	0x8B
+#define X_MOVB	0x88
+#define X_MOVZXB	0x0FB6
+#define X_IMUL	0x0FAF
+#define X_MOVSDLD	0x0F10
+#define X_MOVSDST	0x0F11
+#define X_ADDSD	0x0F58
+#define X_MULSD	0x0F59
+#define X_SUBSD	0x0F5C
+#define X_DIVSD	0x0F5E
+#define X_CVTSI2SD	0x0F2A
+#define X_UCOMISD	0x0F2E
+#define X_MOVQ	0x0F6E
+
+/* offsets of fields used by native code */
+#define SVSIZE		cast_int(sizeof(StackValue))
+#define TTOFF		cast_int(offsetof(TValue, tt_))
+#define REG(r)		((r) * SVSIZE)
+#define KST(n)		((n) * cast_int(sizeof(TValue)))
+#define CIFUNC		cast_int(offsetof(CallInfo, func))
+#define CITRAP		cast_int(offsetof(CallInfo, u.l.trap))
+#define CISAVEDPC	cast_int(offsetof(CallInfo, u.l.savedpc))
+
+
+/* kinds of jump targets */
+#define FX_LABEL	0	/* an instruction */
+#define FX_EXIT		1	/* exit to the interpreter at an instruction */
+#define FX_TRAP		2	/* a trap stub */
+#define FX_POS		3	/* a position in the code */
+#define FX_EPILOGUE	4	/* the function epilogue */
+
+typedef struct Fixup {
+  int at;  /* position of the 32-bit displacement */
+  int kind;
+  int target;
+} Fixup;
+
+
+/* out-of-line code for a trap check */
+typedef struct TrapStub {
+  int back;  /* where to go on when there is nothing to do */
+  int exitpc;  /* where the interpreter continues otherwise */
+} TrapStub;
+
+
+typedef struct JitBuf {
+  sol_State *L;
+  Proto *p;
+  lu_byte *code;
+  int n;  /* number of bytes in 'code' */
+  int size;  /* size of 'code' */
+  int *label;  /* position of the code of each instruction */
+  int *exitpos;  /* position of the exit stub for each instruction */
+  Fixup *fix;
+  int nfix;
+  int sizefix;
+  TrapStub *trap;
+  int ntrap;
+  int sizetrap;
+  int epilogue;  /* position of the epilogue */
+  int failed;  /* true after an allocation failure */
+} JitBuf;
+
+
+/*
+** Buffers use the state allocator directly, so that a failure only
+** abandons the compilation (instead of raising an error).
+*/
+static void *jitrealloc (JitBuf *J, void *block, size_t osize,
+                                               size_t nsize) {
+  global_State *g = G(J->L);
+  void *nb = (*g->frealloc)(g->ud, block, osize, nsize);
+  if (nb == NULL && nsize > 0)
+    J->failed = 1;
+  return nb;
+}
+
+
+#define growbuf(J,v,nelems,size,t) \
+  ((nelems) < (size) ? 1 : growbuf_(J, cast(void **, &(v)), &(size), \
+                                    sizeof(t)))
+
+static int growbuf_ (JitBuf *J, void **v, int *size, size_t elemsize) {
+  int nsize = (*size < 64) ? 64 : *size * 2;
+  void *nv = jitrealloc(J, *v, *size * elemsize, nsize * elemsize);
+  if (nv == NULL)
+    return 0;
+  *v = nv;
+  *size = nsize;
+  return 1;
+}
+
+
+static void eb (JitBuf *J, int b) {
+  if (growbuf(J, J->code, J->n, J->size, lu_byte))
+    J->code[J->n++] = cast_byte(b);
+}
+
+
+static void e32 (JitBuf *J, l_uint32 v) {
+  int i;
+  for (i = 0; i < 4; i++, v >>= 8)
+    eb(J, v & 0xFF);
+}
+
+
+static void e64 (JitBuf *J, sol_Unsigned v) {
+  int i;
+  for (i = 0; i < 8; i++, v >>= 8)
+    eb(J, cast_int(v & 0xFF));
+}
+
+
+static void addfixup (JitBuf *J, int kind, int target) {
+  if (growbuf(J, J->fix, J->nfix, J->sizefix, Fixup)) {
+    Fixup *f = &J->fix[J->nfix++];
+    f->at = J->n;
+    f->kind = kind;
+    f->target = target;
+  }
+  e32(J, 0);
+}
+
+
+static void rex (JitBuf *J, int w, int reg, int rm) {
+  int r = 0x40 | (w << 3) | ((reg & 8) >> 1) | ((rm & 8) >> 3);
+  if (r != 0x40)
+    eb(J, r);
+}
+
+
+static void opcode (JitBuf *J, int op) {
+  if (op > 0xFF)
+    eb(J, op >> 8);
+  eb(J, op & 0xFF);
+}
+
+
+/* instruction with operands 'reg' and '[base + disp]' */
+static void emitmem (JitBuf *J, int pfx, int w, int op, int reg, int base,
+                     int disp) {
+  int mod = (disp == 0 && (base & 7) != RBP) ? 0
+          : (-128 <= disp && disp <= 127) ? 1 : 2;
+  if (pfx) eb(J, pfx);
+  rex(J, w, reg, base);
+  opcode(J, op);
+  eb(J, (mod << 6) | ((reg & 7) << 3) | (base & 7));
+  if ((base & 7) == RSP)
+    eb(J, 0x24);  /* SIB byte with no index */
+  if (mod == 1)
+    eb(J, disp & 0xFF);
+  else if (mod == 2)
+    e32(J, cast(l_uint32, disp));
+}
+
+
+/* instruction with two register operands */
+static void emitrr (JitBuf *J, int pfx, int w, int op, int reg, int rm) {
+  if (pfx) eb(J, pfx);
+  rex(J, w, reg, rm);
+  opcode(J, op);
+  eb(J, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+
+static void movimm (JitBuf *J, int r, sol_Unsigned v) {
+  rex(J, (v > 0xFFFFFFFFu), 0, r);
+  eb(J, 0xB8 | (r & 7));
+  if (v > 0xFFFFFFFFu)
+    e64(J, v);
+  else  /* 32-bit move clears the upper half */
+    e32(J, cast(l_uint32, v));
+}
+
+
+#define movptr(J,r,p)	movimm(J, r, cast(sol_Unsigned, cast_sizet(p)))
+
+
+static sol_Unsigned fltbits (sol_Number n) {
+  sol_Unsigned u;
+  memcpy(&u, &n, sizeof(u));
+  return u;
+}
+
+
+static void push (JitBuf *J, int r) {
+  rex(J, 0, 0, r);
+  eb(J, 0x50 | (r & 7));
+}
+
+
+static void pop (JitBuf *J, int r) {
+  rex(J, 0, 0, r);
+  eb(J, 0x58 | (r & 7));
+}
+
+
+static void callptr (JitBuf *J, sol_Unsigned f) {
+  movimm(J, RAX, f);
+  eb(J, 0xFF); eb(J, 0xD0);  /* call rax */
+}
+
+
+/* jump (or conditional jump, if 'cc' is not CC_ALWAYS) to a target */
+static void jump (JitBuf *J, int cc, int kind, int target) {
+  if (cc == CC_ALWAYS)
+    eb(J, 0xE9);
+  else {
+    eb(J, 0x0F); eb(J, 0x80 | cc);
+  }
+  addfixup(J, kind, target);
+}
+
+
+/* forward jump inside a template; returns position to be patched */
+static int jumpfwd (JitBuf *J, int cc) {
+  int at;
+  if (cc == CC_ALWAYS)
+    eb(J, 0xE9);
+  else {
+    eb(J, 0x0F); eb(J, 0x80 | cc);
+  }
+  at = J->n;
+  e32(J, 0);
+  return at;
+}
+
+
+static void patch (JitBuf *J, int at, int dest) {
+  l_uint32 rel = cast(l_uint32, dest - (at + 4));
+  int i;
+  if (J->failed) return;
+  for (i = 0; i < 4; i++, rel >>= 8)
+    J->code[at + i] = cast_byte(rel & 0xFF);
+}
+
+
+#define patchhere(J,at)	patch(J, at, (J)->n)
+
+
+/* reg8 := tag of value at '[base + disp]' (zero extended) */
+static void loadtag (JitBuf *J, int reg, int base, int disp) {
+  emitmem(J, 0, 0, X_MOVZXB, reg, base, disp + TTOFF);
+}
+
+
+/* compare low byte of 'reg' (RAX or RCX) with 'tag' */
+static void cmptag (JitBuf *J, int reg, int tag) {
+  eb(J, 0x80); eb(J, 0xF8 | reg); eb(J, tag);
+}
+
+
+/* set flag Z if low byte of 'reg' (RAX or RCX) is a nil tag */
+static void testnil (JitBuf *J, int reg) {
+  eb(J, 0xF6); eb(J, 0xC0 | reg); eb(J, 0x0F);
+}
+
+
+static void settag (JitBuf *J, int base, int disp, int tag) {
+  emitmem(J, 0, 0, 0xC6, 0, base, disp + TTOFF);
+  eb(J, tag);
+}
+
+
+/* copy value and tag from '[sb + sd]' to '[db + dd]' (uses RCX) */
+static void copyvalue (JitBuf *J, int db, int dd, int sb, int sd) {
+  emitmem(J, 0, 1, X_MOVLD, RCX, sb, sd);
+  emitmem(J, 0, 1, X_MOVST, RCX, db, dd);
+  loadtag(J, RCX, sb, sd);
+  emitmem(J, 0, 0, X_MOVB, RCX, db, dd + TTOFF);
+}
+
+
+static void loadbase (JitBuf *J) {
+  emitmem(J, 0, 1, X_MOVLD, RBASE, RCI, CIFUNC);
+  rex(J, 1, 0, RBASE);
+  eb(J, 0x83); eb(J, 0xC0 | (RBASE & 7)); eb(J, SVSIZE);  /* add */
+}
+
+
+/*
+** Check 'ci->u.l.trap'; when set, go to a stub that either continues
+** here or exits to the interpreter at instruction 'exitpc'.
+*/
+static void trapcheck (JitBuf *J, int exitpc) {
+  emitmem(J, 0, 0, 0x83, 7, RCI, CITRAP);  /* cmp dword [ci.trap], 0 */
+  eb(J, 0);
+  if (growbuf(J, J->trap, J->ntrap, J->sizetrap, TrapStub)) {
+    jump(J, CC_NE, FX_TRAP, J->ntrap);
+    J->trap[J->ntrap].back = J->n;
+    J->trap[J->ntrap++].exitpc = exitpc;
+  }
+}
+
+
+/*
+** Call helper 'f' for instruction 'pc', exiting first if there is a
+** pending trap. Helpers leave their result in EAX.
+*/
+static void callhelper (JitBuf *J, int pc, Helper f) {
+  trapcheck(J, pc);
+  emitrr(J, 0, 1, X_MOVST, RL, RDI);
+  emitrr(J, 0, 1, X_MOVST, RCI, RSI);
+  movptr(J, RDX, J->p->code + pc + 1);
+  callptr(J, cast(sol_Unsigned, cast_sizet(f)));
+  loadbase(J);
+}
+
+
+static void testeax (JitBuf *J) {
+  eb(J, 0x85); eb(J, 0xC0);
+}
+
+
+/* jump to 'target', checking traps on backward jumps */
+static void jumpto (JitBuf *J, int pc, int target) {
+  if (target <= pc)
+    trapcheck(J, target);  /* allow signals and hooks to break loops */
+  jump(J, CC_ALWAYS, FX_LABEL, target);
+}
+
+
+/*
+** Branch for a comparison at 'pc' whose result is given by condition
+** 'cc' (flag P set meaning false if 'unordered'): as in 'docondjump',
+** skip the following jump if the result is not 'k'.
+*/
+static void condjump (JitBuf *J, int pc, int k, int cc, int unordered) {
+  int ontrue = k ? pc + 1 : pc + 2;
+  int onfalse = k ? pc + 2 : pc + 1;
+  if (unordered)
+    jump(J, CC_P, FX_LABEL, onfalse);
+  jump(J, cc, FX_LABEL, ontrue);
+  jump(J, CC_ALWAYS, FX_LABEL, onfalse);
+}
+
+/* }================================================================== */
+
+
+/*
+** {==================================================================
+** Templates
+** ===================================================================
+*/
+
+/*
+** XMM register 'x' := number at '[base + disp]', whose tag is in 'treg',
+** converting integers to floats; other values go to a 'slow' path.
+*/
+static void loadnum (JitBuf *J, int x, int treg, int disp,
+                     int *slow, int *ns) {
+  int notflt, done;
+  cmptag(J, treg, SOL_VNUMFLT);
+  notflt = jumpfwd(J, CC_NE);
+  emitmem(J, 0xF2, 0, X_MOVSDLD, x, RBASE, disp);
+  done = jumpfwd(J, CC_ALWAYS);
+  patchhere(J, notflt);
+  cmptag(J, treg, SOL_VNUMINT);
+  slow[(*ns)++] = jumpfwd(J, CC_NE);
+  emitmem(J, 0xF2, 1, X_CVTSI2SD, x, RBASE, disp);
+  patchhere(J, done);
+}
+
+
+/*
+** Arithmetic: inline integer and float paths (the latter also for
+** mixed operands) for the most common operators; then the generic operation through 'jh_arith', which skips
+** the following OP_MMBIN* instruction when it succeeds.
+*/
+static void arith (JitBuf *J, int pc, Instruction i, OpCode op) {
+  int ra = REG(GETARG_A(i));
+  int rb = REG(GETARG_B(i));
+  int rc = -1;  /* second operand register, or -1 for a constant */
+  int iop = -1;  /* integer operation */
+  int fop = -1;  /* float operation */
+  int hasint = 1;  /* can the constant operand be an integer? */
+  sol_Integer ik = 0;
+  sol_Number fk = 0;
+  switch (op) {
+    case OP_ADD: case OP_ADDK: case OP_ADDI:
+      iop = X_ADD; fop = X_ADDSD; break;
+    case OP_SUB: case OP_SUBK: iop = X_SUB; fop = X_SUBSD; break;
+    case OP_MUL: case OP_MULK: iop = X_IMUL; fop = X_MULSD; break;
+    case OP_DIV: case OP_DIVK: fop = X_DIVSD; break;
+    case OP_BAND: case OP_BANDK: iop = X_AND; break;
+    case OP_BOR: case OP_BORK: iop = X_OR; break;
+    case OP_BXOR: case OP_BXORK: iop = X_XOR; break;
+    default: break;  /* only the generic path */
+  }
+  if (op == OP_ADDI) {
+    ik = GETARG_sC(i);
+    fk = cast_num(ik);
+  }
+  else if (OP_ADDK <= op && op <= OP_BXORK) {
+    const TValue *kv = &J->p->k[GETARG_C(i)];
+    if (ttisinteger(kv)) {
+      ik = ivalue(kv);
+      fk = cast_num(ik);
+    }
+    else {
+      hasint = 0;
+      fk = fltvalue(kv);
+    }
+  }
+  else
+    rc = REG(GETARG_C(i));
+  if (!hasint)
+    iop = -1;
+  if (iop >= 0 || fop >= 0) {
+    int toslow[4];
+    int ns = 0;
+    int tofloat[2];
+    int nf = 0;
+    loadtag(J, RAX, RBASE, rb);
+    if (rc >= 0)
+      loadtag(J, RCX, RBASE, rc);
+    if (iop >= 0) {
+      cmptag(J, RAX, SOL_VNUMINT);
+      tofloat[nf++] = jumpfwd(J, CC_NE);
+      if (rc >= 0) {
+        cmptag(J, RCX, SOL_VNUMINT);
+        tofloat[nf++] = jumpfwd(J, CC_NE);
+        emitmem(J, 0, 1, X_MOVLD, RAX, RBASE, rb);
+        emitmem(J, 0, 1, iop, RAX, RBASE, rc);
+      }
+      else {
+        movimm(J, RCX, l_castS2U(ik));
+        emitmem(J, 0, 1, X_MOVLD, RAX, RBASE, rb);
+        emitrr(J, 0, 1, iop, RAX, RCX);
+      }
+      emitmem(J, 0, 1, X_MOVST, RAX, RBASE, ra);
+      settag(J, RBASE, ra, SOL_VNUMINT);
+      jump(J, CC_ALWAYS, FX_LABEL, pc + 2);  /* skip OP_MMBIN* */
+    }
+    if (fop >= 0) {
+      while (nf > 0)
+        patchhere(J, tofloat[--nf]);
+      loadnum(J, XMM0, RAX, rb, toslow, &ns);
+      if (rc >= 0)
+        loadnum(J, XMM1, RCX, rc, toslow, &ns);
+      else {
+        movimm(J, RCX, fltbits(fk));
+        emitrr(J, 0x66, 1, X_MOVQ, XMM1, RCX);
+      }
+      emitrr(J, 0xF2, 0, fop, XMM0, XMM1);
+      emitmem(J, 0xF2, 0, X_MOVSDST, XMM0, RBASE, ra);
+      settag(J, RBASE, ra, SOL_VNUMFLT);
+      jump(J, CC_ALWAYS, FX_LABEL, pc + 2);
+    }
+    else {
+      while (nf > 0)
+        toslow[ns++] = tofloat[--nf];
+    }
+    while (ns > 0)
+      patchhere(J, toslow[--ns]);
+  }
+  callhelper(J, pc, jh_arith);
+  testeax(J);
+  jump(J, CC_NE, FX_LABEL, pc + 2);
+  /* else go on to the OP_MMBIN* instruction */
+}
+
+
+/*
+** Comparisons: inline integer and float paths (and constant
+** equalities), then the generic comparison through 'jh_compare'.
+*/
+static void compare (JitBuf *J, int pc, Instruction i, OpCode op) {
+  int ra = REG(GETARG_A(i));
+  int k = GETARG_k(i);
+  int toslow[4];
+  int ns = 0;
+  switch (op) {
+    case OP_EQ: case OP_LT: case OP_LE: {
+      int rb = REG(GETARG_B(i));
+      int notint;
+      loadtag(J, RAX, RBASE, ra);
+      loadtag(J, RCX, RBASE, rb);
+      cmptag(J, RAX, SOL_VNUMINT);
+      notint = jumpfwd(J, CC_NE);
+      cmptag(J, RCX, SOL_VNUMINT);
+      toslow[ns++] = jumpfwd(J, CC_NE);
+      emitmem(J, 0, 1, X_MOVLD, RAX, RBASE, ra);
+      emitmem(J, 0, 1, X_CMP, RAX, RBASE, rb);
+      condjump(J, pc, k, (op == OP_EQ) ? CC_E : (op == OP_LT) ? CC_L : CC_LE,
+                  0);
+      if (op == OP_EQ)
+        toslow[ns++] = notint;
+      else {  /* 'b > a' and 'b >= a' are false when unordered */
+        patchhere(J, notint);
+        cmptag(J, RAX, SOL_VNUMFLT);
+        toslow[ns++] = jumpfwd(J, CC_NE);
+        cmptag(J, RCX, SOL_VNUMFLT);
+        toslow[ns++] = jumpfwd(J, CC_NE);
+        emitmem(J, 0xF2, 0, X_MOVSDLD, XMM0, RBASE, rb);
+        emitmem(J, 0x66, 0, X_UCOMISD, XMM0, RBASE, ra);
+        condjump(J, pc, k, (op == OP_LT) ? CC_A : CC_AE, 0);
+      }
+      break;
+    }
+    case OP_EQK: {
+      const TValue *kv = &J->p->k[GETARG_B(i)];
+      loadtag(J, RAX, RBASE, ra);
+      switch (ttypetag(kv)) {
+        case SOL_VNIL: case SOL_VFALSE: case SOL_VTRUE:
+          cmptag(J, RAX, ttypetag(kv));
+          condjump(J, pc, k, CC_E, 0);
+          return;
+        case SOL_VSHRSTR:  /* short strings are equal iff the same */
+          cmptag(J, RAX, ctb(SOL_VSHRSTR));
+          jump(J, CC_NE, FX_LABEL, k ? pc + 2 : pc + 1);
+          movptr(J, RCX, tsvalue(kv));
+          emitmem(J, 0, 1, X_CMP, RCX, RBASE, ra);
+          condjump(J, pc, k, CC_E, 0);
+          return;
+        case SOL_VNUMINT:
+          cmptag(J, RAX, SOL_VNUMINT);
+          toslow[ns++] = jumpfwd(J, CC_NE);
+          movimm(J, RCX, l_castS2U(ivalue(kv)));
+          emitmem(J, 0, 1, X_CMP, RCX, RBASE, ra);
+          condjump(J, pc, k, CC_E, 0);
+          break;
+        default:
+          break;  /* only the generic path */
+      }
+      break;
+    }
+    default: {  /* OP_EQI, OP_LTI, OP_LEI, OP_GTI, OP_GEI */
+      int im = GETARG_sB(i);
+      int notint, notflt;
+      loadtag(J, RAX, RBASE, ra);
+      cmptag(J, RAX, SOL_VNUMINT);
+      notint = jumpfwd(J, CC_NE);
+      emitmem(J, 0, 1, 0x81, 7, RBASE, ra);  /* cmp qword [ra], imm32 */
+      e32(J, cast(l_uint32, im));
+      condjump(J, pc, k, (op == OP_EQI) ? CC_E : (op == OP_LTI) ? CC_L
+                       : (op == OP_LEI) ? CC_LE : (op == OP_GTI) ? CC_G
+                       : CC_GE, 0);
+      patchhere(J, notint);
+      cmptag(J, RAX, SOL_VNUMFLT);
+      notflt = jumpfwd(J, CC_NE);
+      emitmem(J, 0xF2, 0, X_MOVSDLD, XMM0, RBASE, ra);
+      movimm(J, RCX, fltbits(cast_num(im)));
+      emitrr(J, 0x66, 1, X_MOVQ, XMM1, RCX);
+      switch (op) {
+        case OP_EQI:
+          emitrr(J, 0x66, 0, X_UCOMISD, XMM0, XMM1);
+          condjump(J, pc, k, CC_E, 1);
+          break;
+        case OP_LTI: case OP_LEI:  /* 'im > a', 'im >= a' */
+          emitrr(J, 0x66, 0, X_UCOMISD, XMM1, XMM0);
+          condjump(J, pc, k, (op == OP_LTI) ? CC_A : CC_AE, 0);
+          break;
+        default:  /* 'a > im', 'a >= im' */
+          emitrr(J, 0x66, 0, X_UCOMISD, XMM0, XMM1);
+          condjump(J, pc, k, (op == OP_GTI) ? CC_A : CC_AE, 0);
+          break;
+      }
+      patchhere(J, notflt);
+      if (op == OP_EQI) {  /* other types cannot be equal to a number */
+        jump(J, CC_ALWAYS, FX_LABEL, k ? pc + 2 : pc + 1);
+        return;
+      }
+      break;
+    }
+  }
+  while (ns > 0)
+    patchhere(J, toslow[--ns]);
+  callhelper(J, pc, jh_compare);
+  testeax(J);
+  condjump(J, pc, k, CC_NE, 0);
+}
+
+
+/* emit jumps 'tofalse' taken when register 'reg' is false (uses RAX) */
+static void testfalse (JitBuf *J, int reg, int *tofalse) {
+  loadtag(J, RAX, RBASE, reg);
+  cmptag(J, RAX, SOL_VFALSE);
+  tofalse[0] = jumpfwd(J, CC_E);
+  testnil(J, RAX);
+  tofalse[1] = jumpfwd(J, CC_E);
+}
+
+
+static void forloop (JitBuf *J, int pc, Instruction i) {
+  int ra = REG(GETARG_A(i));
+  int back = pc + 1 - GETARG_Bx(i);
+  int isflt, done, fdone;
+  loadtag(J, RAX, RBASE, ra + REG(2));
+  cmptag(J, RAX, SOL_VNUMINT);  /* integer loop? */
+  isflt = jumpfwd(J, CC_NE);
+  emitmem(J, 0, 1, X_MOVLD, RAX, RBASE, ra + REG(1));  /* count */
+  emitrr(J, 0, 1, 0x85, RAX, RAX);  /* test rax, rax */
+  done = jumpfwd(J, CC_E);
+  emitrr(J, 0, 1, 0xFF, 1, RAX);  /* dec rax */
+  emitmem(J, 0, 1, X_MOVST, RAX, RBASE, ra + REG(1));
+  emitmem(J, 0, 1, X_MOVLD, RAX, RBASE, ra);
+  emitmem(J, 0, 1, X_ADD, RAX, RBASE, ra + REG(2));
+  emitmem(J, 0, 1, X_MOVST, RAX, RBASE, ra);
+  emitmem(J, 0, 1, X_MOVST, RAX, RBASE, ra + REG(3));
+  settag(J, RBASE, ra + REG(3), SOL_VNUMINT);
+  jumpto(J, pc, back);
+  patchhere(J, isflt);
+  callhelper(J, pc, jh_forloop);
+  testeax(J);
+  fdone = jumpfwd(J, CC_E);
+  jumpto(J, pc, back);
+  patchhere(J, done);
+  patchhere(J, fdone);
+}
+
+
+static void compileop (JitBuf *J, int pc) {
+  const Instruction *code = J->p->code;
+  Instruction i = code[pc];
+  OpCode op = GET_OPCODE(i);
+  int ra = REG(GETARG_A(i));
+  if (isquickened(op))
+    op = solP_generic(op);  /* native code has its own fast paths */
+  switch (op) {
+    case OP_MOVE:
+      copyvalue(J, RBASE, ra, RBASE, REG(GETARG_B(i)));
+      break;
+    case OP_LOADI:
+      emitmem(J, 0, 1, 0xC7, 0, RBASE, ra);  /* mov qword [ra], imm32 */
+      e32(J, cast(l_uint32, GETARG_sBx(i)));
+      settag(J, RBASE, ra, SOL_VNUMINT);
+      break;
+    case OP_LOADF:
+      movimm(J, RAX, fltbits(cast_num(GETARG_sBx(i))));
+      emitmem(J, 0, 1, X_MOVST, RAX, RBASE, ra);
+      settag(J, RBASE, ra, SOL_VNUMFLT);
+      break;
+    case OP_LOADK:
+      copyvalue(J, RBASE, ra, RK, KST(GETARG_Bx(i)));
+      break;
+    case OP_LOADKX:  /* next instruction (OP_EXTRAARG) has no code */
+      copyvalue(J, RBASE, ra, RK, KST(GETARG_Ax(code[pc + 1])));
+      break;
+    case OP_LOADFALSE:
+      settag(J, RBASE, ra, SOL_VFALSE);
+      break;
+    case OP_LFALSESKIP:
+      settag(J, RBASE, ra, SOL_VFALSE);
+      jump(J, CC_ALWAYS, FX_LABEL, pc + 2);
+      break;
+    case OP_LOADTRUE:
+      settag(J, RBASE, ra, SOL_VTRUE);
+      break;
+    case OP_LOADNIL: {
+      int b = GETARG_B(i);
+      do {
+        settag(J, RBASE, ra, SOL_VNIL);
+        ra += SVSIZE;
+      } while (b--);
+      break;
+    }
+    case OP_GETUPVAL:  /* ra = ci_func(ci)->upvals[B]->v.p */
+      emitmem(J, 0, 1, X_MOVLD, RAX, RCI, CIFUNC);
+      emitmem(J, 0, 1, X_MOVLD, RAX, RAX, 0);
+      emitmem(J, 0, 1, X_MOVLD, RAX, RAX, cast_int(offsetof(LClosure, upvals))
+                 + GETARG_B(i) * cast_int(sizeof(UpVal *)));
+      emitmem(J, 0, 1, X_MOVLD, RDX, RAX, cast_int(offsetof(UpVal, v)));
+      copyvalue(J, RBASE, ra, RDX, 0);
+      break;
+    case OP_SETUPVAL:
+      callhelper(J, pc, jh_setupval);
+      break;
+    case OP_GETTABUP: case OP_GETTABLE: case OP_GETI: case OP_GETFIELD:
+    case OP_SELF:
+      callhelper(J, pc, jh_get);
+      break;
+    case OP_SETTABUP: case OP_SETTABLE: case OP_SETI: case OP_SETFIELD:
+      callhelper(J, pc, jh_set);
+      break;
+    case OP_NEWTABLE:  /* next instruction (OP_EXTRAARG) has no code */
+      callhelper(J, pc, jh_newtable);
+      break;
+    case OP_ADDI: case OP_ADDK: case OP_SUBK: case OP_MULK: case OP_MODK:
+    case OP_POWK: case OP_DIVK: case OP_IDIVK: case OP_BANDK: case OP_BORK:
+    case OP_BXORK: case OP_SHRI: case OP_SHLI: case OP_ADD: case OP_SUB:
+    case OP_MUL: case OP_MOD: case OP_POW: case OP_DIV: case OP_IDIV:
+    case OP_BAND: case OP_BOR: case OP_BXOR: case OP_SHL: case OP_SHR:
+      arith(J, pc, i, op);
+      break;
+    case OP_MMBIN: case OP_MMBINI: case OP_MMBINK:
+      callhelper(J, pc, jh_mmbin);
+      break;
+    case OP_UNM: case OP_BNOT: case OP_LEN:
+      callhelper(J, pc, jh_unary);
+      break;
+    case OP_NOT: {
+      int tofalse[2];
+      int done;
+      testfalse(J, REG(GETARG_B(i)), tofalse);
+      settag(J, RBASE, ra, SOL_VFALSE);
+      done = jumpfwd(J, CC_ALWAYS);
+      patchhere(J, tofalse[0]);
+      patchhere(J, tofalse[1]);
+      settag(J, RBASE, ra, SOL_VTRUE);
+      patchhere(J, done);
+      break;
+    }
+    case OP_CONCAT:
+      callhelper(J, pc, jh_concat);
+      break;
+    case OP_CLOSE:
+      callhelper(J, pc, jh_close);
+      break;
+    case OP_TBC:
+      callhelper(J, pc, jh_tbc);
+      break;
+    case OP_JMP:
+      jumpto(J, pc, pc + 1 + GETARG_sJ(i));
+      break;
+    case OP_EQ: case OP_LT: case OP_LE: case OP_EQK: case OP_EQI:
+    case OP_LTI: case OP_LEI: case OP_GTI: case OP_GEI:
+      compare(J, pc, i, op);
+      break;
+    case OP_TEST: {  /* if (not l_isfalse(ra) != k) skip the jump */
+      int tofalse[2];
+      int k = GETARG_k(i);
+      testfalse(J, ra, tofalse);
+      jump(J, CC_ALWAYS, FX_LABEL, k ? pc + 1 : pc + 2);
+      patchhere(J, tofalse[0]);
+      patchhere(J, tofalse[1]);
+      jump(J, CC_ALWAYS, FX_LABEL, k ? pc + 2 : pc + 1);
+      break;
+    }
+    case OP_TESTSET: {  /* if (l_isfalse(rb) == k) skip, else copy */
+      int tofalse[2];
+      int k = GETARG_k(i);
+      int rb = REG(GETARG_B(i));
+      testfalse(J, rb, tofalse);
+      if (k)
+        copyvalue(J, RBASE, ra, RBASE, rb);
+      jump(J, CC_ALWAYS, FX_LABEL, k ? pc + 1 : pc + 2);
+      patchhere(J, tofalse[0]);
+      patchhere(J, tofalse[1]);
+      if (!k)
+        copyvalue(J, RBASE, ra, RBASE, rb);
+      jump(J, CC_ALWAYS, FX_LABEL, k ? pc + 2 : pc + 1);
+      break;
+    }
+    case OP_CALL:
+      callhelper(J, pc, jh_call);
+      testeax(J);
+      jump(J, CC_NE, FX_EXIT, pc);  /* too deep: let the interpreter do it */
+      break;
+    case OP_RETURN: case OP_RETURN0: case OP_RETURN1:
+      callhelper(J, pc, jh_return);
+      eb(J, 0xB8); e32(J, SOLJ_RETURN);  /* mov eax, SOLJ_RETURN */
+      jump(J, CC_ALWAYS, FX_EPILOGUE, 0);
+      break;
+    case OP_FORLOOP:
+      forloop(J, pc, i);
+      break;
+    case OP_FORPREP:
+      callhelper(J, pc, jh_forprep);
+      testeax(J);
+      jump(J, CC_NE, FX_LABEL, pc + GETARG_Bx(i) + 2);  /* skip the loop */
+      break;
+    case OP_TFORPREP:
+      callhelper(J, pc, jh_tbc);
+      jump(J, CC_ALWAYS, FX_LABEL, pc + GETARG_Bx(i) + 1);
+      break;
+    case OP_TFORCALL:  /* go on to the OP_TFORLOOP that follows */
+      callhelper(J, pc, jh_tforcall);
+      break;
+    case OP_TFORLOOP: {
+      int done;
+      loadtag(J, RAX, RBASE, ra + REG(4));
+      testnil(J, RAX);
+      done = jumpfwd(J, CC_E);
+      copyvalue(J, RBASE, ra + REG(2), RBASE, ra + REG(4));
+      jumpto(J, pc, pc + 1 - GETARG_Bx(i));
+      patchhere(J, done);
+      break;
+    }
+    case OP_SETLIST:  /* next instruction may be an OP_EXTRAARG */
+      callhelper(J, pc, jh_setlist);
+      break;
+    case OP_CLOSURE:
+      callhelper(J, pc, jh_closure);
+      break;
+    case OP_EXTRAARG:
+      break;  /* consumed by the previous instruction */
+    default:  /* OP_TAILCALL, OP_VARARG, OP_VARARGPREP */
+      jump(J, CC_ALWAYS, FX_EXIT, pc);
+      break;
+  }
+}
+
+/* }================================================================== */
+
+
+/*
+** {==================================================================
+** Compilation and code management
+** ===================================================================
+*/
+
+/* space before the code in a mapping, keeping the mapping size */
+#define CODEHEADER	16
+
+
+static void *newcode (const lu_byte *src, size_t n) {
+  size_t size = CODEHEADER + n;
+  lu_byte *m = cast(lu_byte *, mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+  if (m == MAP_FAILED)
+    return NULL;
+  memcpy(m, &size, sizeof(size));
+  memcpy(m + CODEHEADER, src, n);
+  if (mprotect(m, size, PROT_READ | PROT_EXEC) != 0) {
+    munmap(m, size);
+    return NULL;
+  }
+  return m + CODEHEADER;
+}
+
+
+static void freecode (void *code) {
+  lu_byte *m = cast(lu_byte *, code) - CODEHEADER;
+  size_t size;
+  memcpy(&size, m, sizeof(size));
+  munmap(m, size);
+}
+
+
+static void prologue (JitBuf *J) {
+  push(J, RBX); push(J, R12); push(J, R13); push(J, R14);
+  push(J, R15);  /* keeps the stack aligned for calls */
+  emitrr(J, 0, 1, X_MOVST, RDI, RL);
+  emitrr(J, 0, 1, X_MOVST, RSI, RCI);
+  loadbase(J);
+  movptr(J, RK, J->p->k);
+}
+
+
+static void epilogue (JitBuf *J) {
+  J->epilogue = J->n;
+  pop(J, R15); pop(J, R14); pop(J, R13); pop(J, R12); pop(J, RBX);
+  eb(J, 0xC3);  /* ret */
+}
+
+
+/* out-of-line code for trap checks and exits */
+static void stubs (JitBuf *J) {
+  int f;
+  int s;
+  for (s = 0; s < J->ntrap; s++) {
+    int pos = J->n;
+    emitrr(J, 0, 1, X_MOVST, RL, RDI);
+    emitrr(J, 0, 1, X_MOVST, RCI, RSI);
+    callptr(J, cast(sol_Unsigned, cast_sizet(jh_trap)));
+    testeax(J);
+    jump(J, CC_E, FX_POS, J->trap[s].back);
+    jump(J, CC_ALWAYS, FX_EXIT, J->trap[s].exitpc);
+    J->trap[s].back = pos;  /* now the position of the stub itself */
+  }
+  for (f = 0; f < J->nfix; f++) {  /* (exits add fixups to the list) */
+    int pc = J->fix[f].target;
+    if (J->fix[f].kind != FX_EXIT || J->exitpos[pc] >= 0)
+      continue;  /* not an exit or stub already done */
+    else {
+      J->exitpos[pc] = J->n;
+      movptr(J, RAX, J->p->code + pc);
+      emitmem(J, 0, 1, X_MOVST, RAX, RCI, CISAVEDPC);
+      eb(J, 0xB8); e32(J, SOLJ_EXIT);  /* mov eax, SOLJ_EXIT */
+      jump(J, CC_ALWAYS, FX_EPILOGUE, 0);
+    }
+  }
+}
+
+
+static void resolve (JitBuf *J) {
+  int f;
+  for (f = 0; f < J->nfix && !J->failed; f++) {
+    Fixup *fx = &J->fix[f];
+    int dest;
+    switch (fx->kind) {
+      case FX_LABEL: dest = J->label[fx->target]; break;
+      case FX_EXIT: dest = J->exitpos[fx->target]; break;
+      case FX_TRAP: dest = J->trap[fx->target].back; break;
+      case FX_POS: dest = fx->target; break;
+      default: dest = J->epilogue; break;
+    }
+    patch(J, fx->at, dest);
+  }
+}
+
+
+/*
+** Compile prototype 'p'; returns its native code or NULL if it cannot
+** be compiled. Vararg functions are left to the interpreter, which
+** has to adjust their frames.
+*/
+static void *compile (sol_State *L, Proto *p) {
+  JitBuf J;
+  void *code = NULL;
+  int n = p->sizecode;
+  int pc;
+  if (p->is_vararg || sizeof(sol_Integer) != 8 || SVSIZE != 16 ||
+      sizeof(l_signalT) != 4)
+    return NULL;
+  memset(&J, 0, sizeof(J));
+  J.L = L;
+  J.p = p;
+  J.label = cast(int *, jitrealloc(&J, NULL, 0, (n + 1) * sizeof(int)));
+  J.exitpos = cast(int *, jitrealloc(&J, NULL, 0, (n + 1) * sizeof(int)));
+  if (!J.failed) {
+    for (pc = 0; pc <= n; pc++)
+      J.exitpos[pc] = -1;
+    prologue(&J);
+    for (pc = 0; pc < n; pc++) {
+      J.label[pc] = J.n;
+      compileop(&J, pc);
+    }
+    J.label[n] = J.n;
+    epilogue(&J);
+    stubs(&J);
+    resolve(&J);
+    if (!J.failed)
+      code = newcode(J.code, J.n);
+  }
+  jitrealloc(&J, J.code, J.size, 0);
+  jitrealloc(&J, J.fix, J.sizefix * sizeof(Fixup), 0);
+  jitrealloc(&J, J.trap, J.sizetrap * sizeof(TrapStub), 0);
+  if (J.label != NULL)
+    jitrealloc(&J, J.label, (n + 1) * sizeof(int), 0);
+  if (J.exitpos != NULL)
+    jitrealloc(&J, J.exitpos, (n + 1) * sizeof(int), 0);
+  return code;
+}
+
+
+JitState *solJ_state (sol_State *L) {
+  global_State *g = G(L);
+  if (g->jit == NULL) {
+    JitState *js = solM_new(L, JitState);
+    js->on = 0;
+    js->hotcount = SOLI_JITHOT;
+    js->ncode = 0;
+    js->retired = NULL;
+    js->nretired = js->sizeretired = 0;
+    g->jit = js;
+  }
+  return g->jit;
+}
+
+
+/*
+** Called when a Sol function starts: run its native code, compiling
+** it first if it became hot.
+*/
+int solJ_enter (sol_State *L, CallInfo *ci) {
+  Proto *p = ci_func(ci)->p;
+  int status;
+  if (ci->u.l.savedpc != p->code) {  /* resuming an interrupted frame? */
+    ci->callstatus &= ~CIST_JIT;  /* its native frame is gone */
+    return SOLJ_NOCODE;
+  }
+  if (l_unlikely(p->jitcode == NULL)) {
+    JitState *js = G(L)->jit;
+    if (p->jitcount < 0 || ++p->jitcount < js->hotcount)
+      return SOLJ_NOCODE;
+    p->jitcode = compile(L, p);
+    if (p->jitcode == NULL) {
+      p->jitcount = -1;  /* do not try again */
+      return SOLJ_NOCODE;
+    }
+    js->ncode++;
+  }
+  ci->callstatus |= CIST_JIT;
+  status = (*cast(NativeCode, p->jitcode))(L, ci);
+  ci->callstatus &= ~CIST_JIT;
+  return status;
+}
+
+
+static int runsnative (sol_State *L1) {
+  CallInfo *ci;
+  for (ci = L1->ci; ci != NULL; ci = ci->previous) {
+    if (ci->callstatus & CIST_JIT)
+      return 1;
+  }
+  return 0;
+}
+
+
+static void freeretired (JitState *js) {
+  while (js->nretired > 0)
+    freecode(js->retired[--js->nretired]);
+}
+
+
+/*
+** Retire the code of all prototypes in list 'o'. Returns whether some
+** thread in the list runs native code.
+*/
+static int flushlist (sol_State *L, JitState *js, GCObject *o) {
+  int active = 0;
+  for (; o != NULL; o = o->next) {
+    if (o->tt == SOL_VPROTO) {
+      Proto *p = gco2p(o);
+      if (p->jitcode != NULL) {
+        solM_growvector(L, js->retired, js->nretired, js->sizeretired,
+                        void *, MAX_INT, "retired code");
+        js->retired[js->nretired++] = p->jitcode;
+        p->jitcode = NULL;
+        js->ncode--;
+      }
+      p->jitcount = 0;
+    }
+    else if (o->tt == SOL_VTHREAD && runsnative(gco2th(o)))
+      active = 1;
+  }
+  return active;
+}
+
+
+/*
+** Discard the native code of all functions. Code that may be running
+** (in some thread with a native frame) is only freed in a later flush
+** or when the state is closed.
+*/
+void solJ_flush (sol_State *L) {
+  global_State *g = G(L);
+  JitState *js = g->jit;
+  int active;
+  if (js == NULL)
+    return;
+  solC_waitsweeper(L);  /* old objects must be in 'allgc' */
+  active = runsnative(g->mainthread);
+  active |= flushlist(L, js, g->allgc);
+  active |= flushlist(L, js, g->frozen);
+  if (!active)
+    freeretired(js);
+}
+
+
+void solJ_freeproto (sol_State *L, Proto *f) {
+  if (f->jitcode != NULL) {
+    freecode(f->jitcode);
+    G(L)->jit->ncode--;
+  }
+}
+
+
+void solJ_close (sol_State *L) {
+  JitState *js = G(L)->jit;
+  if (js != NULL) {
+    freeretired(js);
+    solM_freearray(L, js->retired, js->sizeretired);
+    solM_free(L, js);
+    G(L)->jit = NULL;
+  }
+}
+
+/* }================================================================== */
+
+#endif
@@ -0,0 +1,73 @@
+/*
+** $Id: ljit.h $
+** Baseline (template) compiler to native code
+** See Copyright Notice in sol.h
+*/
+
+#ifndef ljit_h
+#define ljit_h
+
+
+#include "lobject.h"
+#include "lstate.h"
+
+
+/*
+** The compiler generates x86-64 code and needs to map executable
+** memory, so it is available only on x86-64 Linux with the default
+** (double) float type. Define SOL_NOJIT to build without it.
+*/
+#if !defined(SOL_USE_JIT)
+#if defined(__x86_64__) && defined(__linux__) && !defined(SOL_NOJIT) && \
+    SOL_FLOAT_TYPE == SOL_FLOAT_DOUBLE
+#define SOL_USE_JIT	1
+#else
+#define SOL_USE_JIT	0
+#endif
+#endif
+
+
+/*
+** Default number of calls to a function before it is compiled (its
+** "hotness"); it can be changed with 'sol_jit'.
+*/
+#if !defined(SOLI_JITHOT)
+#define SOLI_JITHOT	50
+#endif
+
+
+/* results of 'solJ_enter' */
+#define SOLJ_RETURN	0	/* native code returned from the function */
+#define SOLJ_EXIT	1	/* interpreter must continue at 'savedpc' */
+#define SOLJ_NOCODE	2	/* no native code; interpret the function */
+
+
+typedef struct JitState {
+  lu_byte on;  /* true if compiled code can run */
+  int hotcount;  /* calls before a function is compiled */
+  int ncode;  /* number of functions with native code */
+  void **retired;  /* flushed code that may still be running */
+  int nretired;  /* number of entries in 'retired' */
+  int sizeretired;  /* size of 'retired' */
+} JitState;
+
+
+#define solJ_isenabled(g)	((g)->jit != NULL && (g)->jit->on)
+
+
+#if SOL_USE_JIT
+
+SOLI_FUNC JitState *solJ_state (sol_State *L);
+SOLI_FUNC int solJ_enter (sol_State *L, CallInfo *ci);
+SOLI_FUNC void solJ_flush (sol_State *L);
+SOLI_FUNC void solJ_freeproto (sol_State *L, Proto *f);
+SOLI_FUNC void solJ_close (sol_State *L);
+
+#else
+
+#define solJ_freeproto(L,f)	((void)0)
+#define solJ_close(L)		((void)0)
+
+#endif
+
+#endif
@@ -0,0 +1,83 @@
+/*
+** $Id: ljitlib.c $
+** Library to control the baseline compiler
+** See Copyright Notice in sol.h
+*/
+
+#define ljitlib_c
+#define SOL_LIB
+
+#include "lprefix.h"
+
+
+#include <limits.h>
+
+#include "sol.h"
+
+#include "lauxlib.h"
+#include "sollib.h"
+
+
+/*
+** jit.on([hotcount]): enable the compiler, optionally setting how many
+** calls make a function "hot"
+*/
+static int jit_on (sol_State *L) {
+  sol_Integer hot = solL_optinteger(L, 1, 0);
+  solL_argcheck(L, 0 <= hot && hot <= INT_MAX, 1, "value out of range");
+  if (sol_jit(L, SOL_JITON) < 0) {  /* not available? */
+    solL_pushfail(L);
+    sol_pushliteral(L, "JIT compiler not available");
+    return 2;
+  }
+  if (hot > 0)
+    sol_jit(L, SOL_JITSETHOT, (int)hot);
+  sol_pushboolean(L, 1);
+  return 1;
+}
+
+
+static int jit_off (sol_State *L) {
+  sol_jit(L, SOL_JITOFF);
+  return 0;
+}
+
+
+static int jit_flush (sol_State *L) {
+  sol_jit(L, SOL_JITFLUSH);
+  return 0;
+}
+
+
+/*
+** jit.status(): whether the compiler is on, the number of compiled
+** functions, and the hot count
+*/
+static int jit_status (sol_State *L) {
+  int on = sol_jit(L, SOL_JITISON);
+  if (on < 0) {  /* not available? */
+    sol_pushboolean(L, 0);
+    return 1;
+  }
+  sol_pushboolean(L, on);
+  sol_pushinteger(L, sol_jit(L, SOL_JITCOUNT));
+  sol_pushinteger(L, sol_jit(L, SOL_JITSETHOT, 0));
+  return 3;
+}
+
+
+static const solL_Reg jit_funcs[] = {
+  {"on", jit_on},
+  {"off", jit_off},
+  {"flush", jit_flush},
+  {"status", jit_status},
+  {NULL, NULL}
+};
+
+
+
+SOLMOD_API int solopen_jit (sol_State *L) {
+  solL_newlib(L, jit_funcs);
+  return 1;
+}
+
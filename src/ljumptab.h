@@ -107,6 +107,16 @@ static const void *const disptab[NUM_OPCODES] = {
 &&L_OP_CLOSURE,
 &&L_OP_VARARG,
 &&L_OP_VARARGPREP,
-&&L_OP_EXTRAARG
+&&L_OP_EXTRAARG,
+&&L_OP_ADDII,
+&&L_OP_ADDFF,
+&&L_OP_SUBII,
+&&L_OP_SUBFF,
+&&L_OP_MULII,
+&&L_OP_MULFF,
+&&L_OP_LTII,
+&&L_OP_LTFF,
+&&L_OP_LEII,
+&&L_OP_LEFF
 
 };
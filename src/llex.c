@@ -134,13 +134,15 @@ l_noret solX_syntaxerror (LexState *ls, const char *msg) {
 TString *solX_newstring (LexState *ls, const char *str, size_t l) {
   sol_State *L = ls->L;
   TString *ts = solS_newlstr(L, str, l);  /* create new string */
-  const TValue *o = solH_getstr(ls->h, ts);
-  if (!ttisnil(o))  /* string already present? */
-    ts = keystrval(nodefromval(o));  /* get saved copy */
+  const TValue *o = solH_Hgetstr(ls->h, ts);
+  if (!ttisnil(o)) {  /* string already present? */
+    if (ts->tt == SOL_VLNGSTR)  /* (short strings are unique) */
+      ts = keystrval(nodefromval(o));  /* get saved copy */
+  }
   else {  /* not in use yet */
     TValue *stv = s2v(L->top.p++);  /* reserve stack space for string */
     setsvalue(L, stv, ts);  /* temporarily anchor the string */
-    solH_finishset(L, ls->h, stv, o, stv);  /* t[string] = string */
+    solH_set(L, ls->h, stv, stv);  /* t[string] = string */
     /* table is not a metatable, so it does not need to invalidate cache */
     solC_checkGC(L);
     L->top.p--;  /* remove string from stack */
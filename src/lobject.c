@@ -10,6 +10,7 @@
 #include "lprefix.h"
 
 
+#include <float.h>
 #include <locale.h>
 #include <math.h>
 #include <stdarg.h>
@@ -146,6 +147,110 @@ static int isneg (const char **s) {
 
 
 
+/*
+** {==================================================================
+** Decimal scaling
+** ===================================================================
+*/
+
+/*
+** The fast conversions between floats and decimal numerals scale
+** numbers by powers of 10 with 64-bit integer arithmetic, tracking the
+** error, and fall back to the C library when the result could be
+** wrong. They need IEEE doubles and 64-bit integers; define
+** SOL_USE_FASTNUM as 0 to always use the C library.
+*/
+#if !defined(SOL_USE_FASTNUM)
+#if SOL_FLOAT_TYPE == SOL_FLOAT_DOUBLE && FLT_RADIX == 2 && \
+    DBL_MANT_DIG == 53 && (SOL_MAXINTEGER >> 62) == 1
+#define SOL_USE_FASTNUM		1
+#else
+#define SOL_USE_FASTNUM		0
+#endif
+#endif
+
+
+#if SOL_USE_FASTNUM	/* { */
+
+typedef sol_Unsigned FWord;  /* 64 bits */
+
+#define mk64(hi,lo)	((cast(FWord, hi) << 32) | cast(FWord, lo))
+
+
+/*
+** Normalized 64-bit approximations (with binary exponents) of 10^-348,
+** 10^-340, ..., 10^340
+*/
+static const struct {
+  l_uint32 hi, lo;
+  short e;
+} tenpow[] = {
+  {0xfa8fd5a0u, 0x081c0288u, -1220}, {0xbaaee17fu, 0xa23ebf76u, -1193},
+  {0x8b16fb20u, 0x3055ac76u, -1166}, {0xcf42894au, 0x5dce35eau, -1140},
+  {0x9a6bb0aau, 0x55653b2du, -1113}, {0xe61acf03u, 0x3d1a45dfu, -1087},
+  {0xab70fe17u, 0xc79ac6cau, -1060}, {0xff77b1fcu, 0xbebcdc4fu, -1034},
+  {0xbe5691efu, 0x416bd60cu, -1007}, {0x8dd01fadu, 0x907ffc3cu, -980},
+  {0xd3515c28u, 0x31559a83u, -954}, {0x9d71ac8fu, 0xada6c9b5u, -927},
+  {0xea9c2277u, 0x23ee8bcbu, -901}, {0xaecc4991u, 0x4078536du, -874},
+  {0x823c1279u, 0x5db6ce57u, -847}, {0xc2109436u, 0x4dfb5637u, -821},
+  {0x9096ea6fu, 0x3848984fu, -794}, {0xd77485cbu, 0x25823ac7u, -768},
+  {0xa086cfcdu, 0x97bf97f4u, -741}, {0xef340a98u, 0x172aace5u, -715},
+  {0xb23867fbu, 0x2a35b28eu, -688}, {0x84c8d4dfu, 0xd2c63f3bu, -661},
+  {0xc5dd4427u, 0x1ad3cdbau, -635}, {0x936b9fceu, 0xbb25c996u, -608},
+  {0xdbac6c24u, 0x7d62a584u, -582}, {0xa3ab6658u, 0x0d5fdaf6u, -555},
+  {0xf3e2f893u, 0xdec3f126u, -529}, {0xb5b5ada8u, 0xaaff80b8u, -502},
+  {0x87625f05u, 0x6c7c4a8bu, -475}, {0xc9bcff60u, 0x34c13053u, -449},
+  {0x964e858cu, 0x91ba2655u, -422}, {0xdff97724u, 0x70297ebdu, -396},
+  {0xa6dfbd9fu, 0xb8e5b88fu, -369}, {0xf8a95fcfu, 0x88747d94u, -343},
+  {0xb9447093u, 0x8fa89bcfu, -316}, {0x8a08f0f8u, 0xbf0f156bu, -289},
+  {0xcdb02555u, 0x653131b6u, -263}, {0x993fe2c6u, 0xd07b7facu, -236},
+  {0xe45c10c4u, 0x2a2b3b06u, -210}, {0xaa242499u, 0x697392d3u, -183},
+  {0xfd87b5f2u, 0x8300ca0eu, -157}, {0xbce50864u, 0x92111aebu, -130},
+  {0x8cbccc09u, 0x6f5088ccu, -103}, {0xd1b71758u, 0xe219652cu, -77},
+  {0x9c400000u, 0x00000000u, -50}, {0xe8d4a510u, 0x00000000u, -24},
+  {0xad78ebc5u, 0xac620000u, 3}, {0x813f3978u, 0xf8940984u, 30},
+  {0xc097ce7bu, 0xc90715b3u, 56}, {0x8f7e32ceu, 0x7bea5c70u, 83},
+  {0xd5d238a4u, 0xabe98068u, 109}, {0x9f4f2726u, 0x179a2245u, 136},
+  {0xed63a231u, 0xd4c4fb27u, 162}, {0xb0de6538u, 0x8cc8ada8u, 189},
+  {0x83c7088eu, 0x1aab65dbu, 216}, {0xc45d1df9u, 0x42711d9au, 242},
+  {0x924d692cu, 0xa61be758u, 269}, {0xda01ee64u, 0x1a708deau, 295},
+  {0xa26da399u, 0x9aef774au, 322}, {0xf209787bu, 0xb47d6b85u, 348},
+  {0xb454e4a1u, 0x79dd1877u, 375}, {0x865b8692u, 0x5b9bc5c2u, 402},
+  {0xc83553c5u, 0xc8965d3du, 428}, {0x952ab45cu, 0xfa97a0b3u, 455},
+  {0xde469fbdu, 0x99a05fe3u, 481}, {0xa59bc234u, 0xdb398c25u, 508},
+  {0xf6c69a72u, 0xa3989f5cu, 534}, {0xb7dcbf53u, 0x54e9beceu, 561},
+  {0x88fcf317u, 0xf22241e2u, 588}, {0xcc20ce9bu, 0xd35c78a5u, 614},
+  {0x98165af3u, 0x7b2153dfu, 641}, {0xe2a0b5dcu, 0x971f303au, 667},
+  {0xa8d9d153u, 0x5ce3b396u, 694}, {0xfb9b7cd9u, 0xa4a7443cu, 720},
+  {0xbb764c4cu, 0xa7a44410u, 747}, {0x8bab8eefu, 0xb6409c1au, 774},
+  {0xd01fef10u, 0xa657842cu, 800}, {0x9b10a4e5u, 0xe9913129u, 827},
+  {0xe7109bfbu, 0xa19c0c9du, 853}, {0xac2820d9u, 0x623bf429u, 880},
+  {0x80444b5eu, 0x7aa7cf85u, 907}, {0xbf21e440u, 0x03acdd2du, 933},
+  {0x8e679c2fu, 0x5e44ff8fu, 960}, {0xd433179du, 0x9c8cb841u, 986},
+  {0x9e19db92u, 0xb4e31ba9u, 1013}, {0xeb96bf6eu, 0xbadf77d9u, 1039},
+  {0xaf87023bu, 0x9bf0ee6bu, 1066},
+};
+
+#define TENPOWMIN	(-348)	/* decimal exponent of first power */
+#define TENPOWSTEP	8	/* distance between decimal exponents */
+#define NTENPOW		cast_int(sizeof(tenpow) / sizeof(tenpow[0]))
+
+
+/* high half of the 128-bit product 'a * b', rounded */
+static FWord mulhi (FWord a, FWord b) {
+  FWord a1 = a >> 32, a0 = a & 0xFFFFFFFFu;
+  FWord b1 = b >> 32, b0 = b & 0xFFFFFFFFu;
+  FWord p11 = a1 * b1, p10 = a1 * b0, p01 = a0 * b1, p00 = a0 * b0;
+  FWord mid = (p00 >> 32) + (p10 & 0xFFFFFFFFu) + (p01 & 0xFFFFFFFFu);
+  mid += cast(FWord, 1) << 31;  /* round */
+  return p11 + (p10 >> 32) + (p01 >> 32) + (mid >> 32);
+}
+
+#endif					/* } */
+
+/* }================================================================== */
+
+
 /*
 ** {==================================================================
 ** Sol's implementation for 'sol_strx2number'
@@ -215,6 +320,220 @@ static sol_Number sol_strx2number (const char *s, char **endptr) {
 /* }====================================================== */
 
 
+/*
+** {==================================================================
+** Fast conversion of decimal numerals
+** ===================================================================
+*/
+
+#if SOL_USE_FASTNUM	/* { */
+
+/* powers of 10 that are exact as doubles */
+static const double exactpow10[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12,
+  1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/*
+** Whether 'w * 10^e' (or 'w / 10^-e') is correctly rounded when both
+** operands are exact; not with excess precision (as in x87).
+*/
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+#define EXACTMUL	1
+#else
+#define EXACTMUL	0
+#endif
+
+
+/* shift 'f' (not zero) until its top bit is set, updating exponent 'e' */
+static FWord normalize (FWord f, int *e) {
+  int n = 0;
+  if ((f >> 32) == 0) { f <<= 32; n += 32; }
+  if ((f >> 48) == 0) { f <<= 16; n += 16; }
+  if ((f >> 56) == 0) { f <<= 8; n += 8; }
+  if ((f >> 60) == 0) { f <<= 4; n += 4; }
+  if ((f >> 62) == 0) { f <<= 2; n += 2; }
+  if ((f >> 63) == 0) { f <<= 1; n += 1; }
+  *e -= n;
+  return f;
+}
+
+
+/*
+** Float nearest to 'w * 10^e10', where 'w' has at most 19 digits and
+** is not zero; 'err' is its error in eighths of a unit. Based on
+** 'DiyFpStrtod' from the double-conversion library: 'w' is scaled by
+** the cached power of 10 below 10^e10 and by an exact power of 10
+** (each product adding half a unit of error), and the result is
+** rounded to 53 bits. Returns 0 if the error makes that rounding
+** uncertain or if the result is not a normal float.
+*/
+static int scaledecimal (FWord w, int e10, FWord err, double *res) {
+  int e2 = 0;
+  int i, adj, sh;
+  FWord bits;
+  const FWord half = cast(FWord, 1) << 10 << 3;  /* in eighths */
+  if (e10 < TENPOWMIN || (e10 - TENPOWMIN) / TENPOWSTEP >= NTENPOW)
+    return 0;
+  w = normalize(w, &e2);
+  err <<= -e2;
+  i = (e10 - TENPOWMIN) / TENPOWSTEP;
+  adj = e10 - (TENPOWMIN + i * TENPOWSTEP);  /* 0 to 7 */
+  if (adj > 0) {  /* multiply by 10^adj first */
+    static const l_uint32 small[] = {10, 100, 1000, 10000, 100000,
+                                     1000000, 10000000};
+    int pe = 0;
+    FWord p = normalize(small[adj - 1], &pe);
+    w = mulhi(w, p);
+    e2 += pe + 64;
+    err += 4;
+    sh = e2;
+    w = normalize(w, &e2);
+    err <<= sh - e2;
+  }
+  w = mulhi(w, mk64(tenpow[i].hi, tenpow[i].lo));
+  e2 += tenpow[i].e + 64;
+  err += 4 + (err != 0) + 4;  /* power, product, and rounding errors */
+  sh = e2;
+  w = normalize(w, &e2);
+  err <<= sh - e2;
+  /* value is 'w * 2^e2'; a double keeps the top 53 bits of 'w' */
+  if (err >= half || e2 + 63 < DBL_MIN_EXP - 1 || e2 + 64 > DBL_MAX_EXP)
+    return 0;  /* too inaccurate, subnormal, or too large */
+  bits = (w & 0x7FF) << 3;
+  if (half - err < bits && bits < half + err)
+    return 0;  /* too close to the halfway point */
+  w >>= 11;
+  e2 += 11;
+  if (bits >= half + err) {  /* round up? */
+    w++;
+    if ((w >> 53) != 0) {  /* carry? */
+      w >>= 1;
+      e2++;
+    }
+  }
+  if (e2 + 53 > DBL_MAX_EXP)
+    return 0;  /* overflow */
+  *res = l_mathop(ldexp)(cast_num(w), e2);
+  return 1;
+}
+
+
+/*
+** Convert a plain decimal numeral (an optional sign, digits with an
+** optional dot, and an optional exponent, between optional spaces)
+** without 'strtod'. Returns the address of the ending '\0', or NULL if
+** 's' is not such a numeral or if the conversion might not be exact;
+** then the caller must use 'strtod'.
+*/
+static const char *l_str2dfast (const char *s, sol_Number *result) {
+  FWord w = 0;  /* significand (up to 19 significant digits) */
+  int nd = 0;  /* number of significant digits in 'w' */
+  int e10 = 0;  /* decimal exponent */
+  int ndigits = 0;  /* total number of digits */
+  int hasdot = 0;
+  int roundup = 0;  /* first dropped digit is 5 or more */
+  int dropped = 0;  /* some digits did not fit in 'w' */
+  int neg;
+  double x;
+  while (lisspace(cast_uchar(*s))) s++;  /* skip initial spaces */
+  neg = isneg(&s);
+  for (;; s++) {
+    if (lisdigit(cast_uchar(*s))) {
+      int d = *s - '0';
+      ndigits++;
+      if (nd < 19) {
+        if (w != 0 || d != 0) {  /* not a leading zero? */
+          w = w * 10 + d;
+          nd++;
+        }
+        if (hasdot) e10--;
+      }
+      else {  /* digit does not fit */
+        if (!dropped)
+          roundup = (d >= 5);
+        dropped |= 1;
+        if (!hasdot) e10++;
+      }
+    }
+    else if (*s == '.' && !hasdot)
+      hasdot = 1;
+    else break;
+  }
+  if (ndigits == 0)
+    return NULL;
+  if (*s == 'e' || *s == 'E') {  /* exponent? */
+    int exp = 0;
+    int eneg;
+    s++;  /* skip 'e' */
+    eneg = isneg(&s);
+    if (!lisdigit(cast_uchar(*s)))
+      return NULL;
+    for (; lisdigit(cast_uchar(*s)); s++) {
+      if (exp < 100000)  /* (larger exponents give 0 or inf anyway) */
+        exp = exp * 10 + (*s - '0');
+    }
+    e10 += (eneg) ? -exp : exp;
+  }
+  while (lisspace(cast_uchar(*s))) s++;  /* skip trailing spaces */
+  if (*s != '\0')
+    return NULL;
+  if (w == 0)
+    x = 0.0;
+  else if (EXACTMUL && !dropped && (w >> 53) == 0 &&
+           -22 <= e10 && e10 <= 22) {  /* both operands are exact? */
+    x = cast_num(w);
+    x = (e10 < 0) ? x / exactpow10[-e10] : x * exactpow10[e10];
+  }
+  else if (!scaledecimal(w + roundup, e10, (dropped ? 4 : 0), &x))
+    return NULL;
+  *result = (neg) ? -x : x;
+  return s;
+}
+
+
+/*
+** Value of the 'n' decimal digits at 's', eight of them at a time
+** (combining the digits of a 64-bit word in three multiplications).
+*/
+static sol_Unsigned digitsvalue (const char *s, int n) {
+  sol_Unsigned a = 0;
+  for (; n >= 8; n -= 8, s += 8) {
+    FWord v = cast(FWord, cast_uchar(s[0]))       |
+              cast(FWord, cast_uchar(s[1])) << 8  |
+              cast(FWord, cast_uchar(s[2])) << 16 |
+              cast(FWord, cast_uchar(s[3])) << 24 |
+              cast(FWord, cast_uchar(s[4])) << 32 |
+              cast(FWord, cast_uchar(s[5])) << 40 |
+              cast(FWord, cast_uchar(s[6])) << 48 |
+              cast(FWord, cast_uchar(s[7])) << 56;
+    v -= mk64(0x30303030u, 0x30303030u);
+    v = (v * 10) + (v >> 8);  /* pairs of digits */
+    v = ((v & mk64(0xFFu, 0xFFu)) * mk64(1000000u, 100u) +
+         ((v >> 16) & mk64(0xFFu, 0xFFu)) * mk64(10000u, 1u)) >> 32;
+    a = a * 100000000u + (v & 0xFFFFFFFFu);
+  }
+  for (; n > 0; n--, s++)
+    a = a * 10 + cast_uint(*s - '0');
+  return a;
+}
+
+#else					/* }{ */
+
+#define l_str2dfast(s,r)	NULL
+
+static sol_Unsigned digitsvalue (const char *s, int n) {
+  sol_Unsigned a = 0;
+  for (; n > 0; n--, s++)
+    a = a * 10 + cast_uint(*s - '0');
+  return a;
+}
+
+#endif					/* } */
+
+/* }================================================================== */
+
+
 /* maximum length of a numeral to be converted to a number */
 #if !defined (L_MAXLENNUM)
 #define L_MAXLENNUM	200
@@ -254,6 +573,8 @@ static const char *l_str2d (const char *s, sol_Number *result) {
   int mode = pmode ? ltolower(cast_uchar(*pmode)) : 0;
   if (mode == 'n')  /* reject 'inf' and 'nan' */
     return NULL;
+  if (mode != 'x' && (endptr = l_str2dfast(s, result)) != NULL)
+    return endptr;  /* plain decimal numeral converted */
   endptr = l_str2dloc(s, result, mode);  /* try to convert */
   if (endptr == NULL) {  /* failed? may be a different locale */
     char buff[L_MAXLENNUM + 1];
@@ -273,6 +594,13 @@ static const char *l_str2d (const char *s, sol_Number *result) {
 #define MAXBY10		cast(sol_Unsigned, SOL_MAXINTEGER / 10)
 #define MAXLASTD	cast_int(SOL_MAXINTEGER % 10)
 
+/* number of decimal digits that always fit in a 'sol_Integer' */
+#if (SOL_MAXINTEGER >> 62) == 1
+#define SAFEDIGITS	18
+#else
+#define SAFEDIGITS	9
+#endif
+
 static const char *l_str2int (const char *s, sol_Integer *result) {
   sol_Unsigned a = 0;
   int empty = 1;
@@ -288,12 +616,22 @@ static const char *l_str2int (const char *s, sol_Integer *result) {
     }
   }
   else {  /* decimal */
-    for (; lisdigit(cast_uchar(*s)); s++) {
-      int d = *s - '0';
-      if (a >= MAXBY10 && (a > MAXBY10 || d > MAXLASTD + neg))  /* overflow? */
-        return NULL;  /* do not accept it (as integer) */
-      a = a * 10 + d;
-      empty = 0;
+    const char *e = s;
+    while (lisdigit(cast_uchar(*e))) e++;
+    if (e - s <= SAFEDIGITS) {  /* no overflow? */
+      a = digitsvalue(s, cast_int(e - s));
+      empty = (e == s);
+      s = e;
+    }
+    else {
+      for (; lisdigit(cast_uchar(*s)); s++) {
+        int d = *s - '0';
+        if (a >= MAXBY10 &&
+            (a > MAXBY10 || d > MAXLASTD + neg))  /* overflow? */
+          return NULL;  /* do not accept it (as integer) */
+        a = a * 10 + d;
+        empty = 0;
+      }
     }
   }
   while (lisspace(cast_uchar(*s))) s++;  /* skip trailing spaces */
@@ -349,6 +687,306 @@ int solO_utf8esc (char *buff, unsigned long x) {
 #define MAXNUMBER2STR	44
 
 
+/*
+** {==================================================================
+** Conversion of numbers to decimal
+** ===================================================================
+*/
+
+/* "00" to "99", to write integers two digits at a time */
+static const char digitpairs[] =
+  "00010203040506070809101112131415161718192021222324252627282930313233"
+  "34353637383940414243444546474849505152535455565758596061626364656667"
+  "6869707172737475767778798081828384858687888990919293949596979899";
+
+
+/*
+** Write 'i' in decimal into 'buff', as 'sol_integer2str' would, and
+** return its length.
+*/
+static int int2str (char *buff, sol_Integer i) {
+  char temp[MAXNUMBER2STR];
+  char *p = temp + sizeof(temp);
+  sol_Unsigned u = l_castS2U(i);
+  int len;
+  if (i < 0)
+    u = 0u - u;
+  while (u >= 100) {
+    unsigned int d = cast_uint(u % 100);
+    u /= 100;
+    p -= 2;
+    memcpy(p, digitpairs + 2 * d, 2);
+  }
+  if (u >= 10) {
+    p -= 2;
+    memcpy(p, digitpairs + 2 * cast_uint(u), 2);
+  }
+  else
+    *--p = cast_char('0' + cast_int(u));
+  if (i < 0)
+    *--p = '-';
+  len = cast_int(temp + sizeof(temp) - p);
+  memcpy(buff, p, len);
+  buff[len] = '\0';
+  return len;
+}
+
+
+/*
+** Floats are converted by the method of Grisu (Florian Loitsch,
+** "Printing Floating-Point Numbers Quickly and Accurately with
+** Integers"), in its variant for a fixed number of digits: the float
+** is scaled by a power of 10, and the digits come from the fixed-point
+** result. The error of the scaling is tracked, and when it does not
+** allow to decide how the last digit rounds (a rare case), the
+** conversion falls back to 'l_sprintf'. So, the result is always the
+** correctly rounded one that 'printf' gives.
+*/
+#if SOL_USE_FASTNUM	/* { */
+
+/*
+** Round digits 'd[0..n-1]', with 'rest' below the last one and an
+** error of 'unit', in a scale where the last digit is worth 'ten'.
+** Returns false if the error does not allow to decide; a carry out of
+** the first digit increments '*point'.
+*/
+static int rounddigits (char *d, int n, FWord rest, FWord ten,
+                        FWord unit, int *point) {
+  if (unit >= ten || ten - unit <= unit)
+    return 0;
+  if (ten - rest > rest && ten - 2 * rest >= 2 * unit)
+    return 1;  /* surely below the half: round down */
+  if (rest > unit && ten - (rest - unit) <= rest - unit) {
+    /* surely above the half: round up */
+    int i = n - 1;
+    d[i]++;
+    while (i > 0 && d[i] == '0' + 10) {
+      d[i] = '0';
+      d[--i]++;
+    }
+    if (d[0] == '0' + 10) {  /* carry out of the first digit? */
+      d[0] = '1';  /* (all other digits are zero now) */
+      (*point)++;
+    }
+    return 1;
+  }
+  return 0;
+}
+
+
+/*
+** Generate the decimal digits of 'x' (positive, normal, and finite)
+** into 'd': 'n' significant digits, or, if 'fixed', all digits up to
+** the n-th one after the decimal point. Returns the number of digits
+** (at most 17) and sets '*point' to the position of the decimal point
+** relative to them; returns -1 if it cannot do that. (With 'fixed', it
+** may return 0, when 'x' is below a tenth of the last digit.)
+*/
+static int gendigits (double x, int n, int fixed, char *d, int *point) {
+  int e2, k, q, sh, kappa, len, i;
+  FWord f, w, rest, unit, one;
+  l_uint32 ipart, div;
+  f = cast(FWord, l_mathop(ldexp)(l_mathop(frexp)(x, &e2), 53)) << 11;
+  /* x == f * 2^(e2 - 64); choose 'tenpow[i]' to scale it into a fixed
+     point number with 32 to 60 fractional bits */
+  k = cast_int(l_mathop(ceil)((3 - e2) * 0.30102999566398114));
+  i = (k - TENPOWMIN - 1) / TENPOWSTEP + 1;
+  q = TENPOWMIN + i * TENPOWSTEP;  /* scaled number is x * 10^q */
+  w = mulhi(f, mk64(tenpow[i].hi, tenpow[i].lo));
+  sh = -(e2 + tenpow[i].e);
+  sol_assert(32 <= sh && sh <= 60);
+  one = cast(FWord, 1) << sh;
+  ipart = cast(l_uint32, w >> sh);
+  rest = w & (one - 1);
+  unit = 1;  /* error of 'w' */
+  for (kappa = 1, div = 1; ipart / div >= 10; kappa++)
+    div *= 10;
+  /* 'kappa' is the number of digits of 'ipart' */
+  if (fixed) {
+    n += kappa - q;  /* significant digits up to the n-th decimal */
+    if (n < 0) {  /* surely rounds to zero? */
+      *point = 0;
+      return 0;
+    }
+  }
+  if (n <= 0 || n > 17)
+    return -1;
+  *point = kappa - q;
+  len = 0;
+  for (;;) {  /* digits from integer part */
+    d[len++] = cast_char('0' + ipart / div);
+    ipart %= div;
+    if (len == n) {
+      return rounddigits(d, len, (cast(FWord, ipart) << sh) + rest,
+                         cast(FWord, div) << sh, unit, point) ? len : -1;
+    }
+    else if (div == 1)
+      break;
+    div /= 10;
+  }
+  while (len < n && rest > unit) {  /* digits from fraction part */
+    rest *= 10;
+    unit *= 10;
+    d[len++] = cast_char('0' + cast_int(rest >> sh));
+    rest &= one - 1;
+  }
+  if (len < n || !rounddigits(d, len, rest, one, unit, point))
+    return -1;
+  return len;
+}
+
+
+/* add exponent 'e' to 'p' as 'printf' does: sign and 2+ digits */
+static char *addexp (char *p, int e) {
+  *p++ = 'e';
+  *p++ = (e < 0) ? '-' : '+';
+  if (e < 0) e = -e;
+  if (e >= 100) {
+    *p++ = cast_char('0' + e / 100);
+    e %= 100;
+  }
+  memcpy(p, digitpairs + 2 * e, 2);
+  return p + 2;
+}
+
+
+/*
+** Write 'x' into 'buff' as 'printf' with format "%.<prec><conv>",
+** for 'conv' one of 'e', 'f', or 'g'. Returns the length of the
+** result, or -1 if 'x' is zero, subnormal, or not finite, or if it
+** needs more than 17 significant digits or cannot be decided.
+*/
+static int fastfmt (char *buff, double x, int conv, int prec) {
+  char d[17];
+  char *p = buff;
+  char dp = sol_getlocaledecpoint();
+  int n, point, exp, nfrac, i;
+  if (x < 0) {
+    *p++ = '-';
+    x = -x;
+  }
+  if (!(DBL_MIN <= x && x <= DBL_MAX))
+    return -1;
+  switch (conv) {
+    case 'f': {
+      if (prec > 99 || (n = gendigits(x, prec, 1, d, &point)) < 0)
+        return -1;
+      if (point <= 0)
+        *p++ = '0';
+      for (i = 0; i < point; i++)  /* integer part */
+        *p++ = (i < n) ? d[i] : '0';
+      if (prec > 0) {
+        *p++ = dp;
+        for (i = point; i < point + prec; i++)  /* fraction part */
+          *p++ = (0 <= i && i < n) ? d[i] : '0';
+      }
+      break;
+    }
+    case 'e': case 'g': {
+      int g = (conv == 'g');
+      if (g && prec == 0) prec = 1;
+      n = g ? prec : prec + 1;
+      if (n > 17 || gendigits(x, n, 0, d, &point) < 0)
+        return -1;
+      exp = point - 1;
+      if (g) {  /* remove trailing zeros */
+        while (n > 1 && d[n - 1] == '0')
+          n--;
+      }
+      if (g && -4 <= exp && exp < prec) {  /* fixed notation */
+        if (point <= 0) {
+          *p++ = '0';
+          *p++ = dp;
+          for (i = point; i < 0; i++)
+            *p++ = '0';
+          memcpy(p, d, n);
+          p += n;
+        }
+        else {
+          for (i = 0; i < point; i++)
+            *p++ = (i < n) ? d[i] : '0';
+          if (n > point) {
+            *p++ = dp;
+            memcpy(p, d + point, n - point);
+            p += n - point;
+          }
+        }
+      }
+      else {  /* exponential notation */
+        *p++ = d[0];
+        nfrac = n - 1;
+        if (nfrac > 0) {
+          *p++ = dp;
+          memcpy(p, d + 1, nfrac);
+          p += nfrac;
+        }
+        p = addexp(p, exp);
+      }
+      break;
+    }
+    default: return -1;
+  }
+  *p = '\0';
+  return cast_int(p - buff);
+}
+
+#else					/* }{ */
+
+#define fastfmt(buff,x,conv,prec)	(-1)
+
+#endif					/* } */
+
+
+/*
+** Precision of SOL_NUMBER_FMT, if it has the form "%.<prec>g"; else -1.
+*/
+static int numberprec (void) {
+  const char *fmt = SOL_NUMBER_FMT;
+  int prec = 0;
+  if (fmt[0] != '%' || fmt[1] != '.')
+    return -1;
+  for (fmt += 2; lisdigit(cast_uchar(*fmt)); fmt++)
+    prec = prec * 10 + (*fmt - '0');
+  return (fmt[0] == 'g' && fmt[1] == '\0') ? prec : -1;
+}
+
+
+/*
+** Write float 'x' into 'buff' (with size 'sz') as 'printf' with format
+** "%.<prec><conv>" ('conv' is 'e', 'f', or 'g'), or with SOL_NUMBER_FMT
+** if 'conv' is 0. Returns the length of the result.
+*/
+int solO_fmtfloat (char *buff, size_t sz, sol_Number x, int conv,
+                                          int prec) {
+  int len;
+  if (conv == 0) {
+    prec = numberprec();
+    len = (prec >= 0) ? fastfmt(buff, x, 'g', prec) : -1;
+    if (len < 0)
+      len = sol_number2str(buff, sz, x);
+  }
+  else {
+    len = fastfmt(buff, x, conv, prec);
+    if (len < 0) {
+      char fmt[16];  /* "%.<prec><conv>", with length modifier */
+      char *f = fmt;
+      *f++ = '%';
+      *f++ = '.';
+      f += int2str(f, prec);
+      strcpy(f, SOL_NUMBER_FRMLEN);
+      f += strlen(f);
+      *f++ = cast_char(conv);
+      *f = '\0';
+      len = l_sprintf(buff, sz, fmt, (SOLI_UACNUMBER)x);
+    }
+  }
+  sol_assert(len >= 0 && cast_sizet(len) < sz);
+  return len;
+}
+
+/* }================================================================== */
+
+
 /*
 ** Convert a number object to a string, adding it to a buffer
 */
@@ -356,9 +994,9 @@ static int tostringbuff (TValue *obj, char *buff) {
   int len;
   sol_assert(ttisnumber(obj));
   if (ttisinteger(obj))
-    len = sol_integer2str(buff, MAXNUMBER2STR, ivalue(obj));
+    len = int2str(buff, ivalue(obj));
   else {
-    len = sol_number2str(buff, MAXNUMBER2STR, fltvalue(obj));
+    len = solO_fmtfloat(buff, MAXNUMBER2STR, fltvalue(obj), 0, 0);
     if (buff[strspn(buff, "-0123456789")] == '\0') {  /* looks like an int? */
       buff[len++] = sol_getlocaledecpoint();
       buff[len++] = '0';  /* adds '.0' to result */
@@ -542,7 +1180,7 @@ const char *solO_pushvfstring (sol_State *L, const char *fmt, va_list argp) {
   addstr2buff(&buff, fmt, strlen(fmt));  /* rest of 'fmt' */
   clearbuff(&buff);  /* empty buffer into the stack */
   sol_assert(buff.pushed == 1);
-  return getstr(tsvalue(s2v(L->top.p - 1)));
+  return solS_getstr(L, tsvalue(s2v(L->top.p - 1)));
 }
 
 
@@ -21,14 +21,15 @@
 */
 #define SOL_TUPVAL	SOL_NUMTYPES  /* upvalues */
 #define SOL_TPROTO	(SOL_NUMTYPES+1)  /* function prototypes */
-#define SOL_TDEADKEY	(SOL_NUMTYPES+2)  /* removed keys in tables */
+#define SOL_TSHAPE	(SOL_NUMTYPES+2)  /* table shapes */
+#define SOL_TDEADKEY	(SOL_NUMTYPES+3)  /* removed keys in tables */
 
 
 
 /*
 ** number of all possible types (including SOL_TNONE but excluding DEADKEY)
 */
-#define SOL_TOTALTYPES		(SOL_TPROTO + 2)
+#define SOL_TOTALTYPES		(SOL_TSHAPE + 2)
 
 
 /*
@@ -188,6 +189,9 @@ typedef union {
 /* Value returned for a key not found in a table (absent key) */
 #define SOL_VABSTKEY	makevariant(SOL_TNIL, 2)
 
+/* Special variant to signal that a fast get is accessing a non-table */
+#define SOL_VNOTABLE	makevariant(SOL_TNIL, 3)
+
 
 /* macro to test for (any kind of) nil */
 #define ttisnil(v)		checktype((v), SOL_TNIL)
@@ -216,6 +220,9 @@ typedef union {
 */
 #define isempty(v)		ttisnil(v)
 
+/* same test, for the type tag returned by a table access */
+#define tagisempty(tag)		(novariant(tag) == SOL_TNIL)
+
 
 /* macro defining a value corresponding to an absent key */
 #define ABSTKEYCONSTANT		{NULL}, SOL_VABSTKEY
@@ -381,34 +388,71 @@ typedef struct GCObject {
 
 
 /*
-** Header for a string value.
+** Header for a string value. The bytes of a short string follow its
+** header, from the position of 'contents'. A long string has them
+** elsewhere, pointed by 'contents': right after the header for a
+** regular string, in a block of their own for a rope or a slice, or in
+** memory owned by the host for an external string (which is released
+** with 'falloc' when the string is collected).
+** A rope is a long string built by a concatenation without copying
+** its operands: while 'contents' is NULL, its bytes are the ones of
+** 'left' followed by the ones of 'right' (which is never lazy).
+** A slice is a long string cut from another one without copying it:
+** its bytes are the ones of 'left' (its parent, which always has its
+** own bytes) from position 'offset'. Ropes and slices still without
+** their own bytes ('contents' is NULL) are lazy strings; a lazy string
+** gets its own bytes when something needs them in a block ending with
+** '\0'. Then a rope drops its pieces, but a slice keeps its parent, as
+** pointers into it may still be in use (see 'sol_tostringview').
 */
 typedef struct TString {
   CommonHeader;
   lu_byte extra;  /* reserved words for short strings; "has hash" for longs */
-  lu_byte shrlen;  /* length for short strings, 0xFF for long strings */
+  lu_byte shrlen;  /* length for short strings, kind for long strings */
   unsigned int hash;
   union {
     size_t lnglen;  /* length for long strings */
     struct TString *hnext;  /* linked list for hash table */
   } u;
-  char contents[1];
+  char *contents;  /* pointer to contents in long strings */
+  struct TString *left;  /* pieces of an unflattened rope; parent of a slice */
+  struct TString *right;
+  size_t offset;  /* position of a slice in its parent */
+  sol_Alloc falloc;  /* release function of an external string */
+  void *ud;  /* its user data */
 } TString;
 
 
+/* kinds of long strings (values of 'shrlen' above any short length) */
+#define LSTRREG		0xFF	/* regular string or rope */
+#define LSTRSLICE	0xFE	/* slice */
+#define LSTREXT		0xFD	/* external string */
+
+#define strisshr(ts)	((ts)->shrlen <= SOLI_MAXSHORTLEN)
+
+/* is 'ts' a rope or a slice still without its own bytes? */
+#define islazy(ts)	(!strisshr(ts) && (ts)->contents == NULL)
+#define isrope(ts)	(islazy(ts) && (ts)->shrlen == LSTRREG)
+#define isslice(ts)	((ts)->shrlen == LSTRSLICE)
+
+/* bytes of a slice in its parent (not always followed by a '\0') */
+#define slicestr(ts)	check_exp(isslice(ts), (ts)->left->contents + (ts)->offset)
+
 
 /*
 ** Get the actual string (array of bytes) from a 'TString'. (Generic
 ** version and specialized versions for long and short strings.)
+** Lazy strings must get their bytes before (see 'solS_getstr').
 */
-#define getstr(ts)	((ts)->contents)
-#define getlngstr(ts)	check_exp((ts)->shrlen == 0xFF, (ts)->contents)
-#define getshrstr(ts)	check_exp((ts)->shrlen != 0xFF, (ts)->contents)
+#define rawgetshrstr(ts)	(cast_charp(&(ts)->contents))
+#define getshrstr(ts)	check_exp(strisshr(ts), rawgetshrstr(ts))
+#define getlngstr(ts)	check_exp(!islazy(ts) && !strisshr(ts), (ts)->contents)
+#define getstr(ts)	(strisshr(ts) ? rawgetshrstr(ts) : getlngstr(ts))
 
 
 /* get string length from 'TString *s' */
 #define tsslen(s)  \
-	((s)->shrlen != 0xFF ? (s)->shrlen : (s)->u.lnglen)
+	(strisshr(s) ? (s)->shrlen : (s)->u.lnglen)
 
 /* }================================================================== */
 
@@ -544,6 +588,56 @@ typedef struct AbsLineInfo {
   int line;
 } AbsLineInfo;
 
+/*
+** Inline cache for an instruction that indexes a table with a constant
+** short-string key (OP_GETTABUP, OP_GETFIELD, and OP_SELF). 'slot' is
+** the index of the node (or, for a shaped table, of the slot) where the
+** key was last found; it is validated against the key stored in that
+** node (or in that position of the shape), so it can serve any table
+** with the same layout. 'islot' is the same for the '__index' table of a
+** method lookup. 'hits' and 'misses' are statistics for the debug
+** library (they wrap around).
+*/
+typedef struct ICache {
+  unsigned int slot;
+  unsigned int islot;
+  unsigned int hits;
+  unsigned int misses;
+} ICache;
+
+
+/*
+** Only instructions that use an inline cache have one (see 'hascache'),
+** so the caches of a prototype are found through a map: each entry
+** covers 32 instructions, with a bit in 'mask' for each of them that
+** has a cache and the number of caches of previous entries in 'base'.
+*/
+typedef struct ICMap {
+  unsigned int mask;
+  int base;
+} ICMap;
+
+
+/*
+** Description of a call inlined by the compiler: instructions in
+** [startpc, endpc) run the code of function 'p[fidx]', which the
+** original call found in local variable 'reg', with its frame
+** starting at register 'base'. 'line' is the line of the call. The
+** call wanted 'nres' results, and 'nilargs' tells whether the code
+** starts with a LOADNIL for missing arguments (see 'solK_inlinedpc').
+*/
+typedef struct InlineInfo {
+  int startpc;
+  int endpc;
+  int line;
+  short fidx;
+  lu_byte reg;
+  lu_byte base;
+  lu_byte nres;
+  lu_byte nilargs;
+} InlineInfo;
+
+
 /*
 ** Function Prototypes
 */
@@ -559,8 +653,12 @@ typedef struct Proto {
   int sizep;  /* size of 'p' */
   int sizelocvars;
   int sizeabslineinfo;  /* size of 'abslineinfo' */
+  int sizeicache;  /* size of 'icache' */
+  int sizeicmap;  /* size of 'icmap' */
+  int sizeinlined;  /* size of 'inlined' */
   int linedefined;  /* debug information  */
   int lastlinedefined;  /* debug information  */
+  int jitcount;  /* calls before compilation; -1 if not compilable */
   TValue *k;  /* constants used by the function */
   Instruction *code;  /* opcodes */
   struct Proto **p;  /* functions defined inside the function */
@@ -568,6 +666,10 @@ typedef struct Proto {
   ls_byte *lineinfo;  /* information about source lines (debug information) */
   AbsLineInfo *abslineinfo;  /* idem */
   LocVar *locvars;  /* information about local variables (debug information) */
+  InlineInfo *inlined;  /* information about inlined calls (debug information) */
+  ICache *icache;  /* inline caches */
+  ICMap *icmap;  /* map from instructions to inline caches */
+  void *jitcode;  /* native code for the function (NULL if none) */
   TString  *source;  /* used for debug information */
   GCObject *gclist;
 } Proto;
@@ -669,6 +771,45 @@ typedef union Closure {
 /* }================================================================== */
 
 
+/*
+** {==================================================================
+** Shapes
+** ===================================================================
+*/
+
+#define SOL_VSHAPE	makevariant(SOL_TSHAPE, 0)
+
+
+/*
+** A shape describes the string keys of a "shaped" table (see
+** ltable.h): their number and the slot of each one. Tables that got
+** the same keys in the same order share a shape. Shapes are immutable
+** and form a tree: each one extends its 'parent' with one key, the
+** last one in 'keys'. After the 'nfields' keys comes a small hash
+** index with 2^lsizeidx bytes, mapping keys to (slot + 1).
+*/
+typedef struct Shape {
+  CommonHeader;
+  lu_byte nfields;  /* number of keys */
+  lu_byte lsizeidx;  /* log2 of the size of the index */
+  unsigned int hash;  /* hash of 'parent' and the last key */
+  struct Shape *parent;  /* shape without the last key (NULL in root) */
+  struct Shape *hnext;  /* chain in the shape table */
+  TString *keys[1];  /* keys, in slot order */
+} Shape;
+
+
+/* index of a shape */
+#define shapeidx(s)	cast(lu_byte *, &(s)->keys[(s)->nfields])
+
+/* size of a shape with 'n' keys and an index of size 2^'ls' */
+#define sizeshape(n,ls)  \
+	(offsetof(Shape, keys) + cast_sizet(n) * sizeof(TString *) + \
+	 (cast_sizet(1) << (ls)))
+
+/* }================================================================== */
+
+
 /*
 ** {==================================================================
 ** Tables
@@ -734,12 +875,22 @@ typedef union Node {
 #define setnorealasize(t)	((t)->flags |= BITRAS)
 
 
+/*
+** When 'isnumarray(t)' is true, the array part is "typed": it keeps
+** raw numbers, all with the same type, and no type tags (see
+** ltable.h). Such arrays always have 'alimit' equal to their real size.
+*/
+#define BITNUMA		(1 << 6)
+#define isnumarray(t)		((t)->flags & BITNUMA)
+
+
 typedef struct Table {
   CommonHeader;
   lu_byte flags;  /* 1<<p means tagmethod(p) is not present */
   lu_byte lsizenode;  /* log2 of size of 'node' array */
   unsigned int alimit;  /* "limit" of 'array' array */
-  TValue *array;  /* array part */
+  Value *array;  /* array part (see ltable.h) */
+  TValue *slots;  /* values of the shape keys (see ltable.h) */
   Node *node;
   Node *lastfree;  /* any free position is before this position */
   struct Table *metatable;
@@ -802,6 +953,8 @@ SOLI_FUNC void solO_arith (sol_State *L, int op, const TValue *p1,
                            const TValue *p2, StkId res);
 SOLI_FUNC size_t solO_str2num (const char *s, TValue *o);
 SOLI_FUNC int solO_hexavalue (int c);
+SOLI_FUNC int solO_fmtfloat (char *buff, size_t sz, sol_Number x, int conv,
+                                                              int prec);
 SOLI_FUNC void solO_tostring (sol_State *L, TValue *obj);
 SOLI_FUNC const char *solO_pushvfstring (sol_State *L, const char *fmt,
                                                        va_list argp);
@@ -100,5 +100,31 @@ SOLI_DDEF const lu_byte solP_opmodes[NUM_OPCODES] = {
  ,opmode(0, 1, 0, 0, 1, iABC)		/* OP_VARARG */
  ,opmode(0, 0, 1, 0, 1, iABC)		/* OP_VARARGPREP */
  ,opmode(0, 0, 0, 0, 0, iAx)		/* OP_EXTRAARG */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_ADDII */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_ADDFF */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_SUBII */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_SUBFF */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_MULII */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_MULFF */
+ ,opmode(0, 0, 0, 1, 0, iABC)		/* OP_LTII */
+ ,opmode(0, 0, 0, 1, 0, iABC)		/* OP_LTFF */
+ ,opmode(0, 0, 0, 1, 0, iABC)		/* OP_LEII */
+ ,opmode(0, 0, 0, 1, 0, iABC)		/* OP_LEFF */
+};
+
+
+/* ORDER OP */
+
+SOLI_DDEF const lu_byte solP_genericop[NUM_OPCODES - OP_ADDII] = {
+  OP_ADD		/* OP_ADDII */
+ ,OP_ADD		/* OP_ADDFF */
+ ,OP_SUB		/* OP_SUBII */
+ ,OP_SUB		/* OP_SUBFF */
+ ,OP_MUL		/* OP_MULII */
+ ,OP_MUL		/* OP_MULFF */
+ ,OP_LT			/* OP_LTII */
+ ,OP_LT			/* OP_LTFF */
+ ,OP_LE			/* OP_LEII */
+ ,OP_LE			/* OP_LEFF */
 };
 
@@ -306,11 +306,23 @@ OP_VARARG,/*	A C	R[A], R[A+1], ..., R[A+C-2] = vararg		*/
 
 OP_VARARGPREP,/*A	(adjust vararg parameters)			*/
 
-OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
+OP_EXTRAARG,/*	Ax	extra (larger) argument for previous opcode	*/
+
+/* quickened opcodes (see note) */
+OP_ADDII,/*	A B C	R[A] := R[B] + R[C]  (integers)			*/
+OP_ADDFF,/*	A B C	R[A] := R[B] + R[C]  (floats)			*/
+OP_SUBII,/*	A B C	R[A] := R[B] - R[C]  (integers)			*/
+OP_SUBFF,/*	A B C	R[A] := R[B] - R[C]  (floats)			*/
+OP_MULII,/*	A B C	R[A] := R[B] * R[C]  (integers)			*/
+OP_MULFF,/*	A B C	R[A] := R[B] * R[C]  (floats)			*/
+OP_LTII,/*	A B k	if ((R[A] <  R[B]) ~= k) then pc++  (integers)	*/
+OP_LTFF,/*	A B k	if ((R[A] <  R[B]) ~= k) then pc++  (floats)	*/
+OP_LEII,/*	A B k	if ((R[A] <= R[B]) ~= k) then pc++  (integers)	*/
+OP_LEFF/*	A B k	if ((R[A] <= R[B]) ~= k) then pc++  (floats)	*/
 } OpCode;
 
 
-#define NUM_OPCODES	((int)(OP_EXTRAARG) + 1)
+#define NUM_OPCODES	((int)(OP_LEFF) + 1)
 
 
 
@@ -365,6 +377,13 @@ OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
   original operand was a float. (It must be corrected in case of
   metamethods.)
 
+  (*) Quickened opcodes are never generated by the compiler. The
+  interpreter rewrites a hot OP_ADD, OP_SUB, OP_MUL, OP_LT, or OP_LE
+  into one of them once its operands are seen to be both integers or
+  both floats. When a quickened instruction finds operands of other
+  types, it rewrites itself back into its generic form ('solP_generic')
+  and executes that.
+
 ===========================================================================*/
 
 
@@ -395,6 +414,29 @@ SOLI_DDEC(const lu_byte solP_opmodes[NUM_OPCODES];)
 /* "in top" (uses top from previous instruction) */
 #define isIT(i)		(testITMode(GET_OPCODE(i)) && GETARG_B(i) == 0)
 
+/* opcode is a quickened variant */
+#define isquickened(o)	((o) > OP_EXTRAARG)
+
+SOLI_DDEC(const lu_byte solP_genericop[NUM_OPCODES - OP_ADDII];)
+
+/* generic form of a (possibly quickened) opcode */
+#define solP_generic(o)  \
+	(isquickened(o) ? cast(OpCode, solP_genericop[(o) - OP_ADDII]) : (o))
+
+/* instruction has an inline cache (indexes a table with a constant key) */
+#define isIC(i)  \
+	(GET_OPCODE(i) == OP_GETTABUP || GET_OPCODE(i) == OP_GETFIELD || \
+	 GET_OPCODE(i) == OP_SELF)
+
+/* instruction can be quickened (counts its executions in a cache) */
+#define isquickenable(i)  \
+	(GET_OPCODE(i) == OP_ADD || GET_OPCODE(i) == OP_SUB || \
+	 GET_OPCODE(i) == OP_MUL || GET_OPCODE(i) == OP_LT || \
+	 GET_OPCODE(i) == OP_LE)
+
+/* instruction has an inline cache (see 'solF_initcache') */
+#define hascache(i)	(isIC(i) || isquickenable(i))
+
 #define opmode(mm,ot,it,t,a,m)  \
     (((mm) << 7) | ((ot) << 6) | ((it) << 5) | ((t) << 4) | ((a) << 3) | (m))
 
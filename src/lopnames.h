@@ -96,6 +96,16 @@ static const char *const opnames[] = {
   "VARARG",
   "VARARGPREP",
   "EXTRAARG",
+  "ADDII",
+  "ADDFF",
+  "SUBII",
+  "SUBFF",
+  "MULII",
+  "MULFF",
+  "LTII",
+  "LTFF",
+  "LEII",
+  "LEFF",
   NULL
 };
 
@@ -201,6 +201,7 @@ static int new_localvar (LexState *ls, TString *name) {
                   dyd->actvar.size, Vardesc, SHRT_MAX, "local variables");
   var = &dyd->actvar.arr[dyd->actvar.n++];
   var->vd.kind = VDKREG;  /* default */
+  var->vd.fidx = -1;
   var->vd.name = name;
   return dyd->actvar.n - 1 - fs->firstlocal;
 }
@@ -305,6 +306,34 @@ static void check_readonly (LexState *ls, expdesc *e) {
 }
 
 
+/*
+** Mark the variable being assigned in 'e' as not holding its 'local
+** function' anymore, so that calls to it are not inlined. Through
+** upvalues, go to the function where the variable is local.
+*/
+static void markassigned (LexState *ls, expdesc *e) {
+  FuncState *fs = ls->fs;
+  int i;
+  if (e->k == VLOCAL)
+    getlocalvardesc(fs, e->u.var.vidx)->vd.fidx = -1;
+  else if (e->k == VUPVAL) {
+    Upvaldesc *up = &fs->f->upvalues[e->u.info];
+    while (!up->instack) {  /* upvalue of an enclosing function? */
+      fs = fs->prev;
+      up = &fs->f->upvalues[up->idx];
+    }
+    fs = fs->prev;  /* function where the variable is local */
+    if (fs == NULL)  /* main function's '_ENV'? */
+      return;
+    for (i = 0; i < fs->nactvar; i++) {
+      Vardesc *vd = getlocalvardesc(fs, i);
+      if (vd->vd.kind != RDKCTC && vd->vd.ridx == up->idx)
+        vd->vd.fidx = -1;
+    }
+  }
+}
+
+
 /*
 ** Start the scope for the last 'nvars' created variables.
 */
@@ -321,11 +350,31 @@ static void adjustlocalvars (LexState *ls, int nvars) {
 }
 
 
+/*
+** Calls to variables leaving scope can be inlined only if those
+** variables were never assigned (so that they still hold the function
+** created by their 'local function' statement).
+*/
+static void settleinline (FuncState *fs, int tolevel) {
+  Dyndata *dyd = fs->ls->dyd;
+  int i;
+  for (i = fs->firstinline; i < dyd->inl.n; i++) {
+    InlineCall *c = &dyd->inl.arr[i];
+    if (c->vidx >= fs->firstlocal + tolevel) {  /* leaving scope? */
+      if (dyd->actvar.arr[c->vidx].vd.fidx != c->fidx)  /* assigned? */
+        c->fidx = -1;  /* cannot inline it */
+      c->vidx = -1;  /* call is settled */
+    }
+  }
+}
+
+
 /*
 ** Close the scope for all variables up to level 'tolevel'.
 ** (debug info.)
 */
 static void removevars (FuncState *fs, int tolevel) {
+  settleinline(fs, tolevel);
   fs->ls->dyd->actvar.n -= (fs->nactvar - tolevel);
   while (fs->nactvar > tolevel) {
     LocVar *var = localdebuginfo(fs, --fs->nactvar);
@@ -745,6 +794,7 @@ static void open_func (LexState *ls, FuncState *fs, BlockCnt *bl) {
   fs->needclose = 0;
   fs->firstlocal = ls->dyd->actvar.n;
   fs->firstlabel = ls->dyd->label.n;
+  fs->firstinline = ls->dyd->inl.n;
   fs->bl = NULL;
   f->source = ls->source;
   solC_objbarrier(ls->L, f, f->source);
@@ -761,6 +811,7 @@ static void close_func (LexState *ls) {
   leaveblock(fs);
   sol_assert(fs->bl == NULL);
   solK_finish(fs);
+  solK_inline(fs);
   solM_shrinkvector(L, f->code, f->sizecode, fs->pc, Instruction);
   solM_shrinkvector(L, f->lineinfo, f->sizelineinfo, fs->pc, ls_byte);
   solM_shrinkvector(L, f->abslineinfo, f->sizeabslineinfo,
@@ -769,6 +820,7 @@ static void close_func (LexState *ls) {
   solM_shrinkvector(L, f->p, f->sizep, fs->np, Proto *);
   solM_shrinkvector(L, f->locvars, f->sizelocvars, fs->ndebugvars, LocVar);
   solM_shrinkvector(L, f->upvalues, f->sizeupvalues, fs->nups, Upvaldesc);
+  solF_initcache(L, f);
   ls->fs = fs->prev;
   solC_checkGC(L);
 }
@@ -1021,6 +1073,28 @@ static int explist (LexState *ls, expdesc *v) {
 }
 
 
+/*
+** Register the call at 'pc' as a candidate for inlining if the called
+** local variable 'var' holds a function from a 'local function'
+** statement. ('solK_inline' decides later whether it is inlined.)
+*/
+static void addinlinecall (LexState *ls, expdesc *var, int pc) {
+  FuncState *fs = ls->fs;
+  Vardesc *vd = getlocalvardesc(fs, var->u.var.vidx);
+  if (vd->vd.fidx >= 0) {
+    Dyndata *dyd = ls->dyd;
+    InlineCall *c;
+    solM_growvector(ls->L, dyd->inl.arr, dyd->inl.n + 1, dyd->inl.size,
+                    InlineCall, MAX_INT, "calls");
+    c = &dyd->inl.arr[dyd->inl.n++];
+    c->pc = pc;
+    c->vidx = fs->firstlocal + var->u.var.vidx;
+    c->fidx = vd->vd.fidx;
+    c->reg = var->u.var.ridx;
+  }
+}
+
+
 static void funcargs (LexState *ls, expdesc *f) {
   FuncState *fs = ls->fs;
   expdesc args;
@@ -1126,8 +1200,11 @@ static void suffixedexp (LexState *ls, expdesc *v) {
         break;
       }
       case '(': case TK_STRING: case '{': {  /* funcargs */
+        expdesc fn = *v;  /* called expression */
         solK_exp2nextreg(fs, v);
         funcargs(ls, v);
+        if (fn.k == VLOCAL)
+          addinlinecall(ls, &fn, v->u.info);
         break;
       }
       default: return;
@@ -1375,6 +1452,7 @@ static void restassign (LexState *ls, struct LHS_assign *lh, int nvars) {
   expdesc e;
   check_condition(ls, vkisvar(lh->v.k), "syntax error");
   check_readonly(ls, &lh->v);
+  markassigned(ls, &lh->v);
   if (testnext(ls, ',')) {  /* restassign -> ',' suffixedexp restassign */
     struct LHS_assign nv;
     nv.prev = lh;
@@ -1694,13 +1772,16 @@ static void localfunc (LexState *ls) {
   body(ls, &b, 0, ls->linenumber);  /* function created in next register */
   /* debug information will only see the variable after this point! */
   localdebuginfo(fs, fvar)->startpc = fs->pc;
+  if (fs->np - 1 <= SHRT_MAX)  /* remember its function, for inlining */
+    getlocalvardesc(fs, fvar)->vd.fidx = cast(short, fs->np - 1);
 }
 
 
 static int getlocalattribute (LexState *ls) {
   /* ATTRIB -> ['<' Name '>'] */
   if (testnext(ls, '<')) {
-    const char *attr = getstr(str_checkname(ls));
+    TString *ts = str_checkname(ls);
+    const char *attr = getstr(ts);
     checknext(ls, '>');
     if (strcmp(attr, "const") == 0)
       return RDKCONST;  /* read-only variable */
@@ -1786,6 +1867,7 @@ static void funcstat (LexState *ls, int line) {
   ismethod = funcname(ls, &v);
   body(ls, &b, ismethod, line);
   check_readonly(ls, &v);
+  markassigned(ls, &v);
   solK_storevar(ls->fs, &v, &b);
   solK_fixline(ls->fs, line);  /* definition "happens" in the first line */
 }
@@ -1954,12 +2036,13 @@ LClosure *solY_parser (sol_State *L, ZIO *z, Mbuffer *buff,
   solC_objbarrier(L, funcstate.f, funcstate.f->source);
   lexstate.buff = buff;
   lexstate.dyd = dyd;
-  dyd->actvar.n = dyd->gt.n = dyd->label.n = 0;
+  dyd->actvar.n = dyd->gt.n = dyd->label.n = dyd->inl.n = 0;
   solX_setinput(L, &lexstate, z, funcstate.f->source, firstchar);
   mainfunc(&lexstate, &funcstate);
   sol_assert(!funcstate.prev && funcstate.nups == 1 && !lexstate.fs);
   /* all scopes should be correctly finished */
-  sol_assert(dyd->actvar.n == 0 && dyd->gt.n == 0 && dyd->label.n == 0);
+  sol_assert(dyd->actvar.n == 0 && dyd->gt.n == 0 && dyd->label.n == 0 &&
+             dyd->inl.n == 0);
   L->top.p--;  /* remove scanner's table */
   return cl;  /* closure is on the stack, too */
 }
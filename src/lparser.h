@@ -99,6 +99,7 @@ typedef union Vardesc {
     lu_byte kind;
     lu_byte ridx;  /* register holding the variable */
     short pidx;  /* index of the variable in the Proto's 'locvars' array */
+    short fidx;  /* index in 'f->p' of its 'local function', or -1 */
     TString *name;  /* variable name */
   } vd;
   TValue k;  /* constant value (if any) */
@@ -124,6 +125,24 @@ typedef struct Labellist {
 } Labellist;
 
 
+/* description of a call that may be inlined (see 'solK_inline') */
+typedef struct InlineCall {
+  int pc;  /* position of the OP_CALL instruction */
+  int vidx;  /* called variable (index in 'actvar.arr'); -1 after its scope */
+  int size;  /* size of the inlined code */
+  short fidx;  /* index in 'f->p' of the called function; -1 if not inlined */
+  lu_byte reg;  /* register of the called variable */
+} InlineCall;
+
+
+/* an instruction with its line, for code being rewritten */
+typedef struct CodeLine {
+  Instruction i;
+  int line;
+  int newpc;  /* position of its new code */
+} CodeLine;
+
+
 /* dynamic structures used by the parser */
 typedef struct Dyndata {
   struct {  /* list of all active local variables */
@@ -133,6 +152,15 @@ typedef struct Dyndata {
   } actvar;
   Labellist gt;  /* list of pending gotos */
   Labellist label;   /* list of active labels */
+  struct {  /* list of calls that may be inlined */
+    InlineCall *arr;
+    int n;
+    int size;
+  } inl;
+  struct {  /* copy of the code being rewritten by the inliner */
+    CodeLine *arr;
+    int size;
+  } copy;
 } Dyndata;
 
 
@@ -154,6 +182,7 @@ typedef struct FuncState {
   int nabslineinfo;  /* number of elements in 'abslineinfo' */
   int firstlocal;  /* index of first local var (in Dyndata array) */
   int firstlabel;  /* index of first label (in 'dyd->label->arr') */
+  int firstinline;  /* index of first call to inline (in 'dyd->inl.arr') */
   short ndebugvars;  /* number of elements in 'f->locvars' */
   lu_byte nactvar;  /* number of active local variables */
   lu_byte nups;  /* number of upvalues */
@@ -0,0 +1,181 @@
+/*
+** $Id: lshape.c $
+** Shapes (key layouts shared by tables)
+** See Copyright Notice in sol.h
+*/
+
+#define lshape_c
+#define SOL_CORE
+
+#include "lprefix.h"
+
+
+#include <string.h>
+
+#include "sol.h"
+
+#include "lgc.h"
+#include "lmem.h"
+#include "lobject.h"
+#include "lshape.h"
+#include "lstate.h"
+
+
+/*
+** Shapes are kept in a hash table, like short strings, so that adding
+** a key to a shape always gives the same shape. The table is keyed by
+** the pair (parent, last key); a shape is removed from it when it is
+** collected. The root shape (no keys) is not in the table and is
+** never collected.
+*/
+
+
+/* initial size for the shape table (must be a power of 2) */
+#if !defined(MINSHAPETABSIZE)
+#define MINSHAPETABSIZE	64
+#endif
+
+
+#define MAXSHAPETB	cast_int(solM_limitN(MAX_INT, Shape*))
+
+
+/* hash for the transition from 'p' by key 'key' */
+#define transhash(p,key)	((key)->hash ^ point2uint(p))
+
+
+static Shape *newshape (sol_State *L, Shape *parent, TString *key,
+                                      unsigned int h) {
+  int n = (parent == NULL) ? 0 : parent->nfields + 1;
+  int ls = (n == 0) ? 0 : solO_ceillog2(cast_uint(2 * n));
+  GCObject *o = solC_newobj(L, SOL_VSHAPE, sizeshape(n, ls));
+  Shape *s = gco2shape(o);
+  lu_byte *idx;
+  unsigned int mask = (1u << ls) - 1;
+  int i;
+  s->nfields = cast_byte(n);
+  s->lsizeidx = cast_byte(ls);
+  s->hash = h;
+  s->parent = parent;
+  s->hnext = NULL;
+  if (n > 0) {
+    memcpy(s->keys, parent->keys, (n - 1) * sizeof(TString *));
+    s->keys[n - 1] = key;
+  }
+  idx = shapeidx(s);
+  memset(idx, 0, mask + 1);
+  for (i = 0; i < n; i++) {  /* build index (load is at most 1/2) */
+    unsigned int j = s->keys[i]->hash & mask;
+    while (idx[j] != 0)
+      j = (j + 1) & mask;
+    idx[j] = cast_byte(i + 1);
+  }
+  return s;
+}
+
+
+static void rehashshapes (Shape **vect, int osize, int nsize) {
+  int i;
+  for (i = osize; i < nsize; i++)  /* clear new elements */
+    vect[i] = NULL;
+  for (i = 0; i < osize; i++) {  /* rehash old part of the array */
+    Shape *p = vect[i];
+    vect[i] = NULL;
+    while (p) {  /* for each shape in the list */
+      Shape *hnext = p->hnext;  /* save next */
+      unsigned int h = lmod(p->hash, nsize);  /* new position */
+      p->hnext = vect[h];  /* chain it into array */
+      vect[h] = p;
+      p = hnext;
+    }
+  }
+}
+
+
+/*
+** Double the size of the shape table. A failed reallocation just
+** leaves the table as it was, with longer chains.
+*/
+static void growshapetab (sol_State *L, shapetable *tb) {
+  if (tb->size <= MAXSHAPETB / 2) {
+    int nsize = tb->size * 2;
+    Shape **newvect = solM_reallocvector(L, tb->hash, tb->size, nsize,
+                                         Shape*);
+    if (newvect != NULL) {
+      rehashshapes(newvect, tb->size, nsize);
+      tb->hash = newvect;
+      tb->size = nsize;
+    }
+  }
+}
+
+
+void solR_init (sol_State *L) {
+  global_State *g = G(L);
+  shapetable *tb = &g->shpt;
+  tb->hash = solM_newvector(L, MINSHAPETABSIZE, Shape*);
+  rehashshapes(tb->hash, 0, MINSHAPETABSIZE);  /* clear array */
+  tb->size = MINSHAPETABSIZE;
+  g->rootshape = newshape(L, NULL, NULL, 0);
+  solC_fix(L, obj2gco(g->rootshape));  /* it should never be collected */
+}
+
+
+/*
+** Slot of key 'key' in shape 's', or -1 if 's' does not have it.
+*/
+int solR_find (const Shape *s, const TString *key) {
+  const lu_byte *idx = shapeidx(s);
+  unsigned int mask = (1u << s->lsizeidx) - 1;
+  unsigned int i = key->hash & mask;
+  while (idx[i] != 0) {
+    int slot = idx[i] - 1;
+    if (s->keys[slot] == key)
+      return slot;
+    i = (i + 1) & mask;
+  }
+  return -1;
+}
+
+
+/*
+** Shape with the keys of 's' plus 'key' (which 's' must not have).
+** The new shape refers only to 's' and 'key', so it is safe to
+** resurrect a dead one while they are alive.
+*/
+Shape *solR_addkey (sol_State *L, Shape *s, TString *key) {
+  global_State *g = G(L);
+  shapetable *tb = &g->shpt;
+  unsigned int h = transhash(s, key);
+  Shape **list = &tb->hash[lmod(h, tb->size)];
+  Shape *c;
+  sol_assert(s->nfields < SOLI_MAXSHAPE && solR_find(s, key) < 0);
+  for (c = *list; c != NULL; c = c->hnext) {
+    if (c->parent == s && c->keys[s->nfields] == key) {  /* found? */
+      if (isdead(g, c))  /* dead (but not collected yet)? */
+        changewhite(c);  /* resurrect it */
+      return c;
+    }
+  }
+  /* else must create a new shape */
+  if (tb->nuse >= tb->size)  /* need to grow shape table? */
+    growshapetab(L, tb);
+  c = newshape(L, s, key, h);
+  list = &tb->hash[lmod(h, tb->size)];  /* table may have changed */
+  c->hnext = *list;
+  *list = c;
+  tb->nuse++;
+  return c;
+}
+
+
+void solR_free (sol_State *L, Shape *s) {
+  if (s->parent != NULL) {  /* not the root shape? */
+    shapetable *tb = &G(L)->shpt;
+    Shape **p = &tb->hash[lmod(s->hash, tb->size)];
+    while (*p != s)  /* find previous element */
+      p = &(*p)->hnext;
+    *p = (*p)->hnext;  /* remove element from its list */
+    tb->nuse--;
+  }
+  solM_freemem(L, s, sizeshape(s->nfields, s->lsizeidx));
+}
@@ -0,0 +1,29 @@
+/*
+** $Id: lshape.h $
+** Shapes (key layouts shared by tables)
+** See Copyright Notice in sol.h
+*/
+
+#ifndef lshape_h
+#define lshape_h
+
+#include "lobject.h"
+#include "lstate.h"
+
+
+/*
+** Maximum number of keys in a shape (at most 254); a table that would
+** need more keys goes back to a regular hash part.
+*/
+#if !defined(SOLI_MAXSHAPE)
+#define SOLI_MAXSHAPE	32
+#endif
+
+
+SOLI_FUNC void solR_init (sol_State *L);
+SOLI_FUNC int solR_find (const Shape *s, const TString *key);
+SOLI_FUNC Shape *solR_addkey (sol_State *L, Shape *s, TString *key);
+SOLI_FUNC void solR_free (sol_State *L, Shape *s);
+
+
+#endif
@@ -20,8 +20,10 @@
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "llex.h"
 #include "lmem.h"
+#include "lshape.h"
 #include "lstate.h"
 #include "lstring.h"
 #include "ltable.h"
@@ -216,12 +218,15 @@ static void freestack (sol_State *L) {
 static void init_registry (sol_State *L, global_State *g) {
   /* create registry */
   Table *registry = solH_new(L);
+  TValue aux;
   sethvalue(L, &g->l_registry, registry);
   solH_resize(L, registry, SOL_RIDX_LAST, 0);
   /* registry[SOL_RIDX_MAINTHREAD] = L */
-  setthvalue(L, &registry->array[SOL_RIDX_MAINTHREAD - 1], L);
+  setthvalue(L, &aux, L);
+  solH_setint(L, registry, SOL_RIDX_MAINTHREAD, &aux);
   /* registry[SOL_RIDX_GLOBALS] = new table (table of globals) */
-  sethvalue(L, &registry->array[SOL_RIDX_GLOBALS - 1], solH_new(L));
+  sethvalue(L, &aux, solH_new(L));
+  solH_setint(L, registry, SOL_RIDX_GLOBALS, &aux);
 }
 
 
@@ -232,6 +237,7 @@ static void f_solopen (sol_State *L, void *ud) {
   global_State *g = G(L);
   UNUSED(ud);
   stack_init(L, L);  /* init stack */
+  solR_init(L);
   init_registry(L, g);
   solS_init(L);
   solT_init(L);
@@ -278,7 +284,12 @@ static void close_state (sol_State *L) {
     solC_freeallobjects(L);  /* collect all objects */
     soli_userstateclose(L);
   }
+  solJ_close(L);  /* after all prototypes are gone */
+  solC_freemarkers(L);
+  solC_freesweeper(L);
   solM_freearray(L, G(L)->strt.hash, G(L)->strt.size);
+  solM_freearray(L, G(L)->shpt.hash, G(L)->shpt.size);
+  solM_freearray(L, G(L)->frozendirty, G(L)->sizefrozendirty);
   freestack(L);
   sol_assert(gettotalbytes(g) == sizeof(LG));
   (*g->frealloc)(g->ud, fromstate(L), sizeof(LG), 0);  /* free main block */
@@ -377,13 +388,20 @@ SOL_API sol_State *sol_newstate (sol_Alloc f, void *ud) {
   incnny(L);  /* main thread is always non yieldable */
   g->frealloc = f;
   g->ud = ud;
+  g->allocsafe = 0;
   g->warnf = NULL;
   g->ud_warn = NULL;
+  g->jit = NULL;
+  g->markpool = NULL;
+  g->sweeper = NULL;
   g->mainthread = L;
   g->seed = soli_makeseed(L);
   g->gcstp = GCSTPGC;  /* no GC while building state */
   g->strt.size = g->strt.nuse = 0;
   g->strt.hash = NULL;
+  g->shpt.size = g->shpt.nuse = 0;
+  g->shpt.hash = NULL;
+  g->rootshape = NULL;
   setnilvalue(&g->l_registry);
   g->panic = NULL;
   g->gcstate = GCSpause;
@@ -391,6 +409,12 @@ SOL_API sol_State *sol_newstate (sol_Alloc f, void *ud) {
   g->gcstopem = 0;
   g->gcemergency = 0;
   g->finobj = g->tobefnz = g->fixedgc = NULL;
+  g->frozen = NULL;
+  g->frozendirty = NULL;
+  g->nfrozendirty = g->sizefrozendirty = 0;
+  g->gcsteptime = 0;
+  g->gcrate[0] = g->gcrate[1] = g->gcrate[2] = SOLI_GCRATE;
+  memset(&g->gcstats, 0, sizeof(g->gcstats));
   g->firstold1 = g->survival = g->old1 = g->reallyold = NULL;
   g->finobjsur = g->finobjold1 = g->finobjrold = NULL;
   g->sweepgc = NULL;
@@ -431,13 +455,19 @@ void solE_warning (sol_State *L, const char *msg, int tocont) {
 
 
 /*
-** Generate a warning from an error message
+** Generate a warning from an error message. (It cannot raise errors,
+** so a lazy string that cannot get its bytes is reported as a memory
+** error.)
 */
 void solE_warnerror (sol_State *L, const char *where) {
   TValue *errobj = s2v(L->top.p - 1);  /* error object */
-  const char *msg = (ttisstring(errobj))
-                  ? getstr(tsvalue(errobj))
-                  : "error object is not a string";
+  const char *msg = "error object is not a string";
+  if (ttisstring(errobj)) {
+    TString *ts = tsvalue(errobj);
+    msg = !islazy(ts) ? getstr(ts) : solS_tryflatten(L, ts);
+    if (msg == NULL)
+      msg = MEMERRMSG;
+  }
   /* produce warning "error in %s (%s)" (where, msg) */
   solE_warning(L, "error in ", 1);
   solE_warning(L, where, 1);
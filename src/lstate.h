@@ -29,7 +29,9 @@ typedef struct CallInfo CallInfo;
 ** 'finobj': all objects marked for finalization;
 ** 'tobefnz': all objects ready to be finalized;
 ** 'fixedgc': all objects that are not to be collected (currently
-** only small strings, such as reserved words).
+** only small strings, such as reserved words);
+** 'frozen': all objects moved out of the other lists by 'solC_freeze',
+** which are neither marked nor swept again.
 **
 ** For the generational collector, some of these lists have marks for
 ** generations. Each mark points to the first element in the list for
@@ -159,6 +161,17 @@ typedef struct stringtable {
 } stringtable;
 
 
+/*
+** Table of shape transitions, keyed by parent shape and new key (see
+** lshape.c)
+*/
+typedef struct shapetable {
+  struct Shape **hash;
+  int nuse;  /* number of elements */
+  int size;
+} shapetable;
+
+
 /*
 ** Information about a call.
 ** About union 'u':
@@ -222,6 +235,7 @@ struct CallInfo {
 #if defined(SOL_COMPAT_LT_LE)
 #define CIST_LEQ	(1<<13)  /* using __lt for __le */
 #endif
+#define CIST_JIT	(1<<14)  /* call is running native code */
 
 
 /*
@@ -259,6 +273,8 @@ typedef struct global_State {
   lu_mem GCestimate;  /* an estimate of the non-garbage memory in use */
   lu_mem lastatomic;  /* see function 'genstep' in file 'lgc.c' */
   stringtable strt;  /* hash table for strings */
+  shapetable shpt;  /* hash table for shapes */
+  struct Shape *rootshape;  /* shape with no keys */
   TValue l_registry;
   TValue nilvalue;  /* a nil value */
   unsigned int seed;  /* randomized seed for hashes */
@@ -273,6 +289,7 @@ typedef struct global_State {
   lu_byte gcpause;  /* size of pause between successive GCs */
   lu_byte gcstepmul;  /* GC "speed" */
   lu_byte gcstepsize;  /* (log2 of) GC granularity */
+  lu_byte allocsafe;  /* true if 'frealloc' is thread safe */
   GCObject *allgc;  /* list of all collectable objects */
   GCObject **sweepgc;  /* current position of sweep in list */
   GCObject *finobj;  /* list of collectable objects with finalizers */
@@ -283,6 +300,14 @@ typedef struct global_State {
   GCObject *allweak;  /* list of all-weak tables */
   GCObject *tobefnz;  /* list of userdata to be GC */
   GCObject *fixedgc;  /* list of objects not to be collected */
+  GCObject *frozen;  /* list of frozen objects */
+  GCObject **frozendirty;  /* frozen objects to traverse at every cycle */
+  int nfrozendirty;  /* number of elements in 'frozendirty' */
+  int sizefrozendirty;  /* size of 'frozendirty' */
+  /* fields for time-budgeted steps */
+  l_mem gcsteptime;  /* time target for incremental steps (microseconds) */
+  l_mem gcrate[3];  /* measured work per millisecond (see 'timedsteps') */
+  sol_GCStepStats gcstats;  /* durations of the collector steps */
   /* fields for generational collector */
   GCObject *survival;  /* start of objects that survived one GC cycle */
   GCObject *old1;  /* start of old1 objects */
@@ -300,6 +325,9 @@ typedef struct global_State {
   TString *strcache[STRCACHE_N][STRCACHE_M];  /* cache for strings in API */
   sol_WarnFunction warnf;  /* warning function */
   void *ud_warn;         /* auxiliary data to 'warnf' */
+  struct JitState *jit;  /* state of the baseline compiler (see ljit.h) */
+  struct MarkPool *markpool;  /* threads for parallel marking (see lgc.c) */
+  struct Sweeper *sweeper;  /* thread for background sweeping (see lgc.c) */
 } global_State;
 
 
@@ -359,6 +387,7 @@ union GCUnion {
   struct Proto p;
   struct sol_State th;  /* thread */
   struct UpVal upv;
+  struct Shape sh;
 };
 
 
@@ -381,6 +410,7 @@ union GCUnion {
 #define gco2p(o)  check_exp((o)->tt == SOL_VPROTO, &((cast_u(o))->p))
 #define gco2th(o)  check_exp((o)->tt == SOL_VTHREAD, &((cast_u(o))->th))
 #define gco2upv(o)	check_exp((o)->tt == SOL_VUPVAL, &((cast_u(o))->upv))
+#define gco2shape(o)  check_exp((o)->tt == SOL_VSHAPE, &((cast_u(o))->sh))
 
 
 /*
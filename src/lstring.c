@@ -28,22 +28,169 @@
 #define MAXSTRTB	cast_int(solM_limitN(MAX_INT, TString*))
 
 
+/*
+** Walk the pieces of a string from its end: return the last piece of
+** '*ts' (with its length in '*l') and move '*ts' to what comes before
+** that piece (NULL if nothing).
+*/
+static const char *prevpiece (TString **ts, size_t *l) {
+  TString *s = *ts;
+  if (isrope(s)) {
+    *ts = s->left;
+    s = s->right;  /* never lazy */
+  }
+  else {
+    *ts = NULL;
+    if (isslice(s)) {
+      *l = s->u.lnglen;
+      return slicestr(s);
+    }
+  }
+  *l = tsslen(s);
+  return getstr(s);
+}
+
+
+/*
+** Copy the contents of string 'ts' (lazy or not) to 'buff'
+*/
+void solS_copy (TString *ts, char *buff) {
+  size_t end = tsslen(ts);
+  while (ts != NULL) {
+    size_t l;
+    const char *s = prevpiece(&ts, &l);
+    end -= l;
+    memcpy(buff + end, s, l * sizeof(char));
+  }
+}
+
+
+/*
+** Compare, from their ends, the pieces of two strings with the same
+** length
+*/
+static int eqpieces (TString *a, TString *b) {
+  const char *sa = NULL, *sb = NULL;  /* current pieces */
+  size_t la = 0, lb = 0;  /* bytes not yet compared in each piece */
+  for (;;) {
+    size_t n;
+    if (la == 0) {
+      if (a == NULL)
+        return 1;  /* all bytes are equal */
+      sa = prevpiece(&a, &la);
+    }
+    else if (lb == 0) {
+      if (b == NULL)
+        return 0;  /* cannot happen with equal lengths */
+      sb = prevpiece(&b, &lb);
+    }
+    else {
+      n = (la < lb) ? la : lb;
+      if (memcmp(sa + la - n, sb + lb - n, n * sizeof(char)) != 0)
+        return 0;
+      la -= n;
+      lb -= n;
+    }
+  }
+}
+
+
 /*
 ** equality for long strings
 */
 int solS_eqlngstr (TString *a, TString *b) {
   size_t len = a->u.lnglen;
   sol_assert(a->tt == SOL_VLNGSTR && b->tt == SOL_VLNGSTR);
-  return (a == b) ||  /* same instance or... */
-    ((len == b->u.lnglen) &&  /* equal length and ... */
-     (memcmp(getlngstr(a), getlngstr(b), len) == 0));  /* equal contents */
+  if (a == b)  /* same instance? */
+    return 1;
+  else if (len != b->u.lnglen)  /* different lengths? */
+    return 0;
+  else if (!islazy(a) && !islazy(b))
+    return (memcmp(getlngstr(a), getlngstr(b), len) == 0);
+  else
+    return eqpieces(a, b);
 }
 
 
-unsigned int solS_hash (const char *str, size_t l, unsigned int seed) {
-  unsigned int h = seed ^ cast_uint(l);
+#define hashbyte(h,c)	((h) ^= (((h)<<5) + ((h)>>2) + cast_byte(c)))
+
+
+/*
+** Classic hash, one byte at a time from the end of the string. Long
+** strings always use it, as lazy strings are hashed piece by piece
+** from the end (see 'hashpieces').
+*/
+static unsigned int hashbytes (const char *str, size_t l, unsigned int h) {
   for (; l > 0; l--)
-    h ^= ((h<<5) + (h>>2) + cast_byte(str[l - 1]));
+    hashbyte(h, str[l - 1]);
+  return h;
+}
+
+
+#if SOL_USE_FASTHASH
+
+/*
+** Word-at-a-time hash (in the style of wyhash): each word of the
+** string is mixed into the state with a multiplication and a
+** xor-shift, and a final avalanche folds the high bits (where the
+** multiplications leave most entropy) into the low bits used to
+** index the string table. Words are read with 'memcpy', so the string
+** needs no alignment and is never read past its end. The hash depends
+** on the byte order of the machine, which is fine as hashes are never
+** saved.
+*/
+
+typedef sol_Unsigned HWord;
+
+#define HWSIZE		sizeof(HWord)
+#define HWBITS		(HWSIZE * CHAR_BIT)
+
+/* 64-bit constants (truncated when 'HWord' is smaller) */
+#define mk64(hi,lo)	((cast(HWord, hi) << 16 << 16) | cast(HWord, lo))
+#define HMUL1		mk64(0x9E3779B9u, 0x7F4A7C15u)
+#define HMUL2		mk64(0xBF58476Du, 0x1CE4E5B9u)
+
+#define hmix(h,w)	((h) = ((h) ^ (w)) * HMUL1, (h) ^= (h) >> (HWBITS / 2 - 3))
+
+
+unsigned int solS_hash (const char *str, size_t l, unsigned int seed) {
+  HWord h = cast(HWord, seed ^ cast_uint(l)) * HMUL2;
+  HWord w;
+  for (; l >= HWSIZE; l -= HWSIZE, str += HWSIZE) {
+    memcpy(&w, str, HWSIZE);
+    hmix(h, w);
+  }
+  if (l > 0) {  /* partial last word? */
+    w = 0;
+    memcpy(&w, str, l);
+    hmix(h, w);
+  }
+  h ^= h >> (HWBITS / 2);  /* final avalanche */
+  h *= HMUL2;
+  h ^= h >> (HWBITS / 2);
+  return cast_uint(h);
+}
+
+#else
+
+unsigned int solS_hash (const char *str, size_t l, unsigned int seed) {
+  return hashbytes(str, l, seed ^ cast_uint(l));
+}
+
+#endif
+
+
+/*
+** Hash of a lazy string without giving it its bytes. (The hash goes from the end of
+** the string to its start, as 'prevpiece'.)
+*/
+static unsigned int hashpieces (TString *ts) {
+  unsigned int h = ts->hash ^ cast_uint(ts->u.lnglen);
+  while (ts != NULL) {
+    size_t l;
+    const char *s = prevpiece(&ts, &l);
+    h = hashbytes(s, l, h);
+  }
   return h;
 }
 
@@ -51,8 +198,11 @@ unsigned int solS_hash (const char *str, size_t l, unsigned int seed) {
 unsigned int solS_hashlongstr (TString *ts) {
   sol_assert(ts->tt == SOL_VLNGSTR);
   if (ts->extra == 0) {  /* no hash? */
-    size_t len = ts->u.lnglen;
-    ts->hash = solS_hash(getlngstr(ts), len, ts->hash);
+    if (islazy(ts))
+      ts->hash = hashpieces(ts);
+    else
+      ts->hash = hashbytes(getlngstr(ts), ts->u.lnglen,
+                           ts->hash ^ cast_uint(ts->u.lnglen));
     ts->extra = 1;  /* now it has its hash */
   }
   return ts->hash;
@@ -140,28 +290,137 @@ void solS_init (sol_State *L) {
 /*
 ** creates a new string object
 */
-static TString *createstrobj (sol_State *L, size_t l, int tag, unsigned int h) {
-  TString *ts;
-  GCObject *o;
-  size_t totalsize;  /* total size of TString object */
-  totalsize = sizelstring(l);
-  o = solC_newobj(L, tag, totalsize);
-  ts = gco2ts(o);
+static TString *createstrobj (sol_State *L, size_t totalsize, int tag,
+                                            unsigned int h) {
+  GCObject *o = solC_newobj(L, tag, totalsize);
+  TString *ts = gco2ts(o);
   ts->hash = h;
   ts->extra = 0;
-  getstr(ts)[l] = '\0';  /* ending 0 */
   return ts;
 }
 
 
 TString *solS_createlngstrobj (sol_State *L, size_t l) {
-  TString *ts = createstrobj(L, l, SOL_VLNGSTR, G(L)->seed);
+  TString *ts = createstrobj(L, sizelngstr(l), SOL_VLNGSTR, G(L)->seed);
+  ts->u.lnglen = l;
+  ts->shrlen = LSTRREG;
+  ts->contents = lngcontents(ts);
+  ts->contents[l] = '\0';  /* ending 0 */
+  return ts;
+}
+
+
+/*
+** Creates a rope with the contents of 'left' followed by the contents
+** of 'right' (which cannot be lazy). Both must be anchored, and the
+** caller must check the total length.
+*/
+TString *solS_newrope (sol_State *L, TString *left, TString *right) {
+  TString *ts = createstrobj(L, sizerefstr, SOL_VLNGSTR, G(L)->seed);
+  sol_assert(!islazy(right));
+  ts->u.lnglen = tsslen(left) + tsslen(right);
+  ts->shrlen = LSTRREG;
+  ts->contents = NULL;  /* signals that it is lazy */
+  ts->left = left;
+  ts->right = right;
+  return ts;
+}
+
+
+/*
+** Creates a long string with the 'l' bytes at 's' (followed by a '\0'),
+** which are owned by the host. When the string is collected, they are
+** released with 'falloc(ud, s, l + 1, 0)', unless 'falloc' is NULL.
+*/
+TString *solS_newextlngstr (sol_State *L, const char *s, size_t l,
+                                          sol_Alloc falloc, void *ud) {
+  TString *ts = createstrobj(L, sizeof(TString), SOL_VLNGSTR, G(L)->seed);
+  sol_assert(l > SOLI_MAXSHORTLEN && s[l] == '\0');
   ts->u.lnglen = l;
-  ts->shrlen = 0xFF;  /* signals that it is a long string */
+  ts->shrlen = LSTREXT;
+  ts->contents = cast_charp(s);
+  ts->falloc = falloc;
+  ts->ud = ud;
   return ts;
 }
 
 
+/*
+** Creates a string with the 'l' bytes of 'ts' from position 'i'. A
+** long enough substring that is not too small for the string holding
+** its bytes is a slice of that string; otherwise, the bytes are copied.
+** ('ts' must be anchored.)
+*/
+TString *solS_sub (sol_State *L, TString *ts, size_t i, size_t l) {
+  TString *s;
+  sol_assert(i <= tsslen(ts) && l <= tsslen(ts) - i);
+  if (l == tsslen(ts))  /* whole string? */
+    return ts;
+  if (isslice(ts)) {  /* cut from its parent */
+    i += ts->offset;
+    ts = ts->left;
+  }
+  if (l < SOLI_MINSLICE || l <= SOLI_MAXSHORTLEN ||
+      l < tsslen(ts) / SOLI_SLICERATIO)  /* not worth a slice? */
+    return solS_newlstr(L, solS_getstr(L, ts) + i, l);
+  if (isrope(ts))
+    solS_flatten(L, ts);
+  s = createstrobj(L, sizerefstr, SOL_VLNGSTR, G(L)->seed);
+  s->u.lnglen = l;
+  s->shrlen = LSTRSLICE;
+  s->contents = NULL;  /* signals that it is lazy */
+  s->left = ts;
+  s->right = NULL;
+  s->offset = i;
+  return s;
+}
+
+
+/*
+** Gives lazy string 'ts' its contents; a rope drops its pieces.
+** (Everything else
+** in the string stays as it was; in particular, its hash.) Returns
+** NULL if there is no memory for the contents.
+*/
+char *solS_tryflatten (sol_State *L, TString *ts) {
+  size_t l = ts->u.lnglen;
+  char *buff = cast_charp(solM_realloc_(L, NULL, 0, (l + 1) * sizeof(char)));
+  sol_assert(islazy(ts));
+  if (buff != NULL) {
+    solS_copy(ts, buff);
+    buff[l] = '\0';  /* ending 0 */
+    ts->contents = buff;
+    if (ts->shrlen == LSTRREG)  /* a rope? */
+      ts->left = ts->right = NULL;  /* drop its pieces */
+  }
+  return buff;
+}
+
+
+char *solS_flatten (sol_State *L, TString *ts) {
+  char *buff = solS_tryflatten(L, ts);
+  if (l_unlikely(buff == NULL))
+    solM_error(L);
+  return buff;
+}
+
+
+void solS_freelngstr (sol_State *L, TString *ts) {
+  if (ts->contents == lngcontents(ts))  /* regular string? */
+    solM_freemem(L, ts, sizelngstr(ts->u.lnglen));
+  else if (ts->shrlen == LSTREXT) {  /* external string? */
+    if (ts->falloc != NULL)  /* must release its bytes? */
+      (*ts->falloc)(ts->ud, ts->contents, ts->u.lnglen + 1, 0);
+    solM_freemem(L, ts, sizeof(TString));
+  }
+  else {  /* a rope or a slice */
+    if (ts->contents != NULL)  /* flattened? */
+      solM_freearray(L, ts->contents, ts->u.lnglen + 1);
+    solM_freemem(L, ts, sizerefstr);
+  }
+}
+
+
 void solS_remove (sol_State *L, TString *ts) {
   stringtable *tb = &G(L)->strt;
   TString **p = &tb->hash[lmod(ts->hash, tb->size)];
@@ -206,9 +465,10 @@ static TString *internshrstr (sol_State *L, const char *str, size_t l) {
     growstrtab(L, tb);
     list = &tb->hash[lmod(h, tb->size)];  /* rehash with new size */
   }
-  ts = createstrobj(L, l, SOL_VSHRSTR, h);
+  ts = createstrobj(L, sizelstring(l), SOL_VSHRSTR, h);
   ts->shrlen = cast_byte(l);
   memcpy(getshrstr(ts), str, l * sizeof(char));
+  getshrstr(ts)[l] = '\0';  /* ending 0 */
   ts->u.hnext = *list;
   *list = ts;
   tb->nuse++;
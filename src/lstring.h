@@ -20,11 +20,59 @@
 
 
 /*
-** Size of a TString: Size of the header plus space for the string
-** itself (including final '\0').
+** Size of a short TString: Size of the header plus space for the
+** string itself (including final '\0').
 */
 #define sizelstring(l)  (offsetof(TString, contents) + ((l) + 1) * sizeof(char))
 
+/* size of a regular long string, with its contents after the header */
+#define sizelngstr(l)	(offsetof(TString, left) + ((l) + 1) * sizeof(char))
+
+/* size of a rope or a slice (without the fields of external strings) */
+#define sizerefstr	offsetof(TString, falloc)
+
+/* position of the contents of a regular long string */
+#define lngcontents(ts)	(cast_charp(ts) + offsetof(TString, left))
+
+
+/*
+** A concatenation whose first operand is a string with at least this
+** many bytes builds a rope; consecutive small pieces of a rope are
+** merged while they fit in this size.
+*/
+#if !defined(SOLI_MINROPE)
+#define SOLI_MINROPE	256
+#endif
+
+
+/*
+** Define SOL_USE_FASTHASH as 0 to hash short strings one byte at a
+** time, like long strings. The default hashes them a machine word at
+** a time (see lstring.c).
+*/
+#if !defined(SOL_USE_FASTHASH)
+#define SOL_USE_FASTHASH	1
+#endif
+
+
+/*
+** A substring with at least this many bytes is a slice of the string
+** holding its bytes (see 'solS_sub'), unless that string is more than
+** SOLI_SLICERATIO times longer: a slice keeps alive the string it was
+** cut from.
+*/
+#if !defined(SOLI_MINSLICE)
+#define SOLI_MINSLICE	256
+#endif
+
+#if !defined(SOLI_SLICERATIO)
+#define SOLI_SLICERATIO	8
+#endif
+
+
+/* get the contents of string 'ts', flattening it if it is lazy */
+#define solS_getstr(L,ts)	(islazy(ts) ? solS_flatten(L, ts) : getstr(ts))
+
 #define solS_newliteral(L, s)	(solS_newlstr(L, "" s, \
                                  (sizeof(s)/sizeof(char))-1))
 
@@ -52,6 +100,14 @@ SOLI_FUNC Udata *solS_newudata (sol_State *L, size_t s, int nuvalue);
 SOLI_FUNC TString *solS_newlstr (sol_State *L, const char *str, size_t l);
 SOLI_FUNC TString *solS_new (sol_State *L, const char *str);
 SOLI_FUNC TString *solS_createlngstrobj (sol_State *L, size_t l);
+SOLI_FUNC TString *solS_newrope (sol_State *L, TString *left, TString *right);
+SOLI_FUNC TString *solS_newextlngstr (sol_State *L, const char *s,
+                                     size_t l, sol_Alloc falloc, void *ud);
+SOLI_FUNC TString *solS_sub (sol_State *L, TString *ts, size_t i, size_t l);
+SOLI_FUNC char *solS_tryflatten (sol_State *L, TString *ts);
+SOLI_FUNC char *solS_flatten (sol_State *L, TString *ts);
+SOLI_FUNC void solS_copy (TString *ts, char *buff);
+SOLI_FUNC void solS_freelngstr (sol_State *L, TString *ts);
 
 
 #endif
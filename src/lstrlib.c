@@ -52,9 +52,22 @@
 
 
 
+/*
+** Get the bytes of string argument 'arg' where they are, without giving
+** a slice its own bytes (see 'sol_tostringview'). As they may not be
+** followed by a '\0', this is only for functions that use the length.
+*/
+static const char *checkview (sol_State *L, int arg, size_t *l) {
+  const char *s = sol_tostringview(L, arg, l);
+  if (l_unlikely(s == NULL))
+    return solL_checklstring(L, arg, l);  /* raise the error */
+  return s;
+}
+
+
 static int str_len (sol_State *L) {
   size_t l;
-  solL_checklstring(L, 1, &l);
+  checkview(L, 1, &l);
   sol_pushinteger(L, (sol_Integer)l);
   return 1;
 }
@@ -99,11 +112,12 @@ static size_t getendpos (sol_State *L, int arg, sol_Integer def,
 
 static int str_sub (sol_State *L) {
   size_t l;
-  const char *s = solL_checklstring(L, 1, &l);
-  size_t start = posrelatI(solL_checkinteger(L, 2), l);
-  size_t end = getendpos(L, 3, -1, l);
+  size_t start, end;
+  checkview(L, 1, &l);
+  start = posrelatI(solL_checkinteger(L, 2), l);
+  end = getendpos(L, 3, -1, l);
   if (start <= end)
-    sol_pushlstring(L, s + start - 1, (end - start) + 1);
+    sol_pushsubstring(L, 1, start - 1, (end - start) + 1);
   else sol_pushliteral(L, "");
   return 1;
 }
@@ -112,7 +126,7 @@ static int str_sub (sol_State *L) {
 static int str_reverse (sol_State *L) {
   size_t l, i;
   solL_Buffer b;
-  const char *s = solL_checklstring(L, 1, &l);
+  const char *s = checkview(L, 1, &l);
   char *p = solL_buffinitsize(L, &b, l);
   for (i = 0; i < l; i++)
     p[i] = s[l - i - 1];
@@ -125,7 +139,7 @@ static int str_lower (sol_State *L) {
   size_t l;
   size_t i;
   solL_Buffer b;
-  const char *s = solL_checklstring(L, 1, &l);
+  const char *s = checkview(L, 1, &l);
   char *p = solL_buffinitsize(L, &b, l);
   for (i=0; i<l; i++)
     p[i] = tolower(uchar(s[i]));
@@ -138,7 +152,7 @@ static int str_upper (sol_State *L) {
   size_t l;
   size_t i;
   solL_Buffer b;
-  const char *s = solL_checklstring(L, 1, &l);
+  const char *s = checkview(L, 1, &l);
   char *p = solL_buffinitsize(L, &b, l);
   for (i=0; i<l; i++)
     p[i] = toupper(uchar(s[i]));
@@ -149,7 +163,7 @@ static int str_upper (sol_State *L) {
 
 static int str_rep (sol_State *L) {
   size_t l, lsep;
-  const char *s = solL_checklstring(L, 1, &l);
+  const char *s = checkview(L, 1, &l);
   sol_Integer n = solL_checkinteger(L, 2);
   const char *sep = solL_optlstring(L, 3, "", &lsep);
   if (n <= 0)
@@ -176,7 +190,7 @@ static int str_rep (sol_State *L) {
 
 static int str_byte (sol_State *L) {
   size_t l;
-  const char *s = solL_checklstring(L, 1, &l);
+  const char *s = checkview(L, 1, &l);
   sol_Integer pi = solL_optinteger(L, 2, 1);
   size_t posi = posrelatI(pi, l);
   size_t pose = getendpos(L, 3, pi, l);
@@ -357,9 +371,11 @@ static const solL_Reg stringmetamethods[] = {
 
 typedef struct MatchState {
   const char *src_init;  /* init of source string */
-  const char *src_end;  /* end ('\0') of source string */
+  const char *src_end;  /* end of source string */
   const char *p_end;  /* end ('\0') of pattern */
+  const struct Pattern *pat;  /* compiled pattern (NULL if interpreted) */
   sol_State *L;
+  int src;  /* stack index of source string */
   int matchdepth;  /* control for recursive depth (to avoid C stack overflow) */
   unsigned char level;  /* total number of captures (finished or unfinished) */
   struct {
@@ -400,19 +416,22 @@ static int capture_to_close (MatchState *ms) {
 }
 
 
-static const char *classend (MatchState *ms, const char *p) {
+/*
+** End of the single-char class at 'p', or NULL if it is malformed
+*/
+static const char *findclassend (const char *p, const char *p_end) {
   switch (*p++) {
     case L_ESC: {
-      if (l_unlikely(p == ms->p_end))
-        solL_error(ms->L, "malformed pattern (ends with '%%')");
+      if (l_unlikely(p == p_end))
+        return NULL;
       return p+1;
     }
     case '[': {
       if (*p == '^') p++;
       do {  /* look for a ']' */
-        if (l_unlikely(p == ms->p_end))
-          solL_error(ms->L, "malformed pattern (missing ']')");
-        if (*(p++) == L_ESC && p < ms->p_end)
+        if (l_unlikely(p == p_end))
+          return NULL;
+        if (*(p++) == L_ESC && p < p_end)
           p++;  /* skip escapes (e.g. '%]') */
       } while (*p != ']');
       return p+1;
@@ -424,6 +443,18 @@ static const char *classend (MatchState *ms, const char *p) {
 }
 
 
+static const char *classend (MatchState *ms, const char *p) {
+  const char *ep = findclassend(p, ms->p_end);
+  if (l_unlikely(ep == NULL)) {
+    if (*p == L_ESC)
+      solL_error(ms->L, "malformed pattern (ends with '%%')");
+    else
+      solL_error(ms->L, "malformed pattern (missing ']')");
+  }
+  return ep;
+}
+
+
 static int match_class (int c, int cl) {
   int res;
   switch (tolower(cl)) {
@@ -600,14 +631,15 @@ static const char *match (MatchState *ms, const char *s, const char *p) {
             break;
           }
           case 'f': {  /* frontier? */
-            const char *ep; char previous;
+            const char *ep; char previous, current;
             p += 2;
             if (l_unlikely(*p != '['))
               solL_error(ms->L, "missing '[' after '%%f' in pattern");
             ep = classend(ms, p);  /* points to what is next */
             previous = (s == ms->src_init) ? '\0' : *(s - 1);
+            current = (s == ms->src_end) ? '\0' : *s;
             if (!matchbracketclass(uchar(previous), p, ep - 1) &&
-               matchbracketclass(uchar(*s), p, ep - 1)) {
+               matchbracketclass(uchar(current), p, ep - 1)) {
               p = ep; goto init;  /* return match(ms, s, ep); */
             }
             s = NULL;  /* match failed */
@@ -669,13 +701,130 @@ static const char *match (MatchState *ms, const char *s, const char *p) {
 }
 
 
+/*
+** {======================================================
+** LITERAL SEARCH
+** =======================================================
+*/
+
+/*
+** Bytes of failed comparisons that 'lmemfind' tolerates (besides one
+** for each byte of the subject it skips) before switching to the
+** two-way search.
+*/
+#if !defined(SOLI_MEMFINDSLACK)
+#define SOLI_MEMFINDSLACK	256
+#endif
+
+
+/*
+** Critical factorization of needle 'n' (with length 'l'), using
+** comparison 'rev' (0 for '<', 1 for '>'): returns the start of the
+** maximal suffix and sets '*period' to its period.
+*/
+static size_t maxsuffix (const unsigned char *n, size_t l, int rev,
+                         size_t *period) {
+  size_t ip = (size_t)-1;  /* (wraps to 0 when 'k' is added) */
+  size_t jp = 0, k = 1, p = 1;
+  while (jp + k < l) {
+    unsigned char a = n[ip + k], b = n[jp + k];
+    if (a == b) {
+      if (k == p) {
+        jp += p;
+        k = 1;
+      }
+      else k++;
+    }
+    else if ((a > b) != rev) {
+      jp += k;
+      k = 1;
+      p = jp - ip;
+    }
+    else {
+      ip = jp++;
+      k = p = 1;
+    }
+  }
+  *period = p;
+  return ip;
+}
+
+
+/*
+** Two-way string matching (Crochemore and Perrin), plus a skip on the
+** byte aligned with the end of the needle: linear in the length of
+** the subject 'h' and constant space, whatever the inputs.
+*/
+static const char *twowayfind (const unsigned char *h, size_t lh,
+                               const unsigned char *n, size_t l) {
+  const unsigned char *z = h + lh;
+  size_t shift[UCHAR_MAX + 1];  /* last position (plus 1) of each byte */
+  size_t ms, p, p0, mem, mem0, k;
+  size_t i;
+  for (i = 0; i <= UCHAR_MAX; i++)
+    shift[i] = 0;
+  for (i = 0; i < l; i++)
+    shift[n[i]] = i + 1;
+  ms = maxsuffix(n, l, 0, &p0);
+  i = maxsuffix(n, l, 1, &p);
+  if (i + 1 > ms + 1)  /* ('+ 1' handles the wrapped -1) */
+    ms = i;
+  else
+    p = p0;
+  if (memcmp(n, n + p, ms + 1) != 0) {  /* needle not periodic? */
+    mem0 = 0;
+    p = ((ms > l - ms - 1) ? ms : l - ms - 1) + 1;
+  }
+  else
+    mem0 = l - p;
+  mem = 0;
+  while ((size_t)(z - h) >= l) {
+    size_t sh = shift[h[l - 1]];
+    if (sh == 0) {  /* last byte not in needle? */
+      h += l;
+      mem = 0;
+      continue;
+    }
+    k = l - sh;
+    if (k != 0) {  /* last byte does not match? */
+      h += (k < mem) ? mem : k;
+      mem = 0;
+      continue;
+    }
+    /* compare right half */
+    for (k = (ms + 1 > mem) ? ms + 1 : mem; k < l && n[k] == h[k]; k++)
+      ;
+    if (k < l) {
+      h += k - ms;
+      mem = 0;
+      continue;
+    }
+    /* compare left half */
+    for (k = ms + 1; k > mem && n[k - 1] == h[k - 1]; k--)
+      ;
+    if (k <= mem)
+      return (const char *)h;
+    h += p;
+    mem = mem0;
+  }
+  return NULL;  /* not found */
+}
+
 
+/*
+** Find 's2' inside 's1'. Candidates given by 'memchr' on the first
+** byte are usually rare and the simple check is the fastest; when
+** failed checks pile up (as in repetitive inputs, where the simple
+** search is quadratic), the rest is left to 'twowayfind'.
+*/
 static const char *lmemfind (const char *s1, size_t l1,
                                const char *s2, size_t l2) {
   if (l2 == 0) return s1;  /* empty strings are everywhere */
   else if (l2 > l1) return NULL;  /* avoids a negative 'l1' */
   else {
     const char *init;  /* to search for a '*s2' inside 's1' */
+    const char *s0 = s1;
+    size_t work = 0;  /* bytes compared in failed checks */
     l2--;  /* 1st char will be checked by 'memchr' */
     l1 = l1-l2;  /* 's2' cannot be found after that */
     while (l1 > 0 && (init = (const char *)memchr(s1, *s2, l1)) != NULL) {
@@ -685,200 +834,817 @@ static const char *lmemfind (const char *s1, size_t l1,
       else {  /* correct 'l1' and 's1' to try again */
         l1 -= init-s1;
         s1 = init;
+        work += l2;
+        if (work > (size_t)(s1 - s0) + SOLI_MEMFINDSLACK)  /* too slow? */
+          return twowayfind((const unsigned char *)s1, l1 + l2,
+                            (const unsigned char *)s2, l2 + 1);
       }
     }
     return NULL;  /* not found */
   }
 }
 
+/* }====================================================== */
+
 
 /*
-** get information about the i-th capture. If there are no captures
-** and 'i==0', return information about the whole match, which
-** is the range 's'..'e'. If the capture is a string, return
-** its length and put its address in '*cap'. If it is an integer
-** (a position), push it on the stack and return CAP_POSITION.
+** {======================================================
+** COMPILED PATTERNS
+** =======================================================
 */
-static size_t get_onecapture (MatchState *ms, int i, const char *s,
-                              const char *e, const char **cap) {
-  if (i >= ms->level) {
-    if (l_unlikely(i != 0))
-      solL_error(ms->L, "invalid capture index %%%d", i + 1);
-    *cap = s;
-    return e - s;
-  }
-  else {
-    ptrdiff_t capl = ms->capture[i].len;
-    *cap = ms->capture[i].init;
-    if (l_unlikely(capl == CAP_UNFINISHED))
-      solL_error(ms->L, "unfinished capture");
-    else if (capl == CAP_POSITION)
-      sol_pushinteger(ms->L, (ms->capture[i].init - ms->src_init) + 1);
-    return capl;
-  }
-}
-
 
 /*
-** Push the i-th capture on the stack.
+** A pattern used more than once is compiled into a sequence of items,
+** one for each element that 'match' would handle, with the single-char
+** classes turned into bitmaps. 'pmatch' runs over the items exactly as
+** 'match' runs over the pattern (with the same recursion and the same
+** limits), but without parsing classes again at each character.
+** Compiled patterns are kept in a small LRU cache, shared by the
+** functions of the library, keyed by the identity of the pattern
+** string. (Bitmaps for classes such as '%a' are computed with the
+** locale in use when the pattern is compiled.) A malformed pattern is
+** not compiled, so that the interpreter reports its error when (and
+** if) it reaches the bad part.
 */
-static void push_onecapture (MatchState *ms, int i, const char *s,
-                                                    const char *e) {
-  const char *cap;
-  ptrdiff_t l = get_onecapture(ms, i, s, e, &cap);
-  if (l != CAP_POSITION)
-    sol_pushlstring(ms->L, cap, l);
-  /* else position was already pushed */
-}
 
 
-static int push_captures (MatchState *ms, const char *s, const char *e) {
-  int i;
-  int nlevels = (ms->level == 0 && s) ? 1 : ms->level;
-  solL_checkstack(ms->L, nlevels, "too many captures");
-  for (i = 0; i < nlevels; i++)
-    push_onecapture(ms, i, s, e);
-  return nlevels;  /* number of strings pushed */
-}
+/* kinds of items */
+#define PI_END		0	/* end of pattern */
+#define PI_CHAR		1	/* single character */
+#define PI_NOTCHAR	2	/* all characters but one */
+#define PI_ANY		3	/* '.' */
+#define PI_SET		4	/* other single-char classes */
+#define PI_OPEN		5	/* '(' */
+#define PI_POSITION	6	/* '()' */
+#define PI_CLOSE	7	/* ')' */
+#define PI_EOS		8	/* '$' at the end of the pattern */
+#define PI_BALANCE	9	/* '%bxy' */
+#define PI_FRONTIER	10	/* '%f[set]' */
+#define PI_BACKREF	11	/* '%0'-'%9' */
 
 
-/* check whether pattern has no special characters */
-static int nospecials (const char *p, size_t l) {
-  size_t upto = 0;
-  do {
-    if (strpbrk(p + upto, SPECIALS))
-      return 0;  /* pattern has a special character */
-    upto += strlen(p + upto) + 1;  /* may have more after \0 */
-  } while (upto <= l);
-  return 1;  /* no special chars found */
-}
+typedef struct PatItem {
+  unsigned char kind;
+  char rep;  /* suffix of a single-char class ('\0' if none) */
+  unsigned char c1, c2;  /* character (or '%b' delimiters, or capture) */
+  unsigned short set;  /* index of bitmap for PI_SET and PI_FRONTIER */
+} PatItem;
 
 
-static void prepstate (MatchState *ms, sol_State *L,
-                       const char *s, size_t ls, const char *p, size_t lp) {
-  ms->L = L;
-  ms->matchdepth = MAXCCALLS;
-  ms->src_init = s;
-  ms->src_end = s + ls;
-  ms->p_end = p + lp;
-}
+typedef unsigned char CharSet[(UCHAR_MAX + 1) / CHAR_BIT];
 
+#define setbit(cs,c)	((cs)[(c) >> 3] |= (unsigned char)(1u << ((c) & 7)))
+#define testbit(cs,c)	((cs)[(c) >> 3] & (1u << ((c) & 7)))
 
-static void reprepstate (MatchState *ms) {
-  ms->level = 0;
-  sol_assert(ms->matchdepth == MAXCCALLS);
-}
 
+typedef struct Pattern {
+  PatItem *items;  /* ended by a PI_END item */
+  CharSet *sets;
+  const char *prefix;  /* bytes that any match starts with */
+  size_t lprefix;
+  int firstset;  /* bitmap of the first byte of any match (or -1) */
+} Pattern;
 
-static int str_find_aux (sol_State *L, int find) {
-  size_t ls, lp;
-  const char *s = solL_checklstring(L, 1, &ls);
-  const char *p = solL_checklstring(L, 2, &lp);
-  size_t init = posrelatI(solL_optinteger(L, 3, 1), ls) - 1;
-  if (init > ls) {  /* start after string's end? */
-    solL_pushfail(L);  /* cannot find anything */
-    return 1;
-  }
-  /* explicit request or no special characters? */
-  if (find && (sol_toboolean(L, 4) || nospecials(p, lp))) {
-    /* do a plain search */
-    const char *s2 = lmemfind(s + init, ls - init, p, lp);
-    if (s2) {
-      sol_pushinteger(L, (s2 - s) + 1);
-      sol_pushinteger(L, (s2 - s) + lp);
-      return 2;
+
+/*
+** Compute the bitmap of a single-char class in item 'it': a class with
+** only one character becomes PI_CHAR, one with all but one (such as
+** '[^,]'), PI_NOTCHAR, and one with all of them, PI_ANY.
+*/
+static void compileclass (PatItem *it, CharSet *cs, const char *p,
+                                                    const char *ep) {
+  int c, n = 0, last = 0, out = 0;
+  memset(*cs, 0, sizeof(CharSet));
+  for (c = 0; c <= UCHAR_MAX; c++) {
+    int in;
+    switch (*p) {
+      case '.': in = 1; break;
+      case L_ESC: in = match_class(c, uchar(*(p + 1))); break;
+      case '[': in = matchbracketclass(c, p, ep - 1); break;
+      default: in = (uchar(*p) == c); break;
     }
-  }
-  else {
-    MatchState ms;
-    const char *s1 = s + init;
-    int anchor = (*p == '^');
-    if (anchor) {
-      p++; lp--;  /* skip anchor character */
+    if (in) {
+      setbit(*cs, c);
+      n++; last = c;
     }
-    prepstate(&ms, L, s, ls, p, lp);
-    do {
-      const char *res;
-      reprepstate(&ms);
-      if ((res=match(&ms, s1, p)) != NULL) {
-        if (find) {
-          sol_pushinteger(L, (s1 - s) + 1);  /* start */
-          sol_pushinteger(L, res - s);   /* end */
-          return push_captures(&ms, NULL, 0) + 2;
+    else
+      out = c;
+  }
+  if (n == 1) {
+    it->kind = PI_CHAR;
+    it->c1 = (unsigned char)last;
+  }
+  else if (n == UCHAR_MAX) {
+    it->kind = PI_NOTCHAR;
+    it->c1 = (unsigned char)out;
+  }
+  else if (n == UCHAR_MAX + 1)
+    it->kind = PI_ANY;
+}
+
+
+/*
+** Parse pattern 'p' (after its anchor, if any) into 'pt'. With
+** 'pt->items' NULL, it only counts items and bitmaps. Returns 0 for a
+** pattern that the interpreter would reject.
+*/
+static int parsepattern (const char *p, const char *p_end, Pattern *pt,
+                         int *nitems, int *nsets) {
+  unsigned char closed[SOL_MAXCAPTURES];  /* captures closed so far */
+  int level = 0;  /* captures opened so far */
+  int ni = 0, ns = 0;
+  for (;;) {
+    PatItem it;
+    it.rep = '\0';
+    it.c1 = it.c2 = 0;
+    it.set = 0;
+    if (p == p_end)
+      it.kind = PI_END;
+    else {
+      switch (*p) {
+        case '(': {
+          if (level >= SOL_MAXCAPTURES)
+            return 0;  /* too many captures */
+          if (*(p + 1) == ')') {  /* position capture? */
+            it.kind = PI_POSITION;
+            closed[level++] = 1;
+            p += 2;
+          }
+          else {
+            it.kind = PI_OPEN;
+            closed[level++] = 0;
+            p++;
+          }
+          break;
+        }
+        case ')': {
+          int l = level - 1;
+          while (l >= 0 && closed[l])
+            l--;
+          if (l < 0)
+            return 0;  /* invalid pattern capture */
+          closed[l] = 1;
+          it.kind = PI_CLOSE;
+          p++;
+          break;
+        }
+        case '$': {
+          if (p + 1 != p_end)  /* not the last char in pattern? */
+            goto single;
+          it.kind = PI_EOS;
+          p++;
+          break;
+        }
+        case L_ESC: {
+          switch (*(p + 1)) {
+            case 'b': {
+              if (p + 2 >= p_end - 1)
+                return 0;  /* missing arguments to '%b' */
+              it.kind = PI_BALANCE;
+              it.c1 = uchar(*(p + 2));
+              it.c2 = uchar(*(p + 3));
+              p += 4;
+              break;
+            }
+            case 'f': {
+              const char *ep;
+              p += 2;
+              if (*p != '[' || (ep = findclassend(p, p_end)) == NULL)
+                return 0;
+              it.kind = PI_FRONTIER;
+              it.set = (unsigned short)ns;
+              if (pt->items != NULL) {
+                int c;
+                memset(pt->sets[ns], 0, sizeof(CharSet));
+                for (c = 0; c <= UCHAR_MAX; c++)
+                  if (matchbracketclass(c, p, ep - 1))
+                    setbit(pt->sets[ns], c);
+              }
+              ns++;
+              p = ep;
+              break;
+            }
+            case '0': case '1': case '2': case '3':
+            case '4': case '5': case '6': case '7':
+            case '8': case '9': {
+              int l = *(p + 1) - '1';
+              if (l < 0 || l >= level || !closed[l])
+                return 0;  /* invalid capture index */
+              it.kind = PI_BACKREF;
+              it.c1 = uchar(*(p + 1));
+              p += 2;
+              break;
+            }
+            default: goto single;
+          }
+          break;
+        }
+        default: single: {
+          const char *ep = findclassend(p, p_end);
+          if (ep == NULL)
+            return 0;
+          it.kind = PI_SET;
+          it.set = (unsigned short)ns;
+          if (pt->items != NULL)
+            compileclass(&it, &pt->sets[ns], p, ep);
+          ns++;
+          if (ep < p_end &&
+              (*ep == '*' || *ep == '+' || *ep == '-' || *ep == '?'))
+            it.rep = *ep++;
+          p = ep;
+          break;
         }
-        else
-          return push_captures(&ms, s1, res);
       }
-    } while (s1++ < ms.src_end && !anchor);
+    }
+    if (pt->items != NULL)
+      pt->items[ni] = it;
+    ni++;
+    if (it.kind == PI_END)
+      break;
   }
-  solL_pushfail(L);  /* not found */
+  *nitems = ni;
+  *nsets = ns;
   return 1;
 }
 
 
-static int str_find (sol_State *L) {
-  return str_find_aux(L, 1);
+/*
+** Find the bytes that any match of 'pt' must start with, or else the
+** set of bytes that it can start with, skipping captures that start
+** before them.
+*/
+static void findstart (Pattern *pt, char *prefix) {
+  const PatItem *it = pt->items;
+  while (it->kind == PI_OPEN || it->kind == PI_POSITION)
+    it++;
+  pt->prefix = prefix;
+  pt->lprefix = 0;
+  pt->firstset = -1;
+  for (; it->kind == PI_CHAR; it++) {
+    if (it->rep != '\0' && it->rep != '+')  /* may match no char? */
+      break;
+    prefix[pt->lprefix++] = (char)it->c1;
+    if (it->rep != '\0')  /* more chars may follow? */
+      break;
+  }
+  if (pt->lprefix == 0 && it->kind == PI_SET &&
+      (it->rep == '\0' || it->rep == '+'))
+    pt->firstset = it->set;
 }
 
 
-static int str_match (sol_State *L) {
-  return str_find_aux(L, 0);
+/*
+** Compile the pattern at index 'arg' into a new userdata, pushed onto
+** the stack and returned (or return NULL, pushing nothing, if the
+** pattern is malformed). The userdata keeps the pattern string alive.
+*/
+static Pattern *compilepattern (sol_State *L, int arg) {
+  size_t lp;
+  const char *p = sol_tolstring(L, arg, &lp);
+  const char *p_end = p + lp;
+  Pattern temp, *pt;
+  int ni, ns;
+  size_t sz;
+  if (*p == '^') p++;  /* skip anchor (callers handle it) */
+  temp.items = NULL;
+  if (!parsepattern(p, p_end, &temp, &ni, &ns))
+    return NULL;
+  sz = sizeof(Pattern) + ni * sizeof(PatItem) + ns * sizeof(CharSet);
+  pt = (Pattern *)sol_newuserdatauv(L, sz + ni, 1);
+  pt->items = (PatItem *)(pt + 1);
+  pt->sets = (CharSet *)(pt->items + ni);
+  parsepattern(p, p_end, pt, &ni, &ns);
+  findstart(pt, (char *)pt + sz);
+  sol_pushvalue(L, arg);
+  sol_setiuservalue(L, -2, 1);  /* keep the pattern string */
+  return pt;
+}
+
+
+/* single match of item 'it' with the character at 's' */
+static int psinglematch (MatchState *ms, const char *s, const PatItem *it) {
+  if (s >= ms->src_end)
+    return 0;
+  else {
+    int c = uchar(*s);
+    switch (it->kind) {
+      case PI_CHAR: return (it->c1 == c);
+      case PI_NOTCHAR: return (it->c1 != c);
+      case PI_ANY: return 1;
+      default: return testbit(ms->pat->sets[it->set], c);
+    }
+  }
 }
 
 
-/* state for 'gmatch' */
-typedef struct GMatchState {
-  const char *src;  /* current position */
-  const char *p;  /* pattern */
-  const char *lastmatch;  /* end of last match */
-  MatchState ms;  /* match state */
-} GMatchState;
+static const char *pmatch (MatchState *ms, const char *s,
+                                           const PatItem *it);
 
 
-static int gmatch_aux (sol_State *L) {
-  GMatchState *gm = (GMatchState *)sol_touserdata(L, sol_upvalueindex(3));
-  const char *src;
-  gm->ms.L = L;
-  for (src = gm->src; src <= gm->ms.src_end; src++) {
-    const char *e;
-    reprepstate(&gm->ms);
-    if ((e = match(&gm->ms, src, gm->p)) != NULL && e != gm->lastmatch) {
-      gm->src = gm->lastmatch = e;
-      return push_captures(&gm->ms, src, e);
+/*
+** End of the run of characters from 's' that match single-char item
+** 'it'. A class that excludes a single character is a search for that
+** character, left to 'memchr'.
+*/
+static const char *pspan (MatchState *ms, const char *s, const PatItem *it) {
+  const char *e = ms->src_end;
+  switch (it->kind) {
+    case PI_CHAR: {
+      char c = (char)it->c1;
+      while (s < e && *s == c)
+        s++;
+      return s;
+    }
+    case PI_NOTCHAR: {
+      const char *q = (const char *)memchr(s, it->c1, e - s);
+      return (q != NULL) ? q : e;
+    }
+    case PI_ANY:
+      return e;
+    default: {
+      const unsigned char *cs = ms->pat->sets[it->set];
+      while (s < e && testbit(cs, uchar(*s)))
+        s++;
+      return s;
     }
   }
-  return 0;  /* not found */
 }
 
 
-static int gmatch (sol_State *L) {
-  size_t ls, lp;
-  const char *s = solL_checklstring(L, 1, &ls);
-  const char *p = solL_checklstring(L, 2, &lp);
-  size_t init = posrelatI(solL_optinteger(L, 3, 1), ls) - 1;
-  GMatchState *gm;
-  sol_settop(L, 2);  /* keep strings on closure to avoid being collected */
-  gm = (GMatchState *)sol_newuserdatauv(L, sizeof(GMatchState), 0);
-  if (init > ls)  /* start after string's end? */
-    init = ls + 1;  /* avoid overflows in 's + init' */
-  prepstate(&gm->ms, L, s, ls, p, lp);
-  gm->src = s + init; gm->p = p; gm->lastmatch = NULL;
-  sol_pushcclosure(L, gmatch_aux, 3);
-  return 1;
+static const char *pmax_expand (MatchState *ms, const char *s,
+                                                const PatItem *it) {
+  ptrdiff_t i = pspan(ms, s, it) - s;  /* counts maximum expand for item */
+  /* keeps trying to match with the maximum repetitions */
+  while (i>=0) {
+    const char *res = pmatch(ms, (s+i), it + 1);
+    if (res) return res;
+    i--;  /* else didn't match; reduce 1 repetition to try again */
+  }
+  return NULL;
 }
 
 
-static void add_s (MatchState *ms, solL_Buffer *b, const char *s,
-                                                   const char *e) {
-  size_t l;
-  sol_State *L = ms->L;
-  const char *news = sol_tolstring(L, 3, &l);
-  const char *p;
-  while ((p = (char *)memchr(news, L_ESC, l)) != NULL) {
-    solL_addlstring(b, news, p - news);
-    p++;  /* skip ESC */
-    if (*p == L_ESC)  /* '%%' */
-      solL_addchar(b, *p);
+static const char *pmin_expand (MatchState *ms, const char *s,
+                                                const PatItem *it) {
+  for (;;) {
+    const char *res = pmatch(ms, s, it + 1);
+    if (res != NULL)
+      return res;
+    else if (psinglematch(ms, s, it))
+      s++;  /* try with one more repetition */
+    else return NULL;
+  }
+}
+
+
+static const char *pstart_capture (MatchState *ms, const char *s,
+                                   const PatItem *it, int what) {
+  const char *res;
+  int level = ms->level;
+  sol_assert(level < SOL_MAXCAPTURES);  /* checked when compiled */
+  ms->capture[level].init = s;
+  ms->capture[level].len = what;
+  ms->level = level+1;
+  if ((res=pmatch(ms, s, it)) == NULL)  /* match failed? */
+    ms->level--;  /* undo capture */
+  return res;
+}
+
+
+static const char *pend_capture (MatchState *ms, const char *s,
+                                                 const PatItem *it) {
+  int l = capture_to_close(ms);
+  const char *res;
+  ms->capture[l].len = s - ms->capture[l].init;  /* close capture */
+  if ((res = pmatch(ms, s, it)) == NULL)  /* match failed? */
+    ms->capture[l].len = CAP_UNFINISHED;  /* undo capture */
+  return res;
+}
+
+
+/* same as 'match', over the items of a compiled pattern */
+static const char *pmatch (MatchState *ms, const char *s,
+                                           const PatItem *it) {
+  if (l_unlikely(ms->matchdepth-- == 0))
+    solL_error(ms->L, "pattern too complex");
+  init: /* using goto to optimize tail recursion */
+  switch (it->kind) {
+    case PI_END: break;
+    case PI_OPEN: {
+      s = pstart_capture(ms, s, it + 1, CAP_UNFINISHED);
+      break;
+    }
+    case PI_POSITION: {
+      s = pstart_capture(ms, s, it + 1, CAP_POSITION);
+      break;
+    }
+    case PI_CLOSE: {
+      s = pend_capture(ms, s, it + 1);
+      break;
+    }
+    case PI_EOS: {
+      s = (s == ms->src_end) ? s : NULL;  /* check end of string */
+      break;
+    }
+    case PI_BALANCE: {
+      if (s >= ms->src_end || uchar(*s) != it->c1)
+        s = NULL;
+      else {
+        int cont = 1;
+        while (++s < ms->src_end) {
+          if (uchar(*s) == it->c2) {
+            if (--cont == 0) break;
+          }
+          else if (uchar(*s) == it->c1) cont++;
+        }
+        if (s < ms->src_end) {  /* balanced? */
+          s++; it++; goto init;
+        }
+        s = NULL;  /* string ends out of balance */
+      }
+      break;
+    }
+    case PI_FRONTIER: {
+      int previous = (s == ms->src_init) ? '\0' : uchar(*(s - 1));
+      int current = (s == ms->src_end) ? '\0' : uchar(*s);
+      const unsigned char *cs = ms->pat->sets[it->set];
+      if (!testbit(cs, previous) && testbit(cs, current)) {
+        it++; goto init;
+      }
+      s = NULL;  /* match failed */
+      break;
+    }
+    case PI_BACKREF: {
+      s = match_capture(ms, s, it->c1);
+      if (s != NULL) {
+        it++; goto init;
+      }
+      break;
+    }
+    default: {  /* single-char class plus optional suffix */
+      /* does not match at least once? */
+      if (!psinglematch(ms, s, it)) {
+        if (it->rep == '*' || it->rep == '?' || it->rep == '-') {
+          it++; goto init;  /* accept empty */
+        }
+        else  /* '+' or no suffix */
+          s = NULL;  /* fail */
+      }
+      else {  /* matched once */
+        switch (it->rep) {  /* handle optional suffix */
+          case '?': {  /* optional */
+            const char *res;
+            if ((res = pmatch(ms, s + 1, it + 1)) != NULL)
+              s = res;
+            else {
+              it++; goto init;
+            }
+            break;
+          }
+          case '+':  /* 1 or more repetitions */
+            s++;  /* 1 match already done */
+            /* FALLTHROUGH */
+          case '*':  /* 0 or more repetitions */
+            s = pmax_expand(ms, s, it);
+            break;
+          case '-':  /* 0 or more repetitions (minimum) */
+            s = pmin_expand(ms, s, it);
+            break;
+          default:  /* no suffix */
+            s++; it++; goto init;
+        }
+      }
+      break;
+    }
+  }
+  ms->matchdepth++;
+  return s;
+}
+
+
+/* match at 's' with the compiled pattern, if any, or with 'p' */
+#define domatch(ms,s,p)  \
+	((ms)->pat != NULL ? pmatch(ms, s, (ms)->pat->items) : match(ms, s, p))
+
+
+/*
+** First position from 's' where a match of the compiled pattern can
+** start, or NULL if there is none. (Only for unanchored patterns.)
+*/
+static const char *nextstart (MatchState *ms, const char *s) {
+  const Pattern *pt = ms->pat;
+  if (pt->lprefix > 0)
+    return lmemfind(s, ms->src_end - s, pt->prefix, pt->lprefix);
+  else if (pt->firstset >= 0) {
+    const unsigned char *cs = pt->sets[pt->firstset];
+    for (; s < ms->src_end; s++) {
+      if (testbit(cs, uchar(*s)))
+        return s;
+    }
+    return NULL;
+  }
+  else
+    return s;
+}
+
+
+/* number of entries in the pattern cache (ways of each set) */
+#define PCSETS		16
+#define PCWAYS		4
+
+/* subjects from this length on are worth compiling a pattern for */
+#define PCEAGER		4096
+
+/* kinds of entries in the cache */
+#define PC_PATTERN	0
+#define PC_FORMAT	1
+
+typedef struct PatCache {
+  struct {
+    const void *key;  /* pattern (or format) string */
+    void *cp;  /* its compiled form (NULL if used only once) */
+    int kind;  /* PC_PATTERN or PC_FORMAT */
+    unsigned int stamp;  /* time of last use (0 if empty) */
+  } e[PCSETS * PCWAYS];
+  unsigned int clock;
+} PatCache;
+
+
+static void *compileformat (sol_State *L, int arg);
+
+
+/*
+** Compiled form of the string at index 'arg', as a pattern or as a
+** format for 'string.format' (according to 'kind'), from the pattern
+** cache (the first upvalue; the second one keeps its compiled forms),
+** or NULL if the string must be interpreted. The string is compiled
+** when it is used for the second time while in the cache, or at once
+** for a long subject (with length 'ls'). Pushes the userdata with the
+** compiled form (or nil), so that it is not collected while in use.
+*/
+static void *getcompiled (sol_State *L, int arg, size_t ls, int kind) {
+  PatCache *pc = (PatCache *)sol_touserdata(L, sol_upvalueindex(1));
+  const void *key = sol_topointer(L, arg);
+  int base = (int)(((size_t)key >> 4) % PCSETS) * PCWAYS;
+  int i, victim = base;
+  for (i = base; i < base + PCWAYS; i++) {
+    if (pc->e[i].key == key && pc->e[i].kind == kind)  /* hit? */
+      break;
+    else if (pc->e[i].stamp < pc->e[victim].stamp)
+      victim = i;
+  }
+  if (i == base + PCWAYS) {  /* miss? */
+    /* replace least recently used entry of the set */
+    i = victim;
+    if (pc->e[i].cp != NULL) {
+      sol_pushnil(L);
+      sol_rawseti(L, sol_upvalueindex(2), i + 1);  /* release it */
+    }
+    pc->e[i].key = key;
+    pc->e[i].cp = NULL;
+    pc->e[i].kind = kind;
+    if (ls < PCEAGER) {  /* wait for a second use? */
+      pc->e[i].stamp = ++pc->clock;
+      sol_pushnil(L);
+      return NULL;
+    }
+  }
+  pc->e[i].stamp = ++pc->clock;
+  if (pc->e[i].cp != NULL)
+    sol_rawgeti(L, sol_upvalueindex(2), i + 1);
+  else if ((pc->e[i].cp = (kind == PC_PATTERN) ? compilepattern(L, arg)
+                                               : compileformat(L, arg))
+           != NULL) {
+    sol_pushvalue(L, -1);
+    sol_rawseti(L, sol_upvalueindex(2), i + 1);
+  }
+  else
+    sol_pushnil(L);  /* malformed string */
+  return pc->e[i].cp;
+}
+
+
+#define getpattern(L,arg,ls)  \
+	((const Pattern *)getcompiled(L, arg, ls, PC_PATTERN))
+
+
+static void createpatcache (sol_State *L) {
+  PatCache *pc = (PatCache *)sol_newuserdatauv(L, sizeof(PatCache), 0);
+  int i;
+  for (i = 0; i < PCSETS * PCWAYS; i++) {
+    pc->e[i].key = NULL;
+    pc->e[i].cp = NULL;
+    pc->e[i].kind = PC_PATTERN;
+    pc->e[i].stamp = 0;
+  }
+  pc->clock = 0;
+  sol_createtable(L, PCSETS * PCWAYS, 0);  /* compiled forms */
+}
+
+/* }====================================================== */
+
+
+
+/*
+** get information about the i-th capture. If there are no captures
+** and 'i==0', return information about the whole match, which
+** is the range 's'..'e'. If the capture is a string, return
+** its length and put its address in '*cap'. If it is an integer
+** (a position), push it on the stack and return CAP_POSITION.
+*/
+static size_t get_onecapture (MatchState *ms, int i, const char *s,
+                              const char *e, const char **cap) {
+  if (i >= ms->level) {
+    if (l_unlikely(i != 0))
+      solL_error(ms->L, "invalid capture index %%%d", i + 1);
+    *cap = s;
+    return e - s;
+  }
+  else {
+    ptrdiff_t capl = ms->capture[i].len;
+    *cap = ms->capture[i].init;
+    if (l_unlikely(capl == CAP_UNFINISHED))
+      solL_error(ms->L, "unfinished capture");
+    else if (capl == CAP_POSITION)
+      sol_pushinteger(ms->L, (ms->capture[i].init - ms->src_init) + 1);
+    return capl;
+  }
+}
+
+
+/*
+** Push the i-th capture on the stack.
+*/
+static void push_onecapture (MatchState *ms, int i, const char *s,
+                                                    const char *e) {
+  const char *cap;
+  ptrdiff_t l = get_onecapture(ms, i, s, e, &cap);
+  if (l != CAP_POSITION)
+    sol_pushsubstring(ms->L, ms->src, cap - ms->src_init, l);
+  /* else position was already pushed */
+}
+
+
+static int push_captures (MatchState *ms, const char *s, const char *e) {
+  int i;
+  int nlevels = (ms->level == 0 && s) ? 1 : ms->level;
+  solL_checkstack(ms->L, nlevels, "too many captures");
+  for (i = 0; i < nlevels; i++)
+    push_onecapture(ms, i, s, e);
+  return nlevels;  /* number of strings pushed */
+}
+
+
+/* check whether pattern has no special characters */
+static int nospecials (const char *p, size_t l) {
+  size_t upto = 0;
+  do {
+    if (strpbrk(p + upto, SPECIALS))
+      return 0;  /* pattern has a special character */
+    upto += strlen(p + upto) + 1;  /* may have more after \0 */
+  } while (upto <= l);
+  return 1;  /* no special chars found */
+}
+
+
+static void prepstate (MatchState *ms, sol_State *L,
+                       const char *s, size_t ls, const char *p, size_t lp) {
+  ms->L = L;
+  ms->src = 1;
+  ms->matchdepth = MAXCCALLS;
+  ms->src_init = s;
+  ms->src_end = s + ls;
+  ms->p_end = p + lp;
+  ms->pat = NULL;
+}
+
+
+static void reprepstate (MatchState *ms) {
+  ms->level = 0;
+  sol_assert(ms->matchdepth == MAXCCALLS);
+}
+
+
+static int str_find_aux (sol_State *L, int find) {
+  size_t ls, lp;
+  const char *s = checkview(L, 1, &ls);
+  const char *p = solL_checklstring(L, 2, &lp);
+  size_t init = posrelatI(solL_optinteger(L, 3, 1), ls) - 1;
+  if (init > ls) {  /* start after string's end? */
+    solL_pushfail(L);  /* cannot find anything */
+    return 1;
+  }
+  /* explicit request or no special characters? */
+  if (find && (sol_toboolean(L, 4) || nospecials(p, lp))) {
+    /* do a plain search */
+    const char *s2 = lmemfind(s + init, ls - init, p, lp);
+    if (s2) {
+      sol_pushinteger(L, (s2 - s) + 1);
+      sol_pushinteger(L, (s2 - s) + lp);
+      return 2;
+    }
+  }
+  else {
+    MatchState ms;
+    const char *s1 = s + init;
+    int anchor = (*p == '^');
+    const Pattern *pt = getpattern(L, 2, ls);
+    if (anchor) {
+      p++; lp--;  /* skip anchor character */
+    }
+    prepstate(&ms, L, s, ls, p, lp);
+    ms.pat = pt;
+    do {
+      const char *res;
+      if (pt != NULL && !anchor && (s1 = nextstart(&ms, s1)) == NULL)
+        break;  /* no more possible matches */
+      reprepstate(&ms);
+      if ((res=domatch(&ms, s1, p)) != NULL) {
+        if (find) {
+          sol_pushinteger(L, (s1 - s) + 1);  /* start */
+          sol_pushinteger(L, res - s);   /* end */
+          return push_captures(&ms, NULL, 0) + 2;
+        }
+        else
+          return push_captures(&ms, s1, res);
+      }
+    } while (s1++ < ms.src_end && !anchor);
+  }
+  solL_pushfail(L);  /* not found */
+  return 1;
+}
+
+
+static int str_find (sol_State *L) {
+  return str_find_aux(L, 1);
+}
+
+
+static int str_match (sol_State *L) {
+  return str_find_aux(L, 0);
+}
+
+
+/* state for 'gmatch' */
+typedef struct GMatchState {
+  const char *src;  /* current position */
+  const char *p;  /* pattern */
+  const char *lastmatch;  /* end of last match */
+  MatchState ms;  /* match state */
+} GMatchState;
+
+
+static int gmatch_aux (sol_State *L) {
+  GMatchState *gm = (GMatchState *)sol_touserdata(L, sol_upvalueindex(3));
+  const char *src;
+  gm->ms.L = L;
+  for (src = gm->src; src <= gm->ms.src_end; src++) {
+    const char *e;
+    if (gm->ms.pat != NULL && (src = nextstart(&gm->ms, src)) == NULL)
+      break;  /* no more possible matches */
+    reprepstate(&gm->ms);
+    if ((e = domatch(&gm->ms, src, gm->p)) != NULL && e != gm->lastmatch) {
+      gm->src = gm->lastmatch = e;
+      return push_captures(&gm->ms, src, e);
+    }
+  }
+  return 0;  /* not found */
+}
+
+
+static int gmatch (sol_State *L) {
+  size_t ls, lp;
+  const char *s = checkview(L, 1, &ls);
+  const char *p = solL_checklstring(L, 2, &lp);
+  size_t init = posrelatI(solL_optinteger(L, 3, 1), ls) - 1;
+  GMatchState *gm;
+  sol_settop(L, 2);  /* keep strings on closure to avoid being collected */
+  gm = (GMatchState *)sol_newuserdatauv(L, sizeof(GMatchState), 0);
+  if (init > ls)  /* start after string's end? */
+    init = ls + 1;  /* avoid overflows in 's + init' */
+  prepstate(&gm->ms, L, s, ls, p, lp);
+  gm->ms.src = sol_upvalueindex(1);  /* subject is kept as an upvalue */
+  gm->src = s + init; gm->p = p; gm->lastmatch = NULL;
+  if (*p != '^')  /* ('^' is not an anchor here) */
+    gm->ms.pat = getpattern(L, 2, ls);  /* kept as 4th upvalue */
+  else
+    sol_pushnil(L);
+  sol_pushcclosure(L, gmatch_aux, 4);
+  return 1;
+}
+
+
+static void add_s (MatchState *ms, solL_Buffer *b, const char *s,
+                                                   const char *e) {
+  size_t l;
+  sol_State *L = ms->L;
+  const char *news = sol_tolstring(L, 3, &l);
+  const char *p;
+  while ((p = (char *)memchr(news, L_ESC, l)) != NULL) {
+    solL_addlstring(b, news, p - news);
+    p++;  /* skip ESC */
+    if (*p == L_ESC)  /* '%%' */
+      solL_addchar(b, *p);
     else if (*p == '0')  /* '%0' */
         solL_addlstring(b, s, e - s);
     else if (isdigit(uchar(*p))) {  /* '%n' */
@@ -887,496 +1653,1186 @@ static void add_s (MatchState *ms, solL_Buffer *b, const char *s,
       if (resl == CAP_POSITION)
         solL_addvalue(b);  /* add position to accumulated result */
       else
-        solL_addlstring(b, cap, resl);
+        solL_addlstring(b, cap, resl);
+    }
+    else
+      solL_error(L, "invalid use of '%c' in replacement string", L_ESC);
+    l -= p + 1 - news;
+    news = p + 1;
+  }
+  solL_addlstring(b, news, l);
+}
+
+
+/*
+** Add the replacement value to the string buffer 'b'.
+** Return true if the original string was changed. (Function calls and
+** table indexing resulting in nil or false do not change the subject.)
+*/
+static int add_value (MatchState *ms, solL_Buffer *b, const char *s,
+                                      const char *e, int tr) {
+  sol_State *L = ms->L;
+  switch (tr) {
+    case SOL_TFUNCTION: {  /* call the function */
+      int n;
+      sol_pushvalue(L, 3);  /* push the function */
+      n = push_captures(ms, s, e);  /* all captures as arguments */
+      sol_call(L, n, 1);  /* call it */
+      break;
+    }
+    case SOL_TTABLE: {  /* index the table */
+      push_onecapture(ms, 0, s, e);  /* first capture is the index */
+      sol_gettable(L, 3);
+      break;
+    }
+    default: {  /* SOL_TNUMBER or SOL_TSTRING */
+      add_s(ms, b, s, e);  /* add value to the buffer */
+      return 1;  /* something changed */
+    }
+  }
+  if (!sol_toboolean(L, -1)) {  /* nil or false? */
+    sol_pop(L, 1);  /* remove value */
+    solL_addlstring(b, s, e - s);  /* keep original text */
+    return 0;  /* no changes */
+  }
+  else if (l_unlikely(!sol_isstring(L, -1)))
+    return solL_error(L, "invalid replacement value (a %s)",
+                         solL_typename(L, -1));
+  else {
+    solL_addvalue(b);  /* add result to accumulator */
+    return 1;  /* something changed */
+  }
+}
+
+
+static int str_gsub (sol_State *L) {
+  size_t srcl, lp;
+  const char *src = checkview(L, 1, &srcl);  /* subject */
+  const char *p = solL_checklstring(L, 2, &lp);  /* pattern */
+  const char *lastmatch = NULL;  /* end of last match */
+  int tr = sol_type(L, 3);  /* replacement type */
+  sol_Integer max_s = solL_optinteger(L, 4, srcl + 1);  /* max replacements */
+  int anchor = (*p == '^');
+  sol_Integer n = 0;  /* replacement count */
+  int changed = 0;  /* change flag */
+  const Pattern *pt;
+  MatchState ms;
+  solL_Buffer b;
+  solL_argexpected(L, tr == SOL_TNUMBER || tr == SOL_TSTRING ||
+                   tr == SOL_TFUNCTION || tr == SOL_TTABLE, 3,
+                      "string/function/table");
+  pt = getpattern(L, 2, srcl);
+  solL_buffinit(L, &b);
+  if (anchor) {
+    p++; lp--;  /* skip anchor character */
+  }
+  prepstate(&ms, L, src, srcl, p, lp);
+  ms.pat = pt;
+  while (n < max_s) {
+    const char *e;
+    if (pt != NULL && !anchor) {  /* skip where no match can start */
+      const char *ns = nextstart(&ms, src);
+      if (ns == NULL)
+        break;  /* no more possible matches */
+      solL_addlstring(&b, src, ns - src);
+      src = ns;
+    }
+    reprepstate(&ms);  /* (re)prepare state for new match */
+    if ((e = domatch(&ms, src, p)) != NULL && e != lastmatch) {  /* match? */
+      n++;
+      changed = add_value(&ms, &b, src, e, tr) | changed;
+      src = lastmatch = e;
+    }
+    else if (src < ms.src_end)  /* otherwise, skip one character */
+      solL_addchar(&b, *src++);
+    else break;  /* end of subject */
+    if (anchor) break;
+  }
+  if (!changed)  /* no changes? */
+    sol_pushvalue(L, 1);  /* return original string */
+  else {  /* something changed */
+    solL_addlstring(&b, src, ms.src_end-src);
+    solL_pushresult(&b);  /* create and return new string */
+  }
+  sol_pushinteger(L, n);  /* number of substitutions */
+  return 2;
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** STRING FORMAT
+** =======================================================
+*/
+
+#if !defined(sol_number2strx)	/* { */
+
+/*
+** Hexadecimal floating-point formatter
+*/
+
+#define SIZELENMOD	(sizeof(SOL_NUMBER_FRMLEN)/sizeof(char))
+
+
+/*
+** Number of bits that goes into the first digit. It can be any value
+** between 1 and 4; the following definition tries to align the number
+** to nibble boundaries by making what is left after that first digit a
+** multiple of 4.
+*/
+#define L_NBFD		((l_floatatt(MANT_DIG) - 1)%4 + 1)
+
+
+/*
+** Add integer part of 'x' to buffer and return new 'x'
+*/
+static sol_Number adddigit (char *buff, int n, sol_Number x) {
+  sol_Number dd = l_mathop(floor)(x);  /* get integer part from 'x' */
+  int d = (int)dd;
+  buff[n] = (d < 10 ? d + '0' : d - 10 + 'a');  /* add to buffer */
+  return x - dd;  /* return what is left */
+}
+
+
+static int num2straux (char *buff, int sz, sol_Number x) {
+  /* if 'inf' or 'NaN', format it like '%g' */
+  if (x != x || x == (sol_Number)HUGE_VAL || x == -(sol_Number)HUGE_VAL)
+    return l_sprintf(buff, sz, SOL_NUMBER_FMT, (SOLI_UACNUMBER)x);
+  else if (x == 0) {  /* can be -0... */
+    /* create "0" or "-0" followed by exponent */
+    return l_sprintf(buff, sz, SOL_NUMBER_FMT "x0p+0", (SOLI_UACNUMBER)x);
+  }
+  else {
+    int e;
+    sol_Number m = l_mathop(frexp)(x, &e);  /* 'x' fraction and exponent */
+    int n = 0;  /* character count */
+    if (m < 0) {  /* is number negative? */
+      buff[n++] = '-';  /* add sign */
+      m = -m;  /* make it positive */
+    }
+    buff[n++] = '0'; buff[n++] = 'x';  /* add "0x" */
+    m = adddigit(buff, n++, m * (1 << L_NBFD));  /* add first digit */
+    e -= L_NBFD;  /* this digit goes before the radix point */
+    if (m > 0) {  /* more digits? */
+      buff[n++] = sol_getlocaledecpoint();  /* add radix point */
+      do {  /* add as many digits as needed */
+        m = adddigit(buff, n++, m * 16);
+      } while (m > 0);
+    }
+    n += l_sprintf(buff + n, sz - n, "p%+d", e);  /* add exponent */
+    sol_assert(n < sz);
+    return n;
+  }
+}
+
+
+static int sol_number2strx (sol_State *L, char *buff, int sz,
+                            const char *fmt, sol_Number x) {
+  int n = num2straux(buff, sz, x);
+  if (fmt[SIZELENMOD] == 'A') {
+    int i;
+    for (i = 0; i < n; i++)
+      buff[i] = toupper(uchar(buff[i]));
+  }
+  else if (l_unlikely(fmt[SIZELENMOD] != 'a'))
+    return solL_error(L, "modifiers for format '%%a'/'%%A' not implemented");
+  return n;
+}
+
+#endif				/* } */
+
+
+/*
+** Maximum size for items formatted with '%f'. This size is produced
+** by format('%.99f', -maxfloat), and is equal to 99 + 3 ('-', '.',
+** and '\0') + number of decimal digits to represent maxfloat (which
+** is maximum exponent + 1). (99+3+1, adding some extra, 110)
+*/
+#define MAX_ITEMF	(110 + l_floatatt(MAX_10_EXP))
+
+
+/*
+** All formats except '%f' do not need that large limit.  The other
+** float formats use exponents, so that they fit in the 99 limit for
+** significant digits; 's' for large strings and 'q' add items directly
+** to the buffer; all integer formats also fit in the 99 limit.  The
+** worst case are floats: they may need 99 significant digits, plus
+** '0x', '-', '.', 'e+XXXX', and '\0'. Adding some extra, 120.
+*/
+#define MAX_ITEM	120
+
+
+/* valid flags in a format specification */
+#if !defined(L_FMTFLAGSF)
+
+/* valid flags for a, A, e, E, f, F, g, and G conversions */
+#define L_FMTFLAGSF	"-+#0 "
+
+/* valid flags for o, x, and X conversions */
+#define L_FMTFLAGSX	"-#0"
+
+/* valid flags for d and i conversions */
+#define L_FMTFLAGSI	"-+0 "
+
+/* valid flags for u conversions */
+#define L_FMTFLAGSU	"-0"
+
+/* valid flags for c, p, and s conversions */
+#define L_FMTFLAGSC	"-"
+
+#endif
+
+
+/*
+** Maximum size of each format specification (such as "%-099.99d"):
+** Initial '%', flags (up to 5), width (2), period, precision (2),
+** length modifier (8), conversion specifier, and final '\0', plus some
+** extra.
+*/
+#define MAX_FORMAT	32
+
+
+static void addquoted (solL_Buffer *b, const char *s, size_t len) {
+  solL_addchar(b, '"');
+  while (len--) {
+    if (*s == '"' || *s == '\\' || *s == '\n') {
+      solL_addchar(b, '\\');
+      solL_addchar(b, *s);
+    }
+    else if (iscntrl(uchar(*s))) {
+      char buff[10];
+      if (!isdigit(uchar(*(s+1))))
+        l_sprintf(buff, sizeof(buff), "\\%d", (int)uchar(*s));
+      else
+        l_sprintf(buff, sizeof(buff), "\\%03d", (int)uchar(*s));
+      solL_addstring(b, buff);
     }
     else
-      solL_error(L, "invalid use of '%c' in replacement string", L_ESC);
-    l -= p + 1 - news;
-    news = p + 1;
+      solL_addchar(b, *s);
+    s++;
+  }
+  solL_addchar(b, '"');
+}
+
+
+/*
+** Serialize a floating-point number in such a way that it can be
+** scanned back by Sol. Use hexadecimal format for "common" numbers
+** (to preserve precision); inf, -inf, and NaN are handled separately.
+** (NaN cannot be expressed as a numeral, so we write '(0/0)' for it.)
+*/
+static int quotefloat (sol_State *L, char *buff, sol_Number n) {
+  const char *s;  /* for the fixed representations */
+  if (n == (sol_Number)HUGE_VAL)  /* inf? */
+    s = "1e9999";
+  else if (n == -(sol_Number)HUGE_VAL)  /* -inf? */
+    s = "-1e9999";
+  else if (n != n)  /* NaN? */
+    s = "(0/0)";
+  else {  /* format number as hexadecimal */
+    int  nb = sol_number2strx(L, buff, MAX_ITEM,
+                                 "%" SOL_NUMBER_FRMLEN "a", n);
+    /* ensures that 'buff' string uses a dot as the radix character */
+    if (memchr(buff, '.', nb) == NULL) {  /* no dot? */
+      char point = sol_getlocaledecpoint();  /* try locale point */
+      char *ppoint = (char *)memchr(buff, point, nb);
+      if (ppoint) *ppoint = '.';  /* change it to a dot */
+    }
+    return nb;
+  }
+  /* for the fixed representations */
+  return l_sprintf(buff, MAX_ITEM, "%s", s);
+}
+
+
+static void addliteral (sol_State *L, solL_Buffer *b, int arg) {
+  switch (sol_type(L, arg)) {
+    case SOL_TSTRING: {
+      size_t len;
+      const char *s = sol_tolstring(L, arg, &len);
+      addquoted(b, s, len);
+      break;
+    }
+    case SOL_TNUMBER: {
+      char *buff = solL_prepbuffsize(b, MAX_ITEM);
+      int nb;
+      if (!sol_isinteger(L, arg))  /* float? */
+        nb = quotefloat(L, buff, sol_tonumber(L, arg));
+      else {  /* integers */
+        sol_Integer n = sol_tointeger(L, arg);
+        const char *format = (n == SOL_MININTEGER)  /* corner case? */
+                           ? "0x%" SOL_INTEGER_FRMLEN "x"  /* use hex */
+                           : SOL_INTEGER_FMT;  /* else use default format */
+        nb = l_sprintf(buff, MAX_ITEM, format, (SOLI_UACINT)n);
+      }
+      solL_addsize(b, nb);
+      break;
+    }
+    case SOL_TNIL: case SOL_TBOOLEAN: {
+      solL_tolstring(L, arg, NULL);
+      solL_addvalue(b);
+      break;
+    }
+    default: {
+      solL_argerror(L, arg, "value has no literal form");
+    }
+  }
+}
+
+
+static const char *get2digits (const char *s) {
+  if (isdigit(uchar(*s))) {
+    s++;
+    if (isdigit(uchar(*s))) s++;  /* (2 digits at most) */
+  }
+  return s;
+}
+
+
+/*
+** Check whether a conversion specification is valid. When called,
+** first character in 'form' must be '%' and last character must
+** be a valid conversion specifier. 'flags' are the accepted flags;
+** 'precision' signals whether to accept a precision.
+*/
+static int validformat (const char *form, const char *flags,
+                                          int precision) {
+  const char *spec = form + 1;  /* skip '%' */
+  spec += strspn(spec, flags);  /* skip flags */
+  if (*spec != '0') {  /* a width cannot start with '0' */
+    spec = get2digits(spec);  /* skip width */
+    if (*spec == '.' && precision) {
+      spec++;
+      spec = get2digits(spec);  /* skip precision */
+    }
+  }
+  return isalpha(uchar(*spec));  /* went to the end? */
+}
+
+
+static void checkformat (sol_State *L, const char *form, const char *flags,
+                                       int precision) {
+  if (!validformat(form, flags, precision))
+    solL_error(L, "invalid conversion specification: '%s'", form);
+}
+
+
+/*
+** Get a conversion specification and copy it to 'form'.
+** Return the address of its last character.
+*/
+static const char *getformat (sol_State *L, const char *strfrmt,
+                                            char *form) {
+  /* spans flags, width, and precision ('0' is included as a flag) */
+  size_t len = strspn(strfrmt, L_FMTFLAGSF "123456789.");
+  len++;  /* adds following character (should be the specifier) */
+  /* still needs space for '%', '\0', plus a length modifier */
+  if (len >= MAX_FORMAT - 10)
+    solL_error(L, "invalid format (too long)");
+  *(form++) = '%';
+  memcpy(form, strfrmt, len * sizeof(char));
+  *(form + len) = '\0';
+  return strfrmt + len - 1;
+}
+
+
+/*
+** Precision of a format for floats ('e', 'f', or 'g') with no flags
+** and no width, such as "%g" or "%.14g"; -1 for any other format.
+*/
+static int plainprec (const char *form) {
+  const char *spec = form + 1;  /* skip '%' */
+  int prec = 6;  /* default precision */
+  if (*spec == '.') {
+    prec = 0;
+    while (isdigit(uchar(*++spec)))
+      prec = prec * 10 + (*spec - '0');
   }
-  solL_addlstring(b, news, l);
+  if (spec[1] == '\0' && (*spec == 'e' || *spec == 'f' || *spec == 'g'))
+    return prec;
+  else
+    return -1;
 }
 
 
 /*
-** Add the replacement value to the string buffer 'b'.
-** Return true if the original string was changed. (Function calls and
-** table indexing resulting in nil or false do not change the subject.)
+** add length modifier into formats
 */
-static int add_value (MatchState *ms, solL_Buffer *b, const char *s,
-                                      const char *e, int tr) {
-  sol_State *L = ms->L;
-  switch (tr) {
-    case SOL_TFUNCTION: {  /* call the function */
-      int n;
-      sol_pushvalue(L, 3);  /* push the function */
-      n = push_captures(ms, s, e);  /* all captures as arguments */
-      sol_call(L, n, 1);  /* call it */
+static void addlenmod (char *form, const char *lenmod) {
+  size_t l = strlen(form);
+  size_t lm = strlen(lenmod);
+  char spec = form[l - 1];
+  strcpy(form + l - 1, lenmod);
+  form[l + lm - 1] = spec;
+  form[l + lm] = '\0';
+}
+
+
+/*
+** Add to buffer 'b' the result of formatting the value at 'arg' with
+** the conversion specification 'form' (as built by 'getformat').
+*/
+static void addconv (sol_State *L, solL_Buffer *b, int arg, char *form) {
+  int maxitem = MAX_ITEM;  /* maximum length for the result */
+  char *buff = solL_prepbuffsize(b, maxitem);  /* to put result */
+  int nb = 0;  /* number of bytes in result */
+  const char *flags;
+  char conv = form[strlen(form) - 1];  /* conversion specifier */
+  switch (conv) {
+    case 'c': {
+      checkformat(L, form, L_FMTFLAGSC, 0);
+      nb = l_sprintf(buff, maxitem, form, (int)solL_checkinteger(L, arg));
       break;
     }
-    case SOL_TTABLE: {  /* index the table */
-      push_onecapture(ms, 0, s, e);  /* first capture is the index */
-      sol_gettable(L, 3);
+    case 'd': case 'i':
+      flags = L_FMTFLAGSI;
+      goto intcase;
+    case 'u':
+      flags = L_FMTFLAGSU;
+      goto intcase;
+    case 'o': case 'x': case 'X':
+      flags = L_FMTFLAGSX;
+     intcase: {
+      sol_Integer n = solL_checkinteger(L, arg);
+      checkformat(L, form, flags, 1);
+      addlenmod(form, SOL_INTEGER_FRMLEN);
+      nb = l_sprintf(buff, maxitem, form, (SOLI_UACINT)n);
       break;
     }
-    default: {  /* SOL_TNUMBER or SOL_TSTRING */
-      add_s(ms, b, s, e);  /* add value to the buffer */
-      return 1;  /* something changed */
+    case 'a': case 'A':
+      checkformat(L, form, L_FMTFLAGSF, 1);
+      addlenmod(form, SOL_NUMBER_FRMLEN);
+      nb = sol_number2strx(L, buff, maxitem, form,
+                              solL_checknumber(L, arg));
+      break;
+    case 'f':
+      maxitem = MAX_ITEMF;  /* extra space for '%f' */
+      buff = solL_prepbuffsize(b, maxitem);
+      /* FALLTHROUGH */
+    case 'e': case 'E': case 'g': case 'G': {
+      sol_Number n = solL_checknumber(L, arg);
+      int prec;
+      checkformat(L, form, L_FMTFLAGSF, 1);
+      if ((prec = plainprec(form)) >= 0)  /* only a precision? */
+        nb = sol_formatnumber(L, buff, maxitem, n, conv, prec);
+      else {
+        addlenmod(form, SOL_NUMBER_FRMLEN);
+        nb = l_sprintf(buff, maxitem, form, (SOLI_UACNUMBER)n);
+      }
+      break;
+    }
+    case 'p': {
+      const void *p = sol_topointer(L, arg);
+      checkformat(L, form, L_FMTFLAGSC, 0);
+      if (p == NULL) {  /* avoid calling 'printf' with argument NULL */
+        p = "(null)";  /* result */
+        form[strlen(form) - 1] = 's';  /* format it as a string */
+      }
+      nb = l_sprintf(buff, maxitem, form, p);
+      break;
+    }
+    case 'q': {
+      if (form[2] != '\0')  /* modifiers? */
+        solL_error(L, "specifier '%%q' cannot have modifiers");
+      addliteral(L, b, arg);
+      break;
+    }
+    case 's': {
+      size_t l;
+      const char *s = solL_tolstring(L, arg, &l);
+      if (form[2] == '\0')  /* no modifiers? */
+        solL_addvalue(b);  /* keep entire string */
+      else {
+        solL_argcheck(L, l == strlen(s), arg, "string contains zeros");
+        checkformat(L, form, L_FMTFLAGSC, 1);
+        if (strchr(form, '.') == NULL && l >= 100) {
+          /* no precision and string is too long to be formatted */
+          solL_addvalue(b);  /* keep entire string */
+        }
+        else {  /* format the string into 'buff' */
+          nb = l_sprintf(buff, maxitem, form, s);
+          sol_pop(L, 1);  /* remove result from 'solL_tolstring' */
+        }
+      }
+      break;
+    }
+    default: {  /* also treat cases 'pnLlh' */
+      solL_error(L, "invalid conversion '%s' to 'format'", form);
     }
   }
-  if (!sol_toboolean(L, -1)) {  /* nil or false? */
-    sol_pop(L, 1);  /* remove value */
-    solL_addlstring(b, s, e - s);  /* keep original text */
-    return 0;  /* no changes */
-  }
-  else if (l_unlikely(!sol_isstring(L, -1)))
-    return solL_error(L, "invalid replacement value (a %s)",
-                         solL_typename(L, -1));
-  else {
-    solL_addvalue(b);  /* add result to accumulator */
-    return 1;  /* something changed */
-  }
+  sol_assert(nb < maxitem);
+  solL_addsize(b, nb);
 }
 
 
-static int str_gsub (sol_State *L) {
-  size_t srcl, lp;
-  const char *src = solL_checklstring(L, 1, &srcl);  /* subject */
-  const char *p = solL_checklstring(L, 2, &lp);  /* pattern */
-  const char *lastmatch = NULL;  /* end of last match */
-  int tr = sol_type(L, 3);  /* replacement type */
-  sol_Integer max_s = solL_optinteger(L, 4, srcl + 1);  /* max replacements */
-  int anchor = (*p == '^');
-  sol_Integer n = 0;  /* replacement count */
-  int changed = 0;  /* change flag */
-  MatchState ms;
-  solL_Buffer b;
-  solL_argexpected(L, tr == SOL_TNUMBER || tr == SOL_TSTRING ||
-                   tr == SOL_TFUNCTION || tr == SOL_TTABLE, 3,
-                      "string/function/table");
-  solL_buffinit(L, &b);
-  if (anchor) {
-    p++; lp--;  /* skip anchor character */
-  }
-  prepstate(&ms, L, src, srcl, p, lp);
-  while (n < max_s) {
-    const char *e;
-    reprepstate(&ms);  /* (re)prepare state for new match */
-    if ((e = match(&ms, src, p)) != NULL && e != lastmatch) {  /* match? */
-      n++;
-      changed = add_value(&ms, &b, src, e, tr) | changed;
-      src = lastmatch = e;
-    }
-    else if (src < ms.src_end)  /* otherwise, skip one character */
-      solL_addchar(&b, *src++);
-    else break;  /* end of subject */
-    if (anchor) break;
-  }
-  if (!changed)  /* no changes? */
-    sol_pushvalue(L, 1);  /* return original string */
-  else {  /* something changed */
-    solL_addlstring(&b, src, ms.src_end-src);
-    solL_pushresult(&b);  /* create and return new string */
-  }
-  sol_pushinteger(L, n);  /* number of substitutions */
-  return 2;
-}
+/*
+** A format used more than once is compiled into a list of items, each
+** one with the literal text before a conversion (as a position in the
+** format string, which the compiled format keeps as its user value).
+** '%d', '%x', '%X', and '%s' with at most a width and a flag '-' or
+** '0', and the float conversions that 'plainprec' accepts, are done
+** directly; any other conversion keeps its specification for
+** 'addconv'. A format with an invalid conversion is not compiled, so
+** that 'addformat' reports the error as usual. Compiled formats live
+** in the pattern cache.
+*/
 
-/* }====================================================== */
+
+/* kinds of format items */
+#define FI_NONE		0	/* only literal text */
+#define FI_INT		1	/* '%d' or '%i' */
+#define FI_HEX		2	/* '%x' or '%X' */
+#define FI_STR		3	/* '%s' */
+#define FI_FLOAT	4	/* float conversion with only a precision */
+#define FI_OTHER	5	/* any other conversion (done by 'addconv') */
+
+
+/* formats with more items than that are not compiled */
+#define MAXFMTITEMS	64
 
 
+typedef struct FmtItem {
+  size_t lit;  /* position of literal text in the format string */
+  size_t llit;  /* length of literal text */
+  unsigned char kind;
+  char conv;  /* conversion specifier */
+  char flag;  /* '-', '0', or '\0' (for FI_INT, FI_HEX, and FI_STR) */
+  unsigned char width;  /* width (for FI_INT, FI_HEX, and FI_STR) */
+  int prec;  /* precision for FI_FLOAT */
+  char form[MAX_FORMAT];  /* specification for FI_OTHER */
+} FmtItem;
+
+
+typedef struct Format {
+  int nitems;
+  FmtItem *items;
+} Format;
+
 
 /*
-** {======================================================
-** STRING FORMAT
-** =======================================================
+** Check whether the (valid) specification in 'it' has at most one flag
+** ('-' or '0') and a width, and get them.
 */
+static int simplespec (FmtItem *it) {
+  const char *spec = it->form + 1;  /* skip '%' */
+  int w = 0;
+  it->flag = (*spec == '-' || *spec == '0') ? *spec++ : '\0';
+  if (*spec != '0') {  /* not a second flag? */
+    while (isdigit(uchar(*spec)))
+      w = w * 10 + (*spec++ - '0');
+  }
+  it->width = (unsigned char)w;
+  return (*spec == it->conv);
+}
 
-#if !defined(sol_number2strx)	/* { */
 
 /*
-** Hexadecimal floating-point formatter
+** Parse the conversion specification at 's' (after the '%') into 'it',
+** with the same checks that 'addformat' does. Returns the end of the
+** specification, or NULL if it is invalid.
 */
-
-#define SIZELENMOD	(sizeof(SOL_NUMBER_FRMLEN)/sizeof(char))
+static const char *parsespec (const char *s, FmtItem *it) {
+  size_t len = strspn(s, L_FMTFLAGSF "123456789.") + 1;
+  const char *flags;
+  int precision = 1;
+  int kind = FI_OTHER;  /* kind if 'simplespec' accepts it */
+  if (len >= MAX_FORMAT - 10)
+    return NULL;  /* too long */
+  it->form[0] = '%';
+  memcpy(it->form + 1, s, len * sizeof(char));
+  it->form[len + 1] = '\0';
+  it->conv = s[len - 1];
+  it->kind = FI_OTHER;
+  switch (it->conv) {
+    case 'c': case 'p':
+      flags = L_FMTFLAGSC;
+      precision = 0;
+      break;
+    case 'd': case 'i':
+      kind = FI_INT;
+      flags = L_FMTFLAGSI;
+      break;
+    case 'u':
+      flags = L_FMTFLAGSU;
+      break;
+    case 'x': case 'X':
+      kind = FI_HEX;
+      /* FALLTHROUGH */
+    case 'o':
+      flags = L_FMTFLAGSX;
+      break;
+    case 'a': case 'A':
+      flags = L_FMTFLAGSF;
+      break;
+    case 'e': case 'E': case 'f': case 'g': case 'G':
+      if ((it->prec = plainprec(it->form)) >= 0)
+        it->kind = FI_FLOAT;
+      flags = L_FMTFLAGSF;
+      break;
+    case 'q':
+      return (len == 1) ? s + len : NULL;  /* no modifiers */
+    case 's':
+      kind = FI_STR;
+      flags = L_FMTFLAGSC;
+      break;
+    default:  /* invalid conversion */
+      return NULL;
+  }
+  if (!validformat(it->form, flags, precision))
+    return NULL;
+  if (kind != FI_OTHER && simplespec(it))
+    it->kind = kind;
+  return s + len;
+}
 
 
 /*
-** Number of bits that goes into the first digit. It can be any value
-** between 1 and 4; the following definition tries to align the number
-** to nibble boundaries by making what is left after that first digit a
-** multiple of 4.
+** Parse format 'f' (with length 'lf') into 'items', if not NULL.
+** Returns the number of items, or -1 if the format is invalid or too
+** large to compile.
 */
-#define L_NBFD		((l_floatatt(MANT_DIG) - 1)%4 + 1)
+static int parseformat (const char *f, size_t lf, FmtItem *items) {
+  const char *f_end = f + lf;
+  const char *lit = f;  /* start of current literal text */
+  const char *e;
+  int n = 0;
+  while ((e = (const char *)memchr(lit, L_ESC, f_end - lit)) != NULL) {
+    FmtItem temp;
+    FmtItem *it = (items != NULL) ? &items[n] : &temp;
+    if (n == MAXFMTITEMS)
+      return -1;
+    it->lit = lit - f;
+    if (e[1] == L_ESC) {  /* '%%'? */
+      it->llit = e + 1 - lit;  /* keep one '%' as literal text */
+      it->kind = FI_NONE;
+      lit = e + 2;
+    }
+    else {
+      it->llit = e - lit;
+      if ((lit = parsespec(e + 1, it)) == NULL)
+        return -1;
+    }
+    n++;
+  }
+  if (lit < f_end) {  /* literal text after the last conversion? */
+    if (n == MAXFMTITEMS)
+      return -1;
+    if (items != NULL) {
+      items[n].lit = lit - f;
+      items[n].llit = f_end - lit;
+      items[n].kind = FI_NONE;
+    }
+    n++;
+  }
+  return n;
+}
 
 
 /*
-** Add integer part of 'x' to buffer and return new 'x'
+** Compile the format at index 'arg' into a new userdata (left on the
+** stack) and return it; returns NULL (leaving nothing on the stack) if
+** the format is not compiled.
 */
-static sol_Number adddigit (char *buff, int n, sol_Number x) {
-  sol_Number dd = l_mathop(floor)(x);  /* get integer part from 'x' */
-  int d = (int)dd;
-  buff[n] = (d < 10 ? d + '0' : d - 10 + 'a');  /* add to buffer */
-  return x - dd;  /* return what is left */
+static void *compileformat (sol_State *L, int arg) {
+  size_t lf;
+  const char *f = sol_tolstring(L, arg, &lf);
+  int n = parseformat(f, lf, NULL);
+  Format *ft;
+  if (n < 0)
+    return NULL;
+  ft = (Format *)sol_newuserdatauv(L, sizeof(Format) + n * sizeof(FmtItem),
+                                      1);
+  ft->nitems = n;
+  ft->items = (FmtItem *)(ft + 1);
+  parseformat(f, lf, ft->items);
+  sol_pushvalue(L, arg);
+  sol_setiuservalue(L, -2, 1);  /* keep the format string */
+  return ft;
+}
+
+
+/* write integer 'n' in decimal into 'buff'; returns its length */
+static int fmtint (char *buff, sol_Integer n) {
+  char temp[3 * sizeof(sol_Integer)];
+  sol_Unsigned u = (sol_Unsigned)n;
+  int i = 0, l = 0;
+  if (n < 0) {
+    u = 0u - u;
+    buff[l++] = '-';
+  }
+  do {
+    temp[i++] = (char)('0' + u % 10);
+    u /= 10;
+  } while (u != 0);
+  while (i > 0)
+    buff[l++] = temp[--i];
+  return l;
 }
 
 
-static int num2straux (char *buff, int sz, sol_Number x) {
-  /* if 'inf' or 'NaN', format it like '%g' */
-  if (x != x || x == (sol_Number)HUGE_VAL || x == -(sol_Number)HUGE_VAL)
-    return l_sprintf(buff, sz, SOL_NUMBER_FMT, (SOLI_UACNUMBER)x);
-  else if (x == 0) {  /* can be -0... */
-    /* create "0" or "-0" followed by exponent */
-    return l_sprintf(buff, sz, SOL_NUMBER_FMT "x0p+0", (SOLI_UACNUMBER)x);
+/* write 'u' in hexadecimal into 'buff'; returns its length */
+static int fmthex (char *buff, sol_Unsigned u, int upper) {
+  const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+  char temp[2 * sizeof(sol_Unsigned)];
+  int i = 0, l = 0;
+  do {
+    temp[i++] = digits[u & 0xF];
+    u >>= 4;
+  } while (u != 0);
+  while (i > 0)
+    buff[l++] = temp[--i];
+  return l;
+}
+
+
+/*
+** Copy 's' (with length 'l') into 'buff', padded as item 'it' says
+** (zeros go after a sign); returns the length of the result.
+*/
+static int padfield (char *buff, const char *s, int l, const FmtItem *it) {
+  int pad = (it->width > l) ? it->width - l : 0;
+  if (it->flag == '-') {
+    memcpy(buff, s, l * sizeof(char));
+    memset(buff + l, ' ', pad);
+  }
+  else if (it->flag == '0') {
+    int sign = (*s == '-');
+    memcpy(buff, s, sign);
+    memset(buff + sign, '0', pad);
+    memcpy(buff + sign + pad, s + sign, (l - sign) * sizeof(char));
   }
   else {
-    int e;
-    sol_Number m = l_mathop(frexp)(x, &e);  /* 'x' fraction and exponent */
-    int n = 0;  /* character count */
-    if (m < 0) {  /* is number negative? */
-      buff[n++] = '-';  /* add sign */
-      m = -m;  /* make it positive */
-    }
-    buff[n++] = '0'; buff[n++] = 'x';  /* add "0x" */
-    m = adddigit(buff, n++, m * (1 << L_NBFD));  /* add first digit */
-    e -= L_NBFD;  /* this digit goes before the radix point */
-    if (m > 0) {  /* more digits? */
-      buff[n++] = sol_getlocaledecpoint();  /* add radix point */
-      do {  /* add as many digits as needed */
-        m = adddigit(buff, n++, m * 16);
-      } while (m > 0);
+    memset(buff, ' ', pad);
+    memcpy(buff + pad, s, l * sizeof(char));
+  }
+  return l + pad;
+}
+
+
+/*
+** Add to buffer 'b' the result of formatting the values after 'arg'
+** (up to 'top') with the compiled format 'ft', whose string is 'f'.
+*/
+static void addcompiled (sol_State *L, solL_Buffer *b, const Format *ft,
+                         const char *f, int arg, int top) {
+  int i;
+  for (i = 0; i < ft->nitems; i++) {
+    const FmtItem *it = &ft->items[i];
+    solL_addlstring(b, f + it->lit, it->llit);
+    if (it->kind == FI_NONE)
+      continue;
+    if (++arg > top)
+      solL_argerror(L, arg, "no value");
+    switch (it->kind) {
+      case FI_INT: case FI_HEX: {
+        sol_Integer n = solL_checkinteger(L, arg);
+        char *buff = solL_prepbuffsize(b, MAX_ITEM);
+        char temp[MAX_ITEM];
+        char *d = (it->width == 0) ? buff : temp;  /* where to write */
+        int l = (it->kind == FI_INT) ? fmtint(d, n)
+                                     : fmthex(d, (sol_Unsigned)n,
+                                                 it->conv == 'X');
+        if (it->width != 0)
+          l = padfield(buff, temp, l, it);
+        solL_addsize(b, l);
+        break;
+      }
+      case FI_STR: {
+        size_t l;
+        char *buff = solL_prepbuffsize(b, MAX_ITEM);
+        const char *s = solL_tolstring(L, arg, &l);
+        if (it->width == 0)
+          solL_addvalue(b);
+        else {
+          solL_argcheck(L, l == strlen(s), arg, "string contains zeros");
+          if (l >= it->width)  /* no padding? */
+            solL_addvalue(b);
+          else {
+            solL_addsize(b, padfield(buff, s, (int)l, it));
+            sol_pop(L, 1);  /* remove result from 'solL_tolstring' */
+          }
+        }
+        break;
+      }
+      case FI_FLOAT: {
+        sol_Number n = solL_checknumber(L, arg);
+        int maxitem = (it->conv == 'f') ? MAX_ITEMF : MAX_ITEM;
+        char *buff = solL_prepbuffsize(b, maxitem);
+        int nb = sol_formatnumber(L, buff, maxitem, n, it->conv, it->prec);
+        sol_assert(nb < maxitem);
+        solL_addsize(b, nb);
+        break;
+      }
+      default: {  /* FI_OTHER */
+        char form[MAX_FORMAT];
+        memcpy(form, it->form, sizeof(form));  /* 'addconv' changes it */
+        addconv(L, b, arg, form);
+        break;
+      }
     }
-    n += l_sprintf(buff + n, sz - n, "p%+d", e);  /* add exponent */
-    sol_assert(n < sz);
-    return n;
   }
 }
 
 
-static int sol_number2strx (sol_State *L, char *buff, int sz,
-                            const char *fmt, sol_Number x) {
-  int n = num2straux(buff, sz, x);
-  if (fmt[SIZELENMOD] == 'A') {
-    int i;
-    for (i = 0; i < n; i++)
-      buff[i] = toupper(uchar(buff[i]));
+/*
+** Compiled form of the format at index 'arg', or NULL if it must be
+** interpreted. Pushes one value (see 'getcompiled').
+*/
+static const Format *getcformat (sol_State *L, int arg) {
+  if (sol_type(L, arg) == SOL_TSTRING)
+    return (const Format *)getcompiled(L, arg, 0, PC_FORMAT);
+  else {  /* not a string (maybe a number); not compiled */
+    sol_pushnil(L);
+    return NULL;
+  }
+}
+
+
+/*
+** Add to buffer 'b' the result of formatting the values after 'arg'
+** (up to 'top') with the format at 'arg', whose compiled form (if any)
+** is 'ft'.
+*/
+static void addformat (sol_State *L, solL_Buffer *b, const Format *ft,
+                                     int arg, int top) {
+  size_t sfl;
+  const char *strfrmt = solL_checklstring(L, arg, &sfl);
+  const char *strfrmt_end = strfrmt+sfl;
+  if (ft != NULL) {
+    addcompiled(L, b, ft, strfrmt, arg, top);
+    return;
+  }
+  while (strfrmt < strfrmt_end) {
+    if (*strfrmt != L_ESC)
+      solL_addchar(b, *strfrmt++);
+    else if (*++strfrmt == L_ESC)
+      solL_addchar(b, *strfrmt++);  /* %% */
+    else { /* format item */
+      char form[MAX_FORMAT];  /* to store the format ('%...') */
+      if (++arg > top)
+        solL_argerror(L, arg, "no value");
+      strfrmt = getformat(L, strfrmt, form) + 1;
+      addconv(L, b, arg, form);
+    }
   }
-  else if (l_unlikely(fmt[SIZELENMOD] != 'a'))
-    return solL_error(L, "modifiers for format '%%a'/'%%A' not implemented");
-  return n;
 }
 
-#endif				/* } */
 
+static int str_format (sol_State *L) {
+  int top = sol_gettop(L);
+  const Format *ft = getcformat(L, 1);
+  solL_Buffer b;
+  solL_buffinit(L, &b);
+  addformat(L, &b, ft, 1, top);
+  solL_pushresult(&b);
+  return 1;
+}
 
-/*
-** Maximum size for items formatted with '%f'. This size is produced
-** by format('%.99f', -maxfloat), and is equal to 99 + 3 ('-', '.',
-** and '\0') + number of decimal digits to represent maxfloat (which
-** is maximum exponent + 1). (99+3+1, adding some extra, 110)
-*/
-#define MAX_ITEMF	(110 + l_floatatt(MAX_10_EXP))
+/* }====================================================== */
 
 
 /*
-** All formats except '%f' do not need that large limit.  The other
-** float formats use exponents, so that they fit in the 99 limit for
-** significant digits; 's' for large strings and 'q' add items directly
-** to the buffer; all integer formats also fit in the 99 limit.  The
-** worst case are floats: they may need 99 significant digits, plus
-** '0x', '-', '.', 'e+XXXX', and '\0'. Adding some extra, 120.
+** {======================================================
+** STRING BUFFERS
+** =======================================================
 */
-#define MAX_ITEM	120
-
-
-/* valid flags in a format specification */
-#if !defined(L_FMTFLAGSF)
 
-/* valid flags for a, A, e, E, f, F, g, and G conversions */
-#define L_FMTFLAGSF	"-+#0 "
+#define STRBUFFER	"string.buffer"
 
-/* valid flags for o, x, and X conversions */
-#define L_FMTFLAGSX	"-#0"
 
-/* valid flags for d and i conversions */
-#define L_FMTFLAGSI	"-+0 "
+/*
+** A mutable buffer of bytes. Its contents are 'b[r .. w - 1]': reading
+** only moves 'r', and the consumed space is reused when the buffer
+** needs room. The block 'b' is a full userdata kept as the buffer's
+** user value, so that the collector accounts for its memory as it does
+** for strings. Every method gets the buffer as its first argument.
+*/
+typedef struct StrBuf {
+  char *b;
+  size_t size;  /* allocated size */
+  size_t r;  /* read position */
+  size_t w;  /* write position */
+} StrBuf;
 
-/* valid flags for u conversions */
-#define L_FMTFLAGSU	"-0"
 
-/* valid flags for c, p, and s conversions */
-#define L_FMTFLAGSC	"-"
+#define tostrbuf(L,i)	((StrBuf *)solL_checkudata(L, i, STRBUFFER))
 
-#endif
+#define sblen(sb)	((sb)->w - (sb)->r)
 
 
 /*
-** Maximum size of each format specification (such as "%-099.99d"):
-** Initial '%', flags (up to 5), width (2), period, precision (2),
-** length modifier (8), conversion specifier, and final '\0', plus some
-** extra.
+** Copies the unread contents of buffer 'sb' (at stack index 1) to the
+** start of a new block with 'newsize' bytes (no block if 'newsize' is
+** zero). The old block is left to the collector.
 */
-#define MAX_FORMAT	32
-
-
-static void addquoted (solL_Buffer *b, const char *s, size_t len) {
-  solL_addchar(b, '"');
-  while (len--) {
-    if (*s == '"' || *s == '\\' || *s == '\n') {
-      solL_addchar(b, '\\');
-      solL_addchar(b, *s);
-    }
-    else if (iscntrl(uchar(*s))) {
-      char buff[10];
-      if (!isdigit(uchar(*(s+1))))
-        l_sprintf(buff, sizeof(buff), "\\%d", (int)uchar(*s));
-      else
-        l_sprintf(buff, sizeof(buff), "\\%03d", (int)uchar(*s));
-      solL_addstring(b, buff);
-    }
-    else
-      solL_addchar(b, *s);
-    s++;
+static void sbresize (sol_State *L, StrBuf *sb, size_t newsize) {
+  size_t n = sblen(sb);
+  char *b = NULL;
+  sol_assert(n <= newsize);
+  if (newsize > 0) {
+    b = (char *)sol_newuserdatauv(L, newsize, 0);
+    if (n > 0)
+      memcpy(b, sb->b + sb->r, n * sizeof(char));
   }
-  solL_addchar(b, '"');
+  else
+    sol_pushnil(L);
+  sol_setiuservalue(L, 1, 1);  /* buffer's block */
+  sb->b = b;
+  sb->size = newsize;
+  sb->r = 0;
+  sb->w = n;
 }
 
 
 /*
-** Serialize a floating-point number in such a way that it can be
-** scanned back by Sol. Use hexadecimal format for "common" numbers
-** (to preserve precision); inf, -inf, and NaN are handled separately.
-** (NaN cannot be expressed as a numeral, so we write '(0/0)' for it.)
+** Returns a pointer to a free area with at least 'sz' bytes at the end
+** of buffer 'sb'. When at least half of the block has been consumed
+** and 'sz' more bytes fit in it, the unread contents move to its
+** start, paid for by the consumed bytes; otherwise, they go to a new
+** block 1.5 times larger (or more, if needed), without the consumed
+** prefix. So, each byte is moved an amortized constant number of
+** times.
 */
-static int quotefloat (sol_State *L, char *buff, sol_Number n) {
-  const char *s;  /* for the fixed representations */
-  if (n == (sol_Number)HUGE_VAL)  /* inf? */
-    s = "1e9999";
-  else if (n == -(sol_Number)HUGE_VAL)  /* -inf? */
-    s = "-1e9999";
-  else if (n != n)  /* NaN? */
-    s = "(0/0)";
-  else {  /* format number as hexadecimal */
-    int  nb = sol_number2strx(L, buff, MAX_ITEM,
-                                 "%" SOL_NUMBER_FRMLEN "a", n);
-    /* ensures that 'buff' string uses a dot as the radix character */
-    if (memchr(buff, '.', nb) == NULL) {  /* no dot? */
-      char point = sol_getlocaledecpoint();  /* try locale point */
-      char *ppoint = (char *)memchr(buff, point, nb);
-      if (ppoint) *ppoint = '.';  /* change it to a dot */
+static char *sbprep (sol_State *L, StrBuf *sb, size_t sz) {
+  if (sb->size - sb->w < sz) {  /* not enough space? */
+    size_t n = sblen(sb);
+    if (l_unlikely(MAX_SIZET - sz < n))  /* overflow in (n + sz)? */
+      solL_error(L, "buffer too large");
+    if (sb->r >= sb->size / 2 && n + sz <= sb->size) {
+      memmove(sb->b, sb->b + sb->r, n * sizeof(char));
+      sb->r = 0;
+      sb->w = n;
+    }
+    else {
+      size_t newsize = (sb->size / 2) * 3;
+      if (newsize < n + sz)
+        newsize = n + sz;
+      sbresize(L, sb, newsize);
     }
-    return nb;
   }
-  /* for the fixed representations */
-  return l_sprintf(buff, MAX_ITEM, "%s", s);
+  return sb->b + sb->w;
 }
 
 
-static void addliteral (sol_State *L, solL_Buffer *b, int arg) {
-  switch (sol_type(L, arg)) {
-    case SOL_TSTRING: {
-      size_t len;
-      const char *s = sol_tolstring(L, arg, &len);
-      addquoted(b, s, len);
-      break;
-    }
-    case SOL_TNUMBER: {
-      char *buff = solL_prepbuffsize(b, MAX_ITEM);
-      int nb;
-      if (!sol_isinteger(L, arg))  /* float? */
-        nb = quotefloat(L, buff, sol_tonumber(L, arg));
-      else {  /* integers */
-        sol_Integer n = sol_tointeger(L, arg);
-        const char *format = (n == SOL_MININTEGER)  /* corner case? */
-                           ? "0x%" SOL_INTEGER_FRMLEN "x"  /* use hex */
-                           : SOL_INTEGER_FMT;  /* else use default format */
-        nb = l_sprintf(buff, MAX_ITEM, format, (SOLI_UACINT)n);
-      }
-      solL_addsize(b, nb);
-      break;
-    }
-    case SOL_TNIL: case SOL_TBOOLEAN: {
-      solL_tolstring(L, arg, NULL);
-      solL_addvalue(b);
-      break;
-    }
-    default: {
-      solL_argerror(L, arg, "value has no literal form");
-    }
+static void sbadd (sol_State *L, StrBuf *sb, const char *s, size_t l) {
+  if (l > 0) {  /* avoid 'memcpy' when 's' can be NULL */
+    char *p = sbprep(L, sb, l);
+    memcpy(p, s, l * sizeof(char));
+    sb->w += l;
   }
 }
 
 
-static const char *get2digits (const char *s) {
-  if (isdigit(uchar(*s))) {
-    s++;
-    if (isdigit(uchar(*s))) s++;  /* (2 digits at most) */
-  }
-  return s;
+/*
+** string.buffer([size]): a new empty buffer, with room for 'size' bytes
+*/
+static int sb_new (sol_State *L) {
+  sol_Integer size = solL_optinteger(L, 1, 0);
+  StrBuf *sb;
+  solL_argcheck(L, 0 <= size && (sol_Unsigned)size <= MAXSIZE, 1,
+                   "out of range");
+  sol_settop(L, 0);
+  sb = (StrBuf *)sol_newuserdatauv(L, sizeof(StrBuf), 1);  /* at index 1 */
+  sb->b = NULL;
+  sb->size = sb->r = sb->w = 0;
+  solL_setmetatable(L, STRBUFFER);
+  if (size > 0)
+    sbresize(L, sb, (size_t)size);
+  return 1;
 }
 
 
 /*
-** Check whether a conversion specification is valid. When called,
-** first character in 'form' must be '%' and last character must
-** be a valid conversion specifier. 'flags' are the accepted flags;
-** 'precision' signals whether to accept a precision.
+** buf:put(...): append strings, numbers, other buffers (their unread
+** contents, which are not consumed), or values with '__tostring'; any
+** other value is an error
 */
-static void checkformat (sol_State *L, const char *form, const char *flags,
-                                       int precision) {
-  const char *spec = form + 1;  /* skip '%' */
-  spec += strspn(spec, flags);  /* skip flags */
-  if (*spec != '0') {  /* a width cannot start with '0' */
-    spec = get2digits(spec);  /* skip width */
-    if (*spec == '.' && precision) {
-      spec++;
-      spec = get2digits(spec);  /* skip precision */
+static int sb_put (sol_State *L) {
+  StrBuf *sb = tostrbuf(L, 1);
+  int n = sol_gettop(L);
+  int i;
+  for (i = 2; i <= n; i++) {
+    size_t l;
+    const char *s;
+    StrBuf *other;
+    if (sol_isinteger(L, i)) {  /* format it in place */
+      char *p = sbprep(L, sb, MAX_ITEM);
+      sb->w += (size_t)sol_integer2str(p, MAX_ITEM, sol_tointeger(L, i));
+    }
+    else if (sol_type(L, i) == SOL_TSTRING || sol_type(L, i) == SOL_TNUMBER) {
+      s = sol_tolstring(L, i, &l);
+      sbadd(L, sb, s, l);
+    }
+    else if ((other = (StrBuf *)solL_testudata(L, i, STRBUFFER)) != NULL) {
+      char *p = sbprep(L, sb, sblen(other));  /* may move 'other' too */
+      l = sblen(other);
+      if (l > 0)
+        memcpy(p, other->b + other->r, l * sizeof(char));
+      sb->w += l;
     }
+    else if (solL_getmetafield(L, i, "__tostring") != SOL_TNIL) {
+      sol_pop(L, 1);  /* remove metafield */
+      s = solL_tolstring(L, i, &l);
+      sbadd(L, sb, s, l);
+      sol_pop(L, 1);  /* remove result from 'solL_tolstring' */
+    }
+    else
+      return solL_typeerror(L, i, "string");
   }
-  if (!isalpha(uchar(*spec)))  /* did not go to the end? */
-    solL_error(L, "invalid conversion specification: '%s'", form);
+  sol_settop(L, 1);
+  return 1;  /* return the buffer */
 }
 
 
 /*
-** Get a conversion specification and copy it to 'form'.
-** Return the address of its last character.
+** buf:putf(fmt, ...): append the result of 'string.format(fmt, ...)',
+** without creating that string
 */
-static const char *getformat (sol_State *L, const char *strfrmt,
-                                            char *form) {
-  /* spans flags, width, and precision ('0' is included as a flag) */
-  size_t len = strspn(strfrmt, L_FMTFLAGSF "123456789.");
-  len++;  /* adds following character (should be the specifier) */
-  /* still needs space for '%', '\0', plus a length modifier */
-  if (len >= MAX_FORMAT - 10)
-    solL_error(L, "invalid format (too long)");
-  *(form++) = '%';
-  memcpy(form, strfrmt, len * sizeof(char));
-  *(form + len) = '\0';
-  return strfrmt + len - 1;
+static int sb_putf (sol_State *L) {
+  StrBuf *sb = tostrbuf(L, 1);
+  int top = sol_gettop(L);
+  const Format *ft = getcformat(L, 2);
+  solL_Buffer b;
+  solL_buffinit(L, &b);
+  addformat(L, &b, ft, 2, top);
+  sbadd(L, sb, b.b, b.n);  /* (temporary box is closed when returning) */
+  sol_pushvalue(L, 1);
+  return 1;
 }
 
 
 /*
-** add length modifier into formats
+** buf:reserve(size): make room for at least 'size' more bytes;
+** returns how many bytes can be added without reallocating
 */
-static void addlenmod (char *form, const char *lenmod) {
-  size_t l = strlen(form);
-  size_t lm = strlen(lenmod);
-  char spec = form[l - 1];
-  strcpy(form + l - 1, lenmod);
-  form[l + lm - 1] = spec;
-  form[l + lm] = '\0';
+static int sb_reserve (sol_State *L) {
+  StrBuf *sb = tostrbuf(L, 1);
+  sol_Integer sz = solL_checkinteger(L, 2);
+  solL_argcheck(L, 0 <= sz && (sol_Unsigned)sz <= MAXSIZE, 2,
+                   "out of range");
+  sbprep(L, sb, (size_t)sz);
+  sol_pushinteger(L, (sol_Integer)(sb->size - sb->w));
+  return 1;
 }
 
 
-static int str_format (sol_State *L) {
-  int top = sol_gettop(L);
-  int arg = 1;
-  size_t sfl;
-  const char *strfrmt = solL_checklstring(L, arg, &sfl);
-  const char *strfrmt_end = strfrmt+sfl;
-  const char *flags;
-  solL_Buffer b;
-  solL_buffinit(L, &b);
-  while (strfrmt < strfrmt_end) {
-    if (*strfrmt != L_ESC)
-      solL_addchar(&b, *strfrmt++);
-    else if (*++strfrmt == L_ESC)
-      solL_addchar(&b, *strfrmt++);  /* %% */
-    else { /* format item */
-      char form[MAX_FORMAT];  /* to store the format ('%...') */
-      int maxitem = MAX_ITEM;  /* maximum length for the result */
-      char *buff = solL_prepbuffsize(&b, maxitem);  /* to put result */
-      int nb = 0;  /* number of bytes in result */
-      if (++arg > top)
-        return solL_argerror(L, arg, "no value");
-      strfrmt = getformat(L, strfrmt, form);
-      switch (*strfrmt++) {
-        case 'c': {
-          checkformat(L, form, L_FMTFLAGSC, 0);
-          nb = l_sprintf(buff, maxitem, form, (int)solL_checkinteger(L, arg));
-          break;
-        }
-        case 'd': case 'i':
-          flags = L_FMTFLAGSI;
-          goto intcase;
-        case 'u':
-          flags = L_FMTFLAGSU;
-          goto intcase;
-        case 'o': case 'x': case 'X':
-          flags = L_FMTFLAGSX;
-         intcase: {
-          sol_Integer n = solL_checkinteger(L, arg);
-          checkformat(L, form, flags, 1);
-          addlenmod(form, SOL_INTEGER_FRMLEN);
-          nb = l_sprintf(buff, maxitem, form, (SOLI_UACINT)n);
-          break;
-        }
-        case 'a': case 'A':
-          checkformat(L, form, L_FMTFLAGSF, 1);
-          addlenmod(form, SOL_NUMBER_FRMLEN);
-          nb = sol_number2strx(L, buff, maxitem, form,
-                                  solL_checknumber(L, arg));
-          break;
-        case 'f':
-          maxitem = MAX_ITEMF;  /* extra space for '%f' */
-          buff = solL_prepbuffsize(&b, maxitem);
-          /* FALLTHROUGH */
-        case 'e': case 'E': case 'g': case 'G': {
-          sol_Number n = solL_checknumber(L, arg);
-          checkformat(L, form, L_FMTFLAGSF, 1);
-          addlenmod(form, SOL_NUMBER_FRMLEN);
-          nb = l_sprintf(buff, maxitem, form, (SOLI_UACNUMBER)n);
-          break;
-        }
-        case 'p': {
-          const void *p = sol_topointer(L, arg);
-          checkformat(L, form, L_FMTFLAGSC, 0);
-          if (p == NULL) {  /* avoid calling 'printf' with argument NULL */
-            p = "(null)";  /* result */
-            form[strlen(form) - 1] = 's';  /* format it as a string */
-          }
-          nb = l_sprintf(buff, maxitem, form, p);
-          break;
-        }
-        case 'q': {
-          if (form[2] != '\0')  /* modifiers? */
-            return solL_error(L, "specifier '%%q' cannot have modifiers");
-          addliteral(L, &b, arg);
-          break;
-        }
-        case 's': {
-          size_t l;
-          const char *s = solL_tolstring(L, arg, &l);
-          if (form[2] == '\0')  /* no modifiers? */
-            solL_addvalue(&b);  /* keep entire string */
-          else {
-            solL_argcheck(L, l == strlen(s), arg, "string contains zeros");
-            checkformat(L, form, L_FMTFLAGSC, 1);
-            if (strchr(form, '.') == NULL && l >= 100) {
-              /* no precision and string is too long to be formatted */
-              solL_addvalue(&b);  /* keep entire string */
-            }
-            else {  /* format the string into 'buff' */
-              nb = l_sprintf(buff, maxitem, form, s);
-              sol_pop(L, 1);  /* remove result from 'solL_tolstring' */
-            }
-          }
-          break;
-        }
-        default: {  /* also treat cases 'pnLlh' */
-          return solL_error(L, "invalid conversion '%s' to 'format'", form);
-        }
-      }
-      sol_assert(nb < maxitem);
-      solL_addsize(&b, nb);
+/* buf:skip(len): consume (up to) 'len' bytes */
+static int sb_skip (sol_State *L) {
+  StrBuf *sb = tostrbuf(L, 1);
+  sol_Integer l = solL_checkinteger(L, 2);
+  if (l > 0)
+    sb->r += ((sol_Unsigned)l < sblen(sb)) ? (size_t)l : sblen(sb);
+  if (sb->r == sb->w)  /* empty? */
+    sb->r = sb->w = 0;  /* reuse all space */
+  sol_settop(L, 1);
+  return 1;
+}
+
+
+/*
+** buf:get([len...]): consume and return a string with (up to) 'len'
+** bytes for each argument, or with all contents for a nil argument or
+** no arguments
+*/
+static int sb_get (sol_State *L) {
+  StrBuf *sb = tostrbuf(L, 1);
+  int n = sol_gettop(L) - 1;
+  int i;
+  if (n == 0) {
+    sol_pushnil(L);  /* as 'buf:get(nil)' */
+    n = 1;
+  }
+  solL_checkstack(L, n, "too many results");
+  for (i = 2; i <= n + 1; i++) {
+    size_t l = sblen(sb);
+    if (!sol_isnil(L, i)) {
+      sol_Integer li = solL_checkinteger(L, i);
+      if (li < 0) li = 0;
+      if ((sol_Unsigned)li < l) l = (size_t)li;
     }
+    sol_pushlstring(L, sb->b + sb->r, l);
+    sb->r += l;
   }
-  solL_pushresult(&b);
+  if (sb->r == sb->w)  /* empty? */
+    sb->r = sb->w = 0;  /* reuse all space */
+  return n;
+}
+
+
+/* buf:tostring(): the contents of the buffer, without consuming them */
+static int sb_tostring (sol_State *L) {
+  StrBuf *sb = tostrbuf(L, 1);
+  sol_pushlstring(L, sb->b + sb->r, sblen(sb));
+  return 1;
+}
+
+
+/* buf:reset(): make the buffer empty (keeping its memory) */
+static int sb_reset (sol_State *L) {
+  StrBuf *sb = tostrbuf(L, 1);
+  sb->r = sb->w = 0;
+  sol_settop(L, 1);
+  return 1;
+}
+
+
+static int sb_len (sol_State *L) {
+  StrBuf *sb = tostrbuf(L, 1);
+  sol_pushinteger(L, (sol_Integer)sblen(sb));
   return 1;
 }
 
+
+/* buf:__close(): release the buffer's memory */
+static int sb_close (sol_State *L) {
+  StrBuf *sb = tostrbuf(L, 1);
+  sb->r = sb->w = 0;
+  sbresize(L, sb, 0);
+  return 0;
+}
+
+
+static const solL_Reg sb_meth[] = {
+  {"put", sb_put},
+  {"append", sb_put},
+  {"putf", sb_putf},
+  {"reserve", sb_reserve},
+  {"skip", sb_skip},
+  {"get", sb_get},
+  {"tostring", sb_tostring},
+  {"reset", sb_reset},
+  {NULL, NULL}
+};
+
+
+static const solL_Reg sb_metameth[] = {
+  {"__index", NULL},  /* placeholder */
+  {"__len", sb_len},
+  {"__tostring", sb_tostring},
+  {"__close", sb_close},
+  {NULL, NULL}
+};
+
+
+/*
+** Create the metatable for string buffers. The two values on the top
+** of the stack (the pattern cache, see 'getcompiled') are upvalues for
+** the methods, which use it for 'putf'.
+*/
+static void createbuffermeta (sol_State *L) {
+  solL_newmetatable(L, STRBUFFER);  /* metatable for string buffers */
+  solL_setfuncs(L, sb_metameth, 0);  /* add metamethods to new metatable */
+  solL_newlibtable(L, sb_meth);  /* create method table */
+  sol_pushvalue(L, -4);  /* pattern cache */
+  sol_pushvalue(L, -4);  /* its compiled forms */
+  solL_setfuncs(L, sb_meth, 2);  /* add buffer methods to method table */
+  sol_setfield(L, -2, "__index");  /* metatable.__index = method table */
+  sol_pop(L, 1);  /* pop metatable */
+}
+
 /* }====================================================== */
 
 
@@ -1832,6 +3288,7 @@ static const solL_Reg strlib[] = {
   {"char", str_char},
   {"dump", str_dump},
   {"find", str_find},
+  {"buffer", sb_new},
   {"format", str_format},
   {"gmatch", gmatch},
   {"gsub", str_gsub},
@@ -1867,7 +3324,10 @@ static void createmetatable (sol_State *L) {
 ** Open string library
 */
 SOLMOD_API int solopen_string (sol_State *L) {
-  solL_newlib(L, strlib);
+  solL_newlibtable(L, strlib);
+  createpatcache(L);  /* shared by patterns and formats */
+  createbuffermeta(L);
+  solL_setfuncs(L, strlib, 2);
   createmetatable(L);
   return 1;
 }
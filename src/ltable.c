@@ -16,6 +16,8 @@
 ** Non-negative integer keys are all candidates to be kept in the array
 ** part. The actual size of the array is the largest 'n' such that
 ** more than half the slots between 1 and n are in use.
+** An array part holding only numbers of a single type (integers or
+** floats) may be kept "typed", as a vector of raw numbers.
 ** Hash uses a mix of chained scatter table with Brent's variation.
 ** A main invariant of these tables is that, if an element is not
 ** in its main position (i.e. the 'original' position that its hash gives
@@ -25,6 +27,7 @@
 
 #include <math.h>
 #include <limits.h>
+#include <string.h>
 
 #include "sol.h"
 
@@ -33,6 +36,7 @@
 #include "lgc.h"
 #include "lmem.h"
 #include "lobject.h"
+#include "lshape.h"
 #include "lstate.h"
 #include "lstring.h"
 #include "ltable.h"
@@ -68,6 +72,17 @@
 #define MAXHSIZE	solM_limitN(1u << MAXHBITS, Node)
 
 
+/*
+** Minimum size for an array part to be kept as a typed array. Smaller
+** arrays do not save enough memory to pay for their conversions.
+*/
+#if !defined(SOLI_MINNUMA)
+#define SOLI_MINNUMA	8
+#endif
+
+
+#if !SOL_USE_SWISSHASH
+
 /*
 ** When the original hash value is good, hashing by a power of 2
 ** avoids the cost of '%'.
@@ -95,10 +110,44 @@ static const Node dummynode_ = {
    SOL_VNIL, 0, {NULL}}  /* key type, next, and key value */
 };
 
+#else
+
+/* number of control bytes probed at once (see 'Group') */
+#if defined(__AVX2__)
+#define GROUPWIDTH	32
+#elif defined(__SSE2__)
+#define GROUPWIDTH	16
+#else
+#define GROUPWIDTH	cast_int(sizeof(size_t))
+#endif
+
+/*
+** The dummy node is followed by its (free) control bytes, so that
+** searches in an empty hash part need no special case.
+*/
+#define dummynode		(&dummy_.node)
+
+static const struct {
+  Node node;
+  lu_byte ctrl[GROUPWIDTH];
+} dummy_ = {
+  {{{NULL}, SOL_VEMPTY,  /* value's value and type */
+    SOL_VNIL, 0, {NULL}}},  /* key type, next, and key value */
+  {0}  /* all control bytes free */
+};
+
+#endif
+
 
 static const TValue absentkey = {ABSTKEYCONSTANT};
 
 
+/* true if array element 'i' (base 0) of table 't' is empty */
+#define arrayisempty(t,i)  \
+	(isnumarray(t) ? (i) >= numheader(t)->n : tagisempty(*arraytag(t,i)))
+
+
+#if !SOL_USE_SWISSHASH
 /*
 ** Hash for integers. To allow a good hash, use the remainder operator
 ** ('%'). If integer fits as a non-negative int, compute an int
@@ -112,6 +161,7 @@ static Node *hashint (const Table *t, sol_Integer i) {
   else
     return hashmod(t, ui);
 }
+#endif
 
 
 /*
@@ -144,6 +194,8 @@ static int l_hashfloat (sol_Number n) {
 #endif
 
 
+#if !SOL_USE_SWISSHASH
+
 /*
 ** returns the 'main' position of an element in a table (that is,
 ** the index of its hash value).
@@ -192,6 +244,237 @@ l_sinline Node *mainpositionfromnode (const Table *t, Node *nd) {
   return mainpositionTV(t, &key);
 }
 
+#else
+
+/*
+** {==================================================================
+** Swiss-table hash part
+** ===================================================================
+*/
+
+/*
+** Here the hash part is an open-addressing table. Its nodes are
+** followed by one control byte per node: 0 for a free node, or 0x80
+** plus the 7 highest bits of the hash of its key for a used one. A
+** search loads a group of consecutive control bytes and compares all of
+** them at once with the hash bits of the key, checking only the nodes
+** that match; a free node in the group ends the search. Groups are
+** probed quadratically from the position given by the hash. So that a
+** group can start at any node, the first GROUPWIDTH control bytes are
+** replicated after the last one.
+** As with chained scatter, nodes are never freed: a removed entry keeps
+** its key (which may become dead) and its control byte, so that 'next'
+** still finds it, and only that same key reuses it. 'lastfree' counts
+** down the nodes that can still be used before a rehash ('lastfree -
+** node' of them), which keeps at least 1/8 of the nodes free.
+*/
+
+/* number of nodes that can be used in a hash part of size 'size' */
+#define maxfill(size)	((size) - ((size) >= 16 ? (size) >> 3 : 1))
+
+#define ctrlbytes(t)	cast(lu_byte *, gnode(t, sizenode(t)))
+
+/* control byte for a used node with hash 'h' */
+#define ctrlhash(h)	cast_byte(((h) >> 25) | 0x80)
+
+/* size in bytes of a hash part with 'size' nodes */
+#define hashsize(size)	((size) * (sizeof(Node) + 1) + GROUPWIDTH)
+
+
+#if defined(__GNUC__)
+#define ctz(m)		cast_uint(__builtin_ctzll(m))
+#else
+static unsigned int ctz (unsigned long long m) {
+  unsigned int i = 0;
+  while (!(m & 1)) { m >>= 1; i++; }
+  return i;
+}
+#endif
+
+
+/*
+** A 'Group' holds GROUPWIDTH control bytes; 'groupmatch' and 'groupfree'
+** give a mask with one bit (or byte) for each control byte equal to the
+** given one or free, and 'maskslot' gives the position of the first
+** one in a mask.
+*/
+#if defined(__SSE2__)
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+
+typedef __m256i Group;
+#define groupload(p)	_mm256_loadu_si256(cast(const __m256i *, p))
+#define groupmatch(g,c)  \
+	cast_uint(_mm256_movemask_epi8(_mm256_cmpeq_epi8(g, \
+	                               _mm256_set1_epi8(cast(char, c)))))
+#define groupfree(g)  \
+	cast_uint(_mm256_movemask_epi8(_mm256_cmpeq_epi8(g, \
+	                               _mm256_setzero_si256())))
+#else
+#include <emmintrin.h>
+
+typedef __m128i Group;
+#define groupload(p)	_mm_loadu_si128(cast(const __m128i *, p))
+#define groupmatch(g,c)  \
+	cast_uint(_mm_movemask_epi8(_mm_cmpeq_epi8(g, \
+	                            _mm_set1_epi8(cast(char, c)))))
+/* free bytes are the ones without their sign bit */
+#define groupfree(g)	(cast_uint(_mm_movemask_epi8(g)) ^ 0xFFFFu)
+#endif
+
+typedef unsigned int GroupMask;
+#define maskslot(m)	ctz(m)
+
+#else  /* }{ */
+
+/*
+** Portable version, treating a 'size_t' as a vector of bytes. The
+** match may signal bytes that follow a matching one and are equal to
+** the given byte plus 1, so it can produce false positives (and the
+** callers check each candidate).
+*/
+typedef size_t Group;
+typedef size_t GroupMask;
+
+#define GLSB		(~cast_sizet(0) / 0xFF)
+#define GMSB		(GLSB << 7)
+
+l_sinline Group groupload (const lu_byte *p) {
+  Group g = 0;
+  int i;
+  for (i = GROUPWIDTH - 1; i >= 0; i--)
+    g = (g << 8) | p[i];
+  return g;
+}
+
+l_sinline GroupMask groupmatch (Group g, lu_byte c) {
+  Group x = g ^ (GLSB * c);
+  return (x - GLSB) & ~x & GMSB;
+}
+
+#define groupfree(g)	(~(g) & GMSB)
+#define maskslot(m)	(ctz(m) >> 3)
+
+#endif  /* } */
+
+
+/*
+** Mix the bits of a hash value, as the hash part uses both its lowest
+** bits (for the position) and its highest ones (for the control byte).
+*/
+l_sinline unsigned int mixhash (unsigned int h) {
+  h ^= h >> 16;
+  h *= 0x45d9f3bu;
+  h ^= h >> 16;
+  return h;
+}
+
+
+l_sinline unsigned int hashint (sol_Integer i) {
+  sol_Unsigned ui = l_castS2U(i);
+  return mixhash(cast_uint(ui) ^ cast_uint(ui >> 16 >> 16));
+}
+
+
+#define hashstr(str)	mixhash((str)->hash)
+
+
+static unsigned int hashTV (const TValue *key) {
+  switch (ttypetag(key)) {
+    case SOL_VNUMINT:
+      return hashint(ivalue(key));
+    case SOL_VNUMFLT:
+      return mixhash(cast_uint(l_hashfloat(fltvalue(key))));
+    case SOL_VSHRSTR:
+      return hashstr(tsvalue(key));
+    case SOL_VLNGSTR:
+      return mixhash(solS_hashlongstr(tsvalue(key)));
+    case SOL_VFALSE:
+      return mixhash(0);
+    case SOL_VTRUE:
+      return mixhash(1);
+    case SOL_VLIGHTUSERDATA:
+      return mixhash(point2uint(pvalue(key)));
+    case SOL_VLCF:
+      return mixhash(point2uint(fvalue(key)));
+    default:
+      return mixhash(point2uint(gcvalue(key)));
+  }
+}
+
+
+/*
+** Most keys are in the first group probed, and often in the node where
+** their probe starts; loading that node together with the control
+** bytes overlaps their cache misses in large tables.
+*/
+#if defined(__GNUC__)
+#define prefetchnode(n)		__builtin_prefetch(n)
+#else
+#define prefetchnode(n)		((void)0)
+#endif
+
+
+/*
+** Search table 't' for a key with hash 'h', returning the value of the
+** first node 'n' for which 'iskey' is true, or 'absentkey'.
+*/
+#define searchhash(t,h,n,iskey) {  \
+  const lu_byte *ctrl_ = ctrlbytes(t);  \
+  unsigned int mask_ = sizenode(t) - 1;  \
+  unsigned int pos_ = (h) & mask_;  \
+  unsigned int step_ = 0;  \
+  prefetchnode(gnode(t, pos_));  \
+  for (;;) {  \
+    Group g_ = groupload(ctrl_ + pos_);  \
+    GroupMask m_;  \
+    for (m_ = groupmatch(g_, ctrlhash(h)); m_ != 0; m_ &= m_ - 1) {  \
+      n = gnode(t, (pos_ + maskslot(m_)) & mask_);  \
+      if (iskey) return gval(n);  \
+    }  \
+    if (groupfree(g_) != 0) return &absentkey;  \
+    step_ += GROUPWIDTH;  \
+    pos_ = (pos_ + step_) & mask_;  \
+  } }
+
+
+/*
+** Set the control byte of node 'i' of table 't' and its replicas.
+*/
+static void setctrl (Table *t, unsigned int i, lu_byte c) {
+  lu_byte *ctrl = ctrlbytes(t);
+  unsigned int size = sizenode(t);
+  for (; i < size + GROUPWIDTH; i += size)
+    ctrl[i] = c;
+}
+
+
+/*
+** Take a free node for a new key with hash 'h'. The table must have
+** nodes that can still be used.
+*/
+static Node *newnode (Table *t, unsigned int h) {
+  const lu_byte *ctrl = ctrlbytes(t);
+  unsigned int mask = sizenode(t) - 1;
+  unsigned int pos = h & mask;
+  unsigned int step = 0;
+  GroupMask m;
+  sol_assert(!isdummy(t) && t->lastfree > t->node);
+  t->lastfree--;
+  while ((m = groupfree(groupload(ctrl + pos))) == 0) {
+    step += GROUPWIDTH;
+    pos = (pos + step) & mask;
+  }
+  pos = (pos + maskslot(m)) & mask;
+  setctrl(t, pos, ctrlhash(h));
+  return gnode(t, pos);
+}
+
+/* }================================================================== */
+
+#endif
+
 
 /*
 ** Check whether key 'k1' is equal to the key in node 'n2'. This
@@ -297,6 +580,10 @@ static unsigned int setlimittosize (Table *t) {
 ** See explanation about 'deadok' in function 'equalkey'.
 */
 static const TValue *getgeneric (Table *t, const TValue *key, int deadok) {
+#if SOL_USE_SWISSHASH
+  Node *n;
+  searchhash(t, hashTV(key), n, equalkey(key, n, deadok));
+#else
   Node *n = mainpositionTV(t, key);
   for (;;) {  /* check whether 'key' is somewhere in the chain */
     if (equalkey(key, n, deadok))
@@ -308,6 +595,7 @@ static const TValue *getgeneric (Table *t, const TValue *key, int deadok) {
       n += nx;
     }
   }
+#endif
 }
 
 
@@ -325,8 +613,9 @@ static unsigned int arrayindex (sol_Integer k) {
 
 /*
 ** returns the index of a 'key' for table traversals. First goes all
-** elements in the array part, then elements in the hash part. The
-** beginning of a traversal is signaled by 0.
+** elements in the array part, then elements in the slots (for a shaped
+** table) or in the hash part. The beginning of a traversal is signaled
+** by 0.
 */
 static unsigned int findindex (sol_State *L, Table *t, TValue *key,
                                unsigned int asize) {
@@ -335,6 +624,12 @@ static unsigned int findindex (sol_State *L, Table *t, TValue *key,
   i = ttisinteger(key) ? arrayindex(ivalue(key)) : 0;
   if (i - 1u < asize)  /* is 'key' inside array part? */
     return i;  /* yes; that's the index */
+  else if (isshaped(t)) {  /* slot elements are numbered after array ones */
+    int s = ttisshrstring(key) ? solR_find(tshape(t), tsvalue(key)) : -1;
+    if (l_unlikely(s < 0))
+      solG_runerror(L, "invalid key to 'next'");  /* key not found */
+    return cast_uint(s + 1) + asize;
+  }
   else {
     const TValue *n = getgeneric(t, key, 1);
     if (l_unlikely(isabstkey(n)))
@@ -350,12 +645,29 @@ int solH_next (sol_State *L, Table *t, StkId key) {
   unsigned int asize = solH_realasize(t);
   unsigned int i = findindex(L, t, s2v(key), asize);  /* find original key */
   for (; i < asize; i++) {  /* try first array part */
-    if (!isempty(&t->array[i])) {  /* a non-empty entry? */
+    if (!arrayisempty(t, i)) {  /* a non-empty entry? */
       setivalue(s2v(key), i + 1);
-      setobj2s(L, key + 1, &t->array[i]);
+      if (isnumarray(t)) {
+        TValue *io = s2v(key + 1);
+        io->value_ = numvalues(t)[i];
+        settt_(io, numheader(t)->tt);
+      }
+      else
+        arr2obj(t, i, s2v(key + 1));
       return 1;
     }
   }
+  if (isshaped(t)) {
+    const Shape *s = tshape(t);
+    for (i -= asize; i < s->nfields; i++) {  /* slots */
+      if (!isempty(&t->slots[i])) {  /* a non-empty entry? */
+        setsvalue2s(L, key, s->keys[i]);
+        setobj2s(L, key + 1, &t->slots[i]);
+        return 1;
+      }
+    }
+    return 0;  /* no more elements (hash part is empty) */
+  }
   for (i -= asize; cast_int(i) < sizenode(t); i++) {  /* hash part */
     if (!isempty(gval(gnode(t, i)))) {  /* a non-empty entry? */
       Node *n = gnode(t, i);
@@ -369,11 +681,142 @@ int solH_next (sol_State *L, Table *t, StkId key) {
 
 
 static void freehash (sol_State *L, Table *t) {
-  if (!isdummy(t))
+  if (!isdummy(t)) {
+#if SOL_USE_SWISSHASH
+    solM_freemem(L, t->node, hashsize(cast_sizet(sizenode(t))));
+#else
     solM_freearray(L, t->node, cast_sizet(sizenode(t)));
+#endif
+  }
+}
+
+
+/* number of 'Value's used by the tags of a generic array of size 'n' */
+#define tagsize(n)	((cast_sizet(n) + sizeof(Value) - 1) / sizeof(Value))
+
+/* number of 'Value's in the block of an array part of size 'n' */
+#define blocksize(n,typed)	(((typed) ? 0 : tagsize(n)) + 1 + cast_sizet(n))
+
+
+/*
+** Allocate the block for an array part of size 'n' > 0, typed or
+** generic (see ltable.h), returning the address of its first value,
+** or NULL if the allocation fails.
+*/
+static Value *allocarray (sol_State *L, unsigned int n, int typed) {
+  size_t size = blocksize(n, typed);
+  Value *block;
+  sol_assert(n > 0);
+  block = solM_reallocvector(L, NULL, 0, size, Value);
+  return (block == NULL) ? NULL : block + (size - n);
+}
+
+
+static void freearray (sol_State *L, Value *array, unsigned int n,
+                                                   int typed) {
+  if (n > 0) {
+    size_t size = blocksize(n, typed);
+    solM_freearray(L, array - (size - n), size);
+  }
+}
+
+
+/*
+** {=============================================================
+** Typed arrays
+** ==============================================================
+*/
+
+/*
+** Try to set element 'k' (base 0) of the typed array part of 't' to
+** 'val', keeping its present elements as a prefix of a single type.
+** Returns 0 when that is not possible.
+*/
+static int setnum (Table *t, unsigned int k, const TValue *val) {
+  NumHeader *nh = numheader(t);
+  if (ttisnil(val)) {  /* removing an element? */
+    if (k + 1 < nh->n)
+      return 0;  /* cannot open a hole */
+    else if (k + 1 == nh->n)
+      nh->n--;  /* remove the last element */
+    return 1;
+  }
+  else if (k < nh->n) {  /* replacing an element? */
+    if (ttypetag(val) != nh->tt)
+      return 0;
+    numvalues(t)[k] = val->value_;
+    return 1;
+  }
+  else if (k == nh->n && ttisnumber(val) &&
+           (k == 0 || ttypetag(val) == nh->tt)) {  /* appending? */
+    numvalues(t)[k] = val->value_;
+    nh->tt = ttypetag(val);
+    nh->n++;
+    return 1;
+  }
+  else
+    return 0;
+}
+
+
+/*
+** Convert the typed array part of 't' into a generic one.
+*/
+static void togeneric (sol_State *L, Table *t) {
+  unsigned int size = limitasasize(t);
+  Value *array = allocarray(L, size, 0);
+  const NumHeader *nh = numheader(t);
+  if (l_unlikely(array == NULL))
+    solM_error(L);
+  if (nh->n > 0) {
+    memcpy(array, numvalues(t), nh->n * sizeof(Value));
+    memset(tagaddr(array, nh->n - 1), nh->tt, nh->n);
+  }
+  memset(tagaddr(array, size - 1), SOL_VEMPTY, size - nh->n);
+  freearray(L, t->array, size, 1);
+  t->array = array;
+  t->flags &= cast_byte(~BITNUMA);
 }
 
 
+/*
+** Try to convert the array part of 't' into a typed array. That is
+** possible when its present elements are a non-empty prefix of the
+** array with a single number type. As this is only an optimization,
+** nothing happens if the allocation fails.
+*/
+static void trynumarray (sol_State *L, Table *t) {
+  unsigned int size = limitasasize(t);
+  unsigned int n, i;
+  lu_byte tt;
+  Value *array;
+  if (size < SOLI_MINNUMA)
+    return;
+  tt = *arraytag(t, 0);
+  if (novariant(tt) != SOL_TNUMBER)
+    return;
+  n = 1;
+  while (n < size && *arraytag(t, n) == tt)
+    n++;
+  for (i = n; i < size; i++) {
+    if (!tagisempty(*arraytag(t, i)))
+      return;  /* not a prefix of numbers of a single type */
+  }
+  array = allocarray(L, size, 1);
+  if (array == NULL)
+    return;  /* keep the generic array */
+  memcpy(array, t->array, n * sizeof(Value));
+  cast(NumHeader *, array - 1)->n = n;
+  cast(NumHeader *, array - 1)->tt = tt;
+  freearray(L, t->array, size, 0);
+  t->array = array;
+  t->flags |= BITNUMA;
+}
+
+
+/* }============================================================= */
+
+
 /*
 ** {=============================================================
 ** Rehash
@@ -443,7 +886,7 @@ static unsigned int numusearray (const Table *t, unsigned int *nums) {
     }
     /* count elements in range (2^(lg - 1), 2^lg] */
     for (; i <= lim; i++) {
-      if (!isempty(&t->array[i-1]))
+      if (!arrayisempty(t, i - 1))
         lc++;
     }
     nums[lg] += lc;
@@ -470,6 +913,27 @@ static int numusehash (const Table *t, unsigned int *nums, unsigned int *pna) {
 }
 
 
+/*
+** Make all nodes of the (allocated) hash part of 't' free.
+*/
+static void clearhash (Table *t) {
+  unsigned int size = sizenode(t);
+  unsigned int i;
+  for (i = 0; i < size; i++) {
+    Node *n = gnode(t, i);
+    gnext(n) = 0;
+    setnilkey(n);
+    setempty(gval(n));
+  }
+#if SOL_USE_SWISSHASH
+  memset(ctrlbytes(t), 0, size + GROUPWIDTH);  /* all nodes are free */
+  t->lastfree = gnode(t, maxfill(size));  /* nodes that can be used */
+#else
+  t->lastfree = gnode(t, size);  /* all positions are free */
+#endif
+}
+
+
 /*
 ** Creates an array for the hash part of a table with the given
 ** size, or reuses the dummy node if size is zero.
@@ -484,20 +948,21 @@ static void setnodevector (sol_State *L, Table *t, unsigned int size) {
     t->lastfree = NULL;  /* signal that it is using dummy node */
   }
   else {
-    int i;
     int lsize = solO_ceillog2(size);
+#if SOL_USE_SWISSHASH
+    if (maxfill(twoto(lsize)) < cast_int(size))
+      lsize++;  /* keep some nodes free */
+#endif
     if (lsize > MAXHBITS || (1u << lsize) > MAXHSIZE)
       solG_runerror(L, "table overflow");
     size = twoto(lsize);
+#if SOL_USE_SWISSHASH
+    t->node = cast(Node *, solM_malloc_(L, hashsize(cast_sizet(size)), 0));
+#else
     t->node = solM_newvector(L, size, Node);
-    for (i = 0; i < cast_int(size); i++) {
-      Node *n = gnode(t, i);
-      gnext(n) = 0;
-      setnilkey(n);
-      setempty(gval(n));
-    }
+#endif
     t->lsizenode = cast_byte(lsize);
-    t->lastfree = gnode(t, size);  /* all positions are free */
+    clearhash(t);
   }
 }
 
@@ -515,6 +980,15 @@ static void reinsert (sol_State *L, Table *ot, Table *t) {
          already present in the table */
       TValue k;
       getnodekey(L, &k, old);
+#if SOL_USE_SWISSHASH
+      /* a key going to the hash part cannot be there yet */
+      if (!ttisinteger(&k) || l_castS2U(ivalue(&k)) - 1u >= t->alimit) {
+        Node *n = newnode(t, hashTV(&k));
+        setnodekey(L, n, &k);
+        setobj2t(L, gval(n), gval(old));
+      }
+      else
+#endif
       solH_set(L, t, &k, gval(old));
     }
   }
@@ -537,6 +1011,99 @@ static void exchangehashpart (Table *t1, Table *t2) {
 }
 
 
+/*
+** Check whether the integer keys in the hash part of 't' that will
+** move to an array part with size 'newasize' can extend its typed
+** array, that is, whether all of them have the array type and, with
+** the elements already present, form a prefix of the new array. If so,
+** returns how many they are; otherwise, returns -1.
+*/
+static int numextension (const Table *t, unsigned int newasize) {
+  const NumHeader *nh = numheader(t);
+  lu_byte tt = nh->tt;
+  unsigned int count = 0;
+  unsigned int max = 0;
+  int i;
+  for (i = 0; i < allocsizenode(t); i++) {
+    const Node *n = gnode(t, i);
+    if (!isempty(gval(n)) && keyisinteger(n) &&
+        l_castS2U(keyival(n)) - 1u < newasize) {  /* moves to the array? */
+      if (!ttisnumber(gval(n)) ||
+          ((nh->n > 0 || count > 0) && ttypetag(gval(n)) != tt))
+        return -1;
+      tt = ttypetag(gval(n));
+      count++;
+      if (cast_uint(keyival(n)) > max)
+        max = cast_uint(keyival(n));
+    }
+  }
+  return (count == 0 || max == nh->n + count) ? cast_int(count) : -1;
+}
+
+
+/*
+** Move into the typed array of 't' the elements from its hash part
+** that will go to the new array part with size 'newasize' (which were
+** checked by 'numextension'). The later reinsertion of the hash part
+** rewrites them with the same values.
+*/
+static void numextend (Table *t, unsigned int newasize, int count) {
+  NumHeader *nh = numheader(t);
+  int i;
+  for (i = 0; count > 0; i++) {
+    const Node *n = gnode(t, i);
+    if (!isempty(gval(n)) && keyisinteger(n) &&
+        l_castS2U(keyival(n)) - 1u < newasize) {
+      numvalues(t)[keyival(n) - 1] = gval(n)->value_;
+      nh->tt = ttypetag(gval(n));
+      count--;
+      nh->n++;
+    }
+  }
+}
+
+
+/*
+** Resize table 't', with a typed array part that stays typed. (See
+** 'solH_resize'.)
+*/
+static void resizenum (sol_State *L, Table *t, unsigned int oldasize,
+                       unsigned int newasize, unsigned int nhsize,
+                       int count) {
+  unsigned int i;
+  Table newt;  /* to keep the new hash part */
+  Value *block;
+  unsigned int n = numheader(t)->n;
+  setnodevector(L, &newt, nhsize);
+  if (newasize < n) {  /* will lose elements? */
+    t->alimit = newasize;  /* pretend array has new size... */
+    exchangehashpart(t, &newt);  /* and new hash */
+    /* re-insert into the new hash the elements from vanishing slice */
+    for (i = newasize; i < n; i++) {
+      TValue v;
+      v.value_ = numvalues(t)[i];
+      settt_(&v, numheader(t)->tt);
+      solH_setint(L, t, i + 1, &v);
+    }
+    t->alimit = oldasize;  /* restore current size... */
+    exchangehashpart(t, &newt);  /* and hash (in case of errors) */
+  }
+  block = solM_reallocvector(L, t->array - 1, cast_sizet(oldasize) + 1,
+                             cast_sizet(newasize) + 1, Value);
+  if (l_unlikely(block == NULL)) {  /* allocation failed? */
+    freehash(L, &newt);  /* release new hash part */
+    solM_error(L);  /* raise error (with array unchanged) */
+  }
+  t->array = block + 1;  /* set new array part */
+  t->alimit = newasize;
+  if (numheader(t)->n > newasize)
+    numheader(t)->n = newasize;
+  numextend(t, newasize, count);
+  exchangehashpart(t, &newt);  /* 't' has the new hash ('newt' has the old) */
+  reinsert(L, &newt, t);  /* 'newt' now has the old hash */
+  freehash(L, &newt);  /* free old hash part */
+}
+
 /*
 ** Resize table 't' for the new given sizes. Both allocations (for
 ** the hash part and for the array part) can fail, which creates some
@@ -549,13 +1116,25 @@ static void exchangehashpart (Table *t1, Table *t2) {
 ** into the table, initializes the new part of the array (if any) with
 ** nils and reinserts the elements of the old hash back into the new
 ** parts of the table.
+** A typed array part stays typed when the elements coming from the
+** hash part can extend it; otherwise, it is converted to a generic
+** array, which at the end becomes typed again if possible.
 */
 void solH_resize (sol_State *L, Table *t, unsigned int newasize,
                                           unsigned int nhsize) {
   unsigned int i;
   Table newt;  /* to keep the new hash part */
   unsigned int oldasize = setlimittosize(t);
-  TValue *newarray;
+  Value *newarray;
+  sol_assert(!isshaped(t) || nhsize == 0);
+  if (isnumarray(t)) {
+    int count = (newasize > 0) ? numextension(t, newasize) : -1;
+    if (count >= 0) {  /* can array stay typed? */
+      resizenum(L, t, oldasize, newasize, nhsize, count);
+      return;
+    }
+    togeneric(L, t);
+  }
   /* create new hash part with appropriate size into 'newt' */
   setnodevector(L, &newt, nhsize);
   if (newasize < oldasize) {  /* will array shrink? */
@@ -563,27 +1142,41 @@ void solH_resize (sol_State *L, Table *t, unsigned int newasize,
     exchangehashpart(t, &newt);  /* and new hash */
     /* re-insert into the new hash the elements from vanishing slice */
     for (i = newasize; i < oldasize; i++) {
-      if (!isempty(&t->array[i]))
-        solH_setint(L, t, i + 1, &t->array[i]);
+      if (!tagisempty(*arraytag(t, i))) {
+        TValue v;
+        arr2obj(t, i, &v);
+        solH_setint(L, t, i + 1, &v);
+      }
     }
     t->alimit = oldasize;  /* restore current size... */
     exchangehashpart(t, &newt);  /* and hash (in case of errors) */
   }
-  /* allocate new array */
-  newarray = solM_reallocvector(L, t->array, oldasize, newasize, TValue);
-  if (l_unlikely(newarray == NULL && newasize > 0)) {  /* allocation failed? */
-    freehash(L, &newt);  /* release new hash part */
-    solM_error(L);  /* raise error (with array unchanged) */
+  if (newasize == oldasize)  /* array keeps its size? */
+    exchangehashpart(t, &newt);  /* only the hash part changes */
+  else {
+    /* allocate new array */
+    newarray = (newasize > 0) ? allocarray(L, newasize, 0) : NULL;
+    if (l_unlikely(newarray == NULL && newasize > 0)) {  /* alloc. failed? */
+      freehash(L, &newt);  /* release new hash part */
+      solM_error(L);  /* raise error (with array unchanged) */
+    }
+    /* allocation ok; move the kept elements to the new array */
+    exchangehashpart(t, &newt);  /* 't' has the new hash ('newt' the old) */
+    i = (newasize < oldasize) ? newasize : oldasize;
+    if (i > 0) {
+      memcpy(newarray, t->array, i * sizeof(Value));
+      memcpy(tagaddr(newarray, i - 1), arraytag(t, i - 1), i);
+    }
+    freearray(L, t->array, oldasize, 0);
+    t->array = newarray;  /* set new array part */
+    t->alimit = newasize;
+    if (i < newasize)  /* clear new slice of the array */
+      memset(tagaddr(newarray, newasize - 1), SOL_VEMPTY, newasize - i);
   }
-  /* allocation ok; initialize new part of the array */
-  exchangehashpart(t, &newt);  /* 't' has the new hash ('newt' has the old) */
-  t->array = newarray;  /* set new array part */
-  t->alimit = newasize;
-  for (i = oldasize; i < newasize; i++)  /* clear new slice of the array */
-     setempty(&t->array[i]);
   /* re-insert elements from old hash part into new parts */
   reinsert(L, &newt, t);  /* 'newt' now has the old hash */
   freehash(L, &newt);  /* free old hash part */
+  trynumarray(L, t);
 }
 
 
@@ -592,6 +1185,130 @@ void solH_resizearray (sol_State *L, Table *t, unsigned int nasize) {
   solH_resize(L, t, nasize, nsize);
 }
 
+
+/*
+** Remove all elements from table 't', keeping its parts (and its
+** metatable) for reuse. Unlike assigning nil to each field, this also
+** removes the keys, so a traversal cannot continue after it.
+*/
+void solH_clear (sol_State *L, Table *t) {
+  unsigned int asize = setlimittosize(t);
+  if (isnumarray(t))
+    numheader(t)->n = 0;
+  else if (asize > 0)
+    memset(tagaddr(t->array, asize - 1), SOL_VEMPTY, asize);
+  if (isshaped(t))
+    tshape(t) = G(L)->rootshape;
+  if (!isdummy(t))
+    clearhash(t);
+}
+
+
+/*
+** {=============================================================
+** Shaped tables
+** ==============================================================
+*/
+
+/* size in bytes of a block with 'n' slots */
+#define slotsize(n)	(sizeof(SlotHeader) + cast_sizet(n) * sizeof(TValue))
+
+
+/*
+** Resize the slots of 't' to 'size'; a table with no slots gets the
+** root shape. (New slots are not initialized: a slot is only used
+** after its key is added to the shape, which sets its value.)
+*/
+static void setslots (sol_State *L, Table *t, unsigned int size) {
+  SlotHeader *old = isshaped(t) ? slotheader(t) : NULL;
+  size_t osize = (old == NULL) ? 0 : slotsize(old->size);
+  SlotHeader *h = cast(SlotHeader *,
+                       solM_saferealloc_(L, old, osize, slotsize(size)));
+  if (old == NULL)
+    h->shape = G(L)->rootshape;
+  h->size = size;
+  t->slots = cast(TValue *, h + 1);
+}
+
+
+static void freeslots (sol_State *L, TValue *slots) {
+  SlotHeader *h = cast(SlotHeader *, slots) - 1;
+  solM_freemem(L, h, slotsize(h->size));
+}
+
+
+/*
+** Add short-string key 'key' with value 'value' to 't', which must be
+** shaped or have an empty hash part. Return false if the table cannot
+** have more fields in its shape.
+*/
+static int addslot (sol_State *L, Table *t, TString *key, TValue *value) {
+  Shape *s = isshaped(t) ? tshape(t) : G(L)->rootshape;
+  unsigned int n = s->nfields;
+  sol_assert(isdummy(t));
+  if (n >= SOLI_MAXSHAPE)
+    return 0;
+  if (!isshaped(t) || slotheader(t)->size == n) {  /* no free slot? */
+    unsigned int size = (n < 4) ? 4 : 2 * n;
+    setslots(L, t, (size < SOLI_MAXSHAPE) ? size : SOLI_MAXSHAPE);
+  }
+  /* get the new shape only now, as allocating slots may collect it */
+  s = solR_addkey(L, s, key);
+  tshape(t) = s;
+  solC_objbarrier(L, t, s);
+  setobj2t(L, &t->slots[n], value);
+  return 1;
+}
+
+
+/*
+** Move the fields of shaped table 't' to a regular hash part.
+*/
+static void unshape (sol_State *L, Table *t) {
+  const Shape *s = tshape(t);
+  TValue *slots = t->slots;
+  unsigned int i;
+  unsigned int n = 0;
+  Table newt;
+  sol_assert(isdummy(t));
+  for (i = 0; i < s->nfields; i++)  /* count fields */
+    n += !isempty(&slots[i]);
+  setnodevector(L, &newt, n);
+  exchangehashpart(t, &newt);  /* 't' has the new hash part */
+  t->slots = NULL;
+  for (i = 0; i < s->nfields; i++) {
+    if (!isempty(&slots[i])) {
+      /* doesn't need barrier/invalidate cache, as entry was
+         already present in the table */
+      TValue k;
+      setsvalue(L, &k, s->keys[i]);
+      solH_set(L, t, &k, &slots[i]);
+    }
+  }
+  freeslots(L, slots);
+}
+
+
+/*
+** Size the parts of a new table for 'nasize' array elements and
+** 'nhsize' other keys. Most likely these keys are field names, so
+** (if there are not too many of them) they get slots instead of a
+** hash part.
+*/
+void solH_presize (sol_State *L, Table *t, unsigned int nasize,
+                                           unsigned int nhsize) {
+  if (SOL_USE_SHAPES && 0 < nhsize && nhsize <= SOLI_MAXSHAPE) {
+    sol_assert(!isshaped(t) && isdummy(t));
+    solH_resize(L, t, nasize, 0);
+    setslots(L, t, nhsize);
+  }
+  else
+    solH_resize(L, t, nasize, nhsize);
+}
+
+/* }============================================================= */
+
+
 /*
 ** nums[i] = number of keys 'k' where 2^(i - 1) < k <= 2^i
 */
@@ -612,6 +1329,11 @@ static void rehash (sol_State *L, Table *t, const TValue *ek) {
   totaluse++;
   /* compute new size for array part */
   asize = computesizes(nums, &na);
+  if (isshaped(t) && cast_uint(totaluse) > na) {  /* needs hash part? */
+    unshape(L, t);  /* move the fields to a hash part... */
+    rehash(L, t, ek);  /* ...and count them too */
+    return;
+  }
   /* resize the table to new computed sizes */
   solH_resize(L, t, asize, totaluse - na);
 }
@@ -630,18 +1352,22 @@ Table *solH_new (sol_State *L) {
   t->flags = cast_byte(maskflags);  /* table has no metamethod fields */
   t->array = NULL;
   t->alimit = 0;
+  t->slots = NULL;
   setnodevector(L, t, 0);
   return t;
 }
 
 
 void solH_free (sol_State *L, Table *t) {
+  if (isshaped(t))
+    freeslots(L, t->slots);
   freehash(L, t);
-  solM_freearray(L, t->array, solH_realasize(t));
+  freearray(L, t->array, solH_realasize(t), isnumarray(t));
   solM_free(L, t);
 }
 
 
+#if !SOL_USE_SWISSHASH
 static Node *getfreepos (Table *t) {
   if (!isdummy(t)) {
     while (t->lastfree > t->node) {
@@ -652,6 +1378,7 @@ static Node *getfreepos (Table *t) {
   }
   return NULL;  /* could not find a free place */
 }
+#endif
 
 
 
@@ -661,6 +1388,9 @@ static Node *getfreepos (Table *t) {
 ** position or not: if it is not, move colliding node to an empty place and
 ** put new key in its main position; otherwise (colliding node is in its main
 ** position), new key goes to an empty position.
+** With a Swiss-table hash part, the new key goes to the first free
+** node in its probe sequence. A short-string key for a table with an
+** empty hash part goes to a slot, if possible (see 'addslot').
 */
 static void solH_newkey (sol_State *L, Table *t, const TValue *key,
                                                  TValue *value) {
@@ -680,6 +1410,18 @@ static void solH_newkey (sol_State *L, Table *t, const TValue *key,
   }
   if (ttisnil(value))
     return;  /* do not insert nil values */
+  if (SOL_USE_SHAPES && ttisshrstring(key) && isdummy(t) &&
+      addslot(L, t, tsvalue(key), value))
+    return;
+#if SOL_USE_SWISSHASH
+  if (isdummy(t) || t->lastfree == t->node) {  /* no free nodes left? */
+    rehash(L, t, key);  /* grow table */
+    /* whatever called 'newkey' takes care of TM cache */
+    solH_set(L, t, key, value);  /* insert key into grown table */
+    return;
+  }
+  mp = newnode(t, hashTV(key));
+#else
   mp = mainpositionTV(t, key);
   if (!isempty(gval(mp)) || isdummy(t)) {  /* main position is taken? */
     Node *othern;
@@ -713,6 +1455,7 @@ static void solH_newkey (sol_State *L, Table *t, const TValue *key,
       mp = f;
     }
   }
+#endif
   setnodekey(L, mp, key);
   solC_barrierback(L, obj2gco(t), key);
   sol_assert(isempty(gval(mp)));
@@ -721,11 +1464,11 @@ static void solH_newkey (sol_State *L, Table *t, const TValue *key,
 
 
 /*
-** Search function for integers. If integer is inside 'alimit', get it
-** directly from the array part. Otherwise, if 'alimit' is not
-** the real size of the array, the key still can be in the array part.
-** In this case, do the "Xmilia trick" to check whether 'key-1' is
-** smaller than the real size.
+** Returns 'key' if it is an index of the array part of 't', 0
+** otherwise. If integer is inside 'alimit', it is in the array part.
+** Otherwise, if 'alimit' is not the real size of the array, the key
+** still can be in the array part. In this case, do the "Xmilia trick"
+** to check whether 'key-1' is smaller than the real size.
 ** The trick works as follow: let 'p' be an integer such that
 **   '2^(p+1) >= alimit > 2^p', or  '2^(p+1) > alimit-1 >= 2^p'.
 ** That is, 2^(p+1) is the real size of the array, and 'p' is the highest
@@ -742,37 +1485,81 @@ static void solH_newkey (sol_State *L, Table *t, const TValue *key,
 ** If key is 0 or negative, 'res' will have its higher bit on, so that
 ** if cannot be smaller than alimit.
 */
-const TValue *solH_getint (Table *t, sol_Integer key) {
+static unsigned int ikeyinarray (Table *t, sol_Integer key) {
   sol_Unsigned alimit = t->alimit;
   if (l_castS2U(key) - 1u < alimit)  /* 'key' in [1, t->alimit]? */
-    return &t->array[key - 1];
+    return cast_uint(key);
   else if (!isrealasize(t) &&  /* key still may be in the array part? */
            (((l_castS2U(key) - 1u) & ~(alimit - 1u)) < alimit)) {
     t->alimit = cast_uint(key);  /* probably '#t' is here now */
-    return &t->array[key - 1];
-  }
-  else {  /* key is not in the array part; check the hash */
-    Node *n = hashint(t, key);
-    for (;;) {  /* check whether 'key' is somewhere in the chain */
-      if (keyisinteger(n) && keyival(n) == key)
-        return gval(n);  /* that's it */
-      else {
-        int nx = gnext(n);
-        if (nx == 0) break;
-        n += nx;
-      }
+    return cast_uint(key);
+  }
+  else
+    return 0;
+}
+
+
+static const TValue *getintfromhash (Table *t, sol_Integer key) {
+#if SOL_USE_SWISSHASH
+  Node *n;
+  searchhash(t, hashint(key), n, keyisinteger(n) && keyival(n) == key);
+#else
+  Node *n = hashint(t, key);
+  for (;;) {  /* check whether 'key' is somewhere in the chain */
+    if (keyisinteger(n) && keyival(n) == key)
+      return gval(n);  /* that's it */
+    else {
+      int nx = gnext(n);
+      if (nx == 0) break;
+      n += nx;
     }
-    return &absentkey;
   }
+  return &absentkey;
+#endif
 }
 
 
 /*
-** search function for short strings
+** Copy the value in 'slot' into 'res', unless it is empty, and return
+** its tag.
 */
-const TValue *solH_getshortstr (Table *t, TString *key) {
+static lu_byte finishnodeget (const TValue *slot, TValue *res) {
+  if (!isempty(slot))
+    setobj(cast(sol_State *, NULL), res, slot);
+  return ttypetag(slot);
+}
+
+
+/*
+** Search function for integers.
+*/
+lu_byte solH_getint (Table *t, sol_Integer key, TValue *res) {
+  unsigned int k = ikeyinarray(t, key);
+  if (k == 0)  /* key is not in the array part? */
+    return finishnodeget(getintfromhash(t, key), res);
+  else if (!isnumarray(t)) {
+    lu_byte tag = *arraytag(t, k - 1);
+    if (!tagisempty(tag))
+      arr2obj(t, k - 1, res);
+    return withvariant(tag);
+  }
+  else if (k - 1 < numheader(t)->n) {  /* present in a typed array? */
+    res->value_ = numvalues(t)[k - 1];
+    settt_(res, numheader(t)->tt);
+    return numheader(t)->tt;
+  }
+  else
+    return SOL_VEMPTY;
+}
+
+
+static const TValue *getshortstrfromhash (Table *t, TString *key) {
+#if SOL_USE_SWISSHASH
+  Node *n;
+  searchhash(t, hashstr(key), n,
+             keyisshrstr(n) && eqshrstr(keystrval(n), key));
+#else
   Node *n = hashstr(t, key);
-  sol_assert(key->tt == SOL_VSHRSTR);
   for (;;) {  /* check whether 'key' is somewhere in the chain */
     if (keyisshrstr(n) && eqshrstr(keystrval(n), key))
       return gval(n);  /* that's it */
@@ -783,12 +1570,32 @@ const TValue *solH_getshortstr (Table *t, TString *key) {
       n += nx;
     }
   }
+#endif
 }
 
 
-const TValue *solH_getstr (Table *t, TString *key) {
+/*
+** search function for short strings
+*/
+const TValue *solH_Hgetshortstr (Table *t, TString *key) {
+  sol_assert(key->tt == SOL_VSHRSTR);
+  if (isshaped(t)) {
+    int i = solR_find(tshape(t), key);
+    return (i < 0) ? &absentkey : &t->slots[i];
+  }
+  else
+    return getshortstrfromhash(t, key);
+}
+
+
+lu_byte solH_getshortstr (Table *t, TString *key, TValue *res) {
+  return finishnodeget(solH_Hgetshortstr(t, key), res);
+}
+
+
+const TValue *solH_Hgetstr (Table *t, TString *key) {
   if (key->tt == SOL_VSHRSTR)
-    return solH_getshortstr(t, key);
+    return solH_Hgetshortstr(t, key);
   else {  /* for long strings, use generic case */
     TValue ko;
     setsvalue(cast(sol_State *, NULL), &ko, key);
@@ -797,38 +1604,130 @@ const TValue *solH_getstr (Table *t, TString *key) {
 }
 
 
+lu_byte solH_getstr (Table *t, TString *key, TValue *res) {
+  return finishnodeget(solH_Hgetstr(t, key), res);
+}
+
+
 /*
 ** main search function
 */
-const TValue *solH_get (Table *t, const TValue *key) {
+lu_byte solH_get (Table *t, const TValue *key, TValue *res) {
+  switch (ttypetag(key)) {
+    case SOL_VSHRSTR: return solH_getshortstr(t, tsvalue(key), res);
+    case SOL_VNUMINT: return solH_getint(t, ivalue(key), res);
+    case SOL_VNIL: return SOL_VABSTKEY;
+    case SOL_VNUMFLT: {
+      sol_Integer k;
+      if (solV_flttointeger(fltvalue(key), &k, F2Ieq)) /* integral index? */
+        return solH_getint(t, k, res);  /* use specialized version */
+      /* else... */
+    }  /* FALLTHROUGH */
+    default:
+      return finishnodeget(getgeneric(t, key, 0), res);
+  }
+}
+
+
+/*
+** Finish a "pre-set" for a slot in the hash part: set the value if
+** the slot is not empty, otherwise encode where the key is.
+*/
+static int finishnodeset (Table *t, const TValue *slot, TValue *val) {
+  if (!isempty(slot)) {
+    setobj(cast(sol_State *, NULL), cast(TValue *, slot), val);
+    return HOK;  /* success */
+  }
+  else if (isabstkey(slot))
+    return HNOTFOUND;  /* no slot with that key */
+  else if (isshaped(t))  /* return slot encoded */
+    return cast_int(slot - t->slots) + HFIRSTNODE;
+  else  /* return node encoded */
+    return cast_int(nodefromval(slot) - gnode(t, 0)) + HFIRSTNODE;
+}
+
+
+int solH_psetint (Table *t, sol_Integer key, TValue *val) {
+  unsigned int k = ikeyinarray(t, key);
+  if (k == 0)  /* key is not in the array part? */
+    return finishnodeset(t, getintfromhash(t, key), val);
+  else if (isnumarray(t)) {
+    if (k - 1 >= numheader(t)->n)
+      return ~cast_int(k - 1);  /* absent element */
+    return setnum(t, k - 1, val) ? HOK : HRETYPE;
+  }
+  else {
+    if (tagisempty(*arraytag(t, k - 1)))
+      return ~cast_int(k - 1);
+    obj2arr(t, k - 1, val);
+    return HOK;
+  }
+}
+
+
+int solH_psetshortstr (Table *t, TString *key, TValue *val) {
+  return finishnodeset(t, solH_Hgetshortstr(t, key), val);
+}
+
+
+int solH_psetstr (Table *t, TString *key, TValue *val) {
+  return finishnodeset(t, solH_Hgetstr(t, key), val);
+}
+
+
+int solH_pset (Table *t, const TValue *key, TValue *val) {
   switch (ttypetag(key)) {
-    case SOL_VSHRSTR: return solH_getshortstr(t, tsvalue(key));
-    case SOL_VNUMINT: return solH_getint(t, ivalue(key));
-    case SOL_VNIL: return &absentkey;
+    case SOL_VSHRSTR: return solH_psetshortstr(t, tsvalue(key), val);
+    case SOL_VNUMINT: return solH_psetint(t, ivalue(key), val);
+    case SOL_VNIL: return HNOTFOUND;
     case SOL_VNUMFLT: {
       sol_Integer k;
       if (solV_flttointeger(fltvalue(key), &k, F2Ieq)) /* integral index? */
-        return solH_getint(t, k);  /* use specialized version */
+        return solH_psetint(t, k, val);  /* use specialized version */
       /* else... */
     }  /* FALLTHROUGH */
     default:
-      return getgeneric(t, key, 0);
+      return finishnodeset(t, getgeneric(t, key, 0), val);
   }
 }
 
 
 /*
-** Finish a raw "set table" operation, where 'slot' is where the value
-** should have been (the result of a previous "get table").
+** Set element 'k' (base 0) of the array part of 't' to 'value'.
+*/
+static void setarray (sol_State *L, Table *t, unsigned int k,
+                                              TValue *value) {
+  if (isnumarray(t)) {
+    if (setnum(t, k, value))
+      return;
+    togeneric(L, t);  /* typed array cannot hold 'value' */
+  }
+  obj2arr(t, k, value);
+}
+
+
+/*
+** Finish a raw "set table" operation, where 'hres' is the result of a
+** previous "pre-set" (see 'solH_pset*').
 ** Beware: when using this function you probably need to check a GC
 ** barrier and invalidate the TM cache.
 */
 void solH_finishset (sol_State *L, Table *t, const TValue *key,
-                                   const TValue *slot, TValue *value) {
-  if (isabstkey(slot))
+                                   TValue *value, int hres) {
+  sol_assert(hres != HOK && hres != HNOTATABLE);
+  if (hres == HNOTFOUND)
     solH_newkey(L, t, key, value);
-  else
-    setobj2t(L, cast(TValue *, slot), value);
+  else if (hres == HRETYPE) {  /* key is present in a typed array */
+    togeneric(L, t);
+    solH_set(L, t, key, value);
+  }
+  else if (hres >= HFIRSTNODE) {  /* slot in the hash part or a slot? */
+    TValue *slot = isshaped(t) ? &t->slots[hres - HFIRSTNODE]
+                               : gval(gnode(t, hres - HFIRSTNODE));
+    setobj2t(L, slot, value);
+  }
+  else  /* slot in the array part */
+    setarray(L, t, cast_uint(~hres), value);
 }
 
 
@@ -837,20 +1736,39 @@ void solH_finishset (sol_State *L, Table *t, const TValue *key,
 ** barrier and invalidate the TM cache.
 */
 void solH_set (sol_State *L, Table *t, const TValue *key, TValue *value) {
-  const TValue *slot = solH_get(t, key);
-  solH_finishset(L, t, key, slot, value);
+  int hres = solH_pset(t, key, value);
+  if (hres != HOK)
+    solH_finishset(L, t, key, value, hres);
 }
 
 
 void solH_setint (sol_State *L, Table *t, sol_Integer key, TValue *value) {
-  const TValue *p = solH_getint(t, key);
-  if (isabstkey(p)) {
+  int hres = solH_psetint(t, key, value);
+  if (hres != HOK) {
     TValue k;
     setivalue(&k, key);
-    solH_newkey(L, t, &k, value);
+    solH_finishset(L, t, &k, value, hres);
   }
-  else
-    setobj2t(L, cast(TValue *, p), value);
+}
+
+
+/*
+** Set the 'n' values 'v[1..n]' as elements 'first + 1' to 'first + n'
+** of the array part of 't', which must be large enough for them (as
+** done by table constructors).
+*/
+void solH_setlist (sol_State *L, Table *t, unsigned int first,
+                                           StkId v, int n) {
+  int i;
+  sol_assert(first + cast_uint(n) <= solH_realasize(t));
+  for (i = 1; i <= n; i++)
+    setarray(L, t, first + cast_uint(i) - 1, s2v(v + i));
+}
+
+
+static int hashkeyisempty (Table *t, sol_Unsigned key) {
+  const TValue *v = getintfromhash(t, l_castU2S(key));
+  return isempty(v);
 }
 
 
@@ -876,27 +1794,27 @@ static sol_Unsigned hash_search (Table *t, sol_Unsigned j) {
       j *= 2;
     else {
       j = SOL_MAXINTEGER;
-      if (isempty(solH_getint(t, j)))  /* t[j] not present? */
+      if (hashkeyisempty(t, j))  /* t[j] not present? */
         break;  /* 'j' now is an absent index */
       else  /* weird case */
         return j;  /* well, max integer is a boundary... */
     }
-  } while (!isempty(solH_getint(t, j)));  /* repeat until an absent t[j] */
+  } while (!hashkeyisempty(t, j));  /* repeat until an absent t[j] */
   /* i < j  &&  t[i] present  &&  t[j] absent */
   while (j - i > 1u) {  /* do a binary search between them */
     sol_Unsigned m = (i + j) / 2;
-    if (isempty(solH_getint(t, m))) j = m;
+    if (hashkeyisempty(t, m)) j = m;
     else i = m;
   }
   return i;
 }
 
 
-static unsigned int binsearch (const TValue *array, unsigned int i,
-                                                    unsigned int j) {
+static unsigned int binsearch (const Table *t, unsigned int i,
+                                                unsigned int j) {
   while (j - i > 1u) {  /* binary search */
     unsigned int m = (i + j) / 2;
-    if (isempty(&array[m - 1])) j = m;
+    if (tagisempty(*arraytag(t, m - 1))) j = m;
     else i = m;
   }
   return i;
@@ -934,12 +1852,20 @@ static unsigned int binsearch (const TValue *array, unsigned int i,
 ** 'hash_search' to find a boundary in the hash part of the table.
 ** (In those cases, the boundary is not inside the array part, and
 ** therefore cannot be used as a new limit.)
+**
+** The present elements of a typed array are a prefix of it, so they
+** give a boundary directly, unless the whole array is present (3).
 */
 sol_Unsigned solH_getn (Table *t) {
   unsigned int limit = t->alimit;
-  if (limit > 0 && isempty(&t->array[limit - 1])) {  /* (1)? */
+  if (isnumarray(t)) {  /* typed array? */
+    if (numheader(t)->n < limit)
+      return numheader(t)->n;
+    /* else the whole array is present (3) */
+  }
+  else if (limit > 0 && tagisempty(*arraytag(t, limit - 1))) {  /* (1)? */
     /* there must be a boundary before 'limit' */
-    if (limit >= 2 && !isempty(&t->array[limit - 2])) {
+    if (limit >= 2 && !tagisempty(*arraytag(t, limit - 2))) {
       /* 'limit - 1' is a boundary; can it be a new limit? */
       if (ispow2realasize(t) && !ispow2(limit - 1)) {
         t->alimit = limit - 1;
@@ -948,7 +1874,7 @@ sol_Unsigned solH_getn (Table *t) {
       return limit - 1;
     }
     else {  /* must search for a boundary in [0, limit] */
-      unsigned int boundary = binsearch(t->array, 0, limit);
+      unsigned int boundary = binsearch(t, 0, limit);
       /* can this boundary represent the real size of the array? */
       if (ispow2realasize(t) && boundary > solH_realasize(t) / 2) {
         t->alimit = boundary;  /* use it as the new limit */
@@ -960,14 +1886,14 @@ sol_Unsigned solH_getn (Table *t) {
   /* 'limit' is zero or present in table */
   if (!limitequalsasize(t)) {  /* (2)? */
     /* 'limit' > 0 and array has more elements after 'limit' */
-    if (isempty(&t->array[limit]))  /* 'limit + 1' is empty? */
+    if (tagisempty(*arraytag(t, limit)))  /* 'limit + 1' is empty? */
       return limit;  /* this is the boundary */
     /* else, try last element in the array */
     limit = solH_realasize(t);
-    if (isempty(&t->array[limit - 1])) {  /* empty? */
+    if (tagisempty(*arraytag(t, limit - 1))) {  /* empty? */
       /* there must be a boundary in the array after old limit,
          and it must be a valid new limit */
-      unsigned int boundary = binsearch(t->array, t->alimit, limit);
+      unsigned int boundary = binsearch(t, t->alimit, limit);
       t->alimit = boundary;
       return boundary;
     }
@@ -975,8 +1901,8 @@ sol_Unsigned solH_getn (Table *t) {
   }
   /* (3) 'limit' is the last element and either is zero or present in table */
   sol_assert(limit == solH_realasize(t) &&
-             (limit == 0 || !isempty(&t->array[limit - 1])));
-  if (isdummy(t) || isempty(solH_getint(t, cast(sol_Integer, limit + 1))))
+             (limit == 0 || !arrayisempty(t, limit - 1)));
+  if (isdummy(t) || hashkeyisempty(t, cast(sol_Unsigned, limit) + 1))
     return limit;  /* 'limit + 1' is absent */
   else  /* 'limit + 1' is also present */
     return hash_search(t, limit);
@@ -989,7 +1915,11 @@ sol_Unsigned solH_getn (Table *t) {
 /* export these functions for the test library */
 
 Node *solH_mainposition (const Table *t, const TValue *key) {
+#if SOL_USE_SWISSHASH
+  return gnode(t, hashTV(key) & (sizenode(t) - 1));
+#else
   return mainpositionTV(t, key);
+#endif
 }
 
 #endif
@@ -10,6 +10,26 @@
 #include "lobject.h"
 
 
+/*
+** Define SOL_USE_SWISSHASH as 1 to build tables with an open-addressing
+** hash part ("Swiss table"), whose control bytes are probed a group
+** at a time with SIMD compares. The default hash part uses chained
+** scatter (see ltable.c).
+*/
+#if !defined(SOL_USE_SWISSHASH)
+#define SOL_USE_SWISSHASH	0
+#endif
+
+
+/*
+** Define SOL_USE_SHAPES as 0 to build tables without shapes (see
+** below), keeping all their non-array keys in the hash part.
+*/
+#if !defined(SOL_USE_SHAPES)
+#define SOL_USE_SHAPES		1
+#endif
+
+
 #define gnode(t,i)	(&(t)->node[i])
 #define gval(n)		(&(n)->i_val)
 #define gnext(n)	((n)->u.next)
@@ -35,20 +55,155 @@
 #define nodefromval(v)	cast(Node *, (v))
 
 
-SOLI_FUNC const TValue *solH_getint (Table *t, sol_Integer key);
+/*
+** 'solH_get*' operations copy the value of the key into 'res', unless
+** it is absent, and return the tag of the value.
+** The 'solH_pset*' (pre-set) operations set the given value and return
+** HOK, unless they cannot do it by themselves. That happens when the
+** original value is absent, because there might be a metamethod: if
+** the key is really absent, they return HNOTFOUND; if there is a slot
+** with that key but with no value, they return an encoding of where
+** the key is. A slot in the hash part is encoded as (HFIRSTNODE + node
+** index), a slot of a shaped table as (HFIRSTNODE + slot index), a
+** slot in the array part as (~array index), a negative
+** value. The result HRETYPE means that the key is present in a typed
+** array part that cannot hold the new value. In all these cases,
+** 'solH_finishset' completes the assignment. The value HNOTATABLE is
+** used by the fast macros to signal that the value being indexed is
+** not a table.
+*/
+#define HOK		0
+#define HNOTFOUND	1
+#define HNOTATABLE	2
+#define HRETYPE		3
+#define HFIRSTNODE	4
+
+
+/*
+** The array part is a single block holding, in this order, the type
+** tags of its elements (one byte each, in reverse order, padded to a
+** multiple of the size of a 'Value'), a header with the size of a
+** 'Value', and the values of the elements. 'array' points to the first
+** value, so that neither the values nor the tags depend on the size of
+** the array. This layout spends 9 bytes per element instead of the 16
+** of a padded 'TValue'.
+** A typed array part keeps its elements as raw numbers, all with the
+** same type, and has no tags. Its present elements are always a prefix
+** t[1..n] of the array. Its header keeps 'n' and the type tag of the
+** elements (which is meaningless while 'n' is zero). Storing a value
+** that breaks these rules (a value of another type, a nil or a new
+** element that would leave a hole) converts the array part back to a
+** generic one.
+*/
+typedef struct NumHeader {
+  unsigned int n;  /* number of elements present */
+  lu_byte tt;  /* type tag of the elements */
+} NumHeader;
+
+#define numheader(t)	check_exp(isnumarray(t), cast(NumHeader *, (t)->array - 1))
+#define numvalues(t)	((t)->array)
+
+/* address of the tag of element 'i' (base 0) of a generic array 'a' */
+#define tagaddr(a,i)	(cast(lu_byte *, (a) - 1) - 1 - (i))
+#define arraytag(t,i)	check_exp(!isnumarray(t), tagaddr((t)->array, i))
+
+/* copy element 'i' of the generic array part of 't' to 'o' */
+#define arr2obj(t,i,o)  \
+  { TValue *io_ = (o); io_->value_ = (t)->array[i]; \
+    settt_(io_, *arraytag(t,i)); }
+
+/* set element 'i' of the generic array part of 't' to 'o' */
+#define obj2arr(t,i,o)  \
+  { const TValue *io_ = (o); (t)->array[i] = io_->value_; \
+    *arraytag(t,i) = rawtt(io_); }
+
+
+/*
+** A "shaped" table keeps its short-string keys in a shape (see
+** lshape.c), shared with other tables that got the same keys in the
+** same order, and their values in 'slots', in the order of the keys in
+** the shape; its hash part is always empty. A block of slots starts
+** with a header, holding the shape and the number of allocated slots,
+** before the slot that 'slots' points to. A slot whose field is
+** removed stays in the shape with an empty value, much like a dead key
+** in the hash part. A key of any other kind (or too many keys) moves
+** all fields to a regular hash part. Tables with an empty hash part
+** become shaped when they get their first short-string key.
+*/
+typedef struct SlotHeader {
+  Shape *shape;
+  unsigned int size;  /* number of allocated slots */
+} SlotHeader;
+
+#if SOL_USE_SHAPES
+#define isshaped(t)	((t)->slots != NULL)
+#else
+#define isshaped(t)	0
+#endif
+
+#define slotheader(t)	check_exp(isshaped(t), cast(SlotHeader *, (t)->slots) - 1)
+#define tshape(t)	(slotheader(t)->shape)
+
+/* number of slots in use */
+#define nslots(t)	(isshaped(t) ? cast_uint(tshape(t)->nfields) : 0u)
+
+
+/*
+** Fast track for 'solH_getint', for a key inside the array part.
+*/
+#define solH_fastgeti(L,t,k,res,tag) \
+  { Table *h_ = (t); sol_Unsigned u_ = l_castS2U(k) - 1u; \
+    if (u_ < h_->alimit) { \
+      if (!isnumarray(h_)) { \
+        tag = withvariant(*arraytag(h_, u_)); \
+        if (!tagisempty(tag)) arr2obj(h_, u_, res); } \
+      else if (u_ < numheader(h_)->n) { \
+        tag = numheader(h_)->tt; \
+        (res)->value_ = numvalues(h_)[u_]; settt_(res, tag); } \
+      else tag = SOL_VEMPTY; } \
+    else tag = solH_getint(h_, (k), res); }
+
+
+/*
+** Fast track for 'solH_psetint', for a present key inside the array
+** part (holding a value of the same type, if the array is typed).
+*/
+#define solH_fastseti(L,t,k,val,hres) \
+  { Table *h_ = (t); sol_Unsigned u_ = l_castS2U(k) - 1u; \
+    if (u_ < h_->alimit && !isnumarray(h_) && \
+        !tagisempty(*arraytag(h_, u_))) { \
+      obj2arr(h_, u_, val); hres = HOK; } \
+    else if (u_ < h_->alimit && isnumarray(h_) && \
+             u_ < numheader(h_)->n && ttypetag(val) == numheader(h_)->tt) { \
+      numvalues(h_)[u_] = (val)->value_; hres = HOK; } \
+    else hres = solH_psetint(h_, (k), val); }
+
+
+SOLI_FUNC lu_byte solH_getint (Table *t, sol_Integer key, TValue *res);
+SOLI_FUNC lu_byte solH_getshortstr (Table *t, TString *key, TValue *res);
+SOLI_FUNC lu_byte solH_getstr (Table *t, TString *key, TValue *res);
+SOLI_FUNC lu_byte solH_get (Table *t, const TValue *key, TValue *res);
+SOLI_FUNC const TValue *solH_Hgetshortstr (Table *t, TString *key);
+SOLI_FUNC const TValue *solH_Hgetstr (Table *t, TString *key);
+SOLI_FUNC int solH_psetint (Table *t, sol_Integer key, TValue *val);
+SOLI_FUNC int solH_psetshortstr (Table *t, TString *key, TValue *val);
+SOLI_FUNC int solH_psetstr (Table *t, TString *key, TValue *val);
+SOLI_FUNC int solH_pset (Table *t, const TValue *key, TValue *val);
 SOLI_FUNC void solH_setint (sol_State *L, Table *t, sol_Integer key,
                                                     TValue *value);
-SOLI_FUNC const TValue *solH_getshortstr (Table *t, TString *key);
-SOLI_FUNC const TValue *solH_getstr (Table *t, TString *key);
-SOLI_FUNC const TValue *solH_get (Table *t, const TValue *key);
 SOLI_FUNC void solH_set (sol_State *L, Table *t, const TValue *key,
                                                  TValue *value);
 SOLI_FUNC void solH_finishset (sol_State *L, Table *t, const TValue *key,
-                                       const TValue *slot, TValue *value);
+                                              TValue *value, int hres);
+SOLI_FUNC void solH_setlist (sol_State *L, Table *t, unsigned int first,
+                                           StkId v, int n);
 SOLI_FUNC Table *solH_new (sol_State *L);
 SOLI_FUNC void solH_resize (sol_State *L, Table *t, unsigned int nasize,
                                                     unsigned int nhsize);
 SOLI_FUNC void solH_resizearray (sol_State *L, Table *t, unsigned int nasize);
+SOLI_FUNC void solH_presize (sol_State *L, Table *t, unsigned int nasize,
+                                                     unsigned int nhsize);
+SOLI_FUNC void solH_clear (sol_State *L, Table *t);
 SOLI_FUNC void solH_free (sol_State *L, Table *t);
 SOLI_FUNC int solH_next (sol_State *L, Table *t, StkId key);
 SOLI_FUNC sol_Unsigned solH_getn (Table *t);
@@ -11,6 +11,7 @@
 
 
 #include <limits.h>
+#include <locale.h>
 #include <stddef.h>
 #include <string.h>
 
@@ -144,6 +145,10 @@ static int tmove (sol_State *L) {
 }
 
 
+/* room for a number written by 'addnumbers' */
+#define MAXNUMSTR	64
+
+
 static void addfield (sol_State *L, solL_Buffer *b, sol_Integer i) {
   sol_geti(L, 1, i);
   if (l_unlikely(!sol_isstring(L, -1)))
@@ -153,6 +158,42 @@ static void addfield (sol_State *L, solL_Buffer *b, sol_Integer i) {
 }
 
 
+/*
+** Add to 'b' the elements 't[i .. last]' (with their separators) while
+** they are in a typed array, formatting the raw numbers directly, and
+** return the index of the first element not added. The array is looked
+** up again for each element, as a buffer that grows can run the
+** collector, and so finalizers that change the table.
+*/
+static sol_Integer addnumbers (sol_State *L, solL_Buffer *b, sol_Integer i,
+                               sol_Integer last, const char *sep,
+                               size_t lsep) {
+  for (; i <= last; i++) {
+    char *buff = solL_prepbuffsize(b, MAXNUMSTR);
+    sol_Unsigned n;
+    int isint;
+    void *p = sol_tonumarray(L, 1, &n, &isint);
+    int len;
+    if (p == NULL || i < 1 || (sol_Unsigned)i > n)
+      break;  /* not in a typed array */
+    if (isint)
+      len = sol_integer2str(buff, MAXNUMSTR, ((sol_Integer *)p)[i - 1]);
+    else {
+      len = sol_formatnumber(L, buff, MAXNUMSTR, ((sol_Number *)p)[i - 1],
+                                0, 0);
+      if (buff[strspn(buff, "-0123456789")] == '\0') {  /* looks like an int? */
+        buff[len++] = sol_getlocaledecpoint();
+        buff[len++] = '0';  /* adds '.0' to result, as 'tostring' */
+      }
+    }
+    solL_addsize(b, len);
+    if (i < last)
+      solL_addlstring(b, sep, lsep);
+  }
+  return i;
+}
+
+
 static int tconcat (sol_State *L) {
   solL_Buffer b;
   sol_Integer last = aux_getn(L, 1, TAB_R);
@@ -161,6 +202,8 @@ static int tconcat (sol_State *L) {
   sol_Integer i = solL_optinteger(L, 3, 1);
   last = solL_optinteger(L, 4, last);
   solL_buffinit(L, &b);
+  if (i <= last)
+    i = addnumbers(L, &b, i, last, sep, lsep);
   for (; i < last; i++) {
     addfield(L, &b, i);
     solL_addlstring(&b, sep, lsep);
@@ -172,6 +215,31 @@ static int tconcat (sol_State *L) {
 }
 
 
+/*
+** table.new(narray [, nhash]): create a table with room for 'narray'
+** array elements and 'nhash' other fields
+*/
+static int tnew (sol_State *L) {
+  sol_Integer na = solL_checkinteger(L, 1);
+  sol_Integer nh = solL_optinteger(L, 2, 0);
+  solL_argcheck(L, 0 <= na && na <= INT_MAX, 1, "out of range");
+  solL_argcheck(L, 0 <= nh && nh <= INT_MAX, 2, "out of range");
+  sol_createtable(L, (int)na, (int)nh);
+  return 1;
+}
+
+
+/*
+** table.clear(t): remove all elements from 't', keeping the memory it
+** already uses
+*/
+static int tclear (sol_State *L) {
+  solL_checktype(L, 1, SOL_TTABLE);
+  sol_cleartable(L, 1);
+  return 0;
+}
+
+
 /*
 ** {======================================================
 ** Pack/unpack
@@ -395,15 +463,448 @@ static void auxsort (sol_State *L, IdxT lo, IdxT up,
   }  /* tail call auxsort(L, lo, up, rnd) */
 }
 
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Native and stable sorting
+** =======================================================
+*/
+
+#if !defined(MAX_SIZET)
+/* maximum value for size_t */
+#define MAX_SIZET	((size_t)(~(size_t)0))
+#endif
+
+
+/*
+** Allocate (as a userdata on the top of the stack) a buffer for 'n'
+** elements of size 'sz', or return NULL if that size overflows.
+*/
+static void *sortbuffer (sol_State *L, IdxT n, size_t sz) {
+  if (n > MAX_SIZET / sz)
+    return NULL;
+  return sol_newuserdatauv(L, n * sz, 0);
+}
+
+
+/*
+** Sort keys for numbers: an unsigned integer whose order is the order
+** of the number. For integers, flip the sign bit; for floats (only if
+** they have the size of an unsigned integer), flip all bits of a
+** negative number and only the sign bit of a non-negative one.
+*/
+typedef sol_Unsigned SortKey;
+
+#define SIGNBIT		(~((SortKey)~0 >> 1))
+#define KEYBYTES	((int)sizeof(SortKey))
+
+#define canradixfloat	(sizeof(sol_Number) == sizeof(SortKey))
+
+
+static SortKey flt2key (sol_Number f) {
+  SortKey k = 0;
+  memcpy(&k, &f, canradixfloat ? sizeof(k) : 0);
+  return (k & SIGNBIT) ? ~k : (k | SIGNBIT);
+}
+
+
+static sol_Number key2flt (SortKey k) {
+  sol_Number f = 0;
+  k = (k & SIGNBIT) ? (k & ~SIGNBIT) : ~k;
+  memcpy(&f, &k, canradixfloat ? sizeof(f) : 0);
+  return f;
+}
+
+
+/* arrays smaller than this are sorted by insertion */
+#define RADIXMIN	64u
+
+
+/*
+** LSD radix sort of keys 'a[0 .. n-1]', one byte per pass, using
+** 'tmp' (also with 'n' elements). Passes where all keys have the same
+** byte are skipped. The sort is stable.
+*/
+static void radixsort (SortKey *a, SortKey *tmp, IdxT n) {
+  IdxT count[KEYBYTES][256];
+  SortKey *src = a, *dst = tmp;
+  IdxT i;
+  int b;
+  if (n < RADIXMIN) {  /* small array? */
+    for (i = 1; i < n; i++) {  /* insertion sort */
+      SortKey k = a[i];
+      IdxT j = i;
+      for (; j > 0 && k < a[j - 1]; j--)
+        a[j] = a[j - 1];
+      a[j] = k;
+    }
+    return;
+  }
+  memset(count, 0, sizeof(count));
+  for (i = 0; i < n; i++) {  /* count all bytes in one pass */
+    for (b = 0; b < KEYBYTES; b++)
+      count[b][(a[i] >> (8 * b)) & 0xff]++;
+  }
+  for (b = 0; b < KEYBYTES; b++) {
+    IdxT *c = count[b];
+    IdxT total = 0;
+    int d;
+    if (c[(src[0] >> (8 * b)) & 0xff] == n)
+      continue;  /* all keys have the same byte here */
+    for (d = 0; d < 256; d++) {  /* compute the start of each bucket */
+      IdxT t = c[d];
+      c[d] = total;
+      total += t;
+    }
+    for (i = 0; i < n; i++)
+      dst[c[(src[i] >> (8 * b)) & 0xff]++] = src[i];
+    { SortKey *t = src; src = dst; dst = t; }
+  }
+  if (src != a)
+    memcpy(a, src, n * sizeof(SortKey));
+}
+
+
+/*
+** Get the sort keys of the numbers 't[1 .. n]', which are all integers
+** ('isint') or all floats. Returns false if it finds another value, a
+** NaN, or (when 'stable') a negative zero, which radix would put before
+** positive zeros. A typed array is read directly.
+*/
+static int getkeys (sol_State *L, SortKey *a, IdxT n, int isint,
+                                  int stable) {
+  sol_Unsigned na;
+  int ti;
+  void *p = sol_tonumarray(L, 1, &na, &ti);
+  IdxT i;
+  if (p != NULL && n <= na && ti == isint) {  /* typed array? */
+    for (i = 0; i < n; i++) {
+      if (isint)
+        a[i] = (SortKey)((sol_Integer *)p)[i] ^ SIGNBIT;
+      else {
+        sol_Number f = ((sol_Number *)p)[i];
+        if (f != f || (stable && f == 0 && flt2key(f) < SIGNBIT))
+          return 0;
+        a[i] = flt2key(f);
+      }
+    }
+    return 1;
+  }
+  for (i = 0; i < n; i++) {
+    int ok = (sol_rawgeti(L, 1, i + 1) == SOL_TNUMBER &&
+              sol_isinteger(L, -1) == isint);
+    if (ok) {
+      if (isint)
+        a[i] = (SortKey)sol_tointeger(L, -1) ^ SIGNBIT;
+      else {
+        sol_Number f = sol_tonumber(L, -1);
+        ok = (f == f) && !(stable && f == 0 && flt2key(f) < SIGNBIT);
+        a[i] = flt2key(f);
+      }
+    }
+    sol_pop(L, 1);
+    if (!ok)
+      return 0;
+  }
+  return 1;
+}
+
+
+/*
+** Put the sorted keys back into 't[1 .. n]', directly if 't' has a
+** typed array.
+*/
+static void setkeys (sol_State *L, const SortKey *a, IdxT n, int isint) {
+  sol_Unsigned na;
+  int ti;
+  void *p = sol_tonumarray(L, 1, &na, &ti);
+  IdxT i;
+  if (p != NULL && n <= na && ti == isint) {  /* typed array? */
+    for (i = 0; i < n; i++) {
+      if (isint)
+        ((sol_Integer *)p)[i] = (sol_Integer)(a[i] ^ SIGNBIT);
+      else
+        ((sol_Number *)p)[i] = key2flt(a[i]);
+    }
+    return;
+  }
+  for (i = 0; i < n; i++) {
+    if (isint)
+      sol_pushinteger(L, (sol_Integer)(a[i] ^ SIGNBIT));
+    else
+      sol_pushnumber(L, key2flt(a[i]));
+    sol_rawseti(L, 1, i + 1);
+  }
+}
+
+
+/*
+** Sort the numbers 't[1 .. n]', which are all integers ('isint') or all
+** floats, without changing the table if 'getkeys' fails.
+*/
+static int sortnumbers (sol_State *L, IdxT n, int isint, int stable) {
+  SortKey *a;
+  int ok;
+  if (!isint && !canradixfloat)
+    return 0;
+  a = (SortKey *)sortbuffer(L, n, 2 * sizeof(SortKey));
+  if (a == NULL)
+    return 0;
+  ok = getkeys(L, a, n, isint, stable);
+  if (ok) {
+    radixsort(a, a + n, n);
+    setkeys(L, a, n, isint);
+  }
+  sol_pop(L, 1);  /* remove buffer */
+  return ok;
+}
+
+
+typedef struct SortStr {
+  const char *s;
+  size_t l;
+  IdxT i;  /* original position (base 0) */
+} SortStr;
+
+
+/* character of 'x' at depth 'd', or -1 at its end */
+#define charat(x,d)	((d) < (x)->l ? (int)(unsigned char)(x)->s[d] : -1)
+
+
+/* is 'x' less than 'y', knowing that both are equal up to depth 'd'? */
+static int strless (const SortStr *x, const SortStr *y, size_t d) {
+  size_t lx = x->l - d, ly = y->l - d;
+  int r = memcmp(x->s + d, y->s + d, (lx < ly) ? lx : ly);
+  return (r < 0 || (r == 0 && lx < ly));
+}
+
+
+static int med3 (int a, int b, int c) {
+  if (a < b)
+    return (b < c) ? b : (a < c) ? c : a;
+  else
+    return (b > c) ? b : (a > c) ? c : a;
+}
+
+
+/*
+** Multikey quicksort (Bentley and Sedgewick) of 'a[0 .. n-1]', all
+** equal up to depth 'd': a three-way partition on the character at
+** depth 'd', then the "equal" part goes on at depth 'd + 1'. It recurses
+** on the two smaller parts and loops on the largest one.
+*/
+static void mkqsort (SortStr *a, IdxT n, size_t d) {
+  while (n > 1) {
+    IdxT lt = 0, i = 0, gt = n;
+    IdxT nl, ne, ng;
+    int pv;
+    if (n < 12) {  /* small array? */
+      IdxT j;
+      for (i = 1; i < n; i++) {  /* insertion sort */
+        SortStr x = a[i];
+        for (j = i; j > 0 && strless(&x, &a[j - 1], d); j--)
+          a[j] = a[j - 1];
+        a[j] = x;
+      }
+      return;
+    }
+    pv = med3(charat(&a[0], d), charat(&a[n / 2], d), charat(&a[n - 1], d));
+    while (i < gt) {  /* a[0 .. lt-1] < pv == a[lt .. i-1]; a[gt ..] > pv */
+      int c = charat(&a[i], d);
+      SortStr x = a[i];
+      if (c < pv) { a[i++] = a[lt]; a[lt++] = x; }
+      else if (c > pv) { a[i] = a[--gt]; a[gt] = x; }
+      else i++;
+    }
+    nl = lt; ng = n - gt;
+    ne = (pv < 0) ? 0 : gt - lt;  /* strings ending here are sorted */
+    if (nl >= ne && nl >= ng) {  /* "less" part is the largest? */
+      mkqsort(a + lt, ne, d + 1);
+      mkqsort(a + gt, ng, d);
+      n = nl;
+    }
+    else if (ng >= ne) {  /* "greater" part is the largest? */
+      mkqsort(a, nl, d);
+      mkqsort(a + lt, ne, d + 1);
+      a += gt; n = ng;
+    }
+    else {  /* "equal" part is the largest */
+      mkqsort(a, nl, d);
+      mkqsort(a + gt, ng, d);
+      a += lt; n = ne; d++;
+    }
+  }
+}
+
+
+/*
+** Is the string order the byte order? ('l_strcmp' uses 'strcoll'.)
+*/
+static int bytecollate (void) {
+  const char *loc = setlocale(LC_COLLATE, NULL);
+  return (loc != NULL && (strcmp(loc, "C") == 0 || strcmp(loc, "POSIX") == 0));
+}
+
+
+/*
+** Sort the strings 't[1 .. n]'. Returns false (without changing the
+** table) if it finds another value. The strings are anchored by the
+** table while they are sorted; then they are moved to their places
+** following the cycles of the permutation.
+*/
+static int sortstrings (sol_State *L, IdxT n) {
+  SortStr *a;
+  IdxT i;
+  if (!bytecollate())
+    return 0;
+  a = (SortStr *)sortbuffer(L, n, sizeof(SortStr));
+  if (a == NULL)
+    return 0;
+  for (i = 0; i < n; i++) {
+    if (sol_rawgeti(L, 1, i + 1) != SOL_TSTRING) {
+      sol_pop(L, 2);  /* remove value and buffer */
+      return 0;
+    }
+    a[i].s = sol_tolstring(L, -1, &a[i].l);
+    a[i].i = i;
+    sol_pop(L, 1);
+  }
+  mkqsort(a, n, 0);
+  for (i = 0; i < n; i++) {  /* element 'i' gets old element 'a[i].i' */
+    IdxT j = i;
+    if (a[i].i == i)
+      continue;  /* already in place (or moved) */
+    sol_rawgeti(L, 1, i + 1);  /* save first element of the cycle */
+    for (;;) {
+      IdxT src = a[j].i;
+      a[j].i = j;  /* mark as moved */
+      if (src == i)
+        break;
+      sol_rawgeti(L, 1, src + 1);
+      sol_rawseti(L, 1, j + 1);
+      j = src;
+    }
+    sol_rawseti(L, 1, j + 1);  /* last place gets first element */
+  }
+  sol_pop(L, 1);  /* remove buffer */
+  return 1;
+}
+
+
+/*
+** Try to sort 't[1 .. n]' without calls through the stack for each
+** comparison, when there is no order function and 't' is a table with
+** no metatable: all integers or all floats are radix sorted, all
+** strings are sorted with a multikey quicksort. Returns false if it
+** cannot do it.
+*/
+static int nativesort (sol_State *L, IdxT n, int stable) {
+  int tt, isint;
+  if (!sol_isnil(L, 2) || sol_type(L, 1) != SOL_TTABLE)
+    return 0;
+  if (sol_getmetatable(L, 1)) {
+    sol_pop(L, 1);
+    return 0;
+  }
+  tt = sol_rawgeti(L, 1, 1);
+  isint = sol_isinteger(L, -1);
+  sol_pop(L, 1);
+  if (tt == SOL_TNUMBER)
+    return sortnumbers(L, n, isint, stable);
+  else if (tt == SOL_TSTRING)
+    return sortstrings(L, n);
+  else
+    return 0;
+}
+
+
+/*
+** Compare values 'a' and 'b' of the auxiliary table (at index 3)
+*/
+static int idxless (sol_State *L, IdxT a, IdxT b) {
+  int res;
+  sol_rawgeti(L, 3, a);
+  sol_rawgeti(L, 3, b);
+  res = sort_comp(L, -2, -1);
+  sol_pop(L, 2);
+  return res;
+}
+
 
+/*
+** Merge sorted runs 'a[lo .. mid-1]' and 'a[mid .. hi-1]' into 'b'.
+** Ties take the left element, which keeps the sort stable.
+*/
+static void merge (sol_State *L, const IdxT *a, IdxT *b, IdxT lo,
+                                 IdxT mid, IdxT hi) {
+  IdxT i = lo, j = mid, k = lo;
+  if (mid < hi && idxless(L, a[mid], a[mid - 1])) {  /* not in order? */
+    while (i < mid && j < hi)
+      b[k++] = idxless(L, a[j], a[i]) ? a[j++] : a[i++];
+  }
+  while (i < mid) b[k++] = a[i++];
+  while (j < hi) b[k++] = a[j++];
+}
+
+
+/*
+** Stable sort: copy 't[1 .. n]' to an auxiliary table, merge sort
+** (bottom up) an array of indices into it, and then copy the values
+** back in order. If the order function raises an error, the table is
+** left unchanged.
+*/
+static void stablesort (sol_State *L, IdxT n) {
+  IdxT *a, *b;
+  IdxT i, w;
+  sol_createtable(L, (int)n, 0);  /* auxiliary table at index 3 */
+  for (i = 1; i <= n; i++) {
+    sol_geti(L, 1, i);
+    sol_rawseti(L, 3, i);
+  }
+  a = (IdxT *)sortbuffer(L, n, 2 * sizeof(IdxT));
+  if (a == NULL)
+    solL_error(L, "array too big");
+  b = a + n;
+  for (i = 0; i < n; i++)
+    a[i] = i + 1;
+  for (w = 1; w < n; w *= 2) {
+    IdxT lo;
+    for (lo = 0; lo < n; lo += 2 * w) {
+      IdxT mid = (n - lo > w) ? lo + w : n;
+      IdxT hi = (n - mid > w) ? mid + w : n;
+      merge(L, a, b, lo, mid, hi);
+    }
+    { IdxT *t = a; a = b; b = t; }
+  }
+  for (i = 0; i < n; i++) {
+    sol_rawgeti(L, 3, a[i]);
+    sol_seti(L, 1, i + 1);
+  }
+  sol_pop(L, 2);  /* remove buffer and auxiliary table */
+}
+
+
+/*
+** table.sort(list [, comp [, mode]]): 'mode' "stable" keeps the
+** relative order of equal elements
+*/
 static int sort (sol_State *L) {
+  static const char *const modes[] = {"unstable", "stable", NULL};
   sol_Integer n = aux_getn(L, 1, TAB_RW);
+  int stable = solL_checkoption(L, 3, "unstable", modes);
   if (n > 1) {  /* non-trivial interval? */
     solL_argcheck(L, n < INT_MAX, 1, "array too big");
     if (!sol_isnoneornil(L, 2))  /* is there a 2nd argument? */
       solL_checktype(L, 2, SOL_TFUNCTION);  /* must be a function */
     sol_settop(L, 2);  /* make sure there are two arguments */
-    auxsort(L, 1, (IdxT)n, 0);
+    if (nativesort(L, (IdxT)n, stable))
+      return 0;
+    if (stable)
+      stablesort(L, (IdxT)n);
+    else
+      auxsort(L, 1, (IdxT)n, 0);
   }
   return 0;
 }
@@ -419,6 +920,8 @@ static const solL_Reg tab_funcs[] = {
   {"remove", tremove},
   {"move", tmove},
   {"sort", sort},
+  {"new", tnew},
+  {"clear", tclear},
   {NULL, NULL}
 };
 
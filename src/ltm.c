@@ -31,7 +31,7 @@ SOLI_DDEF const char *const solT_typenames_[SOL_TOTALTYPES] = {
   "no value",
   "nil", "boolean", udatatypename, "number",
   "string", "table", "function", udatatypename, "thread",
-  "upvalue", "proto" /* these last cases are used for tests only */
+  "upvalue", "proto", "shape" /* these last cases are used for tests only */
 };
 
 
@@ -58,7 +58,7 @@ void solT_init (sol_State *L) {
 ** tag methods
 */
 const TValue *solT_gettm (Table *events, TMS event, TString *ename) {
-  const TValue *tm = solH_getshortstr(events, ename);
+  const TValue *tm = solH_Hgetshortstr(events, ename);
   sol_assert(event <= TM_EQ);
   if (notm(tm)) {  /* no tag method? */
     events->flags |= cast_byte(1u<<event);  /* cache this fact */
@@ -80,7 +80,7 @@ const TValue *solT_gettmbyobj (sol_State *L, const TValue *o, TMS event) {
     default:
       mt = G(L)->mt[ttype(o)];
   }
-  return (mt ? solH_getshortstr(mt, G(L)->tmname[event]) : &G(L)->nilvalue);
+  return (mt ? solH_Hgetshortstr(mt, G(L)->tmname[event]) : &G(L)->nilvalue);
 }
 
 
@@ -92,9 +92,9 @@ const char *solT_objtypename (sol_State *L, const TValue *o) {
   Table *mt;
   if ((ttistable(o) && (mt = hvalue(o)->metatable) != NULL) ||
       (ttisfulluserdata(o) && (mt = uvalue(o)->metatable) != NULL)) {
-    const TValue *name = solH_getshortstr(mt, solS_new(L, "__name"));
+    const TValue *name = solH_Hgetshortstr(mt, solS_new(L, "__name"));
     if (ttisstring(name))  /* is '__name' a string? */
-      return getstr(tsvalue(name));  /* use it as type name */
+      return solS_getstr(L, tsvalue(name));  /* use it as type name */
   }
   return ttypename(ttype(o));  /* else use standard type name */
 }
@@ -252,6 +252,22 @@ static void loadDebug (LoadState *S, Proto *f) {
     n = f->sizeupvalues;  /* must be this many */
   for (i = 0; i < n; i++)
     f->upvalues[i].name = loadStringN(S, f);
+  n = loadInt(S);
+  f->inlined = solM_newvectorchecked(S->L, n, InlineInfo);
+  f->sizeinlined = n;
+  for (i = 0; i < n; i++) {
+    InlineInfo *ii = &f->inlined[i];
+    ii->startpc = loadInt(S);
+    ii->endpc = loadInt(S);
+    ii->line = loadInt(S);
+    ii->fidx = cast(short, loadInt(S));
+    ii->reg = loadByte(S);
+    ii->base = loadByte(S);
+    ii->nres = loadByte(S);
+    ii->nilargs = loadByte(S);
+    if (ii->fidx < 0 || ii->fidx >= f->sizep)
+      error(S, "bad inlined call");
+  }
 }
 
 
@@ -269,6 +285,7 @@ static void loadFunction (LoadState *S, Proto *f, TString *psource) {
   loadUpvalues(S, f);
   loadProtos(S, f);
   loadDebug(S, f);
+  solF_initcache(S->L, f);
 }
 
 
@@ -23,7 +23,7 @@
 */
 #define SOLC_VERSION  (((SOL_VERSION_NUM / 100) * 16) + SOL_VERSION_NUM % 100)
 
-#define SOLC_FORMAT	0	/* this is the official format */
+#define SOLC_FORMAT	2	/* format with inlined calls and their layout */
 
 /* load one chunk; from lundump.c */
 SOLI_FUNC LClosure* solU_undump (sol_State* L, ZIO* Z, const char* name);
@@ -29,6 +29,7 @@
 #include "ltable.h"
 #include "ltm.h"
 #include "lvm.h"
+#include "ljit.h"
 
 
 /*
@@ -85,15 +86,15 @@
 ** If the value is not a string or is a string not representing
 ** a valid numeral (or if coercions from strings to numbers
 ** are disabled via macro 'cvt2num'), do not modify 'result'
-** and return 0.
+** and return 0. (A rope is flattened before.)
 */
-static int l_strton (const TValue *obj, TValue *result) {
+static int l_strton (sol_State *L, const TValue *obj, TValue *result) {
   sol_assert(obj != result);
   if (!cvt2num(obj))  /* is object not a string? */
     return 0;
   else {
     TString *st = tsvalue(obj);
-    return (solO_str2num(getstr(st), result) == tsslen(st) + 1);
+    return (solO_str2num(solS_getstr(L, st), result) == tsslen(st) + 1);
   }
 }
 
@@ -102,13 +103,13 @@ static int l_strton (const TValue *obj, TValue *result) {
 ** Try to convert a value to a float. The float case is already handled
 ** by the macro 'tonumber'.
 */
-int solV_tonumber_ (const TValue *obj, sol_Number *n) {
+int solV_tonumber_ (sol_State *L, const TValue *obj, sol_Number *n) {
   TValue v;
   if (ttisinteger(obj)) {
     *n = cast_num(ivalue(obj));
     return 1;
   }
-  else if (l_strton(obj, &v)) {  /* string coercible to number? */
+  else if (l_strton(L, obj, &v)) {  /* string coercible to number? */
     *n = nvalue(&v);  /* convert result of 'solO_str2num' to a float */
     return 1;
   }
@@ -151,9 +152,10 @@ int solV_tointegerns (const TValue *obj, sol_Integer *p, F2Imod mode) {
 /*
 ** try to convert a value to an integer.
 */
-int solV_tointeger (const TValue *obj, sol_Integer *p, F2Imod mode) {
+int solV_tointeger (sol_State *L, const TValue *obj, sol_Integer *p,
+                    F2Imod mode) {
   TValue v;
-  if (l_strton(obj, &v))  /* does 'obj' point to a numerical string? */
+  if (l_strton(L, obj, &v))  /* does 'obj' point to a numerical string? */
     obj = &v;  /* change it to point to its corresponding number */
   return solV_tointegerns(obj, p, mode);
 }
@@ -177,10 +179,10 @@ int solV_tointeger (const TValue *obj, sol_Integer *p, F2Imod mode) {
 */
 static int forlimit (sol_State *L, sol_Integer init, const TValue *lim,
                                    sol_Integer *p, sol_Integer step) {
-  if (!solV_tointeger(lim, p, (step < 0 ? F2Iceil : F2Ifloor))) {
+  if (!solV_tointeger(L, lim, p, (step < 0 ? F2Iceil : F2Ifloor))) {
     /* not coercible to in integer */
     sol_Number flim;  /* try to convert to float */
-    if (!tonumber(lim, &flim)) /* cannot convert to float? */
+    if (!tonumber(L, lim, &flim)) /* cannot convert to float? */
       solG_forerror(L, lim, "limit");
     /* else 'flim' is a float out of integer bounds */
     if (soli_numlt(0, flim)) {  /* if it is positive, it is too large */
@@ -205,7 +207,7 @@ static int forlimit (sol_State *L, sol_Integer init, const TValue *lim,
 **   ra + 2 : step
 **   ra + 3 : control variable
 */
-static int forprep (sol_State *L, StkId ra) {
+int solV_forprep (sol_State *L, StkId ra) {
   TValue *pinit = s2v(ra);
   TValue *plimit = s2v(ra + 1);
   TValue *pstep = s2v(ra + 2);
@@ -237,11 +239,11 @@ static int forprep (sol_State *L, StkId ra) {
   }
   else {  /* try making all values floats */
     sol_Number init; sol_Number limit; sol_Number step;
-    if (l_unlikely(!tonumber(plimit, &limit)))
+    if (l_unlikely(!tonumber(L, plimit, &limit)))
       solG_forerror(L, plimit, "limit");
-    if (l_unlikely(!tonumber(pstep, &step)))
+    if (l_unlikely(!tonumber(L, pstep, &step)))
       solG_forerror(L, pstep, "step");
-    if (l_unlikely(!tonumber(pinit, &init)))
+    if (l_unlikely(!tonumber(L, pinit, &init)))
       solG_forerror(L, pinit, "initial value");
     if (step == 0)
       solG_runerror(L, "'for' step is zero");
@@ -265,7 +267,7 @@ static int forprep (sol_State *L, StkId ra) {
 ** true iff the loop must continue. (The integer case is
 ** written online with opcode OP_FORLOOP, for performance.)
 */
-static int floatforloop (StkId ra) {
+int solV_floatforloop (StkId ra) {
   sol_Number step = fltvalue(s2v(ra + 2));
   sol_Number limit = fltvalue(s2v(ra + 1));
   sol_Number idx = fltvalue(s2v(ra));  /* internal index */
@@ -283,15 +285,15 @@ static int floatforloop (StkId ra) {
 
 /*
 ** Finish the table access 'val = t[key]'.
-** if 'slot' is NULL, 't' is not a table; otherwise, 'slot' points to
-** t[k] entry (which must be empty).
+** 'tag' is the (empty) result of the fast access to 't[key]'; it is
+** SOL_VNOTABLE when 't' is not a table.
 */
 void solV_finishget (sol_State *L, const TValue *t, TValue *key, StkId val,
-                      const TValue *slot) {
+                      lu_byte tag) {
   int loop;  /* counter to avoid infinite loops */
   const TValue *tm;  /* metamethod */
   for (loop = 0; loop < MAXTAGLOOP; loop++) {
-    if (slot == NULL) {  /* 't' is not a table? */
+    if (tag == SOL_VNOTABLE) {  /* 't' is not a table? */
       sol_assert(!ttistable(t));
       tm = solT_gettmbyobj(L, t, TM_INDEX);
       if (l_unlikely(notm(tm)))
@@ -299,7 +301,7 @@ void solV_finishget (sol_State *L, const TValue *t, TValue *key, StkId val,
       /* else will try the metamethod */
     }
     else {  /* 't' is a table */
-      sol_assert(isempty(slot));
+      sol_assert(tagisempty(tag));
       tm = fasttm(L, hvalue(t)->metatable, TM_INDEX);  /* table's metamethod */
       if (tm == NULL) {  /* no metamethod? */
         setnilvalue(s2v(val));  /* result is nil */
@@ -312,10 +314,9 @@ void solV_finishget (sol_State *L, const TValue *t, TValue *key, StkId val,
       return;
     }
     t = tm;  /* else try to access 'tm[key]' */
-    if (solV_fastget(L, t, key, slot, solH_get)) {  /* fast track? */
-      setobj2s(L, val, slot);  /* done */
-      return;
-    }
+    solV_fastget(L, t, key, s2v(val), solH_get, tag);
+    if (!tagisempty(tag))  /* fast track? */
+      return;  /* done */
     /* else repeat (tail call 'solV_finishget') */
   }
   solG_runerror(L, "'__index' chain too long; possible loop");
@@ -324,24 +325,23 @@ void solV_finishget (sol_State *L, const TValue *t, TValue *key, StkId val,
 
 /*
 ** Finish a table assignment 't[key] = val'.
-** If 'slot' is NULL, 't' is not a table.  Otherwise, 'slot' points
-** to the entry 't[key]', or to a value with an absent key if there
-** is no such entry.  (The value at 'slot' must be empty, otherwise
-** 'solV_fastget' would have done the job.)
+** 'hres' is the result of the fast set (see 'solH_pset*'): HNOTATABLE
+** if 't' is not a table, HRETYPE if 't[key]' is present but its typed
+** array cannot hold 'val', or else where the absent 't[key]' is.
 */
 void solV_finishset (sol_State *L, const TValue *t, TValue *key,
-                     TValue *val, const TValue *slot) {
+                     TValue *val, int hres) {
   int loop;  /* counter to avoid infinite loops */
   for (loop = 0; loop < MAXTAGLOOP; loop++) {
     const TValue *tm;  /* '__newindex' metamethod */
-    if (slot != NULL) {  /* is 't' a table? */
+    if (hres != HNOTATABLE) {  /* is 't' a table? */
       Table *h = hvalue(t);  /* save 't' table */
-      sol_assert(isempty(slot));  /* slot must be empty */
-      tm = fasttm(L, h->metatable, TM_NEWINDEX);  /* get metamethod */
+      tm = (hres == HRETYPE) ? NULL  /* key is present */
+                             : fasttm(L, h->metatable, TM_NEWINDEX);
       if (tm == NULL) {  /* no metamethod? */
         sethvalue2s(L, L->top.p, h);  /* anchor 't' */
         L->top.p++;  /* assume EXTRA_STACK */
-        solH_finishset(L, h, key, slot, val);  /* set new value */
+        solH_finishset(L, h, key, val, hres);  /* set new value */
         L->top.p--;
         invalidateTMcache(h);
         solC_barrierback(L, obj2gco(h), val);
@@ -360,11 +360,12 @@ void solV_finishset (sol_State *L, const TValue *t, TValue *key,
       return;
     }
     t = tm;  /* else repeat assignment over 'tm' */
-    if (solV_fastget(L, t, key, slot, solH_get)) {
-      solV_finishfastset(L, t, slot, val);
+    solV_fastset(L, t, key, val, hres, solH_pset);
+    if (hres == HOK) {
+      solV_finishfastset(L, t, val);
       return;  /* done */
     }
-    /* else 'return solV_finishset(L, t, key, val, slot)' (loop) */
+    /* else 'return solV_finishset(L, t, key, val, hres)' (loop) */
   }
   solG_runerror(L, "'__newindex' chain too long; possible loop");
 }
@@ -378,10 +379,10 @@ void solV_finishset (sol_State *L, const TValue *t, TValue *key,
 ** of the strings. Note that segments can compare equal but still
 ** have different lengths.
 */
-static int l_strcmp (const TString *ts1, const TString *ts2) {
-  const char *s1 = getstr(ts1);
+static int l_strcmp (sol_State *L, TString *ts1, TString *ts2) {
+  const char *s1 = solS_getstr(L, ts1);
   size_t rl1 = tsslen(ts1);  /* real length */
-  const char *s2 = getstr(ts2);
+  const char *s2 = solS_getstr(L, ts2);
   size_t rl2 = tsslen(ts2);
   for (;;) {  /* for each segment */
     int temp = strcoll(s1, s2);
@@ -527,7 +528,7 @@ l_sinline int LEnum (const TValue *l, const TValue *r) {
 static int lessthanothers (sol_State *L, const TValue *l, const TValue *r) {
   sol_assert(!ttisnumber(l) || !ttisnumber(r));
   if (ttisstring(l) && ttisstring(r))  /* both are strings? */
-    return l_strcmp(tsvalue(l), tsvalue(r)) < 0;
+    return l_strcmp(L, tsvalue(l), tsvalue(r)) < 0;
   else
     return solT_callorderTM(L, l, r, TM_LT);
 }
@@ -549,7 +550,7 @@ int solV_lessthan (sol_State *L, const TValue *l, const TValue *r) {
 static int lessequalothers (sol_State *L, const TValue *l, const TValue *r) {
   sol_assert(!ttisnumber(l) || !ttisnumber(r));
   if (ttisstring(l) && ttisstring(r))  /* both are strings? */
-    return l_strcmp(tsvalue(l), tsvalue(r)) <= 0;
+    return l_strcmp(L, tsvalue(l), tsvalue(r)) <= 0;
   else
     return solT_callorderTM(L, l, r, TM_LE);
 }
@@ -633,12 +634,63 @@ static void copy2buff (StkId top, int n, char *buff) {
   do {
     TString *st = tsvalue(s2v(top - n));
     size_t l = tsslen(st);  /* length of string being copied */
-    memcpy(buff + tl, getstr(st), l * sizeof(char));
+    if (islazy(st))
+      solS_copy(st, buff + tl);
+    else
+      memcpy(buff + tl, getstr(st), l * sizeof(char));
     tl += l;
   } while (--n > 0);
 }
 
 
+/*
+** Create a string with the contents of the 'n' strings at the top,
+** whose total length is 'tl'.
+*/
+static TString *flatconcat (sol_State *L, StkId top, int n, size_t tl) {
+  TString *ts;
+  if (tl <= SOLI_MAXSHORTLEN) {  /* is result a short string? */
+    char buff[SOLI_MAXSHORTLEN];
+    copy2buff(top, n, buff);  /* copy strings to buffer */
+    ts = solS_newlstr(L, buff, tl);
+  }
+  else {  /* long string; copy strings directly to final result */
+    ts = solS_createlngstrobj(L, tl);
+    copy2buff(top, n, getlngstr(ts));
+  }
+  return ts;
+}
+
+
+/*
+** Concatenate the 'n' strings at the top (with total length 'tl') as a
+** rope, without copying the first one. The other strings are copied
+** into the right piece, together with the last piece of the first
+** string when it is a rope and everything fits in SOLI_MINROPE bytes.
+** So, a loop doing 's = s .. x' takes linear time and builds pieces
+** that are not too small.
+*/
+static TString *ropeconcat (sol_State *L, StkId top, int n, size_t tl) {
+  TString *left = tsvalue(s2v(top - n));
+  TString *right = tsvalue(s2v(top - 1));
+  size_t rl = tl - tsslen(left);  /* length of the other strings */
+  if (isrope(left) && tsslen(left->right) + rl <= SOLI_MINROPE) {
+    char buff[SOLI_MINROPE];
+    size_t ll = tsslen(left->right);
+    memcpy(buff, getstr(left->right), ll * sizeof(char));
+    copy2buff(top, n - 1, buff + ll);
+    right = solS_newlstr(L, buff, ll + rl);
+    setsvalue2s(L, top - n + 1, right);  /* anchor it */
+    left = left->left;  /* still anchored by the old rope */
+  }
+  else if (n > 2 || islazy(right)) {  /* must build the right piece? */
+    right = flatconcat(L, top, n - 1, rl);
+    setsvalue2s(L, top - n + 1, right);  /* anchor it */
+  }
+  return solS_newrope(L, left, right);
+}
+
+
 /*
 ** Main operation for concatenation: concat 'total' values in the stack,
 ** from 'L->top.p - total' up to 'L->top.p - 1'.
@@ -670,15 +722,10 @@ void solV_concat (sol_State *L, int total) {
         }
         tl += l;
       }
-      if (tl <= SOLI_MAXSHORTLEN) {  /* is result a short string? */
-        char buff[SOLI_MAXSHORTLEN];
-        copy2buff(top, n, buff);  /* copy strings to buffer */
-        ts = solS_newlstr(L, buff, tl);
-      }
-      else {  /* long string; copy strings directly to final result */
-        ts = solS_createlngstrobj(L, tl);
-        copy2buff(top, n, getlngstr(ts));
-      }
+      if (tsslen(tsvalue(s2v(top - n))) >= SOLI_MINROPE)  /* long prefix? */
+        ts = ropeconcat(L, top, n, tl);
+      else
+        ts = flatconcat(L, top, n, tl);
       setsvalue2s(L, top - n, ts);  /* create result */
     }
     total -= n - 1;  /* got 'n' strings to create one new */
@@ -793,8 +840,8 @@ sol_Integer solV_shiftl (sol_Integer x, sol_Integer y) {
 ** create a new Sol closure, push it in the stack, and initialize
 ** its upvalues.
 */
-static void pushclosure (sol_State *L, Proto *p, UpVal **encup, StkId base,
-                         StkId ra) {
+void solV_pushclosure (sol_State *L, Proto *p, UpVal **encup, StkId base,
+                       StkId ra) {
   int nup = p->sizeupvalues;
   Upvaldesc *uv = p->upvalues;
   int i;
@@ -882,6 +929,192 @@ void solV_finishOp (sol_State *L) {
 
 
 
+/*
+** {==================================================================
+** Inline caches
+** ===================================================================
+*/
+
+/*
+** Inline cache of the instruction at 'pc' of 'p' (see 'ICMap'): the
+** caches of the previous map entries plus the ones before 'pc' in its
+** entry, counted by a population count of the bits of the mask below
+** 'pc'.
+*/
+l_sinline ICache *icacheat (const Proto *p, int pc) {
+  const ICMap *m = &p->icmap[pc / ICMAPBITS];
+  unsigned int x = m->mask & ((1u << (pc % ICMAPBITS)) - 1);
+  sol_assert(solF_hascache(p, pc));
+  x = x - ((x >> 1) & 0x55555555u);
+  x = (x & 0x33333333u) + ((x >> 2) & 0x33333333u);
+  x = (x + (x >> 4)) & 0x0F0F0F0Fu;
+  return p->icache + m->base + cast_int(((x * 0x01010101u) >> 24) & 0xFF);
+}
+
+
+/*
+** Check whether node 's' of table 'h' (or slot 's', if 'h' is shaped)
+** holds the short-string key 'key'. Returns the value in that node (or
+** slot) or NULL if the cache does not match.
+*/
+l_sinline const TValue *icprobe (Table *h, TString *key, unsigned int s) {
+  if (isshaped(h)) {
+    const Shape *sh = tshape(h);
+    if (s < sh->nfields && sh->keys[s] == key)
+      return &h->slots[s];
+  }
+  else if (s < cast_uint(sizenode(h))) {
+    Node *n = gnode(h, s);
+    if (keyisshrstr(n) && eqshrstr(keystrval(n), key))
+      return gval(n);
+  }
+  return NULL;
+}
+
+
+/*
+** Regular search for short-string 'key' in table 'h', remembering in
+** '*s' the node (or slot) where it was found (if it was found).
+*/
+static const TValue *iclookup (Table *h, TString *key, unsigned int *s) {
+  const TValue *slot = solH_Hgetshortstr(h, key);
+  if (!isabstkey(slot))
+    *s = isshaped(h) ? cast_uint(slot - h->slots)
+                     : cast_uint(nodefromval(slot) - gnode(h, 0));
+  return slot;
+}
+
+
+/*
+** Equivalent to 'solH_Hgetshortstr', using the inline cache 'ic'.
+*/
+l_sinline const TValue *icgetshortstr (Table *h, TString *key, ICache *ic) {
+  const TValue *slot = icprobe(h, key, ic->slot);
+  if (slot != NULL) {
+    ic->hits++;
+    return slot;
+  }
+  ic->misses++;
+  return iclookup(h, key, &ic->slot);
+}
+
+
+/*
+** Method lookup for OP_SELF. Tries the object itself and then, when
+** the key is absent there, the '__index' table of its metatable (the
+** usual layout for classes). Returns NULL if the value was not found
+** through these two tables.
+*/
+static const TValue *icgetmethod (sol_State *L, Table *h, TString *key,
+                                  ICache *ic) {
+  const TValue *slot = icprobe(h, key, ic->slot);
+  int hit = (slot != NULL);
+  if (!hit)
+    slot = iclookup(h, key, &ic->slot);
+  if (isempty(slot)) {  /* not in the object? try its class */
+    const TValue *tm = fasttm(L, h->metatable, TM_INDEX);
+    if (tm != NULL && ttistable(tm)) {
+      Table *ih = hvalue(tm);
+      slot = icprobe(ih, key, ic->islot);
+      hit = (slot != NULL);
+      if (!hit)
+        slot = iclookup(ih, key, &ic->islot);
+    }
+  }
+  if (hit) ic->hits++;
+  else ic->misses++;
+  return isempty(slot) ? NULL : slot;
+}
+
+
+/*
+** Variant of 'solV_fastget' for constant short-string keys, going
+** through the inline cache 'ic'.
+*/
+#define icfastget(L,t,k,res,tag,ic) \
+  if (!ttistable(t)) tag = SOL_VNOTABLE; \
+  else { const TValue *slot_ = icgetshortstr(hvalue(t), k, ic); \
+         tag = ttypetag(slot_); \
+         if (!tagisempty(tag)) setobj(L, res, slot_); }
+
+/* }================================================================== */
+
+
+
+/*
+** {==================================================================
+** Quickening
+** ===================================================================
+*/
+
+/*
+** By default, rewrite hot arithmetic and comparison instructions into
+** variants specialized for the types of their operands.
+*/
+#if !defined(SOL_USE_QUICKEN)
+#define SOL_USE_QUICKEN		1
+#endif
+
+/* number of executions between checks for quickening an instruction */
+#if !defined(SOL_QUICKENHOT)
+#define SOL_QUICKENHOT		16
+#endif
+
+/* number of deoptimizations after which an instruction stays generic */
+#if !defined(SOL_MAXDEOPT)
+#define SOL_MAXDEOPT		4
+#endif
+
+
+/* true if both values have tag 't' (tested with a single branch) */
+#define bothtt(v1,v2,t)	(((rawtt(v1) ^ (t)) | (rawtt(v2) ^ (t))) == 0)
+
+
+/*
+** Rewrite instruction '*pi' into 'iop' if its operands 'v1' and 'v2'
+** are both integers or into 'fop' if they are both floats. For these
+** instructions, the inline cache counts executions with such operands
+** ('hits') and deoptimizations ('misses').
+*/
+static void quicken (ICache *ic, Instruction *pi, const TValue *v1,
+                     const TValue *v2, OpCode iop, OpCode fop) {
+  ic->hits = 0;
+  if (ic->misses >= SOL_MAXDEOPT)  /* types keep changing? */
+    return;  /* leave it generic */
+  if (bothtt(v1, v2, SOL_VNUMINT))
+    SET_OPCODE(*pi, iop);
+  else if (bothtt(v1, v2, SOL_VNUMFLT))
+    SET_OPCODE(*pi, fop);
+}
+
+
+/*
+** Count an execution of a generic instruction whose operands could be
+** quickened (both integers or both floats). Other executions do not
+** look for the cache at all.
+*/
+#if SOL_USE_QUICKEN
+#define checkquicken(v1,v2,iop,fop)  \
+  if (rawtt(v1) == rawtt(v2) && ttisnumber(v1)) {  \
+    ICache *ic_ = ICACHE();  \
+    if (l_unlikely(++ic_->hits >= SOL_QUICKENHOT))  \
+      quicken(ic_, cast(Instruction *, pc - 1), v1, v2, iop, fop); }
+#else
+#define checkquicken(v1,v2,iop,fop)	((void)0)
+#endif
+
+
+/* rewrite the current (quickened) instruction back to its generic form */
+#define deoptimize()  \
+  { ICache *ic_ = ICACHE();  \
+    Instruction *pi_ = cast(Instruction *, pc - 1);  \
+    ic_->misses++;  \
+    SET_OPCODE(*pi_, solP_generic(GET_OPCODE(*pi_))); }
+
+/* }================================================================== */
+
+
+
 /*
 ** {==================================================================
 ** Macros for arithmetic/bitwise/comparison opcodes in 'solV_execute'
@@ -1029,6 +1262,41 @@ void solV_finishOp (sol_State *L) {
   docondjump(); }
 
 
+/*
+** Quickened arithmetic operations: a single guard for the types of
+** both operands ('tt'). When it fails, the instruction deoptimizes
+** itself and does the generic operation ('iop'/'fop').
+*/
+#define op_arithQ(L,tt,getv,setv,op,iop,fop) {  \
+  TValue *v1 = vRB(i);  \
+  TValue *v2 = vRC(i);  \
+  if (l_likely(bothtt(v1, v2, tt))) {  \
+    StkId ra = RA(i);  \
+    pc++; setv(s2v(ra), op(L, getv(v1), getv(v2)));  \
+  }  \
+  else {  \
+    deoptimize();  \
+    op_arith_aux(L, v1, v2, iop, fop);  \
+  }}
+
+
+/*
+** Quickened order operations, following the same scheme; 'other' is
+** the generic comparison.
+*/
+#define op_orderQ(L,tt,getv,op,other) {  \
+  StkId ra = RA(i); \
+  int cond;  \
+  TValue *rb = vRB(i);  \
+  if (l_likely(bothtt(s2v(ra), rb, tt)))  \
+    cond = op(getv(s2v(ra)), getv(rb));  \
+  else {  \
+    deoptimize();  \
+    Protect(cond = other(L, s2v(ra), rb));  \
+  }  \
+  docondjump(); }
+
+
 /*
 ** Order operations with immediate operand. (Immediate operand is
 ** always small enough to have an exact representation as a float.)
@@ -1071,6 +1339,7 @@ void solV_finishOp (sol_State *L) {
 #define RC(i)	(base+GETARG_C(i))
 #define vRC(i)	s2v(RC(i))
 #define KC(i)	(k+GETARG_C(i))
+#define ICACHE()	icacheat(cl->p, pcRel(pc, cl->p))
 #define RKC(i)	((TESTARG_k(i)) ? k + GETARG_C(i) : s2v(base + GETARG_C(i)))
 
 
@@ -1162,6 +1431,18 @@ void solV_execute (sol_State *L, CallInfo *ci) {
 #endif
  startfunc:
   trap = L->hookmask;
+#if SOL_USE_JIT
+  if (!trap && solJ_isenabled(G(L))) {  /* try native code */
+    if (solJ_enter(L, ci) == SOLJ_RETURN) {
+      trap = L->hookmask;  /* native code can change hooks */
+      if (ci->callstatus & CIST_FRESH)
+        return;  /* end this frame */
+      ci = ci->previous;
+      goto returning;  /* continue running caller in this frame */
+    }
+    trap = L->hookmask;  /* else interpret it (from its 'savedpc') */
+  }
+#endif
  returning:  /* trap already set */
   cl = ci_func(ci);
   k = cl->p->k;
@@ -1251,114 +1532,108 @@ void solV_execute (sol_State *L, CallInfo *ci) {
       }
       vmcase(OP_GETTABUP) {
         StkId ra = RA(i);
-        const TValue *slot;
+        lu_byte tag;
         TValue *upval = cl->upvals[GETARG_B(i)]->v.p;
         TValue *rc = KC(i);
         TString *key = tsvalue(rc);  /* key must be a short string */
-        if (solV_fastget(L, upval, key, slot, solH_getshortstr)) {
-          setobj2s(L, ra, slot);
-        }
-        else
-          Protect(solV_finishget(L, upval, rc, ra, slot));
+        icfastget(L, upval, key, s2v(ra), tag, ICACHE());
+        if (tagisempty(tag))
+          Protect(solV_finishget(L, upval, rc, ra, tag));
         vmbreak;
       }
       vmcase(OP_GETTABLE) {
         StkId ra = RA(i);
-        const TValue *slot;
+        lu_byte tag;
         TValue *rb = vRB(i);
         TValue *rc = vRC(i);
-        sol_Unsigned n;
-        if (ttisinteger(rc)  /* fast track for integers? */
-            ? (cast_void(n = ivalue(rc)), solV_fastgeti(L, rb, n, slot))
-            : solV_fastget(L, rb, rc, slot, solH_get)) {
-          setobj2s(L, ra, slot);
+        if (ttisinteger(rc)) {  /* fast track for integers? */
+          solV_fastgeti(L, rb, ivalue(rc), s2v(ra), tag);
         }
         else
-          Protect(solV_finishget(L, rb, rc, ra, slot));
+          solV_fastget(L, rb, rc, s2v(ra), solH_get, tag);
+        if (tagisempty(tag))
+          Protect(solV_finishget(L, rb, rc, ra, tag));
         vmbreak;
       }
       vmcase(OP_GETI) {
         StkId ra = RA(i);
-        const TValue *slot;
+        lu_byte tag;
         TValue *rb = vRB(i);
         int c = GETARG_C(i);
-        if (solV_fastgeti(L, rb, c, slot)) {
-          setobj2s(L, ra, slot);
-        }
-        else {
+        solV_fastgeti(L, rb, c, s2v(ra), tag);
+        if (tagisempty(tag)) {
           TValue key;
           setivalue(&key, c);
-          Protect(solV_finishget(L, rb, &key, ra, slot));
+          Protect(solV_finishget(L, rb, &key, ra, tag));
         }
         vmbreak;
       }
       vmcase(OP_GETFIELD) {
         StkId ra = RA(i);
-        const TValue *slot;
+        lu_byte tag;
         TValue *rb = vRB(i);
         TValue *rc = KC(i);
         TString *key = tsvalue(rc);  /* key must be a short string */
-        if (solV_fastget(L, rb, key, slot, solH_getshortstr)) {
-          setobj2s(L, ra, slot);
-        }
-        else
-          Protect(solV_finishget(L, rb, rc, ra, slot));
+        icfastget(L, rb, key, s2v(ra), tag, ICACHE());
+        if (tagisempty(tag))
+          Protect(solV_finishget(L, rb, rc, ra, tag));
         vmbreak;
       }
       vmcase(OP_SETTABUP) {
-        const TValue *slot;
+        int hres;
         TValue *upval = cl->upvals[GETARG_A(i)]->v.p;
         TValue *rb = KB(i);
         TValue *rc = RKC(i);
         TString *key = tsvalue(rb);  /* key must be a short string */
-        if (solV_fastget(L, upval, key, slot, solH_getshortstr)) {
-          solV_finishfastset(L, upval, slot, rc);
-        }
+        solV_fastset(L, upval, key, rc, hres, solH_psetshortstr);
+        if (hres == HOK)
+          solV_finishfastset(L, upval, rc);
         else
-          Protect(solV_finishset(L, upval, rb, rc, slot));
+          Protect(solV_finishset(L, upval, rb, rc, hres));
         vmbreak;
       }
       vmcase(OP_SETTABLE) {
         StkId ra = RA(i);
-        const TValue *slot;
+        int hres;
         TValue *rb = vRB(i);  /* key (table is in 'ra') */
         TValue *rc = RKC(i);  /* value */
-        sol_Unsigned n;
-        if (ttisinteger(rb)  /* fast track for integers? */
-            ? (cast_void(n = ivalue(rb)), solV_fastgeti(L, s2v(ra), n, slot))
-            : solV_fastget(L, s2v(ra), rb, slot, solH_get)) {
-          solV_finishfastset(L, s2v(ra), slot, rc);
+        if (ttisinteger(rb)) {  /* fast track for integers? */
+          solV_fastseti(L, s2v(ra), ivalue(rb), rc, hres);
         }
         else
-          Protect(solV_finishset(L, s2v(ra), rb, rc, slot));
+          solV_fastset(L, s2v(ra), rb, rc, hres, solH_pset);
+        if (hres == HOK)
+          solV_finishfastset(L, s2v(ra), rc);
+        else
+          Protect(solV_finishset(L, s2v(ra), rb, rc, hres));
         vmbreak;
       }
       vmcase(OP_SETI) {
         StkId ra = RA(i);
-        const TValue *slot;
+        int hres;
         int c = GETARG_B(i);
         TValue *rc = RKC(i);
-        if (solV_fastgeti(L, s2v(ra), c, slot)) {
-          solV_finishfastset(L, s2v(ra), slot, rc);
-        }
+        solV_fastseti(L, s2v(ra), c, rc, hres);
+        if (hres == HOK)
+          solV_finishfastset(L, s2v(ra), rc);
         else {
           TValue key;
           setivalue(&key, c);
-          Protect(solV_finishset(L, s2v(ra), &key, rc, slot));
+          Protect(solV_finishset(L, s2v(ra), &key, rc, hres));
         }
         vmbreak;
       }
       vmcase(OP_SETFIELD) {
         StkId ra = RA(i);
-        const TValue *slot;
+        int hres;
         TValue *rb = KB(i);
         TValue *rc = RKC(i);
         TString *key = tsvalue(rb);  /* key must be a short string */
-        if (solV_fastget(L, s2v(ra), key, slot, solH_getshortstr)) {
-          solV_finishfastset(L, s2v(ra), slot, rc);
-        }
+        solV_fastset(L, s2v(ra), key, rc, hres, solH_psetshortstr);
+        if (hres == HOK)
+          solV_finishfastset(L, s2v(ra), rc);
         else
-          Protect(solV_finishset(L, s2v(ra), rb, rc, slot));
+          Protect(solV_finishset(L, s2v(ra), rb, rc, hres));
         vmbreak;
       }
       vmcase(OP_NEWTABLE) {
@@ -1376,22 +1651,30 @@ void solV_execute (sol_State *L, CallInfo *ci) {
         t = solH_new(L);  /* memory allocation */
         sethvalue2s(L, ra, t);
         if (b != 0 || c != 0)
-          solH_resize(L, t, c, b);  /* idem */
+          solH_presize(L, t, c, b);  /* idem */
         checkGC(L, ra + 1);
         vmbreak;
       }
       vmcase(OP_SELF) {
         StkId ra = RA(i);
-        const TValue *slot;
+        lu_byte tag;
         TValue *rb = vRB(i);
         TValue *rc = RKC(i);
         TString *key = tsvalue(rc);  /* key must be a string */
         setobj2s(L, ra + 1, rb);
-        if (solV_fastget(L, rb, key, slot, solH_getstr)) {
-          setobj2s(L, ra, slot);
+        if (ttistable(rb) && key->tt == SOL_VSHRSTR) {  /* cacheable? */
+          const TValue *res = icgetmethod(L, hvalue(rb), key, ICACHE());
+          if (res != NULL) {
+            setobj2s(L, ra, res);
+          }
+          else
+            Protect(solV_finishget(L, rb, rc, ra, SOL_VABSTKEY));
+        }
+        else {
+          solV_fastget(L, rb, key, s2v(ra), solH_getstr, tag);
+          if (tagisempty(tag))
+            Protect(solV_finishget(L, rb, rc, ra, tag));
         }
-        else
-          Protect(solV_finishget(L, rb, rc, ra, slot));
         vmbreak;
       }
       vmcase(OP_ADDI) {
@@ -1461,14 +1744,17 @@ void solV_execute (sol_State *L, CallInfo *ci) {
         vmbreak;
       }
       vmcase(OP_ADD) {
+        checkquicken(vRB(i), vRC(i), OP_ADDII, OP_ADDFF);
         op_arith(L, l_addi, soli_numadd);
         vmbreak;
       }
       vmcase(OP_SUB) {
+        checkquicken(vRB(i), vRC(i), OP_SUBII, OP_SUBFF);
         op_arith(L, l_subi, soli_numsub);
         vmbreak;
       }
       vmcase(OP_MUL) {
+        checkquicken(vRB(i), vRC(i), OP_MULII, OP_MULFF);
         op_arith(L, l_muli, soli_nummul);
         vmbreak;
       }
@@ -1612,10 +1898,12 @@ void solV_execute (sol_State *L, CallInfo *ci) {
         vmbreak;
       }
       vmcase(OP_LT) {
+        checkquicken(s2v(RA(i)), vRB(i), OP_LTII, OP_LTFF);
         op_order(L, l_lti, LTnum, lessthanothers);
         vmbreak;
       }
       vmcase(OP_LE) {
+        checkquicken(s2v(RA(i)), vRB(i), OP_LEII, OP_LEFF);
         op_order(L, l_lei, LEnum, lessequalothers);
         vmbreak;
       }
@@ -1798,7 +2086,7 @@ void solV_execute (sol_State *L, CallInfo *ci) {
             pc -= GETARG_Bx(i);  /* jump back */
           }
         }
-        else if (floatforloop(ra))  /* float loop */
+        else if (solV_floatforloop(ra))  /* float loop */
           pc -= GETARG_Bx(i);  /* jump back */
         updatetrap(ci);  /* allows a signal to break the loop */
         vmbreak;
@@ -1806,7 +2094,7 @@ void solV_execute (sol_State *L, CallInfo *ci) {
       vmcase(OP_FORPREP) {
         StkId ra = RA(i);
         savestate(L, ci);  /* in case of errors */
-        if (forprep(L, ra))
+        if (solV_forprep(L, ra))
           pc += GETARG_Bx(i) + 1;  /* skip the loop */
         vmbreak;
       }
@@ -1861,18 +2149,15 @@ void solV_execute (sol_State *L, CallInfo *ci) {
         }
         if (last > solH_realasize(h))  /* needs more space? */
           solH_resizearray(L, h, last);  /* preallocate it at once */
-        for (; n > 0; n--) {
-          TValue *val = s2v(ra + n);
-          setobj2t(L, &h->array[last - 1], val);
-          last--;
-          solC_barrierback(L, obj2gco(h), val);
-        }
+        solH_setlist(L, h, last - n, ra, n);
+        for (; n > 0; n--)
+          solC_barrierback(L, obj2gco(h), s2v(ra + n));
         vmbreak;
       }
       vmcase(OP_CLOSURE) {
         StkId ra = RA(i);
         Proto *p = cl->p->p[GETARG_Bx(i)];
-        halfProtect(pushclosure(L, p, cl->upvals, base, ra));
+        halfProtect(solV_pushclosure(L, p, cl->upvals, base, ra));
         checkGC(L, ra + 1);
         vmbreak;
       }
@@ -1895,6 +2180,52 @@ void solV_execute (sol_State *L, CallInfo *ci) {
         sol_assert(0);
         vmbreak;
       }
+      vmcase(OP_ADDII) {
+        op_arithQ(L, SOL_VNUMINT, ivalue, setivalue, l_addi,
+                     l_addi, soli_numadd);
+        vmbreak;
+      }
+      vmcase(OP_ADDFF) {
+        op_arithQ(L, SOL_VNUMFLT, fltvalue, setfltvalue, soli_numadd,
+                     l_addi, soli_numadd);
+        vmbreak;
+      }
+      vmcase(OP_SUBII) {
+        op_arithQ(L, SOL_VNUMINT, ivalue, setivalue, l_subi,
+                     l_subi, soli_numsub);
+        vmbreak;
+      }
+      vmcase(OP_SUBFF) {
+        op_arithQ(L, SOL_VNUMFLT, fltvalue, setfltvalue, soli_numsub,
+                     l_subi, soli_numsub);
+        vmbreak;
+      }
+      vmcase(OP_MULII) {
+        op_arithQ(L, SOL_VNUMINT, ivalue, setivalue, l_muli,
+                     l_muli, soli_nummul);
+        vmbreak;
+      }
+      vmcase(OP_MULFF) {
+        op_arithQ(L, SOL_VNUMFLT, fltvalue, setfltvalue, soli_nummul,
+                     l_muli, soli_nummul);
+        vmbreak;
+      }
+      vmcase(OP_LTII) {
+        op_orderQ(L, SOL_VNUMINT, ivalue, l_lti, solV_lessthan);
+        vmbreak;
+      }
+      vmcase(OP_LTFF) {
+        op_orderQ(L, SOL_VNUMFLT, fltvalue, soli_numlt, solV_lessthan);
+        vmbreak;
+      }
+      vmcase(OP_LEII) {
+        op_orderQ(L, SOL_VNUMINT, ivalue, l_lei, solV_lessequal);
+        vmbreak;
+      }
+      vmcase(OP_LEFF) {
+        op_orderQ(L, SOL_VNUMFLT, fltvalue, soli_numle, solV_lessequal);
+        vmbreak;
+      }
     }
   }
 }
@@ -10,6 +10,7 @@
 
 #include "ldo.h"
 #include "lobject.h"
+#include "ltable.h"
 #include "ltm.h"
 
 
@@ -48,8 +49,8 @@ typedef enum {
 
 
 /* convert an object to a float (including string coercion) */
-#define tonumber(o,n) \
-	(ttisfloat(o) ? (*(n) = fltvalue(o), 1) : solV_tonumber_(o,n))
+#define tonumber(L,o,n) \
+	(ttisfloat(o) ? (*(n) = fltvalue(o), 1) : solV_tonumber_(L,o,n))
 
 
 /* convert an object to a float (without string coercion) */
@@ -59,9 +60,9 @@ typedef enum {
 
 
 /* convert an object to an integer (including string coercion) */
-#define tointeger(o,i) \
+#define tointeger(L,o,i) \
   (l_likely(ttisinteger(o)) ? (*(i) = ivalue(o), 1) \
-                          : solV_tointeger(o,i,SOL_FLOORN2I))
+                          : solV_tointeger(L,o,i,SOL_FLOORN2I))
 
 
 /* convert an object to an integer (without string coercion) */
@@ -77,37 +78,46 @@ typedef enum {
 
 /*
 ** fast track for 'gettable': if 't' is a table and 't[k]' is present,
-** return 1 with 'slot' pointing to 't[k]' (position of final result).
-** Otherwise, return 0 (meaning it will have to check metamethod)
-** with 'slot' pointing to an empty 't[k]' (if 't' is a table) or NULL
-** (otherwise). 'f' is the raw get function to use.
+** copy it into 'res' and set 'tag' to its tag. Otherwise, 'tag' is an
+** empty tag (meaning it will have to check metamethod), which is
+** SOL_VNOTABLE if 't' is not a table. 'f' is the raw get function to
+** use.
 */
-#define solV_fastget(L,t,k,slot,f) \
-  (!ttistable(t)  \
-   ? (slot = NULL, 0)  /* not a table; 'slot' is NULL and result is 0 */  \
-   : (slot = f(hvalue(t), k),  /* else, do raw access */  \
-      !isempty(slot)))  /* result not empty? */
+#define solV_fastget(L,t,k,res,f,tag) \
+  (tag = (!ttistable(t) ? SOL_VNOTABLE : f(hvalue(t), k, res)))
 
 
 /*
 ** Special case of 'solV_fastget' for integers, inlining the fast case
 ** of 'solH_getint'.
 */
-#define solV_fastgeti(L,t,k,slot) \
-  (!ttistable(t)  \
-   ? (slot = NULL, 0)  /* not a table; 'slot' is NULL and result is 0 */  \
-   : (slot = (l_castS2U(k) - 1u < hvalue(t)->alimit) \
-              ? &hvalue(t)->array[k - 1] : solH_getint(hvalue(t), k), \
-      !isempty(slot)))  /* result not empty? */
+#define solV_fastgeti(L,t,k,res,tag) \
+  if (!ttistable(t)) tag = SOL_VNOTABLE; \
+  else { solH_fastgeti(L, hvalue(t), k, res, tag); }
 
 
 /*
-** Finish a fast set operation (when fast get succeeds). In that case,
-** 'slot' points to the place to put the value.
+** fast track for 'settable': if 't' is a table and 't[k]' is present,
+** set it to 'val' and set 'hres' to HOK. Otherwise, 'hres' tells
+** 'solV_finishset' how to finish the assignment (see ltable.h). 'f' is
+** the raw pre-set function to use.
 */
-#define solV_finishfastset(L,t,slot,v) \
-    { setobj2t(L, cast(TValue *,slot), v); \
-      solC_barrierback(L, gcvalue(t), v); }
+#define solV_fastset(L,t,k,val,hres,f) \
+  (hres = (!ttistable(t) ? HNOTATABLE : f(hvalue(t), k, val)))
+
+
+/*
+** Special case of 'solV_fastset' for integers.
+*/
+#define solV_fastseti(L,t,k,val,hres) \
+  if (!ttistable(t)) hres = HNOTATABLE; \
+  else { solH_fastseti(L, hvalue(t), k, val, hres); }
+
+
+/*
+** Finish a fast set operation (when fast set succeeds).
+*/
+#define solV_finishfastset(L,t,v)	solC_barrierback(L, gcvalue(t), v)
 
 
 /*
@@ -120,15 +130,16 @@ typedef enum {
 SOLI_FUNC int solV_equalobj (sol_State *L, const TValue *t1, const TValue *t2);
 SOLI_FUNC int solV_lessthan (sol_State *L, const TValue *l, const TValue *r);
 SOLI_FUNC int solV_lessequal (sol_State *L, const TValue *l, const TValue *r);
-SOLI_FUNC int solV_tonumber_ (const TValue *obj, sol_Number *n);
-SOLI_FUNC int solV_tointeger (const TValue *obj, sol_Integer *p, F2Imod mode);
+SOLI_FUNC int solV_tonumber_ (sol_State *L, const TValue *obj, sol_Number *n);
+SOLI_FUNC int solV_tointeger (sol_State *L, const TValue *obj, sol_Integer *p,
+                              F2Imod mode);
 SOLI_FUNC int solV_tointegerns (const TValue *obj, sol_Integer *p,
                                 F2Imod mode);
 SOLI_FUNC int solV_flttointeger (sol_Number n, sol_Integer *p, F2Imod mode);
 SOLI_FUNC void solV_finishget (sol_State *L, const TValue *t, TValue *key,
-                               StkId val, const TValue *slot);
+                               StkId val, lu_byte tag);
 SOLI_FUNC void solV_finishset (sol_State *L, const TValue *t, TValue *key,
-                               TValue *val, const TValue *slot);
+                               TValue *val, int hres);
 SOLI_FUNC void solV_finishOp (sol_State *L);
 SOLI_FUNC void solV_execute (sol_State *L, CallInfo *ci);
 SOLI_FUNC void solV_concat (sol_State *L, int total);
@@ -137,5 +148,9 @@ SOLI_FUNC sol_Integer solV_mod (sol_State *L, sol_Integer x, sol_Integer y);
 SOLI_FUNC sol_Number solV_modf (sol_State *L, sol_Number x, sol_Number y);
 SOLI_FUNC sol_Integer solV_shiftl (sol_Integer x, sol_Integer y);
 SOLI_FUNC void solV_objlen (sol_State *L, StkId ra, const TValue *rb);
+SOLI_FUNC int solV_forprep (sol_State *L, StkId ra);
+SOLI_FUNC int solV_floatforloop (StkId ra);
+SOLI_FUNC void solV_pushclosure (sol_State *L, Proto *p, UpVal **encup,
+                                 StkId base, StkId ra);
 
 #endif
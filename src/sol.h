@@ -137,6 +137,12 @@ typedef void (*sol_WarnFunction) (void *ud, const char *msg, int tocont);
 typedef struct sol_Debug sol_Debug;
 
 
+/*
+** Type used by the debug API to report inline-cache statistics
+*/
+typedef struct sol_CacheStat sol_CacheStat;
+
+
 /*
 ** Functions to be called by the debugger in specific events
 */
@@ -202,9 +208,12 @@ SOL_API sol_Number      (sol_tonumberx) (sol_State *L, int idx, int *isnum);
 SOL_API sol_Integer     (sol_tointegerx) (sol_State *L, int idx, int *isnum);
 SOL_API int             (sol_toboolean) (sol_State *L, int idx);
 SOL_API const char     *(sol_tolstring) (sol_State *L, int idx, size_t *len);
+SOL_API const char     *(sol_tostringview) (sol_State *L, int idx, size_t *len);
 SOL_API sol_Unsigned    (sol_rawlen) (sol_State *L, int idx);
 SOL_API sol_CFunction   (sol_tocfunction) (sol_State *L, int idx);
 SOL_API void	       *(sol_touserdata) (sol_State *L, int idx);
+SOL_API void	       *(sol_tonumarray) (sol_State *L, int idx,
+                                       sol_Unsigned *n, int *isint);
 SOL_API sol_State      *(sol_tothread) (sol_State *L, int idx);
 SOL_API const void     *(sol_topointer) (sol_State *L, int idx);
 
@@ -245,6 +254,10 @@ SOL_API void        (sol_pushnil) (sol_State *L);
 SOL_API void        (sol_pushnumber) (sol_State *L, sol_Number n);
 SOL_API void        (sol_pushinteger) (sol_State *L, sol_Integer n);
 SOL_API const char *(sol_pushlstring) (sol_State *L, const char *s, size_t len);
+SOL_API void        (sol_pushsubstring) (sol_State *L, int idx, size_t i,
+                                                   size_t len);
+SOL_API const char *(sol_pushexternalstring) (sol_State *L, const char *s,
+                                  size_t len, sol_Alloc falloc, void *ud);
 SOL_API const char *(sol_pushstring) (sol_State *L, const char *s);
 SOL_API const char *(sol_pushvfstring) (sol_State *L, const char *fmt,
                                                       va_list argp);
@@ -282,6 +295,7 @@ SOL_API void  (sol_seti) (sol_State *L, int idx, sol_Integer n);
 SOL_API void  (sol_rawset) (sol_State *L, int idx);
 SOL_API void  (sol_rawseti) (sol_State *L, int idx, sol_Integer n);
 SOL_API void  (sol_rawsetp) (sol_State *L, int idx, const void *p);
+SOL_API void  (sol_cleartable) (sol_State *L, int idx);
 SOL_API int   (sol_setmetatable) (sol_State *L, int objindex);
 SOL_API int   (sol_setiuservalue) (sol_State *L, int idx, int n);
 
@@ -338,10 +352,48 @@ SOL_API void (sol_warning)  (sol_State *L, const char *msg, int tocont);
 #define SOL_GCISRUNNING		9
 #define SOL_GCGEN		10
 #define SOL_GCINC		11
+#define SOL_GCPARALLEL		12
+#define SOL_GCSWEEPER		13
+#define SOL_GCFREEZE		14
+#define SOL_GCSTEPTIME		15
+#define SOL_GCIDLE		16
+#define SOL_GCSTEPSTATS		17
+
+/* number of entries in the histogram of step durations */
+#define SOL_GCSTEPHIST		20
+
+/*
+** Durations of the collector steps, in microseconds (see option
+** SOL_GCSTEPSTATS). Entry 'hist[i]' counts the steps that took less
+** than 2^i microseconds and at least 2^(i-1); the last entry counts
+** all longer steps.
+*/
+typedef struct sol_GCStepStats {
+  sol_Integer steps;  /* number of steps */
+  sol_Integer over;  /* number of steps longer than their time target */
+  sol_Integer total;  /* total time spent in steps */
+  sol_Integer max;  /* longest step */
+  sol_Integer last;  /* last step */
+  sol_Integer hist[SOL_GCSTEPHIST];
+} sol_GCStepStats;
 
 SOL_API int (sol_gc) (sol_State *L, int what, ...);
 
 
+/*
+** baseline compiler function and options
+*/
+
+#define SOL_JITOFF		0
+#define SOL_JITON		1
+#define SOL_JITFLUSH		2
+#define SOL_JITISON		3
+#define SOL_JITSETHOT		4
+#define SOL_JITCOUNT		5
+
+SOL_API int (sol_jit) (sol_State *L, int what, ...);
+
+
 /*
 ** miscellaneous functions
 */
@@ -354,9 +406,12 @@ SOL_API void  (sol_concat) (sol_State *L, int n);
 SOL_API void  (sol_len)    (sol_State *L, int idx);
 
 SOL_API size_t   (sol_stringtonumber) (sol_State *L, const char *s);
+SOL_API int      (sol_formatnumber) (sol_State *L, char *buff, size_t sz,
+                                     sol_Number n, int conv, int prec);
 
 SOL_API sol_Alloc (sol_getallocf) (sol_State *L, void **ud);
 SOL_API void      (sol_setallocf) (sol_State *L, sol_Alloc f, void *ud);
+SOL_API void      (sol_setallocsafe) (sol_State *L, int safe);
 
 SOL_API void (sol_toclose) (sol_State *L, int idx);
 SOL_API void (sol_closeslot) (sol_State *L, int idx);
@@ -472,6 +527,19 @@ SOL_API int (sol_gethookcount) (sol_State *L);
 
 SOL_API int (sol_setcstacklimit) (sol_State *L, unsigned int limit);
 
+SOL_API int (sol_getcachestat) (sol_State *L, int fidx, int n,
+                                sol_CacheStat *cs);
+
+/*
+** Statistics for the inline cache of an instruction
+*/
+struct sol_CacheStat {
+  int pc;		/* instruction index (1-based) */
+  int currentline;	/* line of that instruction */
+  unsigned int hits;
+  unsigned int misses;
+};
+
 struct sol_Debug {
   int event;
   const char *name;	/* (n) */
@@ -491,6 +559,7 @@ struct sol_Debug {
   char short_src[SOL_IDSIZE]; /* (S) */
   /* private part */
   struct CallInfo *i_ci;  /* active function */
+  int i_inl;  /* inlined call running in 'i_ci' (index + 1), or 0 */
 };
 
 /* }====================================================================== */
@@ -17,6 +17,7 @@
 
 #include "sol.h"
 #include "lauxlib.h"
+#include "sollib.h"
 
 #include "ldebug.h"
 #include "lobject.h"
@@ -34,6 +35,7 @@ static void PrintFunction(const Proto* f, int full);
 static int listing=0;			/* list bytecodes? */
 static int dumping=1;			/* dump bytecodes? */
 static int stripping=0;			/* strip debug information? */
+static int running=0;			/* run chunks before listing? */
 static char Output[]={ OUTPUT };	/* default output file name */
 static const char* output=Output;	/* actual output file name */
 static const char* progname=PROGNAME;	/* actual program name */
@@ -63,6 +65,7 @@ static void usage(const char* message)
   "  -l       list (use -l -l for full listing)\n"
   "  -o name  output to file 'name' (default is \"%s\")\n"
   "  -p       parse only\n"
+  "  -q       run chunks, then list them as quickened (implies -l -p)\n"
   "  -s       strip debug information\n"
   "  -v       show version information\n"
   "  --       stop handling options\n"
@@ -101,6 +104,11 @@ static int doargs(int argc, char* argv[])
   }
   else if (IS("-p"))			/* parse only */
    dumping=0;
+  else if (IS("-q"))			/* run chunks and list them */
+  {
+   running=1;
+   dumping=0;
+  }
   else if (IS("-s"))			/* strip debug information */
    stripping=1;
   else if (IS("-v"))			/* show version */
@@ -108,6 +116,7 @@ static int doargs(int argc, char* argv[])
   else					/* unknown option */
    usage(argv[i]);
  }
+ if (running && !listing) listing=1;
  if (i==argc && (listing || !dumping))
  {
   dumping=0;
@@ -177,6 +186,11 @@ static int pmain(sol_State* L)
  {
   const char* filename=IS("-") ? NULL : argv[i];
   if (solL_loadfile(L,filename)!=SOL_OK) fatal(sol_tostring(L,-1));
+  if (running)
+  {
+   sol_pushvalue(L,-1);
+   if (sol_pcall(L,0,0,0)!=SOL_OK) fatal(sol_tostring(L,-1));
+  }
  }
  f=combine(L,argc);
  if (listing) solU_print(f,listing>1);
@@ -201,6 +215,7 @@ int main(int argc, char* argv[])
  if (argc<=0) usage("no input files given");
  L=solL_newstate();
  if (L==NULL) fatal("cannot create state: not enough memory");
+ if (running) solL_openlibs(L);
  sol_pushcfunction(L,&pmain);
  sol_pushinteger(L,argc);
  sol_pushlightuserdata(L,argv);
@@ -650,6 +665,15 @@ static void PrintCode(const Proto* f)
    case OP_EXTRAARG:
 	printf("%d",ax);
 	break;
+   case OP_ADDII: case OP_ADDFF:
+   case OP_SUBII: case OP_SUBFF:
+   case OP_MULII: case OP_MULFF:
+	printf("%d %d %d",a,b,c);
+	break;
+   case OP_LTII: case OP_LTFF:
+   case OP_LEII: case OP_LEFF:
+	printf("%d %d %d",a,b,isk);
+	break;
 #if 0
    default:
 	printf("%d %d %d",a,b,c);
@@ -44,6 +44,9 @@ SOLMOD_API int (solopen_debug) (sol_State *L);
 #define SOL_LOADLIBNAME	"package"
 SOLMOD_API int (solopen_package) (sol_State *L);
 
+#define SOL_JITLIBNAME	"jit"
+SOLMOD_API int (solopen_jit) (sol_State *L);
+
 
 /* open all previous libraries */
 SOLLIB_API void (solL_openlibs) (sol_State *L);
@@ -0,0 +1,31 @@
+-- run the test files
+
+local files = {
+  "arrays.sol",
+  "code.sol",
+  "errors.sol",
+  "find.sol",
+  "formats.sol",
+  "gc.sol",
+  "hash.sol",
+  "intern.sol",
+  "jit.sol",
+  "numfmt.sol",
+  "patterns.sol",
+  "ropes.sol",
+  "shapes.sol",
+  "slices.sol",
+  "sort.sol",
+  "steptime.sol",
+  "str2num.sol",
+  "strbuf.sol",
+  "sweeper.sol",
+  "tables.sol",
+  "typed.sol",
+}
+
+for _, f in ipairs(files) do
+  print("testing " .. f)
+  dofile(f)
+end
+print("all OK")
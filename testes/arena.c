@@ -0,0 +1,131 @@
+/*
+** Tests for the arena allocator, alone and together with background
+** sweeping. The arena is not thread safe, so the sweeper must refuse
+** to run on a state that uses it.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "sol.h"
+#include "lauxlib.h"
+#include "sollib.h"
+
+
+static const char churn[] =
+  "local ok, msg = collectgarbage('sweeper', true)\n"
+  "assert(ok == nil and msg == 'background sweeping not available')\n"
+  "assert(collectgarbage('sweeper') == false)\n"
+  "collectgarbage('incremental')\n"
+  "local keep = {}\n"
+  "for i = 1, 200000 do\n"
+  "  local t = {i, tostring(i)}\n"
+  "  if i % 10 == 0 then keep[#keep + 1] = t end\n"
+  "end\n"
+  "collectgarbage()\n"
+  "assert(#keep == 20000 and keep[20000][2] == '200000')\n";
+
+
+#define check(c)	((c) ? (void)0 : fail(#c, __LINE__))
+
+static void fail (const char *what, int line) {
+  fprintf(stderr, "arena.c:%d: check failed: %s\n", line, what);
+  exit(EXIT_FAILURE);
+}
+
+
+static void run (sol_State *L, const char *code) {
+  if (solL_dostring(L, code) != SOL_OK)
+    fail(sol_tostring(L, -1), 0);
+}
+
+
+/* blocks of all classes, grown and shrunk; returns a checksum */
+static const char work[] =
+  "local t, s = {}, 0\n"
+  "for i = 1, 3000 do\n"
+  "  local v = {}\n"
+  "  for j = 1, i % 300 do v[j] = j end\n"  /* arrays of many sizes */
+  "  v.s = string.rep('x', i % 2000)\n"  /* small and large strings */
+  "  t[i % 500 + 1] = v\n"
+  "end\n"
+  "for i = 1, 500 do\n"
+  "  local v = t[i]\n"
+  "  for j = #v, 1, -1 do s = s + v[j]; v[j] = nil end\n"
+  "  v.x = 1\n"  /* rehash to a smaller block */
+  "  s = s + #v.s\n"
+  "end\n"
+  "return s\n";
+
+
+/* run 'work' and return its result */
+static sol_Integer dowork (sol_State *L) {
+  sol_Integer r;
+  if (solL_loadstring(L, work) != SOL_OK || sol_pcall(L, 0, 1, 0) != SOL_OK)
+    fail(sol_tostring(L, -1), 0);
+  r = sol_tointeger(L, -1);
+  sol_pop(L, 1);
+  return r;
+}
+
+
+/* bytes the collector counts as in use */
+static size_t gcbytes (sol_State *L) {
+  return (size_t)sol_gc(L, SOL_GCCOUNT) * 1024 + sol_gc(L, SOL_GCCOUNTB);
+}
+
+
+int main (void) {
+  sol_State *L;
+  sol_Alloc f;
+  void *ud;
+  int avail;
+  sol_Integer res;
+  solL_ArenaStats st;
+  /* same results with and without an arena */
+  L = solL_newstate();
+  solL_openlibs(L);
+  res = dowork(L);
+  check(!solL_arenastats(L, &st));
+  sol_close(L);
+  L = solL_newstatex(SOLL_ARENA);
+  solL_openlibs(L);
+  check(dowork(L) == res);
+  sol_gc(L, SOL_GCCOLLECT);
+  check(solL_arenastats(L, &st));
+  check(st.reqbytes + st.largebytes == gcbytes(L));
+  check(st.reqbytes <= st.blockbytes && st.slabs > 0);
+  run(L, "collectgarbage('stop'); t = {}\n"
+         "for i = 1, 20000 do t[i] = {i} end\n"
+         "t = nil; collectgarbage('restart'); collectgarbage()");
+  check(solL_arenastats(L, &st));
+  check(st.released > 0);  /* empty slabs went back */
+  check(st.reqbytes + st.largebytes == gcbytes(L));
+  sol_close(L);
+  /* arena: sweeper refuses to start, both from C and from Sol */
+  L = solL_newstatex(SOLL_ARENA);
+  check(L != NULL);
+  solL_openlibs(L);
+  check(sol_gc(L, SOL_GCSWEEPER, 1) == -1);
+  check(sol_gc(L, SOL_GCSWEEPER, -1) == 0);
+  run(L, churn);
+  sol_close(L);
+  /* default allocator is thread safe */
+  L = solL_newstatex(0);
+  check(L != NULL);
+  avail = (sol_gc(L, SOL_GCSWEEPER, 1) == 0);
+  if (avail) {  /* build has background sweeping? */
+    check(sol_gc(L, SOL_GCSWEEPER, -1) == 1);
+    /* a new allocation function stops the sweeper... */
+    f = sol_getallocf(L, &ud);
+    sol_setallocf(L, f, ud);
+    check(sol_gc(L, SOL_GCSWEEPER, -1) == 0);
+    check(sol_gc(L, SOL_GCSWEEPER, 1) == -1);
+    /* ...until it is declared thread safe */
+    sol_setallocsafe(L, 1);
+    check(sol_gc(L, SOL_GCSWEEPER, 1) == 0);
+  }
+  sol_close(L);
+  printf("arena: OK\n");
+  return 0;
+}
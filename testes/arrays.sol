@@ -0,0 +1,95 @@
+-- generic array parts, kept as a block of values and a block of tags
+
+-- values of all types in the array part
+do
+  local co = coroutine.create(print)
+  local vals = {1, 2.5, "s", true, false, {}, print, co, math.maxinteger,
+                string.rep("x", 100), -0.0, io.stdout}
+  local t = {}
+  for r = 0, 9 do
+    for i, v in ipairs(vals) do t[r * #vals + i] = v end
+  end
+  collectgarbage()
+  assert(#t == 10 * #vals)
+  for r = 0, 9 do
+    for i, v in ipairs(vals) do
+      local x = t[r * #vals + i]
+      assert(x == v and math.type(x) == math.type(v) and type(x) == type(v))
+    end
+  end
+end
+
+
+-- nils inside the array part
+do
+  local t = {1, nil, 3, nil, 5, nil, nil, 8}
+  assert(t[2] == nil and t[8] == 8)
+  local n = 0
+  for k, v in pairs(t) do n = n + 1; assert(v == k) end
+  assert(n == 4)
+  for i = 1, 8 do t[i] = i end
+  assert(#t == 8)
+  t[8] = nil
+  assert(#t == 7)
+  for i = 7, 1, -1 do t[i] = nil end
+  assert(next(t) == nil)
+end
+
+
+-- growing and shrinking moves elements between the array and the hash
+do
+  local t = {}
+  for i = 1, 1000 do t[i] = (i % 3 == 0) and tostring(i) or i end
+  for i = 1, 1000, 2 do t[i] = nil end   -- a sparse table
+  collectgarbage()
+  for i = 2, 1000, 2 do
+    assert(t[i] == ((i % 3 == 0) and tostring(i) or i))
+  end
+  for i = 1, 1000, 2 do t[i] = {i} end
+  for i = 1001, 2000 do t[i] = i end   -- rehashes
+  for i = 1, 1000, 2 do assert(t[i][1] == i) end
+  assert(#t == 2000)
+  local n = 0
+  for k, v in pairs(t) do n = n + 1 end
+  assert(n == 2000)
+  for i = 2000, 11, -1 do t[i] = nil end
+  t.x = 1   -- rehash to a smaller array part
+  for i = 1, 10, 2 do assert(t[i][1] == i) end
+  assert(#t == 10 and t.x == 1)
+end
+
+
+-- the collector reads the tags to find collectable values
+do
+  local t = setmetatable({}, {__mode = "v"})
+  local keep = {}
+  for i = 1, 100 do
+    t[i] = {}
+    if i % 2 == 0 then keep[i] = t[i] end
+  end
+  t[101] = 1
+  collectgarbage()
+  for i = 1, 100 do assert((t[i] ~= nil) == (i % 2 == 0)) end
+  assert(t[101] == 1)
+  local strs = {}
+  for i = 1, 100 do strs[i] = string.rep("s", i) .. i end
+  collectgarbage()
+  for i = 1, 100 do assert(strs[i] == string.rep("s", i) .. i) end
+end
+
+
+-- overlapping moves and inserts in a mixed array
+do
+  local t = {}
+  for i = 1, 20 do t[i] = (i % 2 == 0) and i or tostring(i) end
+  table.move(t, 1, 15, 6)
+  for i = 6, 20 do
+    local j = i - 5
+    assert(t[i] == ((j % 2 == 0) and j or tostring(j)))
+  end
+  table.insert(t, 1, false)
+  assert(t[1] == false and #t == 21 and t[21] == "15")
+  assert(table.remove(t, 1) == false and t[1] == "1")
+end
+
+print("OK")
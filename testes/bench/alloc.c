@@ -0,0 +1,44 @@
+/*
+** Runs the workloads of alloc.sol in a state created with the system
+** allocator or with the arena of 'solL_newstatex', and reports the
+** peak resident size of the process. From this directory:
+**
+**   cc -O2 -I../../src -o alloc alloc.c ../../src/libsol.a -lm
+**   ./alloc malloc; ./alloc arena
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include "sol.h"
+#include "lauxlib.h"
+#include "sollib.h"
+
+
+int main (int argc, char **argv) {
+  struct rusage ru;
+  sol_State *L;
+  int flags;
+  if (argc < 2 || (strcmp(argv[1], "malloc") != 0 &&
+                   strcmp(argv[1], "arena") != 0)) {
+    fprintf(stderr, "usage: %s malloc|arena [script]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  flags = (strcmp(argv[1], "arena") == 0) ? SOLL_ARENA : 0;
+  L = solL_newstatex(flags);
+  if (L == NULL) {
+    fprintf(stderr, "cannot create state\n");
+    return EXIT_FAILURE;
+  }
+  solL_openlibs(L);
+  if (solL_dofile(L, (argc > 2) ? argv[2] : "alloc.sol") != SOL_OK) {
+    fprintf(stderr, "%s\n", sol_tostring(L, -1));
+    return EXIT_FAILURE;
+  }
+  sol_close(L);
+  getrusage(RUSAGE_SELF, &ru);
+  printf("peak RSS %ld MB (%s)\n", ru.ru_maxrss / 1024, argv[1]);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,59 @@
+-- Allocation-heavy workloads, to compare allocators (see alloc.c).
+-- Prints the time of each workload.
+
+local function bench (name, f)
+  collectgarbage(); collectgarbage()
+  local t0 = os.clock()
+  f()
+  print(string.format("%-22s %.3fs", name, os.clock() - t0))
+end
+
+bench("binary trees d=16/18", function ()
+  local function make (d)
+    if d == 0 then return {} end
+    return {make(d - 1), make(d - 1)}
+  end
+  local function check (t)
+    if t[1] then return 1 + check(t[1]) + check(t[2]) end
+    return 1
+  end
+  local n = 0
+  for i = 1, 8 do n = n + check(make(16)) end
+  local long = make(18)
+  for i = 1, 4 do n = n + check(make(14)) end
+  return n + check(long)
+end)
+
+bench("3M small records", function ()
+  local keep = {}
+  for i = 1, 3000000 do
+    keep[i % 1000 + 1] = {id = i, name = "n", v = i * 0.5}
+  end
+end)
+
+bench("3M closures", function ()
+  local fs = {}
+  for i = 1, 3000000 do
+    local x = i
+    fs[i % 500 + 1] = function () return x end
+  end
+end)
+
+bench("2M string keys", function ()
+  local t = {}
+  for i = 1, 2000000 do t[i % 2000 + 1] = "key" .. i end
+end)
+
+bench("20k growing arrays", function ()
+  for j = 1, 20000 do
+    local t = {}
+    for i = 1, 100 do t[i] = i end
+  end
+end)
+
+bench("300k coroutines", function ()
+  for i = 1, 300000 do
+    local co = coroutine.wrap(function (a) coroutine.yield(a) end)
+    co(i)
+  end
+end)
@@ -0,0 +1,57 @@
+-- Throughput of literal search and class runs in patterns, in MB/s.
+--
+--   sol find.sol [MB]
+--
+-- The size of the subjects is given in megabytes (default 1); the
+-- numbers of the pattern work were taken with 1 and 100.
+
+local MB = math.tointeger(arg and arg[1]) or 1
+local reps = math.max(1, 100 // MB)
+local n = MB * 1024 * 1024
+
+local function bench (name, f)
+  local t0 = os.clock()
+  local r
+  for i = 1, reps do r = f() end
+  local dt = os.clock() - t0
+  print(string.format("%-26s %8.1f MB/s  (%s)", name, MB * reps / dt,
+                      tostring(r)))
+end
+
+-- repetitive subject: 'aaa...' searched for 'aaa...ab'
+local rep = string.rep("a", n)
+local needle = string.rep("a", 30) .. "b"
+bench("find plain, a^30b", function () return rep:find(needle, 1, true) end)
+bench("find pattern, a^30b", function () return rep:find(needle) end)
+local lneedle = string.rep("a", 1000) .. "b"
+bench("find plain, a^1000b",
+      function () return rep:find(lneedle, 1, true) end)
+
+-- text-like subject
+local words = {"alpha", "beta", "gamma", "delta", "error", "warn", "info",
+               "42", "x=1,y=2"}
+local t, len = {}, 0
+math.randomseed(1)
+while len < n do
+  local w = words[math.random(#words)]
+  t[#t + 1] = w
+  len = len + #w + 1
+end
+local text = table.concat(t, " "):sub(1, n)
+bench("find plain, text, absent",
+      function () return text:find("not-there-at-all", 1, true) end)
+bench("gmatch '%s*' over text", function ()
+  local c = 0
+  for _ in text:gmatch("%s*") do c = c + 1 end
+  return c
+end)
+
+-- csv fields and digits
+local csv = string.rep("field1,22,some text here,4.5\n", n // 30)
+bench("gmatch '[^,]*' over csv", function ()
+  local c = 0
+  for _ in csv:gmatch("[^,]*") do c = c + 1 end
+  return c
+end)
+local digits = string.rep("1234567890", n // 10)
+bench("match '%d+' over digits", function () return #digits:match("%d+") end)
@@ -0,0 +1,59 @@
+-- Throughput of the hash part of tables, in millions of operations per
+-- second: inserts, hits and misses with string keys, and inserts and
+-- hits with integer keys that do not go to the array part.
+--
+--   sol hash.sol [size]
+--
+-- Without a size it runs 1K, 100K and 10M keys. Build once with
+-- -DSOL_USE_SWISSHASH=1 (in MYCFLAGS) and once without to compare the
+-- two hash parts.
+
+local function run (N)
+  local R = math.max(1, 20000000 // N)   -- about 20M lookups per size
+  local keys = {}
+  for i = 1, N do keys[i] = "key" .. i end
+  collectgarbage(); collectgarbage("stop")
+  local t0 = os.clock()
+  local ins = 0
+  local reps = math.max(1, 2000000 // N)
+  local t
+  for r = 1, reps do
+    t = {}
+    for i = 1, N do t[keys[i]] = i end
+    ins = ins + N
+  end
+  local ti = os.clock() - t0
+  collectgarbage("restart"); collectgarbage()
+  t0 = os.clock()
+  local s = 0
+  for r = 1, R do
+    for i = 1, N do s = s + t[keys[i]] end
+  end
+  local tl = os.clock() - t0
+  -- missing keys
+  local miss = {}
+  for i = 1, math.min(N, 100000) do miss[i] = "nokey" .. i end
+  local M = #miss
+  local R2 = math.max(1, 5000000 // M)
+  t0 = os.clock()
+  for r = 1, R2 do for i = 1, M do if t[miss[i]] then s = s + 1 end end end
+  local tm = os.clock() - t0
+  -- integer keys in the hash part
+  local h = {}
+  t0 = os.clock()
+  for i = 1, N do h[i * 7919] = i end
+  local tii = os.clock() - t0
+  t0 = os.clock()
+  for r = 1, R do for i = 1, N do s = s + h[i * 7919] end end
+  local til = os.clock() - t0
+  print(string.format("%9d  str-insert %6.1f  str-hit %6.1f  str-miss %6.1f"
+                      .. "  int-insert %6.1f  int-hit %6.1f",
+        N, ins / ti / 1e6, R * N / tl / 1e6, R2 * M / tm / 1e6,
+        N / tii / 1e6, R * N / til / 1e6))
+end
+
+if arg and arg[1] then
+  run(math.tointeger(arg[1]))
+else
+  for _, n in ipairs{1000, 100000, 10000000} do run(n) end
+end
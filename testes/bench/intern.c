@@ -0,0 +1,114 @@
+/*
+** Benchmark for the interning of short strings: time to push 5M short
+** strings (200000 distinct ones, already interned) through
+** 'sol_pushlstring', for some lengths, and the chains of the string
+** table after interning a set of JSON-like keys. It looks into the
+** string table, so it needs the internal headers. From this directory:
+**
+**   cc -O2 -I../../src -o intern intern.c ../../src/libsol.a -lm
+**   ./intern
+**
+** Build the library with -DSOL_USE_FASTHASH=0 (in MYCFLAGS) to measure
+** the byte-at-a-time hash.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "sol.h"
+#include "lauxlib.h"
+#include "sollib.h"
+
+#include "lstate.h"
+
+
+#define NPUSH		5000000
+#define NDISTINCT	200000
+
+
+/* write key 'k' with length 'len' into 'buff' */
+static void mkkey (char *buff, int len, int k) {
+  snprintf(buff, len + 1, "key_%0*d", len - 4, k);
+}
+
+
+static double seconds (clock_t t) {
+  return (double)(clock() - t) / CLOCKS_PER_SEC;
+}
+
+
+static void interning (int len) {
+  sol_State *L = solL_newstate();
+  char buff[64];
+  double tfmt, tall;
+  clock_t t;
+  int i;
+  sol_createtable(L, NDISTINCT, 0);  /* keep all keys alive */
+  for (i = 0; i < NDISTINCT; i++) {
+    mkkey(buff, len, i);
+    sol_pushlstring(L, buff, len);
+    sol_rawseti(L, -2, i + 1);
+  }
+  t = clock();
+  for (i = 0; i < NPUSH; i++)  /* time of the keys alone */
+    mkkey(buff, len, i % NDISTINCT);
+  tfmt = seconds(t);
+  t = clock();
+  for (i = 0; i < NPUSH; i++) {
+    mkkey(buff, len, i % NDISTINCT);
+    sol_pushlstring(L, buff, len);
+    sol_pop(L, 1);
+  }
+  tall = seconds(t);
+  printf("len %2d: %.3fs\n", len, tall - tfmt);
+  sol_close(L);
+}
+
+
+static const char keys[] =
+  "keep = {}\n"
+  "local fields = {'id', 'name', 'created_at', 'updated_at', 'user_id',\n"
+  "                'status', 'payload', 'x', 'y', 'z'}\n"
+  "for i = 1, 60000 do keep[#keep + 1] = fields[i % 10 + 1] .. '_' .. i end\n"
+  "for i = 1, 100000 do keep[#keep + 1] = string.format('%d', i) end\n"
+  "for i = 1, 100000 do\n"
+  "  keep[#keep + 1] = 'k' .. string.char(i % 256, (i >> 8) % 256)\n"
+  "end\n";
+
+
+static void chains (void) {
+  sol_State *L = solL_newstate();
+  stringtable *tb;
+  long empty = 0, probes = 0;
+  int maxchain = 0;
+  int i;
+  solL_openlibs(L);
+  if (solL_dostring(L, keys) != SOL_OK) {
+    fprintf(stderr, "%s\n", sol_tostring(L, -1));
+    exit(EXIT_FAILURE);
+  }
+  sol_gc(L, SOL_GCCOLLECT);
+  tb = &G(L)->strt;
+  for (i = 0; i < tb->size; i++) {
+    int n = 0;
+    TString *ts;
+    for (ts = tb->hash[i]; ts != NULL; ts = ts->u.hnext)
+      probes += ++n;  /* finding the n-th string of a chain takes n probes */
+    if (n == 0) empty++;
+    if (n > maxchain) maxchain = n;
+  }
+  printf("%d strings, table size %d: %.0f%% empty slots, max chain %d, "
+         "avg probe %.2f\n", tb->nuse, tb->size, 100.0 * empty / tb->size,
+         maxchain, (double)probes / tb->nuse);
+  sol_close(L);
+}
+
+
+int main (void) {
+  interning(16);
+  interning(32);
+  interning(40);
+  chains();
+  return 0;
+}
@@ -0,0 +1,31 @@
+-- Time of a full collection against heap size, in incremental mode,
+-- where all the marking of a full collection is done in the atomic
+-- phase (and so by the parallel markers, if any).
+--
+--   sol pause.sol [markers]
+--
+-- 'markers' is the total number of marking threads (default 1); it is
+-- ignored by builds without parallel marking.
+
+local markers = math.tointeger(arg and arg[1]) or 1
+collectgarbage("incremental")
+if not collectgarbage("parallel", markers) then markers = 1 end  -- no support
+collectgarbage("stop")
+local heap = {}
+local total = 0
+for _, n in ipairs{100000, 400000, 1600000} do
+  for i = total + 1, n do
+    heap[i] = {id = i, name = "n", kids = {i, i + 1},
+               f = (i % 8 == 0) and function () return i end or nil}
+  end
+  total = n
+  local best = math.huge
+  for r = 1, 3 do
+    local t = os.clock()
+    collectgarbage()
+    t = os.clock() - t
+    if t < best then best = t end
+  end
+  print(string.format("%8d objs %7.1f MB  markers %d  full gc %6.1f ms",
+        n * 3, collectgarbage("count") / 1024, markers, best * 1000))
+end
@@ -0,0 +1,22 @@
+-- dumps of running code
+
+-- quickened instructions are dumped in their generic forms
+-- (and 'solc -q' must list them quickened; see the test in the Makefile)
+do
+  local function f (n)
+    local s, x, y = 0, 0.5, 1.0
+    for i = 1, n do
+      s = s + i - i * i + i * i
+      x = x * y
+      if i < n and x <= y then s = s - (i - i) end
+    end
+    return s, x
+  end
+  local before = string.dump(f)
+  local ok, s = pcall(f, 10000)   -- (a direct call could be inlined)
+  assert(ok and s == 10000 * 10001 // 2)
+  assert(string.dump(f) == before)
+  assert(load(string.dump(f))(100) == 5050)
+end
+
+print("OK")
@@ -0,0 +1,40 @@
+-- error messages
+
+local function doit (s)
+  local f, msg = load(s)
+  if not f then return msg end
+  local ok, msg = pcall(f)
+  return (not ok) and msg
+end
+
+
+local function checkmessage (prog, msg)
+  local m = doit(prog)
+  assert(m and string.find(m, msg, 1, true), m)
+end
+
+
+-- errors inside inlined calls name the variables of the inlined function
+do
+  local prog = "local function f (t) t.q = 1 end "
+  checkmessage(prog .. "f(nil)", "index a nil value (local 't')")
+  checkmessage("local function add (a,b) return a+b end print(add(1))",
+               "arithmetic on a nil value (local 'b')")
+  checkmessage("local function g (t) local u = t.x return u.y end g({})",
+               "index a nil value (local 'u')")
+  checkmessage("local function h (t) return t.x.y end h({})",
+               "index a nil value (field 'x')")
+  checkmessage("local function k (a, b) local c = a * 2 return c .. b end "
+               .. "local x = k(1, '') k(x, {})",
+               "concatenate a table value (local 'b')")
+  -- registers of the calling function keep their own names
+  checkmessage("local function id (a) return a end local z; "
+               .. "local y = id(3) .. z",
+               "concatenate a nil value (local 'z')")
+  -- loaded from a dump
+  local f = load(string.dump(load(prog .. "f(nil)")))
+  local ok, msg = pcall(f)
+  assert(not ok and string.find(msg, "(local 't')", 1, true))
+end
+
+print("OK")
@@ -0,0 +1,100 @@
+/*
+** Tests for external strings: strings whose bytes stay in a buffer
+** owned by the host, released through a given function when the
+** string is collected.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sol.h"
+#include "lauxlib.h"
+#include "sollib.h"
+
+
+#define check(c)	((c) ? (void)0 : fail(#c, __LINE__))
+
+static void fail (const char *what, int line) {
+  fprintf(stderr, "extstr.c:%d: check failed: %s\n", line, what);
+  exit(EXIT_FAILURE);
+}
+
+
+static void run (sol_State *L, const char *code) {
+  if (solL_dostring(L, code) != SOL_OK)
+    fail(sol_tostring(L, -1), 0);
+}
+
+
+static int nreleased = 0;  /* number of buffers released */
+static size_t lastsize = 0;  /* size given to the last release */
+
+
+static void *release (void *ud, void *ptr, size_t osize, size_t nsize) {
+  check(ud == &nreleased && nsize == 0);
+  nreleased++;
+  lastsize = osize;
+  free(ptr);
+  return NULL;
+}
+
+
+/* a malloc'ed buffer with 'n' copies of 'c' */
+static char *newbuff (size_t n, char c) {
+  char *b = (char *)malloc(n + 1);
+  check(b != NULL);
+  memset(b, c, n);
+  b[n] = '\0';
+  return b;
+}
+
+
+static const char useit[] =
+  "local s = ...\n"
+  "assert(#s == 1000 and s == string.rep('e', 1000))\n"
+  "local t = {[string.rep('e', 1000)] = 1}\n"
+  "assert(t[s] == 1 and s:sub(-3) == 'eee' and (s .. '!'):sub(-2) == 'e!')\n"
+  "keep = s:sub(100, 900)\n"  /* a slice keeps its parent alive */
+  "assert(#keep == 801 and s:upper() == string.rep('E', 1000))\n";
+
+
+int main (void) {
+  sol_State *L = solL_newstate();
+  const char *s;
+  char *b;
+  solL_openlibs(L);
+  /* short strings are copied and their buffers released right away */
+  b = newbuff(10, 's');
+  s = sol_pushexternalstring(L, b, 10, release, &nreleased);
+  check(nreleased == 1 && lastsize == 11 && s != b);
+  check(strcmp(s, "ssssssssss") == 0);
+  sol_pop(L, 1);
+  /* long strings keep their buffers */
+  b = newbuff(1000, 'e');
+  s = sol_pushexternalstring(L, b, 1000, release, &nreleased);
+  check(s == b && nreleased == 1 && sol_rawlen(L, -1) == 1000);
+  solL_loadstring(L, useit);
+  sol_insert(L, -2);
+  if (sol_pcall(L, 1, 0, 0) != SOL_OK)
+    fail(sol_tostring(L, -1), 0);
+  sol_gc(L, SOL_GCCOLLECT);
+  check(nreleased == 1);  /* still in use by 'keep' */
+  run(L, "assert(keep == string.rep('e', 801)); keep = nil");
+  sol_gc(L, SOL_GCCOLLECT);
+  check(nreleased == 2 && lastsize == 1001);
+  /* no release function: the buffer is never released */
+  s = sol_pushexternalstring(L, "a static buffer that is long enough to "
+                                "be a long string", 55, NULL, NULL);
+  check(strncmp(s, "a static", 8) == 0);
+  sol_pop(L, 1);
+  sol_gc(L, SOL_GCCOLLECT);
+  check(nreleased == 2);
+  /* strings still alive are released when the state closes */
+  sol_pushexternalstring(L, newbuff(500, 'x'), 500, release, &nreleased);
+  sol_setglobal(L, "x");
+  sol_close(L);
+  check(nreleased == 3 && lastsize == 501);
+  printf("extstr: OK\n");
+  return 0;
+}
@@ -0,0 +1,91 @@
+-- literal search (which turns to a two-way search on repetitive
+-- subjects) and runs of classes, against brute force
+
+local function brute (s, p, init)
+  for i = init or 1, #s - #p + 1 do
+    if s:sub(i, i + #p - 1) == p then return i, i + #p - 1 end
+  end
+  return nil
+end
+
+local function randstr (n, alpha)
+  local t = {}
+  for i = 1, n do
+    local k = math.random(#alpha)
+    t[i] = alpha:sub(k, k)
+  end
+  return table.concat(t)
+end
+
+math.randomseed(17)
+
+
+-- random subjects and needles over small alphabets
+for _, alpha in ipairs{"ab", "abc", "a\0"} do
+  for r = 1, 30 do
+    local s = randstr(math.random(0, 3000), alpha)
+    for k = 1, 20 do
+      local p
+      if k % 3 == 0 and #s > 0 then   -- a needle that is in 's'
+        local i = math.random(#s)
+        p = s:sub(i, i + math.random(0, 60))
+      else
+        p = randstr(math.random(0, 40), alpha)
+      end
+      local init = math.random(1, #s + 1)
+      local i, j = s:find(p, init, true)
+      local bi, bj = brute(s, p, init)
+      assert(i == bi and j == bj)
+      if not p:find("%W") then   -- a pattern without specials
+        assert(s:find(p, init) == bi)
+      end
+    end
+  end
+end
+
+
+-- periodic needles in periodic subjects (the worst case for the simple
+-- search)
+do
+  for _, unit in ipairs{"a", "ab", "aab", "abcab"} do
+    local s = string.rep(unit, 5000 // #unit)
+    for _, m in ipairs{10, 100, 1000} do
+      local p = string.rep(unit, m // #unit)
+      assert(s:find(p, 1, true) == 1)
+      assert(s:find(p .. "x", 1, true) == nil)
+      assert(s:find("x" .. p, 1, true) == nil)
+      assert((s .. "x"):find(p .. "x", 1, true) == #s - #p + 1)
+      assert(s:find(p, 2, true) == brute(s, p, 2))
+    end
+  end
+  local s = string.rep("a", 100000) .. "b"
+  assert(s:find(string.rep("a", 1000) .. "b", 1, true) == 100000 - 999)
+  assert(s:find(string.rep("a", 30) .. "b") == 100000 - 29)
+end
+
+
+-- runs of classes in compiled patterns
+do
+  local csv = {}
+  for i = 1, 2000 do csv[i] = randstr(math.random(0, 5), "xy,") end
+  csv = table.concat(csv, ",")
+  local fields = {}
+  for f in csv:gmatch("[^,]*") do fields[#fields + 1] = f end
+  local expect, pos = {}, 1
+  while true do   -- fields after each comma, as 'gmatch' gives them
+    local c = csv:find(",", pos, true)
+    expect[#expect + 1] = csv:sub(pos, (c or #csv + 1) - 1)
+    if not c then break end
+    pos = c + 1
+  end
+  assert(#fields == #expect)
+  for i = 1, #expect do assert(fields[i] == expect[i]) end
+  local digits = randstr(5000, "0123456789") .. "x"
+  assert(digits:match("%d+") == digits:sub(1, -2))
+  assert(digits:match("%d+", 4500) == digits:sub(4500, -2))
+  local spaces = string.rep(" \t", 3000) .. "w"
+  assert(spaces:find("%s*w") == 1 and spaces:match("^%s*()") == #spaces)
+  assert(("aaab"):rep(2000):find("[^a]") == 4)
+end
+
+print("OK")
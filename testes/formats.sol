@@ -0,0 +1,93 @@
+-- compiled formats from the pattern cache must give what the
+-- interpreted 'string.format' gives: a format is interpreted the first
+-- time it is used and compiled the second time
+
+local fmts = {"%d", "%i", "%5d", "%-5d|", "%+d", "% d", "%05d", "%.3d", "%x",
+  "%X", "%#x", "%08X", "%o", "%u", "%s", "%10s|", "%-10s|", "%.2s", "%q",
+  "%c", "%a", "%.3a", "%A", "%g", "%.14g", "%.3f", "%f", "%e", "%.0e", "%G",
+  "%E", "%10.3f", "%-8g|", "%+.2e", "%#g", "plain text", "", "100%%",
+  "%%d %d %%", "a%db%sc%xd%.2fe", "%d%d%d", "x=%d y=%s z=%g\n", "%5.2s|",
+  "%.99f", "%99.99f", "%2d", "%02x", "%1s", "%99d|", "%-99s|", "%0d", "%-0d",
+  "%00d", "%09d", "%-20x|", "%20s|", "%", "abc%", "%y", "%10q", "%123d",
+  "%-+ #0d", "%.123f", "%ld", "%0-5d", "%.s", "%5.s"}
+
+local args = {0, 1, -1, 255, -255, math.maxinteger, math.mininteger, 3.0, 2.5,
+  -0.0, 1e300, 1/0, -1/0, 0/0, "str", "", "a\0b", string.rep("x", 150), true,
+  {}, 12345678901, 0.1, 65}
+
+local function try (f, ...)
+  local r = table.pack(pcall(string.format, f, ...))
+  return tostring(r[1]) .. " " .. tostring(r[2]):gsub("0x%x+", "PTR")
+end
+
+
+-- push everything out of the cache
+local function flush ()
+  for i = 1, 300 do string.format("z" .. i) end
+end
+
+
+for _, f in ipairs(fmts) do
+  for _, a in ipairs(args) do
+    flush()
+    local first = try(f, a)   -- interpreted
+    assert(try(f, a) == first, f)   -- compiled
+    assert(try(f, a) == first, f)   -- from the cache
+    assert(try(f, a, a, a) == try(f, a, a, a))
+  end
+  flush()
+  local first = try(f)
+  assert(try(f) == first and try(f) == first)
+end
+
+
+-- results
+do
+  local f = "a%db%sc%xd%.2fe%%"
+  for i = 1, 3 do
+    assert(string.format(f, 10, "s", 255, 1.005) == "a10bscffd1.00e%")
+  end
+  local big = string.rep("%d,", 70)
+  local t = {}
+  for i = 1, 70 do t[i] = i end
+  for i = 1, 2 do
+    assert(string.format(big, table.unpack(t)) == table.concat(t, ",") .. ",")
+  end
+  local big2 = string.rep("%%", 100) .. "%s"
+  for i = 1, 2 do
+    assert(string.format(big2, "end") == string.rep("%", 100) .. "end")
+  end
+  local mt = {__tostring = function () return "OBJ" end}
+  for i = 1, 3 do
+    assert(string.format("<%s>", setmetatable({}, mt)) == "<OBJ>")
+  end
+  for i = 1, 3 do   -- a string used as a pattern and as a format
+    local s = "%d"
+    assert(string.find("a%db", s, 1, true) == 2 and s:match("%%d") == "%d")
+    assert(string.format(s, i) == tostring(i))
+  end
+  for i = 1, 3 do
+    assert(string.format(12) == "12" and string.format(1.5) == "1.5")
+  end
+  local b = string.buffer()
+  for i = 1, 5 do b:putf("%d:%s:%x;", i, "v", i * 255) end
+  b:putf("%5.1f|%q", 3.14159, "a\nb")
+  assert(b:tostring() ==
+    "1:v:ff;2:v:1fe;3:v:2fd;4:v:3fc;5:v:4fb;  3.1|\"a\\\nb\"")
+end
+
+
+-- formats created at run time and collected
+do
+  for r = 1, 10 do
+    for i = 1, 300 do
+      local f = "n" .. i .. "_" .. r .. "=%d"
+      for k = 1, 3 do
+        assert(string.format(f, k) == "n" .. i .. "_" .. r .. "=" .. k)
+      end
+    end
+    collectgarbage()
+  end
+end
+
+print("OK")
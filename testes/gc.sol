@@ -0,0 +1,111 @@
+-- the collector over large object graphs, with parallel marking when
+-- the build has it
+
+local markers = collectgarbage("parallel", 4)   -- nil when not built in
+collectgarbage("incremental")
+
+
+-- a heap with objects of all kinds
+local function tree (d)
+  if d == 0 then return {d = d, s = "leaf" .. d} end
+  return {tree(d - 1), tree(d - 1), x = d, f = function () return d end}
+end
+local root = tree(14)
+local list = nil
+for i = 1, 100000 do
+  list = {next = list, v = i, s = (i % 97 == 0) and ("s" .. i) or nil}
+end
+local cls = {}
+for i = 1, 10000 do local u = {i}; cls[i] = function () return u[1] end end
+local cos = {}
+for i = 1, 200 do
+  local co = coroutine.wrap(function (a)
+    local t = {a}
+    while true do t = {t}; a = coroutine.yield(#t) end
+  end)
+  co(i); cos[i] = co
+end
+local Mk = setmetatable({}, {__mode = "k"})
+local Mv = setmetatable({}, {__mode = "v"})
+local Mkv = setmetatable({}, {__mode = "kv"})
+local keep = {}
+for i = 1, 5000 do
+  local k, v = {i}, {i}
+  Mk[k] = {k}   -- an ephemeron cycle: collectable
+  Mv[i] = v
+  Mkv[k] = v
+  if i % 10 == 0 then keep[#keep + 1] = k; keep[#keep + 1] = v end
+end
+local Class = {__index = {get = function (s) return s.v end}}
+local WClass = {__mode = "v"}
+local objs, wobjs = {}, {}
+for i = 1, 20000 do objs[i] = setmetatable({v = i, w = {i}}, Class) end
+for i = 1, 100 do wobjs[i] = setmetatable({{}, keep[i]}, WClass) end
+local res, fin = {}, 0
+for i = 1, 1000 do   -- finalizers, some resurrecting their objects
+  setmetatable({i = i, t = {i}}, {__gc = function (o)
+    fin = fin + 1
+    if o.i % 100 == 0 then res[#res + 1] = o end
+  end})
+end
+local big = string.rep("x", 300)
+local strs = {}
+for i = 1, 2000 do strs[i] = (big .. i .. big):sub(3, 400) end
+
+
+local function count (t)
+  local n = 0
+  for _ in pairs(t) do n = n + 1 end
+  return n
+end
+
+for r = 1, 3 do
+  collectgarbage()
+  assert(count(Mk) == 500 and count(Mv) == 500 and count(Mkv) == 500)
+  for i = 1, 100 do
+    assert(wobjs[i][1] == nil and wobjs[i][2] == keep[i])
+  end
+  assert(fin == 1000 and #res == 10 and res[1].t[1] % 100 == 0)
+  for i = 1, 10000 do local t = {i, tostring(i)} end
+end
+
+
+-- everything that should survive did
+do
+  local s = 0
+  for i = 1, 20000 do s = s + objs[i]:get() + objs[i].w[1] end
+  assert(s == 20000 * 20001)
+  local d, l = 0, list
+  while l do d = d + l.v; l = l.next end
+  assert(d == 100000 * 100001 // 2)
+  local cs = 0
+  for i = 1, 10000 do cs = cs + cls[i]() end
+  assert(cs == 10000 * 10001 // 2)
+  local ks = 0
+  for i = 1, 200 do ks = ks + cos[i](i) end
+  assert(ks == 200)
+  for i = 1, 2000 do assert(strs[i] == (big .. i .. big):sub(3, 400)) end
+  local function leaves (t)
+    if t.d then return 1 end
+    return leaves(t[1]) + leaves(t[2]) + t.f() * 0
+  end
+  assert(leaves(root) == 2^14)
+end
+
+
+-- incremental steps interleaved with mutation, then other modes
+for r = 1, 50 do
+  for i = 1, 2000 do objs[(i * r) % 20000 + 1].w = {r} end
+  collectgarbage("step", 100)
+end
+collectgarbage("generational"); collectgarbage()
+collectgarbage("incremental"); collectgarbage()
+for i = 1, 20000 do assert(#objs[i].w == 1) end
+
+if markers then
+  assert(collectgarbage("parallel", markers) == 4)
+else
+  assert(collectgarbage("parallel") == nil)
+end
+
+print("OK")
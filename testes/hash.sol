@@ -0,0 +1,102 @@
+-- hash parts (chained or, with SOL_USE_SWISSHASH, open addressing)
+
+-- keys of all kinds
+do
+  local t = {}
+  local long = string.rep("k", 100)
+  local f, co = print, coroutine.create(print)
+  local keys = {"a", long, 1.5, -3, 2^53, math.mininteger, true, false, f,
+                co, t}
+  for i, k in ipairs(keys) do t[k] = i end
+  for i, k in ipairs(keys) do assert(t[k] == i) end
+  assert(t[string.rep("k", 100)] == 2)   -- equal long string
+  t[3.0] = "three"   -- float keys with integer values are integers
+  assert(t[3] == "three" and next({[3.0] = 1}) == 3)
+  t[-0.0] = "zero"
+  assert(t[0] == "zero" and t[0.0] == "zero")
+  assert(not pcall(function () t[0/0] = 1 end))
+  assert(not pcall(rawset, t, nil, 1))
+  assert(t[0/0] == nil and t[nil] == nil)
+end
+
+
+-- many inserts and removals (removed keys leave their nodes)
+do
+  local t = {}
+  for r = 1, 10 do
+    for i = 1, 1000 do t["k" .. i .. "_" .. r] = i end
+    for i = 1, 1000 do
+      if i % 3 ~= 0 then t["k" .. i .. "_" .. r] = nil end
+    end
+  end
+  local n = 0
+  for k, v in pairs(t) do
+    n = n + 1
+    assert(v % 3 == 0 and k == "k" .. v .. "_" .. k:match("_(%d+)$"))
+  end
+  assert(n == 10 * 333)
+  for r = 1, 10 do
+    for i = 3, 1000, 3 do assert(t["k" .. i .. "_" .. r] == i) end
+    assert(t["k1_" .. r] == nil)
+  end
+end
+
+
+-- clearing fields during a traversal
+do
+  local t = {}
+  for i = 1, 500 do t["x" .. i] = i; t[i * 1.5] = i end
+  local n = 0
+  for k, v in pairs(t) do
+    n = n + 1
+    t[k] = nil   -- allowed: the key stays in its node
+  end
+  assert(n == 1000 and next(t) == nil)
+  -- 'next' from a key that became dead
+  t = {}
+  for i = 1, 100 do t[{}] = i end
+  local k = next(t)
+  t[k] = nil
+  collectgarbage()   -- the key is dead now
+  n = 0
+  local k2 = next(t, k)
+  while k2 ~= nil do n = n + 1; k2 = next(t, k2) end
+  assert(n == 99)
+end
+
+
+-- weak keys and ephemerons
+do
+  local t = setmetatable({}, {__mode = "k"})
+  local keep = {}
+  for i = 1, 200 do
+    local k = {}
+    t[k] = {k}   -- an ephemeron: the value refers to its key
+    if i % 4 == 0 then keep[#keep + 1] = k end
+  end
+  collectgarbage()
+  local n = 0
+  for k, v in pairs(t) do n = n + 1; assert(v[1] == k) end
+  assert(n == 50)
+  for i = 1, 200 do t[{}] = i end   -- reuse of the cleared nodes
+  collectgarbage()
+  n = 0
+  for k in pairs(t) do n = n + 1 end
+  assert(n == 50)
+end
+
+
+-- growing from empty, and keys that collide in their low bits
+do
+  local t = {}
+  for i = 1, 5000 do t[i * 4096] = i end
+  for i = 1, 5000 do assert(t[i * 4096] == i) end
+  assert(t[4096 * 5001] == nil and t[1] == nil)
+  local u = {}
+  for i = 1, 5000 do u[i + 0.5] = i end
+  local n = 0
+  for k, v in pairs(u) do n = n + 1; assert(k == v + 0.5) end
+  assert(n == 5000)
+end
+
+print("OK")
@@ -0,0 +1,65 @@
+-- interning of short strings (hashed a machine word at a time)
+
+-- strings that differ only in their length or in one byte
+do
+  local t, n = {}, 0
+  for len = 0, 48 do   -- short and long strings
+    local s = string.rep("\0", len)
+    assert(t[s] == nil)
+    t[s] = len; n = n + 1
+    for pos = 1, len do
+      for _, c in ipairs{"\1", "\128", "\255"} do
+        local v = s:sub(1, pos - 1) .. c .. s:sub(pos + 1)
+        assert(#v == len and t[v] == nil)
+        t[v] = true; n = n + 1
+      end
+    end
+  end
+  local m = 0
+  for k in pairs(t) do m = m + 1 end
+  assert(m == n)
+  for len = 0, 48 do assert(t[string.rep("\0", len)] == len) end
+  assert(("a"):rep(1) ~= "a\0" and "a\0" ~= "a\0\0")
+end
+
+
+-- the same contents give the same string, however it was built
+do
+  local words = {}
+  for i = 1, 10000 do words[i] = "w" .. i end
+  local t = {}
+  for i = 1, 10000 do t[words[i]] = i end
+  for i = 1, 10000 do
+    local a = string.format("w%d", i)
+    local b = ("w" .. i .. "!"):sub(1, -2)
+    assert(t[a] == i and t[b] == i and a == words[i])
+  end
+  local s = "key_0123456789_abcdefghijklmnopqrstuv"   -- near the maximum
+  assert(#s <= 40)
+  local buf = {}
+  for c in s:gmatch(".") do buf[#buf + 1] = c end
+  assert(table.concat(buf) == s and s:reverse():reverse() == s)
+  assert(s:upper():lower() == s and string.char(s:byte(1, -1)) == s)
+end
+
+
+-- the string table grows and shrinks
+do
+  local keep = {}
+  for r = 1, 3 do
+    local t = {}
+    for i = 1, 100000 do t[i] = "s" .. i .. "_" .. r end
+    if r == 2 then keep = t end
+    collectgarbage()
+  end
+  for i = 1, 100000, 997 do
+    assert(keep[i] == "s" .. i .. "_2")
+  end
+  keep = nil
+  collectgarbage()
+  local t = {}
+  for i = 1, 1000 do t["s" .. i .. "_2"] = i end
+  for i = 1, 1000 do assert(t["s" .. i .. "_2"] == i) end
+end
+
+print("OK")
@@ -0,0 +1,157 @@
+-- the JIT compiler must give the same results as the interpreter,
+-- including where native code hands its frame back to the interpreter
+
+local cases = {}
+
+function cases.arith ()
+  local s, x = 0, 1.5
+  for i = 1, 1000 do
+    s = s + i * 2 - (i // 3) + (i % 5)
+    x = x * 1.0001 + i / 7
+    if i < 10 then s = s - 1 elseif i >= 50 then s = s + 1 end
+    s = s ~ (i & 0xff) | (i << 2) >> 1
+  end
+  return s, x
+end
+
+function cases.overflow ()   -- integers wrap around
+  local s = math.maxinteger - 5
+  for i = 1, 10 do s = s + 1 end
+  local n = 0
+  for i = math.maxinteger - 2, math.maxinteger do n = n + 1 end
+  return s, n
+end
+
+function cases.mixed ()   -- operands change type in the same instruction
+  local s = 0
+  for i = 1, 100 do
+    if i % 2 == 0 then s = s + 0.5 else s = s + 1 end
+    s = s + (i % 3 == 0 and "1" or 1)
+  end
+  return s, math.type(s)
+end
+
+function cases.floatloop ()
+  local s = 0
+  for i = 1.0, 50, 0.5 do s = s + i end
+  return s
+end
+
+function cases.compare ()
+  local function cmp (a, b)
+    local c = 0
+    for i = 1, 20 do
+      if a < b then c = c + 1 end
+      if a <= b then c = c + 1 end
+      if a == b then c = c + 10 end
+    end
+    return c
+  end
+  return cmp(1, 2), cmp(2.5, 2), cmp(3, 3.0), cmp("a", "b"),
+         cmp(math.maxinteger, math.maxinteger + 0.0)
+end
+
+function cases.meta ()
+  local mt = {__add = function (a, b) return 42 end,
+              __index = function (t, k) return k end,
+              __lt = function (a, b) return true end}
+  local o = setmetatable({}, mt)
+  local s = 0
+  for i = 1, 10 do
+    s = s + (o + i) + #o.foo
+    if o < o then s = s + 1 end
+  end
+  return s
+end
+
+function cases.error ()   -- error raised from native code
+  local function err (n)
+    local t = nil
+    for i = 1, n do if i == 150 then return t.x end end
+  end
+  return pcall(err, 200)
+end
+
+function cases.hook ()   -- active hooks send the frame to the interpreter
+  local n = 0
+  debug.sethook(function () n = n + 1 end, "", 100)
+  local s = 0
+  for i = 1, 10000 do s = s + i end
+  debug.sethook()
+  return s, n > 0
+end
+
+function cases.yield ()   -- frames resumed after a yield
+  local function gen (n)
+    local s = 0
+    for i = 1, n do s = s + coroutine.yield(i * i) end
+    return s
+  end
+  local co = coroutine.wrap(gen)
+  local s = co(50)
+  for i = 1, 50 do s = s + co(i) end
+  return s
+end
+
+function cases.deep ()   -- deep recursion (native code uses the C stack)
+  local function nest (n) if n == 0 then return 0 end return n + nest(n - 1) end
+  local function tail (n, acc)
+    if n == 0 then return acc end
+    return tail(n - 1, acc + n)
+  end
+  return nest(10000), tail(100000, 0)
+end
+
+function cases.closures ()
+  local function counter ()
+    local c = 0
+    return function () c = c + 1; return c end
+  end
+  local ctr = counter()
+  local s = 0
+  for i = 1, 100 do s = s + ctr() end
+  local t = {1, 2, 3, x = 9}
+  return s, t[2], t.x, #t, ("a"):rep(3) .. 1
+end
+
+
+local function runall ()
+  local res = {}
+  for name, f in pairs(cases) do res[name] = table.pack(pcall(f)) end
+  return res
+end
+
+local function same (a, b)
+  if a.n ~= b.n then return false end
+  for i = 1, a.n do
+    local x, y = a[i], b[i]
+    if not (x == y or (x ~= x and y ~= y)) or math.type(x) ~= math.type(y) then
+      return false
+    end
+  end
+  return true
+end
+
+jit.off()
+local base = runall()
+assert(base.overflow[2] == math.mininteger + 4 and base.overflow[3] == 3)
+assert(base.error[2] == false and string.find(base.error[3], "index"))
+assert(base.hook[3] == true)
+assert(base.deep[2] == 50005000 and base.deep[3] == 5000050000)
+
+if not jit.on(1) then
+  print("(JIT compiler not available)")
+else
+  for rep = 1, 3 do
+    local res = runall()
+    for name in pairs(cases) do
+      assert(same(res[name], base[name]), name)
+    end
+  end
+  assert(select(2, jit.status()) > 0)   -- something was compiled
+  jit.flush()
+  assert(select(2, jit.status()) == 0)
+  jit.off()
+end
+
+print("OK")
@@ -0,0 +1,66 @@
+-- formatting of numbers without printf: every result must be the one
+-- printf gives (a width of 1 changes nothing, but sends a format
+-- through printf)
+
+local fmts = {"g", ".14g", ".17g", ".1g", ".0g", ".3g", ".16g", "e", ".0e",
+  ".3e", ".16e", "f", ".0f", ".1f", ".3f", ".10f", ".17f", ".20f", ".60f",
+  ".99f"}
+
+local function check (x)
+  for i = 1, #fmts do
+    local f = fmts[i]
+    local s = string.format("%" .. f, x)
+    assert(s == string.format("%1" .. f, x), f)
+  end
+  local s = tostring(x)
+  local p = string.format("%1.14g", x)
+  if math.type(x) == "float" and p:find("^-?%d+$") then p = p .. ".0" end
+  assert(s == p and x .. "" == p)
+  if math.abs(x) < math.huge then   -- round trip with enough digits
+    assert(tonumber(string.format("%.17g", x)) == x)
+  end
+end
+
+math.randomseed(12345)
+
+
+-- random bit patterns (all exponents)
+for i = 1, 3000 do
+  check(string.unpack("<d", string.pack("<i8", math.random(0))))
+end
+
+-- decimal-looking values
+for i = 1, 3000 do
+  local x = math.random(-1000000, 1000000) / 10 ^ math.random(0, 12)
+  check(x); check(x * 3); check(i * 0.1)
+end
+
+-- ties, boundaries and special values
+for _, x in ipairs{0.5, 1.5, 2.5, -0.5, 0.125, 0.375, 2.675, 1.005,
+    1e15 + 0.5, 123456789012345.0, 12345678901234.5, 9.9999999999999995,
+    99999999999999.5, 0.000099999999999999, 1e-5, 1e-4, 9.5e-5, 999999.5,
+    9999995, 0.1, 0.2, 0.3, 0.1 + 0.2, 1/3, 2/3, math.pi, -math.pi, 1e21,
+    1e22, 1e23, 5e-324, 2.2250738585072014e-308, 1.7976931348623157e308,
+    0.0, -0.0, math.huge, -math.huge, 0/0, 2^53, 2^63, 2^64, 1e100, 1e-100,
+    4.35, 0.045, 1e16, 1e17} do
+  check(x)
+end
+for e = -310, 310 do
+  check(10.0 ^ e); check(10.0 ^ e * 0.99999999999999); check(5 * 10.0 ^ e)
+end
+for i = -20, 20 do check(i + 0.5); check(i / 8); check(i * 1e15 + 0.5) end
+
+
+-- integers
+for i = 1, 3000 do
+  local v = math.random(0) >> math.random(0, 63)
+  for _, x in ipairs{v, -v} do
+    assert(tostring(x) == string.format("%d", x) and x .. "" == tostring(x))
+    assert(math.tointeger(tostring(x)) == x)
+  end
+end
+for _, x in ipairs{math.mininteger, math.maxinteger, 0, -1, 9, 10, 99, 100} do
+  assert(tostring(x) == string.format("%d", x))
+end
+
+print("OK")
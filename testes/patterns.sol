@@ -0,0 +1,84 @@
+-- compiled patterns from the pattern cache must match like the
+-- interpreter: a pattern is interpreted the first time it is used and
+-- compiled the second time (or at once for a long subject)
+
+local subjects = {"", "hello world", "aaaaaaaaaab", "a,b,,c,dd,",
+  "  12 34.5  x9 ", "abcabcabcabd", string.rep("ab", 300) .. "c",
+  "THE (quick) fox", "\0a\0b", "key=val; k2=v2", "x1y22z333",
+  string.rep("a", 5000) .. "b"}
+
+local pats = {"a", "a+", "a-b", "^a", "b$", "%d+", "%s*", "[^,]*",
+  "(%w+)=(%w+)", "%f[%w]%w+", "%b()", "()a()", "[%a_][%w_]*", ".-b", "a*",
+  "[a-c]+", "[^%s]+", "%.", "(a)(b)", "abd", "ab", "^(%s*)", "x%d*", "%z",
+  "\0", "[%z]", "(h)(e)(l)", "%S+", "[]]", "[^]]", "a?b", "c$", "(%d)%1",
+  "[%d,]+", "^$", "$", ".", "%x+", "((a)(b))", "[a-", "(()", "%", "%g"}
+
+
+-- all results of the pattern functions for a subject and a pattern
+local function results (s, p)
+  local r = {}
+  local function add (ok, ...)
+    r[#r + 1] = tostring(ok)
+    for i = 1, select("#", ...) do r[#r + 1] = tostring((select(i, ...))) end
+    r[#r + 1] = ";"
+  end
+  add(pcall(string.find, s, p))
+  add(pcall(string.find, s, p, -4))
+  add(pcall(string.find, s, p, 3, true))
+  add(pcall(string.match, s, p))
+  add(pcall(string.match, s, p, 2))
+  add(pcall(string.gsub, s, p, "<%0>", 20))
+  add(pcall(function ()
+    local o = {}
+    for a, b in string.gmatch(s, p) do
+      o[#o + 1] = tostring(a) .. "/" .. tostring(b)
+      if #o > 50 then break end
+    end
+    return table.concat(o, "|")
+  end))
+  return table.concat(r, ",")
+end
+
+
+-- push everything out of the cache
+local function flush ()
+  for i = 1, 300 do string.find("", "z" .. i) end
+end
+
+
+for _, s in ipairs(subjects) do
+  for _, p in ipairs(pats) do
+    flush()
+    local first = results(s, p)   -- interpreted (unless 's' is long)
+    assert(results(s, p) == first, p)   -- compiled
+    assert(results(s, p) == first, p)   -- from the cache
+  end
+end
+
+
+-- long subjects compile at once
+do
+  local s = string.rep("ab", 3000) .. "c"
+  assert(s:find("c") == #s and s:find("(b)c") == #s - 1)
+  assert(select(2, s:gsub("ab", "")) == 3000 and s:match("^(a)b") == "a")
+  local n = 0
+  for w in s:gmatch("a()") do n = n + 1 end
+  assert(n == 3000)
+end
+
+
+-- patterns created at run time and collected: a new pattern may get
+-- the address of a dead one
+do
+  for r = 1, 20 do
+    for i = 1, 100 do
+      local p = "(%d+)" .. string.rep("x", i % 7) .. "y" .. r
+      local s = "12" .. string.rep("x", i % 7) .. "y" .. r
+      for k = 1, 3 do assert(s:match(p) == "12") end
+      assert(("9" .. s):find(p) == 1)
+    end
+    collectgarbage()
+  end
+end
+
+print("OK")
@@ -0,0 +1,106 @@
+-- ropes: concatenations of long strings that get their bytes on demand
+
+local long = string.rep("a", 300)   -- long enough to start a rope
+
+
+-- appending one piece at a time
+do
+  local s = ""
+  for i = 1, 5000 do s = s .. tostring(i) .. "," end
+  local parts = {}
+  for i = 1, 5000 do parts[i] = tostring(i) .. "," end
+  local f = table.concat(parts)
+  assert(s == f and f == s and #s == #f)
+  assert(s:sub(1, 8) == "1,2,3,4," and s:sub(-10) == "4999,5000,")
+  local c = string.rep("c", 500)
+  for i = 1, 1000 do c = c .. "a" .. i .. "b" end
+  assert(c:find("a1000b", 1, true) == #c - 5)
+  local big = string.rep("q", 1000)
+  local r = big
+  for i = 1, 100 do r = r .. big end
+  assert(#r == 101000 and r == string.rep("q", 101000))
+end
+
+
+-- equality, order and hashing
+do
+  local a, b = long, long
+  for i = 1, 50 do a = a .. "x"; b = b .. "x" end
+  assert(a == b and rawequal(a, b) and a <= b and not (a < b))
+  assert(a < b .. "y" and a .. "z" > b)
+  local t = {}
+  t[a] = 1
+  assert(t[b] == 1 and t[long .. string.rep("x", 50)] == 1)
+  t[b] = 2
+  assert(next(t) == a and next(t, a) == nil and t[a] == 2)
+  local z = string.rep("\0", 300)
+  z = z .. "end\0x"   -- embedded zeros
+  assert(#z == 305 and z:byte(301) == 101 and z:byte(304) == 0)
+  assert(z == string.rep("\0", 300) .. "end\0x" and z < z .. "\0")
+end
+
+
+-- ropes on either side and inside ropes
+do
+  local x = long .. "1"
+  local y = string.rep("y", 300) .. "2"
+  local xy = x .. y
+  assert(#xy == 602 and xy:sub(300, 303) == "a1yy")
+  assert((y .. x):sub(300, 303) == "y2aa")
+  assert(("p" .. x):sub(1, 2) == "pa")
+  local n = xy .. xy .. (xy .. xy)
+  assert(#n == 4 * 602 and n == string.rep(xy, 4))
+end
+
+
+-- ropes wherever a string is expected
+do
+  local num = string.rep(" ", 300) .. "42"
+  num = num .. "  "
+  assert(num + 1 == 43 and math.type(num * 1) == "integer")
+  assert(tonumber(num) == 42)
+  local s = long .. "!"
+  assert(s:upper() == string.rep("A", 300) .. "!" and #s:rep(2) == 602)
+  assert(select(2, s:gsub("a", "a")) == 300)
+  assert(string.format("%s", s) == s and tostring(s) == s)
+  local ok, msg = pcall(error, string.rep("E", 300) .. "!")
+  assert(not ok and #msg == 301)
+  local obj = setmetatable({}, {__name = string.rep("N", 300) .. "ame"})
+  ok, msg = pcall(function () return obj + 1 end)
+  assert(not ok and string.find(msg, "Name value"))
+  local src = "return " .. string.rep(" ", 300)
+  src = src .. "1 + 1"
+  assert(load(src)() == 2)
+end
+
+
+-- the collector
+do
+  for round = 1, 3 do
+    local acc = {}
+    for i = 1, 200 do
+      local q = string.rep("r", 300)
+      for j = 1, 50 do q = q .. j end
+      acc[i % 10 + 1] = q
+    end
+    collectgarbage()
+    assert(#acc[1] == 300 + 9 + 41 * 2 and acc[1]:sub(-4) == "4950")
+  end
+  for _, mode in ipairs{"generational", "incremental"} do
+    collectgarbage(mode)
+    local keep = {}
+    for i = 1, 20000 do
+      local q = string.rep("g", 300) .. i
+      q = q .. "." .. i
+      if i % 1000 == 0 then keep[#keep + 1] = q end
+    end
+    collectgarbage()
+    assert(#keep == 20 and keep[20]:sub(-11) == "20000.20000")
+  end
+  local w = setmetatable({}, {__mode = "k"})
+  w[long .. "1"] = true   -- strings are never weak
+  collectgarbage()
+  assert(next(w) == long .. "1")
+end
+
+print("OK")
@@ -0,0 +1,148 @@
+-- shaped tables: short-string keys kept in shapes shared among tables
+
+local function keys (t)
+  local ks = {}
+  for k in pairs(t) do ks[#ks + 1] = tostring(k) end
+  table.sort(ks)
+  return table.concat(ks, ",")
+end
+
+
+-- records built the same way share a shape
+do
+  local ps = {}
+  for i = 1, 100 do ps[i] = {x = i, y = i * 2, name = "p" .. i} end
+  local s = 0
+  for i = 1, 100 do s = s + ps[i].x + ps[i].y end
+  assert(s == 3 * 5050 and ps[7].name == "p7")
+  assert(keys(ps[3]) == "name,x,y")
+  -- same keys in other orders give other shapes
+  local r1, r2 = {}, {}
+  r1.p = 1; r1.q = 2
+  r2.q = 1; r2.p = 2
+  assert(r1.p == 1 and r1.q == 2 and r2.p == 2 and r2.q == 1)
+  assert(keys(r1) == keys(r2))
+end
+
+
+-- fields removed and added again
+do
+  local o = {}
+  o.a = 1; o.b = 2; o.c = 3
+  o.b = nil
+  assert(keys(o) == "a,c" and o.b == nil)
+  o.b = 20   -- reuses the removed slot
+  assert(keys(o) == "a,b,c" and o.b == 20)
+  o.d = nil   -- removing an absent key
+  assert(rawget(o, "d") == nil and keys(o) == "a,b,c")
+  for k, v in pairs(o) do o[k] = v * 10 end
+  assert(o.a == 10 and o.b == 200 and o.c == 30)
+  for k in pairs(o) do o[k] = nil end
+  assert(next(o) == nil)
+  o.z = 1
+  assert(next(o) == "z")
+end
+
+
+-- more keys than a shape can hold
+do
+  local big = {}
+  for i = 1, 100 do
+    big["f" .. i] = i
+    assert(big.f1 == 1 and big["f" .. i] == i)
+  end
+  local n = 0
+  for k, v in pairs(big) do n = n + v; assert(k == "f" .. v) end
+  assert(n == 5050)
+  for i = 1, 100, 2 do big["f" .. i] = nil end
+  for i = 1, 100 do assert(big["f" .. i] == (i % 2 == 0 and i or nil)) end
+end
+
+
+-- other keys beside the shape keys
+do
+  local m = {x = 1, y = 2}
+  m[1] = "a"; m[2] = "b"
+  assert(#m == 2 and keys(m) == "1,2,x,y")
+  m[1.5] = "f"; m[true] = 3; m[m] = 4
+  assert(m[1.5] == "f" and m[true] == 3 and m[m] == 4 and m.x == 1)
+  m[100000] = 5
+  local long = string.rep("k", 50)   -- long strings are not shape keys
+  m[long] = 7
+  assert(m[long] == 7 and m.y == 2 and m[100000] == 5)
+  local n = 0
+  for k in pairs(m) do n = n + 1 end
+  assert(n == 9)
+  local c = {a = 1, b = 2, c = 3, d = 4, e = 5, f = 6, g = 7, h = 8, i = 9,
+             j = 10, k = 11, l = 12, 1, 2, 3}
+  assert(c.l == 12 and c[3] == 3 and #c == 3)
+  c.m = 13; c.n = nil; c.a = nil
+  assert(c.m == 13 and c.a == nil and c.b == 2)
+  assert(not pcall(next, {x = 1}, "nokey"))
+  assert(not pcall(next, {x = 1}, 3))
+end
+
+
+-- metatables
+do
+  local Base = {}
+  Base.__index = Base
+  function Base:get () return self.v end
+  function Base:inc () self.v = self.v + 1 end
+  local objs = {}
+  for i = 1, 50 do objs[i] = setmetatable({v = i}, Base) end
+  for r = 1, 3 do for i = 1, 50 do objs[i]:inc() end end
+  local s = 0
+  for i = 1, 50 do s = s + objs[i]:get() end
+  assert(s == 1275 + 150)
+  local t = setmetatable({}, {__newindex = function (t, k, v)
+    rawset(t, k, v * 2)
+  end})
+  t.a = 1   -- absent: calls __newindex
+  t.a = 5   -- present: a raw store
+  assert(t.a == 5)
+  t.a = nil
+  t.a = 3   -- absent again
+  assert(t.a == 6)
+end
+
+
+-- weak tables and shapes that become garbage
+do
+  local wk = setmetatable({}, {__mode = "k"})
+  local wv = setmetatable({}, {__mode = "v"})
+  local keep = {}
+  wv.a = {}; wv.b = "str"; wv.c = 1; wv.d = keep
+  wk.a = {}; wk.b = keep
+  collectgarbage()
+  assert(keys(wv) == "b,c,d" and keys(wk) == "a,b")
+  for _, mode in ipairs{"generational", "incremental"} do
+    collectgarbage(mode)
+    local keepers = {}
+    for i = 1, 100000 do
+      local r = {id = i, tag = "t", val = i * 0.5}
+      if i % 1000 == 0 then keepers[#keepers + 1] = r end
+      if i % 7 == 0 then r["k" .. (i % 50)] = i end   -- many shapes
+    end
+    collectgarbage()
+    local sum = 0
+    for _, r in ipairs(keepers) do sum = sum + r.id + r.val end
+    assert(#keepers == 100 and sum == 1.5 * 1000 * 5050)
+  end
+  math.randomseed(42)
+  local bag = {}
+  for i = 1, 2000 do
+    local r, set = {}, {}
+    for j = 1, math.random(1, 40) do
+      local k = "x" .. math.random(1, 60)
+      r[k] = j; set[k] = j
+    end
+    if i % 3 == 0 then r.x1 = nil; set.x1 = nil end
+    for k, v in pairs(set) do assert(r[k] == v) end
+    assert(keys(r) == keys(set))
+    bag[i % 100 + 1] = r
+    if i % 500 == 0 then collectgarbage() end
+  end
+end
+
+print("OK")
@@ -0,0 +1,114 @@
+-- slices: long substrings that share the bytes of their source
+
+local big = {}
+for i = 1, 2000 do
+  big[i] = string.format("%05d:%s;", i, string.rep(string.char(97 + i % 26),
+                                                  i % 7))
+end
+big = table.concat(big)
+
+-- 'sub' without slices, for comparison
+local function sub (s, i, j)
+  local t = {}
+  for k = i, j do t[#t + 1] = string.char(s:byte(k)) end
+  return table.concat(t)
+end
+
+
+-- slices of strings and of slices
+do
+  local a = big:sub(100, 5000)
+  local b = a:sub(10, 3000)
+  local c = b:sub(-600)
+  local d = b:sub(5, 40)   -- short: a regular string
+  assert(#a == 4901 and #b == 2991 and #c == 600 and #d == 36)
+  assert(a == sub(big, 100, 5000) and b == sub(big, 109, 3099))
+  assert(c == sub(big, 2500, 3099) and d == sub(big, 113, 148))
+  assert(a:byte(1) == big:byte(100) and c:byte(-1) == big:byte(3099))
+  assert(#a:upper() == #a and a:lower() == a and a:reverse():reverse() == a)
+  assert((a < b) == (sub(big, 100, 5000) < sub(big, 109, 3099)))
+  local t = {}
+  t[a] = 1; t[b] = 2; t[c] = 3
+  assert(t[sub(big, 100, 5000)] == 1 and t[b .. ""] == 2 and t[c] == 3)
+  local r = a
+  for i = 1, 100 do r = r .. i end   -- a rope starting with a slice
+  assert(r:sub(1, #a) == a and r:sub(-3) == "100")
+  local r2 = c .. "|" .. c
+  assert(#r2 == 1201 and r2:find("|", 1, true) == 601)
+end
+
+
+-- C functions that need a final '\0'
+do
+  local num = ("x"):rep(300) .. "12345.5" .. ("y"):rep(300)
+  local n = num:sub(301, 307)
+  assert(n == "12345.5" and tonumber(n) == 12345.5 and n + 1 == 12346.5)
+  local nl = (" "):rep(300) .. "42" .. (" "):rep(300) .. "zz"
+  assert(tonumber(nl:sub(1, 602)) == 42 and tonumber(nl) == nil)
+  local c = big:sub(2000, 3000)
+  assert(string.format("%.5s", c) == c:sub(1, 5))
+  assert(load("return " .. ("1"):rep(300):sub(1, 280) .. "0 // 1") ~= nil)
+end
+
+
+-- patterns over slices, and captures that are slices
+do
+  local a = big:sub(100, 5000)
+  local x, y = a:match("(%d+):(%a+);", 200)
+  assert(x and y and a:find(x .. ":" .. y .. ";", 200, true))
+  local c = big:sub(2000, 3000)
+  assert(c:find("%f[%w]") == 1)
+  local s, k = c:gsub("%d+", "#", 3)
+  assert(k == 3 and #s < #c)
+  local p1, p2 = big:match("^(" .. ("."):rep(400) .. ")(.*)$")
+  assert(#p1 == 400 and p1 .. p2 == big)
+  local n = 0
+  local subj = big:sub(1, 20000)
+  local res = subj:gsub("(%d+):", function (x)
+    n = n + 1
+    if n % 100 == 0 then collectgarbage() end
+    return x .. "="
+  end)
+  assert(n == 2000 and #res == #subj and res:sub(1, 12) == "00001=b;0000")
+  local it = subj:gmatch("(%d+):")
+  big, a, subj = nil
+  collectgarbage(); collectgarbage()
+  local sum = 0
+  for x in it do sum = sum + tonumber(x); collectgarbage("step") end
+  assert(sum == 2000 * 2001 // 2)
+end
+
+
+-- slices outlive their sources
+do
+  local keep = {}
+  for i = 1, 50 do
+    local s = ("z"):rep(1000) .. i .. ("w"):rep(1000)
+    keep[i] = s:sub(500, 1500)
+  end
+  collectgarbage()
+  for i = 1, 50 do
+    local s = keep[i]
+    assert(#s == 1001 and s:sub(1, 501) == ("z"):rep(501))
+    assert(s:sub(502, 501 + #tostring(i)) == tostring(i))
+  end
+  local w = setmetatable({}, {__mode = "k"})
+  w[keep[1]:sub(1, 800)] = true
+  collectgarbage()
+  assert(#next(w) == 800)
+  for _, mode in ipairs{"generational", "incremental"} do
+    collectgarbage(mode)
+    local acc = 0
+    local src = ("abc"):rep(5000)
+    for i = 1, 20000 do
+      local s = src:sub(i % 100 + 1, i % 100 + 3000)
+      local u = s:sub(100, 2900)
+      assert(u:byte(1) == src:byte(i % 100 + 100))
+      acc = acc + #u
+      if i % 1000 == 0 then src = ("abd"):rep(5000) end
+    end
+    assert(acc == 20000 * 2801)
+  end
+end
+
+print("OK")
@@ -0,0 +1,134 @@
+-- 'table.sort': native sorts of numbers and strings, and the stable mode
+
+local function copy (t)
+  local r = {}
+  for i = 1, #t do r[i] = t[i] end
+  return r
+end
+
+-- sort 't' through the generic path (a Sol comparison function)
+local function generic (t)
+  local r = copy(t)
+  table.sort(r, function (a, b) return a < b end)
+  return r
+end
+
+local function same (a, b)
+  if #a ~= #b then return false end
+  for i = 1, #a do
+    if a[i] ~= b[i] or math.type(a[i]) ~= math.type(b[i]) then
+      return false
+    end
+  end
+  return true
+end
+
+math.randomseed(7)
+
+
+-- numbers
+do
+  for _, n in ipairs{0, 1, 2, 5, 100, 1000} do
+    local a, f = {}, {}
+    for i = 1, n do
+      a[i] = math.random(-1000, 1000)
+      f[i] = (math.random() - 0.5) * 1e6
+    end
+    if n >= 6 then
+      a[1], a[2], a[3], a[4] = math.mininteger, math.maxinteger, 0, -1
+      f[1], f[2], f[3], f[4], f[5], f[6] = 0.0, 1/0, -1/0, 1e-300, -1e-300, 2^63
+    end
+    local ga, gf = generic(a), generic(f)
+    table.sort(a); table.sort(f)
+    assert(same(a, ga) and same(f, gf))
+  end
+  local m = {3, 1.5, 2, math.maxinteger, 2^63}   -- integers and floats
+  local gm = generic(m)
+  table.sort(m)
+  assert(same(m, gm) and m[1] == 1.5 and m[5] == 2^63)
+  assert(not pcall(table.sort, {1, "x", 2}))
+  local t = {1.0, 0/0, 2.0, 0/0, 3.0}
+  pcall(table.sort, t)   -- NaNs: no order, but no crash
+  assert(#t == 5)
+end
+
+
+-- strings
+do
+  local s = {}
+  for i = 1, 2000 do
+    local x = {}
+    for j = 1, math.random(0, 8) do
+      x[j] = string.char(math.random(0, 3) * 60 + (j % 2))
+    end
+    s[i] = table.concat(x)
+  end
+  s[1], s[2], s[3], s[4], s[5] = "a\0b", "a", "a\0", "", "\255"
+  local gs = generic(s)
+  table.sort(s)
+  assert(same(s, gs))
+  local deep = {}   -- long common prefixes
+  for i = 1, 300 do
+    deep[i] = string.rep("x", 100) .. string.format("%05d", (i * 37) % 300)
+  end
+  gs = generic(deep)
+  table.sort(deep)
+  assert(same(deep, gs))
+  local dup = {}
+  for i = 1, 300 do dup[i] = "same" end
+  table.sort(dup)
+  assert(dup[1] == "same" and dup[300] == "same")
+end
+
+
+-- tables that cannot go native
+do
+  local t = setmetatable({3, 1, 2}, {__index = function () return 0 end})
+  table.sort(t)
+  assert(t[1] == 1 and t[2] == 2 and t[3] == 3)
+  local mt = {__lt = function (x, y) return x.v < y.v end}
+  local lt = {}
+  for i = 1, 20 do lt[i] = setmetatable({v = (i * 7) % 20}, mt) end
+  table.sort(lt)
+  for i = 1, 20 do assert(lt[i].v == i - 1) end
+  local store = {4, 2, 3, 1}
+  local px = setmetatable({}, {__len = function () return #store end,
+                               __index = store, __newindex = store})
+  table.sort(px, nil, "stable")
+  assert(same(store, {1, 2, 3, 4}))
+end
+
+
+-- stable mode keeps the order of equal elements
+do
+  local recs = {}
+  for i = 1, 500 do recs[i] = {k = math.random(1, 10), i = i} end
+  table.sort(recs, function (x, y) return x.k < y.k end, "stable")
+  for i = 2, #recs do
+    local p, q = recs[i - 1], recs[i]
+    assert(p.k < q.k or (p.k == q.k and p.i < q.i))
+  end
+  local z = {0.0, -0.0, 1.5, -0.0, 0.0}   -- zeros are equal
+  table.sort(z, nil, "stable")
+  assert(1/z[1] > 0 and 1/z[2] < 0 and 1/z[3] < 0 and 1/z[4] > 0)
+  assert(z[5] == 1.5)
+  z = {}
+  for i = 1, 1000 do z[i] = (i % 2 == 0) and 0.0 or -0.0 end
+  table.sort(z, nil, "stable")
+  for i = 1, 1000 do assert((1/z[i] > 0) == (i % 2 == 0)) end
+  local st = {5, 4, 3, 2, 1}
+  table.sort(st, nil, "stable")
+  assert(same(st, {1, 2, 3, 4, 5}))
+  assert(not pcall(table.sort, {"b", 2, "a"}, nil, "stable"))
+  local e = {3, 2, 1}   -- an error leaves the list untouched
+  assert(not pcall(table.sort, e, function (x, y)
+    if x == 1 then error("boom") end
+    return x < y
+  end, "stable"))
+  assert(same(e, {3, 2, 1}))
+  assert(pcall(table.sort, {3, 1, 2}, function () return true end, "stable"))
+  assert(not pcall(table.sort, {1, 2}, nil, "bogus"))
+  table.sort({2, 1}, nil, "unstable")
+end
+
+print("OK")
@@ -0,0 +1,135 @@
+-- time targets for collector steps, idle-time collection, and the
+-- statistics of step durations
+
+collectgarbage("incremental")
+collectgarbage()
+
+
+-- option values
+do
+  local old = collectgarbage("steptime")
+  assert(math.type(old) == "integer" and old >= 0)
+  assert(collectgarbage("steptime", 250) == old)
+  assert(collectgarbage("steptime") == 250)
+  assert(collectgarbage("steptime", -1) == 250)   -- only a query
+  assert(collectgarbage("steptime", 0) == 250)
+  assert(collectgarbage("steptime", old) == 0)
+  assert(not pcall(collectgarbage, "steptime", math.maxinteger))
+  local st, msg = pcall(collectgarbage, "idle", 1 << 40)
+  assert(not st and string.find(msg, "out of range"))
+  assert(not pcall(collectgarbage, "idle"))
+  assert(collectgarbage("idle", 0) == false)
+  assert(collectgarbage("idle", -5) == false)
+end
+
+
+-- the statistics
+local function checkstats (s)
+  local n = 0
+  for i = 1, #s.hist do n = n + s.hist[i] end
+  assert(#s.hist == 20 and n == s.steps)
+  assert(s.over <= s.steps and s.max <= s.total and s.last <= s.max)
+  assert(s.target == collectgarbage("steptime"))
+end
+
+do
+  collectgarbage("stepstats", true)   -- reset
+  local s = collectgarbage("stepstats")
+  assert(s.steps == 0 and s.over == 0 and s.total == 0 and s.max == 0)
+  checkstats(s)
+  for i = 1, 200000 do local t = {i} end
+  s = collectgarbage("stepstats")
+  assert(s.steps > 0)
+  checkstats(s)
+  local s2 = collectgarbage("stepstats", true)   -- returns, then resets
+  assert(s2.steps >= s.steps and collectgarbage("stepstats").steps == 0)
+  collectgarbage("step", 0)
+  assert(collectgarbage("stepstats").steps >= 1)
+end
+
+
+-- with a time target, the collector still keeps up with garbage
+local keep = {}
+for i = 1, 1000 do keep[i] = {i, tostring(i)} end
+for _, target in ipairs{1, 50, 1000} do
+  collectgarbage("steptime", target)
+  collectgarbage()
+  collectgarbage("stepstats", true)
+  local base = collectgarbage("count")
+  local max = 0
+  for r = 1, 20 do
+    for i = 1, 20000 do local t = {i, i + 1}; keep[i % 1000 + 1] = {i} end
+    max = math.max(max, collectgarbage("count"))
+  end
+  local s = collectgarbage("stepstats")
+  checkstats(s)
+  assert(s.target == target and s.steps > 0)
+  assert(max < base + 20 * 20000 * 0.05)   -- much less than all allocated
+end
+collectgarbage("steptime", 0)
+for i = 1, 1000 do assert(keep[i][1] % 1000 + 1 == i) end
+
+
+-- idle time
+do
+  collectgarbage()
+  collectgarbage("stepstats", true)
+  for i = 1, 10 do   -- an idle program starts no cycles
+    assert(collectgarbage("idle", 1000) == false)
+  end
+  assert(collectgarbage("stepstats").steps == 0)
+
+  -- garbage made with the collector stopped: idle calls finish a cycle
+  -- (also with the collector stopped)
+  local function garbage ()
+    collectgarbage("stop")
+    local t = {}
+    for i = 1, 100000 do t[i] = {i} end
+  end
+  garbage()
+  local before = collectgarbage("count")
+  local n = 0
+  repeat n = n + 1 until collectgarbage("idle", 100) or n > 1e6
+  assert(n <= 1e6 and collectgarbage("count") < before / 2)
+  assert(not collectgarbage("isrunning"))
+  collectgarbage("restart")
+  local s = collectgarbage("stepstats")
+  assert(s.steps >= n and s.target == 0)
+  checkstats(s)
+
+  -- idle work counts as credit: afterwards, allocation needs no steps
+  -- (steps stop early while a background sweeper is running)
+  local sw = collectgarbage("sweeper", false)
+  collectgarbage()
+  garbage()
+  collectgarbage("restart")
+  for i = 1, 10 do
+    if collectgarbage("idle", 1000) then break end
+  end
+  collectgarbage("stepstats", true)
+  for i = 1, 100 do local x = {i} end
+  assert(collectgarbage("stepstats").steps == 0)
+  if sw then collectgarbage("sweeper", true) end
+
+  -- does nothing in generational mode
+  collectgarbage("generational")
+  garbage()
+  collectgarbage("restart")
+  assert(collectgarbage("idle", 1000) == false)
+  collectgarbage("incremental")
+end
+
+
+-- not inside finalizers
+do
+  local res
+  setmetatable({}, {__gc = function ()
+    res = {collectgarbage("idle", 10), collectgarbage("stepstats"),
+           collectgarbage("steptime", 5)}
+  end})
+  collectgarbage()
+  assert(res and res[1] == nil and res[2] == nil and res[3] == nil)
+  assert(collectgarbage("steptime") == 0)
+end
+
+print("OK")
@@ -0,0 +1,99 @@
+-- conversion of numerals: round trips through formatting, and known
+-- results at the edges
+
+math.randomseed(99)
+
+local function digits (n)
+  local d = {}
+  for i = 1, n do d[i] = string.char(48 + math.random(0, 9)) end
+  return table.concat(d)
+end
+
+
+-- 17 significant digits give back the same float
+for i = 1, 5000 do
+  local x = string.unpack("<d", string.pack("<i8", math.random(0)))
+  if math.abs(x) < math.huge then
+    assert(tonumber(string.format("%.17g", x)) == x)
+    assert(tonumber(string.format("%.16e", x)) == x)
+  end
+  local y = math.random() * 10 ^ math.random(-30, 30)
+  assert(tonumber(string.format("%.17g", y)) == y)
+  assert(load("return " .. string.format("%.17g", y))() == y)
+end
+
+
+-- numerals with up to 15 significant digits keep them
+for i = 1, 5000 do
+  local s = digits(math.random(1, 15)):gsub("^0+", "1")
+  local e = math.random(-320, 300)
+  local n = s .. "e" .. e
+  local x = tonumber(n)
+  assert(math.type(x) == "float")
+  if x >= 2.2250738585072014e-308 and x < math.huge then   -- normal
+    local back = string.format("%." .. #s - 1 .. "e", x)
+    local d, be = back:match("^(%d[%.%d]*)e([-+]%d+)$")
+    assert(d:gsub("%.", "") == s and tonumber(be) == e + #s - 1, n)
+  end
+  local p = math.random(0, #s)
+  local f = s:sub(1, p) .. "." .. s:sub(p + 1)
+  assert(tonumber(f) == tonumber(s) / 10 ^ (#s - p) or
+         string.format("%.15g", tonumber(f)) ==
+         string.format("%.15g", tonumber(s) / 10 ^ (#s - p)))
+end
+
+
+-- edges
+local cases = {
+  {"0", 0}, {"-0", 0}, {"0.0", 0.0}, {".5", 0.5}, {"5.", 5.0},
+  {" 1 ", 1}, {"\t2\n", 2}, {"+5", 5}, {"0x10", 16}, {"0x1p4", 16.0},
+  {"9007199254740993", 9007199254740993},
+  {"9007199254740993.0", 0x1p53},   -- a tie rounds to even
+  {"9007199254740993.0000000001", 0x1.0000000000001p53},
+  {"4503599627370496.5", 0x1p52}, {"4503599627370497.5", 0x1.0000000000002p52},
+  {"2.2250738585072011e-308", 0x0.fffffffffffffp-1022},
+  {"2.2250738585072014e-308", 0x1p-1022},
+  {"4.9406564584124654e-324", 0x1p-1074}, {"5e-324", 0x1p-1074},
+  {"2.5e-324", 0x1p-1074}, {"2.4e-324", 0.0}, {"1e-400", 0.0},
+  {"0e999999999", 0.0},
+  {"1e-99999999999", 0.0}, {"1e400", math.huge}, {"-1e400", -math.huge},
+  {"1.7976931348623157e308", 0x1.fffffffffffffp1023},
+  {"1.7976931348623158e308", 0x1.fffffffffffffp1023},
+  {"1.7976931348623159e308", math.huge},
+  {"1e23", 0x1.52d02c7e14af6p76}, {"1e22", 0x1.0f0cf064dd592p73},
+  {"1e-22", 0x1.e392010175ee6p-74}, {"0.1", 0x1.999999999999ap-4},
+  {"0.3", 0x1.3333333333333p-2},
+  {"3.141592653589793238462643383279", math.pi},
+  {"1.0e0000000000000000000000000001", 10.0},
+  {"00000000000000000000000000001", 1},
+  {"12345678", 12345678}, {"1234567812345678", 1234567812345678},
+  {"9223372036854775807", math.maxinteger},
+  {"-9223372036854775808", math.mininteger},
+  {"9223372036854775808", 0x1p63}, {"-9223372036854775809", -0x1p63},
+  {"12345678901234567890", 12345678901234567890.0},
+}
+for _, c in ipairs(cases) do
+  local x = tonumber(c[1])
+  assert(x == c[2] and math.type(x) == math.type(c[2]), c[1])
+end
+assert(1 / tonumber("-0.0") < 0)
+for _, s in ipairs{"", ".", "-.", "e5", "1e", "1e+", "1e-", "1.5e3x", "inf",
+                   "nan", "++5", "--5", "5 5", "1..2", "1.2.3", "0x", "1e5.0"} do
+  assert(tonumber(s) == nil, s)
+end
+
+
+-- integers
+for i = 1, 5000 do
+  local v = math.random(0) >> math.random(0, 63)
+  for _, x in ipairs{v, -v} do
+    local y = tonumber(tostring(x))
+    assert(y == x and math.type(y) == "integer")
+  end
+  local s = digits(math.random(1, 18))
+  local n = 0
+  for c in s:gmatch(".") do n = n * 10 + (c:byte() - 48) end
+  assert(tonumber(s) == n and math.type(tonumber(s)) == "integer")
+end
+
+print("OK")
@@ -0,0 +1,84 @@
+-- string buffers
+
+local function checkerror (msg, f, ...)
+  local s, err = pcall(f, ...)
+  assert(not s and string.find(err, msg, 1, true), err)
+end
+
+
+-- 'put' takes strings, numbers, buffers, and values with '__tostring'
+do
+  local b = string.buffer()
+  local other = string.buffer():put("xy")
+  local obj = setmetatable({}, {__tostring = function () return "obj" end})
+  b:put("a", 1, 2.5, other, obj)
+  assert(b:tostring() == "a12.5xyobj" and #other == 2)
+  checkerror("bad argument #1 to 'put' (string expected, got nil)",
+             function () b:put(nil) end)
+  checkerror("bad argument #1 to 'put' (string expected, got boolean)",
+             function () b:put(true) end)
+  checkerror("bad argument #2 to 'append' (string expected, got table)",
+             function () b:append("x", {}) end)
+  checkerror("string expected, got function", b.put, b, print)
+  assert(b:tostring() == "a12.5xyobjx")   -- values before the error stay
+end
+
+
+-- reading and writing at random, against a plain string: contents
+-- move to the start of the block or to a larger one
+do
+  math.randomseed(7)
+  local b, ref = string.buffer(), ""
+  for i = 1, 20000 do
+    local op = math.random(4)
+    if op == 1 then
+      local s = string.rep(string.char(65 + i % 26), math.random(0, 100))
+      b:put(s); ref = ref .. s
+    elseif op == 2 then
+      local n = math.random(0, 120)
+      assert(b:get(n) == ref:sub(1, n)); ref = ref:sub(n + 1)
+    elseif op == 3 then
+      local n = math.random(0, 50)
+      b:skip(n); ref = ref:sub(n + 1)
+    elseif #ref < 5000 then
+      b:put(b); ref = ref .. ref   -- a buffer into itself
+    end
+    assert(#b == #ref)
+  end
+  assert(b:tostring() == ref and b:get() == ref and #b == 0)
+end
+
+
+-- 'reserve'
+do
+  local b = string.buffer(10)
+  assert(b:reserve(0) >= 10 and b:reserve(100) >= 100)
+  b:put(string.rep("x", 90))
+  assert(b:reserve(1000) >= 1000 and b:tostring() == string.rep("x", 90))
+  checkerror("out of range", b.reserve, b, -1)
+  checkerror("out of range", string.buffer, -1)
+end
+
+
+-- buffer memory counts for the collector, and closing releases it
+do
+  collectgarbage(); collectgarbage()
+  local m0 = collectgarbage("count")
+  local b = string.buffer(1 << 20)
+  assert(collectgarbage("count") > m0 + 1000)
+  for i = 1, 5 do b:put(string.rep("y", 1 << 20)) end
+  collectgarbage()
+  assert(collectgarbage("count") > m0 + 5 * 1024)
+  do local c <close> = b end
+  assert(#b == 0 and b:tostring() == "")
+  collectgarbage()
+  assert(collectgarbage("count") < m0 + 100)
+  b:put("again")   -- still usable
+  assert(b:get() == "again")
+  b = nil
+  for i = 1, 100 do string.buffer():put(string.rep("z", 10000)) end
+  collectgarbage()
+  assert(collectgarbage("count") < m0 + 100)
+end
+
+print("OK")
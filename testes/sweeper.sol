@@ -0,0 +1,126 @@
+-- background sweeping: the mutator keeps running (allocating, storing,
+-- closing upvalues, reusing strings) while old objects are swept
+
+local prev, msg = collectgarbage("sweeper", true)
+if prev == nil then
+  assert(msg == "background sweeping not available")
+  print("(no background sweeping)")
+  return
+end
+assert(collectgarbage("sweeper") == true)
+collectgarbage("incremental")
+collectgarbage()
+
+
+-- run the collector in small steps until it finishes a cycle
+local function cycle (f)
+  repeat f() until collectgarbage("step", 0)
+end
+
+
+-- garbage is freed and live objects survive
+do
+  local live = {}
+  for r = 1, 5 do
+    local t = {}
+    for i = 1, 50000 do t[i] = {i} end
+    for i = 1, 1000 do live[#live + 1] = t[i * 50] end
+    t = nil
+    local before = collectgarbage("count")
+    collectgarbage()
+    assert(collectgarbage("count") < before / 2)
+  end
+  for i = 1, #live do assert(live[i][1] == (i - 1) % 1000 * 50 + 50) end
+end
+
+
+-- new objects stored into old ones during the sweep
+do
+  local old = {}
+  for i = 1, 10000 do old[i] = {} end
+  for r = 1, 20 do
+    local i = 0
+    cycle(function ()
+      i = i % 10000 + 1
+      old[i].v = {r, tostring(r)}
+      for k = 1, 10 do local g = {k} end
+    end)
+  end
+  collectgarbage()
+  for i = 1, 10000 do
+    local v = old[i].v
+    assert(v == nil or v[2] == tostring(v[1]))
+  end
+end
+
+
+-- upvalues closed and strings reused during the sweep
+do
+  local fs = {}
+  for r = 1, 10 do
+    local n = 0
+    cycle(function ()
+      n = n + 1
+      local u = {n}
+      fs[n % 1000 + 1] = function () return u[1] end
+      local s = "str" .. n % 500   -- often a dead string, brought back
+      assert(#s >= 4 and s == "str" .. n % 500)
+    end)
+  end
+  collectgarbage()
+  for i = 1, 1000 do
+    local f = fs[i]
+    assert(f == nil or f() % 1000 + 1 == i)
+  end
+end
+
+
+-- weak tables, finalizers, coroutines, slices
+do
+  local wk = setmetatable({}, {__mode = "k"})
+  local keep = {}
+  local fin = 0
+  for i = 1, 2000 do
+    local k = {}
+    wk[k] = i
+    if i % 2 == 0 then keep[#keep + 1] = k end
+    setmetatable({}, {__gc = function () fin = fin + 1 end})
+  end
+  local cos = {}
+  for i = 1, 100 do
+    cos[i] = coroutine.wrap(function (a) while true do a = coroutine.yield(a + 1) end end)
+    cos[i](i)
+  end
+  local big = string.rep("y", 1000)
+  local sl = {}
+  for i = 1, 100 do sl[i] = (big .. i):sub(990) end
+  cycle(function () local t = {} end)
+  collectgarbage()
+  local n = 0
+  for k, v in pairs(wk) do n = n + 1; assert(v % 2 == 0) end
+  assert(n == 1000 and fin == 2000)
+  for i = 1, 100 do assert(cos[i](i) == i + 1 and sl[i] == "yyyyyyyyyyy" .. i) end
+end
+
+
+-- changing modes and turning the sweeper off in the middle of a sweep
+do
+  local t = {}
+  for i = 1, 20000 do t[i] = {i} end
+  for r = 1, 4 do
+    for i = 1, 20000, 3 do t[i] = {i} end
+    for k = 1, 200 do collectgarbage("step", 0) end
+    if r % 2 == 0 then
+      collectgarbage("generational"); collectgarbage("incremental")
+    else
+      assert(collectgarbage("sweeper", false) == true)
+      assert(collectgarbage("sweeper", true) == false)
+    end
+  end
+  collectgarbage()
+  for i = 1, 20000 do assert(t[i][1] == i) end
+end
+
+
+assert(collectgarbage("sweeper", prev) == true)
+print("OK")
@@ -0,0 +1,82 @@
+-- 'table.new' and 'table.clear'
+
+local function count (t)
+  local n = 0
+  for _ in pairs(t) do n = n + 1 end
+  return n
+end
+
+
+-- presized tables start empty
+do
+  local t = table.new(100, 10)
+  assert(type(t) == "table" and #t == 0 and next(t) == nil)
+  for i = 1, 100 do t[i] = i * 0.5 end
+  t.a = 1; t.b = "x"
+  assert(#t == 100 and count(t) == 102 and t[50] == 25.0 and t.a == 1)
+  assert(count(table.new(0)) == 0 and count(table.new(3, 40)) == 0)
+  assert(not pcall(table.new, -1))
+  assert(not pcall(table.new, 1, -1))
+  assert(not pcall(table.new, math.maxinteger))
+  assert(not pcall(table.new))
+end
+
+
+-- a presized table does not grow while it is filled up to its sizes
+do
+  local N = 10000
+  collectgarbage(); collectgarbage("stop")
+  local t = table.new(N, N)
+  local m = collectgarbage("count")
+  for i = 1, N do t[i] = i; t[-i] = i end
+  assert(collectgarbage("count") == m)
+  collectgarbage("restart")
+end
+
+
+-- clearing keeps the table, its metatable, and its memory
+do
+  local t = table.new(100, 10)
+  for i = 1, 100 do t[i] = i end
+  t.a = 1
+  table.clear(t)
+  assert(#t == 0 and next(t) == nil and t[50] == nil and t.a == nil)
+  for i = 1, 10 do t[i] = i end
+  t.c = 3
+  assert(#t == 10 and count(t) == 11 and t.c == 3)
+  local g, ks = {}, {}
+  for i = 1, 100 do ks[i] = "k" .. i end
+  for i = 1, 50 do g[i] = {} end
+  for i = 1, 100 do g[ks[i]] = i end
+  g[1.5] = true
+  table.clear(g)
+  assert(count(g) == 0 and g.k1 == nil and g[1.5] == nil)
+  collectgarbage(); collectgarbage("stop")
+  local m = collectgarbage("count")
+  for i = 1, 50 do g[i] = i end
+  for i = 1, 100 do g[ks[i]] = i end
+  assert(collectgarbage("count") == m and g.k77 == 77)
+  collectgarbage("restart")
+  local mt = {__index = function (_, k) return "dflt" end}
+  local o = setmetatable({x = 1}, mt)
+  table.clear(o)
+  assert(o.x == "dflt" and getmetatable(o) == mt)
+  local cls = {__index = {hello = 1}}
+  o = setmetatable({}, cls)
+  assert(o.hello == 1)
+  table.clear(cls)   -- a metatable loses its fields
+  assert(o.hello == nil)
+  local w = setmetatable({}, {__mode = "v"})
+  w[1] = {}; w.a = {}
+  table.clear(w); collectgarbage()
+  assert(count(w) == 0)
+  local u = {}
+  for i = 1, 1000 do u[i] = i end   -- a typed array
+  table.clear(u)
+  u[1] = "s"
+  assert(u[1] == "s" and #u == 1)
+  assert(not pcall(table.clear, 1))
+  assert(not pcall(table.clear))
+end
+
+print("OK")
@@ -0,0 +1,137 @@
+-- typed arrays: arrays of numbers kept as raw integers or floats
+
+local N = 1000   -- big enough to be kept typed
+
+local function ints (n) local t = {} for i = 1, n do t[i] = i * 3 end return t end
+local function floats (n) local t = {} for i = 1, n do t[i] = i / 4 end return t end
+
+local function check (t, n, f)
+  assert(#t == n)
+  for i = 1, n do assert(t[i] == f(i), i) end
+end
+
+
+-- reading and writing keep the values and their types
+do
+  local t = ints(N)
+  check(t, N, function (i) return i * 3 end)
+  assert(math.type(t[1]) == "integer" and t[0] == nil and t[N + 1] == nil)
+  t[5] = -7   -- same type: stays typed
+  assert(t[5] == -7 and #t == N)
+  local f = floats(N)
+  assert(math.type(f[2]) == "float" and f[2] == 0.5)
+  f[1] = 2.0^60
+  assert(f[1] == 2.0^60 and math.type(f[1]) == "float")
+end
+
+
+-- storing a value of another type converts the array
+do
+  local t = ints(N)
+  t[10] = 1.5   -- a float in an integer array
+  assert(t[10] == 1.5 and math.type(t[10]) == "float")
+  assert(t[9] == 27 and math.type(t[9]) == "integer" and #t == N)
+  t = floats(N)
+  t[10] = 7   -- an integer in a float array
+  assert(math.type(t[10]) == "integer" and t[11] == 11 / 4)
+  t = ints(N)
+  t[20] = "x"
+  assert(t[20] == "x" and t[21] == 63 and #t == N)
+  t = ints(N)
+  local k = {}
+  t[30] = k
+  collectgarbage()
+  assert(t[30] == k and t[31] == 93)
+  t = floats(N)
+  t[N] = true
+  assert(t[N] == true and t[N - 1] == (N - 1) / 4)
+end
+
+
+-- holes and new elements
+do
+  local t = ints(N)
+  t[N] = nil   -- removing the last element keeps a prefix
+  assert(#t == N - 1 and t[N] == nil)
+  t[N] = 5   -- appending right after the prefix
+  assert(#t == N and t[N] == 5)
+  t[500] = nil   -- a hole converts the array
+  assert(t[500] == nil and t[499] == 1497 and t[501] == 1503)
+  local n = 0
+  for k in pairs(t) do n = n + 1 end
+  assert(n == N - 1)
+  t = floats(N)
+  t[N + 10] = 1.0   -- a new element that would leave a hole
+  assert(t[N + 10] == 1.0 and t[N + 1] == nil and t[N] == N / 4)
+  t[N + 1] = 2.0
+  assert(t[N + 1] == 2.0)
+end
+
+
+-- traversal
+do
+  local t = floats(N)
+  local n, s = 0, 0
+  for k, v in pairs(t) do n = n + 1; s = s + k; assert(v == k / 4) end
+  assert(n == N and s == N * (N + 1) // 2)
+  n = 0
+  for i, v in ipairs(t) do n = n + 1; assert(v == i / 4) end
+  assert(n == N)
+  t.x = 1   -- a hash part besides the typed array
+  n = 0
+  for k in pairs(t) do n = n + 1 end
+  assert(n == N + 1)
+  assert(next({}) == nil)
+end
+
+
+-- library functions
+do
+  local t = ints(N)
+  table.insert(t, 1, 0)
+  assert(#t == N + 1 and t[1] == 0 and t[2] == 3 and t[N + 1] == 3 * N)
+  assert(table.remove(t, 1) == 0 and t[1] == 3 and #t == N)
+  assert(table.remove(t) == 3 * N and #t == N - 1)
+  table.move(t, 1, 10, 11)
+  assert(t[11] == 3 and t[20] == 30 and t[21] == 63)
+  local u = table.move(ints(N), 1, N, 1, {})
+  check(u, N, function (i) return i * 3 end)
+  assert(select("#", table.unpack(ints(100))) == 100)
+end
+
+
+-- 'table.concat' and 'table.sort' on the raw numbers
+do
+  local function strs (t, i, j)
+    local r = {}
+    for k = i or 1, j or #t do r[#r + 1] = tostring(t[k]) end
+    return r
+  end
+  local f = floats(N)
+  f[3], f[4], f[5], f[6] = 3.0, -0.0, 1e300, 1/0
+  for _, t in ipairs{ints(N), f} do
+    assert(table.concat(t, ", ") == table.concat(strs(t), ", "))
+    assert(table.concat(t, "", 3, 5) == table.concat(strs(t, 3, 5)))
+    assert(table.concat(t, "-", N - 2) == table.concat(strs(t, N - 2), "-"))
+    assert(table.concat(t, "x", 5, 4) == "")
+  end
+  assert(table.concat(f, ",", 3, 4) == "3.0,-0.0")
+  local t = ints(10)
+  t[11] = "end"   -- past the typed part
+  assert(table.concat(t, ",", 9) == "27,30,end")
+  assert(not pcall(table.concat, ints(N), ",", 1, N + 1))
+  t = {}
+  for i = 1, N do t[i] = (i * 7919) % N - N // 2 end
+  table.sort(t)
+  for i = 2, N do assert(t[i - 1] <= t[i]) end
+  assert(math.type(t[1]) == "integer")
+  t = {}
+  for i = 1, N do t[i] = ((i * 7919) % N) / 3 - 100 end
+  table.sort(t, nil, "stable")
+  for i = 2, N do assert(t[i - 1] <= t[i]) end
+  t[N // 2] = 0/0   -- a NaN goes to the generic sort (which may fail)
+  pcall(table.sort, t)
+  assert(#t == N)
+end
+
+print("OK")